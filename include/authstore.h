@@ -13,26 +13,48 @@
 #define AUTHSTORE_H_
 
 #include "store.h"
+#include "counter.h"
+#include "inline_string.h"
+#include "digest_cache.h"
+#include "digest_read_coalescer.h"
 
 class AuthStore
 {
 public:
   /// @class AuthStore::Digest
   ///
-  /// Represents a Digest
+  /// Represents a Digest.  The HA1, opaque and nonce almost always have
+  /// fixed lengths, so are stored in the digest itself.  A digest can be
+  /// created on the stack and filled in by get_digest without allocating.
   class Digest
   {
   public:
+    /// Lengths of the HA1 (MD5 hex), and of the opaques and nonces that
+    /// Memento generates.  Signed nonces are the longest.
+    static const size_t HA1_LENGTH = 32;
+    static const size_t OPAQUE_LENGTH = 32;
+    static const size_t NONCE_LENGTH = 80;
+
     /// HA1 - supplied on client request
-    std::string _ha1;
+    InlineString<HA1_LENGTH> _ha1;
 
     /// opaque - supplied on client request or generated
     /// from the timestamp
-    std::string _opaque;
+    InlineString<OPAQUE_LENGTH> _opaque;
 
     /// nonce - supplied on client request or generated
     /// from the timestamp
-    std::string _nonce;
+    InlineString<NONCE_LENGTH> _nonce;
+
+    /// nonce_count - one more than the highest nonce count that has been
+    /// used with the digest
+    uint32_t _nonce_count;
+
+    /// nc_window - which of the NC_WINDOW_SIZE nonce counts below
+    /// _nonce_count have been used.  Bit i is set if nonce count
+    /// (_nonce_count - 1 - i) has been used.  Nonce counts below the window
+    /// are treated as used.
+    uint64_t _nc_window;
 
     /// impi - Private ID
     std::string _impi;
@@ -41,10 +63,6 @@ public:
     /// to the home domain
     std::string _realm;
 
-    /// nonce_count - supplied on client request and incremented
-    /// when the digest is examined
-    uint32_t _nonce_count;
-
     /// impu - Public ID
     std::string _impu;
 
@@ -54,10 +72,30 @@ public:
     /// Destructor.
     ~Digest();
 
+    /// Records a use of the digest with a nonce count.  Clients may send
+    /// requests in parallel with the same nonce, so nonce counts can be used
+    /// out of order, but each can only be used once.
+    ///
+    /// @param nonce_count - The nonce count supplied by the client.
+    /// @return            - Whether the nonce count can be used, i.e. it is
+    ///                      within the window and hasn't been used before.
+    ///                      The highest possible nonce count is never
+    ///                      accepted.
+    bool use_nonce_count(uint32_t nonce_count);
+
+    /// The number of nonce counts below the highest used one that are
+    /// tracked.
+    static const uint32_t NC_WINDOW_SIZE = 64;
+
   private:
     /// Memcached CAS value.
     uint64_t _cas;
 
+    /// Version of the locally cached record that the digest was read from,
+    /// or 0 if it was read from the store.  A digest read from the cache has
+    /// no CAS value.
+    uint64_t _cache_version;
+
     // The auth store is a friend so it can read the digest's CAS value.
     friend class AuthStore;
   };
@@ -70,6 +108,14 @@ public:
   class SerializerDeserializer
   {
   public:
+    /// Constructor.
+    ///
+    /// @param read_count - Counter incremented for each record read in this
+    ///                     format (may be NULL).
+    SerializerDeserializer(Counter* read_count = NULL) :
+      _read_count(read_count)
+    {};
+
     /// Virtual destructor.
     virtual ~SerializerDeserializer() {};
 
@@ -79,37 +125,111 @@ public:
     /// @return       - The serialized form.
     virtual std::string serialize_digest(const Digest* digest) = 0;
 
-    /// Deserialize some data from the store to a Digest object.
+    /// Deserialize some data from the store into a Digest object.
+    ///
+    /// @param digest_s - The data to deserialize.
+    /// @param digest   - The newly constructed digest to fill in.
+    /// @return         - Whether the data could be deserialized (it can't
+    ///                   if e.g. it is corrupt).
+    virtual bool deserialize_digest(const std::string& digest_s,
+                                    Digest& digest) = 0;
+
+    /// Deserialize some data from the store to a new Digest object.
     ///
     /// @param digest_s - The data to deserialize.
     /// @return         - A digest object, or NULL if the data could not be
     ///                   deserialized (e.g. because it is corrupt).
-    virtual Digest* deserialize_digest(const std::string& digest_s) = 0;
+    Digest* deserialize_digest(const std::string& digest_s);
 
     /// @return - The name of this (de)serializer.
     virtual std::string name() = 0;
+
+    /// Whether records in this format can start with the given byte.  The
+    /// AuthStore uses this to pick a deserializer from the first byte of a
+    /// record, rather than trying each in turn.
+    ///
+    /// @param first_byte - The first byte of the record.
+    /// @return           - Whether this deserializer should be used.
+    virtual bool handles(unsigned char first_byte) = 0;
+
+    /// Counts a record read in this format.
+    void count_read()
+    {
+      if (_read_count != NULL)
+      {
+        _read_count->increment();
+      }
+    }
+
+  private:
+    Counter* _read_count;
   };
 
-  /// A (de)serializer for the (deprecated) custom binary format.
+  /// A (de)serializer for the (deprecated) custom binary format.  Its records
+  /// can't be identified from their first byte, so it handles any byte that a
+  /// deserializer earlier in the list doesn't.
   class BinarySerializerDeserializer : public SerializerDeserializer
   {
   public:
+    BinarySerializerDeserializer(Counter* read_count = NULL) :
+      SerializerDeserializer(read_count)
+    {};
     ~BinarySerializerDeserializer() {};
 
+    using SerializerDeserializer::deserialize_digest;
     std::string serialize_digest(const Digest* digest);
-    Digest* deserialize_digest(const std::string& digest_s);
+    bool deserialize_digest(const std::string& digest_s, Digest& digest);
     std::string name();
+    bool handles(unsigned char first_byte);
   };
 
   /// A (de)serializer for the JSON format.
   class JsonSerializerDeserializer : public SerializerDeserializer
   {
   public:
+    JsonSerializerDeserializer(Counter* read_count = NULL) :
+      SerializerDeserializer(read_count)
+    {};
     ~JsonSerializerDeserializer() {};
 
+    using SerializerDeserializer::deserialize_digest;
     std::string serialize_digest(const Digest* digest);
-    Digest* deserialize_digest(const std::string& digest_s);
+    bool deserialize_digest(const std::string& digest_s, Digest& digest);
+    std::string name();
+    bool handles(unsigned char first_byte);
+  };
+
+  /// A (de)serializer for the compact binary format.  Records start with a
+  /// byte giving the format version, followed by:
+  /// - a flags byte
+  /// - the HA1, either as 16 bytes (if FLAG_PACKED_HA1 is set) or as a
+  ///   length-prefixed string
+  /// - the nonce count (4 bytes) and nonce count window (8 bytes), both
+  ///   big-endian
+  /// - the opaque, realm and IMPU, each as a length-prefixed string.
+  /// Lengths are 2 bytes, big-endian.  Records are decoded in place, without
+  /// copying them into a stream.
+  class CompactSerializerDeserializer : public SerializerDeserializer
+  {
+  public:
+    CompactSerializerDeserializer(Counter* read_count = NULL) :
+      SerializerDeserializer(read_count)
+    {};
+    ~CompactSerializerDeserializer() {};
+
+    using SerializerDeserializer::deserialize_digest;
+    std::string serialize_digest(const Digest* digest);
+    bool deserialize_digest(const std::string& digest_s, Digest& digest);
     std::string name();
+    bool handles(unsigned char first_byte);
+
+    /// The first byte of a version 1 record.  It has the top bit set, so it
+    /// can't be the start of a JSON or binary record.
+    static const unsigned char VERSION_1 = 0xA1;
+
+    /// Set if the HA1 is a 32 character lower-case hex string, and is stored
+    /// as the 16 bytes it encodes.
+    static const unsigned char FLAG_PACKED_HA1 = 0x01;
   };
 
   /// Constructor.
@@ -117,16 +237,32 @@ public:
   /// @param data_store    A pointer to the underlying data store.
   /// @param serializer    The serializer to use when writing digests.
   ///                      The AuthStore takes ownership of it.
-  /// @param deserializer  A vector of deserializers to try when reading
-  ///                      digests. The order is important - each deserializer
-  ///                      is tried in turn until one successfully parses the
-  ///                      record.  The AuthStore takes ownership of the
+  /// @param deserializer  A vector of deserializers to use when reading
+  ///                      digests. The order is important - each record is
+  ///                      parsed by the first deserializer that handles its
+  ///                      first byte.  The AuthStore takes ownership of the
   ///                      deserializers in the vector.
   /// @param expiry        Expiry time of entries
+  /// @param digest_cache  Local cache of records to read from before
+  ///                      trying the store (may be NULL).  Records are
+  ///                      written to both.
+  /// @param separate_nonce_counts
+  ///                      Whether to record used nonce counts as separate
+  ///                      entries in the store, rather than in the digest.
+  ///                      Digests are then not rewritten, so expire the
+  ///                      expiry time after they were stored.  Replays are
+  ///                      only detected once every node does this.
+  /// @param read_coalescer
+  ///                      Coalescer to share reads of the same record from
+  ///                      the store between concurrent requests (may be
+  ///                      NULL).
   AuthStore(Store* data_store,
             SerializerDeserializer*& serializer,
             std::vector<SerializerDeserializer*>& _deserializers,
-            int expiry);
+            int expiry,
+            DigestCache* digest_cache = NULL,
+            bool separate_nonce_counts = false,
+            DigestReadCoalescer* read_coalescer = NULL);
 
   /// Alternative constructor that creates an AuthStore with just the default
   /// (de)serializer.
@@ -155,18 +291,66 @@ public:
   ///
   /// @param impi   A reference to the private user identity.
   /// @param nonce  A reference to the nonce.
-  /// @param digest A Digest object to populate with the retrieved Digest. Caller is
-  ///               responsible for deleting
+  /// @param digest A newly constructed Digest object to populate with the
+  ///               retrieved Digest.  It is only valid if the status is OK.
   ///
   /// @return       The status code returned by the store.
   virtual Store::Status get_digest(const std::string& impi,
                                    const std::string& nonce,
-                                   Digest*&,
+                                   Digest&,
                                    SAS::TrailId);
 
+  /// get_digest.
+  ///
+  /// @param impi   A reference to the private user identity.
+  /// @param nonce  A reference to the nonce.
+  /// @param digest Set to a new Digest object populated with the retrieved
+  ///               Digest, or NULL if the status isn't OK. Caller is
+  ///               responsible for deleting
+  ///
+  /// @return       The status code returned by the store.
+  Store::Status get_digest(const std::string& impi,
+                           const std::string& nonce,
+                           Digest*&,
+                           SAS::TrailId);
+
+  /// Whether a nonce count used with a digest should be recorded with
+  /// record_nonce_count, rather than by writing the digest.  This is the
+  /// case if nonce counts are recorded separately, and the digest is in the
+  /// store already.
+  bool records_nonce_count_separately(const Digest* digest) const;
+
+  /// record_nonce_count.  Records a nonce count as used, with a single add of
+  /// a small entry to the store.  The add fails if the nonce count has been
+  /// used already, on this or any other node, so this doesn't need to read
+  /// or rewrite the digest.
+  ///
+  /// @param impi        A reference to the private user identity.
+  /// @param nonce       A reference to the nonce.
+  /// @param nonce_count The nonce count that has been used.
+  ///
+  /// @return            DATA_CONTENTION if the nonce count has already been
+  ///                    used, otherwise the status code returned by the
+  ///                    store.
+  virtual Store::Status record_nonce_count(const std::string& impi,
+                                           const std::string& nonce,
+                                           uint32_t nonce_count,
+                                           SAS::TrailId);
+
 private:
   std::string serialize_digest(const Digest* digest);
-  Digest* deserialize_digest(const std::string& digest_s);
+  bool deserialize_digest(const std::string& digest_s, Digest& digest);
+
+  /// Fill in _deserializer_for_byte from _deserializers.
+  void build_deserializer_table();
+
+  /// Get the CAS value to write a digest that was read from the cache with.
+  /// This fails with DATA_CONTENTION if the record has changed, in the cache
+  /// or in the store, since the digest was read.
+  Store::Status get_cas_for_cached_digest(const std::string& key,
+                                          uint64_t cache_version,
+                                          uint64_t& cas,
+                                          SAS::TrailId trail);
 
   /// A pointer to the underlying data store.
   Store* _data_store;
@@ -176,8 +360,22 @@ private:
   SerializerDeserializer* _serializer;
   std::vector<SerializerDeserializer*> _deserializers;
 
+  /// The deserializer to use for records starting with each byte - the first
+  /// in _deserializers that handles the byte, or NULL if none do.
+  SerializerDeserializer* _deserializer_for_byte[256];
+
   /// Time to expire Digest record (controlled by configuration)
   int _expiry;
+
+  /// Local cache of records, or NULL if records aren't cached.
+  DigestCache* _digest_cache;
+
+  /// Whether used nonce counts are recorded as separate entries.
+  bool _separate_nonce_counts;
+
+  /// Coalescer for concurrent reads from the store, or NULL if reads aren't
+  /// coalesced.
+  DigestReadCoalescer* _read_coalescer;
 };
 
 #endif
@@ -0,0 +1,125 @@
+/**
+ * @file call_list_cache.h In-memory cache of rendered call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_CACHE_H_
+#define CALL_LIST_CACHE_H_
+
+#include <time.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "counter.h"
+#include "call_list_compression.h"
+#include "sharded_lru_cache.h"
+
+/// Cache of rendered call lists, keyed by IMPU.
+///
+/// The cache is a ShardedLRUCache with the memory budget split between its
+/// shards, so that requests for different subscribers rarely contend.
+/// Entries expire after a configurable time, as the call list store is
+/// updated by other processes and there is no way to invalidate entries when
+/// that happens.
+class CallListCache
+{
+public:
+  /// A rendered call list, along with the validators for it.
+  struct Entry
+  {
+    Entry() :
+      etag(""), last_modified(0), num_records(0), omitted_calls(0), body("")
+    {};
+
+    /// Entity tag of the call list.
+    std::string etag;
+
+    /// When the call list was last modified (or 0 if this isn't known).
+    time_t last_modified;
+
+    /// Number of call fragments the call list was built from.
+    size_t num_records;
+
+    /// Number of the oldest calls left out of the call list to keep it
+    /// within the size limit.
+    size_t omitted_calls;
+
+    /// The call list document.
+    std::string body;
+
+    /// Compressed copies of the call list document, keyed by encoding.
+    /// These are added as clients ask for them.
+    std::map<CallListCompressor::Encoding, std::string> compressed_bodies;
+  };
+
+  /// Constructor.
+  ///
+  /// @param max_bytes       The maximum amount of memory to use for cached
+  ///                        call lists.
+  /// @param ttl_ms          How long call lists are cached for.
+  /// @param hit_count       Counter incremented on each cache hit.
+  /// @param miss_count      Counter incremented on each cache miss.
+  /// @param eviction_count  Counter incremented each time a call list is
+  ///                        evicted to make room for another.
+  /// @param num_shards      The number of shards to split the cache into.
+  CallListCache(size_t max_bytes,
+                int ttl_ms,
+                Counter* hit_count,
+                Counter* miss_count,
+                Counter* eviction_count,
+                int num_shards = DEFAULT_NUM_SHARDS);
+
+  /// Destructor.
+  virtual ~CallListCache();
+
+  /// Look up a subscriber's call list.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @returns               The cached call list, or NULL if the call list
+  ///                        isn't cached (or has expired).
+  std::shared_ptr<const Entry> get(const std::string& impu);
+
+  /// Cache a subscriber's call list, replacing any existing entry.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param entry           The call list to cache.
+  void put(const std::string& impu, const std::shared_ptr<const Entry>& entry);
+
+  /// Add a compressed copy of the body to a cached call list.  The call list
+  /// keeps its place in the cache and its expiry time.  This does nothing if
+  /// the cached call list has changed (or expired) since it was read.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param etag            The entity tag of the call list that was
+  ///                        compressed.
+  /// @param encoding        The encoding used to compress the body.
+  /// @param compressed_body The compressed body.
+  void add_compressed_body(const std::string& impu,
+                           const std::string& etag,
+                           CallListCompressor::Encoding encoding,
+                           const std::string& compressed_body);
+
+  /// @returns               The amount of memory used by cached call lists.
+  size_t bytes_used();
+
+  static const int DEFAULT_NUM_SHARDS = 16;
+
+private:
+  /// Memory used by an entry, including an allowance for the cache's own
+  /// overheads.
+  static size_t entry_size(const std::string& impu, const Entry& entry);
+
+  ShardedLRUCache<std::shared_ptr<const Entry> > _cache;
+
+  Counter* _hit_count;
+  Counter* _miss_count;
+};
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file call_list_coalescer.h Coalescing of concurrent call list reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_COALESCER_H_
+#define CALL_LIST_COALESCER_H_
+
+#include <pthread.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cassandra_store.h"
+#include "call_list_cache.h"
+#include "counter.h"
+
+/// Coalesces concurrent reads of the same subscriber's call list.
+///
+/// The first request for a call list becomes the leader, and reads and
+/// builds the call list as normal.  Requests for the same call list that
+/// arrive while the leader's read is in progress become followers.  They
+/// don't read the call list themselves, but wait for the leader to share
+/// the call list it has built.
+class CallListReadCoalescer
+{
+public:
+  /// A request waiting for another request's read of a call list.
+  class Follower
+  {
+  public:
+    virtual ~Follower() {};
+
+    /// Called when the leader's read completes.
+    ///
+    /// @param db_rc         Result of the leader's read.
+    /// @param call_list     The call list the leader built.  NULL if the read
+    ///                      failed.
+    virtual void on_call_list_shared(CassandraStore::ResultCode db_rc,
+                                     std::shared_ptr<const CallListCache::Entry> call_list) = 0;
+  };
+
+  /// Constructor.
+  ///
+  /// @param coalesced_count Counter incremented each time a read is avoided
+  ///                        by following another request's read.
+  CallListReadCoalescer(Counter* coalesced_count);
+
+  /// Destructor.
+  virtual ~CallListReadCoalescer();
+
+  /// Starts a read of a subscriber's call list, or joins the read already in
+  /// progress.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param follower        The request, to be called back if it joins a read
+  ///                        in progress.
+  /// @returns               true if the request is the leader, and must read
+  ///                        the call list and then call leader_done().  false
+  ///                        if the request is a follower.
+  bool lead_or_follow(const std::string& impu, Follower* follower);
+
+  /// Ends the leader's read.  Requests for the call list after this start a
+  /// new read.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param followers       Vector to populate with the requests waiting for
+  ///                        the read.  The leader must share the call list
+  ///                        with all of them.
+  void leader_done(const std::string& impu, std::vector<Follower*>& followers);
+
+private:
+  pthread_mutex_t _lock;
+
+  /// The reads in progress, and the requests waiting for each of them.
+  std::unordered_map<std::string, std::vector<Follower*> > _reads;
+
+  Counter* _coalesced_count;
+};
+
+#endif
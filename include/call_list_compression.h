@@ -0,0 +1,84 @@
+/**
+ * @file call_list_compression.h Compression of call list responses.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_COMPRESSION_H_
+#define CALL_LIST_COMPRESSION_H_
+
+#include <atomic>
+#include <string>
+
+/// Compresses call list response bodies.
+///
+/// The compression level adapts to load.  While the number of call list
+/// requests in progress is below the busy threshold, bodies are compressed
+/// at the normal level.  Above it, they are compressed at the fastest level,
+/// trading a larger response for less CPU per request.
+class CallListCompressor
+{
+public:
+  /// Content codings that call lists can be sent with.
+  enum Encoding
+  {
+    IDENTITY = 0,
+    GZIP,
+    ZSTD
+  };
+
+  /// Constructor.
+  ///
+  /// @param busy_threshold  The number of requests in progress at which the
+  ///                        compressor switches to the fastest level.
+  CallListCompressor(int busy_threshold);
+
+  /// Destructor.
+  virtual ~CallListCompressor();
+
+  /// Picks the encoding to use for a response.
+  ///
+  /// @param accept_encoding The Accept-Encoding header on the request.
+  /// @returns               The preferred encoding that the client accepts.
+  static Encoding choose_encoding(const std::string& accept_encoding);
+
+  /// @returns               The name of the encoding, as used in the
+  ///                        Content-Encoding header.
+  static const char* encoding_name(Encoding encoding);
+
+  /// Compresses a response body.
+  ///
+  /// @param encoding        The encoding to use.  Must not be IDENTITY.
+  /// @param body            The uncompressed body.
+  /// @param compressed      String to populate with the compressed body.
+  /// @returns               true if the body was compressed successfully.
+  bool compress(Encoding encoding,
+                const std::string& body,
+                std::string& compressed);
+
+  /// @returns               The compression level currently in use for the
+  ///                        encoding.
+  int level(Encoding encoding) const;
+
+  /// Records the start and end of a call list request.
+  void request_started() { _requests_in_progress++; }
+  void request_complete() { _requests_in_progress--; }
+
+private:
+  static bool gzip(const std::string& body,
+                   int level,
+                   std::string& compressed);
+  static bool zstd(const std::string& body,
+                   int level,
+                   std::string& compressed);
+
+  std::atomic<int> _requests_in_progress;
+  int _busy_threshold;
+};
+
+#endif
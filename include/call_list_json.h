@@ -0,0 +1,55 @@
+/**
+ * @file call_list_json.h JSON and CBOR representations of call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_JSON_H_
+#define CALL_LIST_JSON_H_
+
+#include "call_list_xml.h"
+
+/// Converts a list of CallFragments retrieved from the store into a JSON
+/// document, passing the JSON to the supplied writer a call at a time.
+///
+/// The document has the same structure as the XML document.  Each call is an
+/// object, and each element of the call becomes a member of that object.
+/// Elements with child elements become objects, and other elements become
+/// strings.  For example:
+///
+///   {"calls":[{"to":{"URI":"alice@example.com"},"answered":"1", ... }]}
+///
+/// @param records  - The list of records to generate JSON from. No
+///                   ordering is assumed.
+/// @param writer   - The writer to pass the document to.
+/// @param max_size - The maximum size of the equivalent XML document in
+///                   bytes.  0 means there is no limit.
+/// @param trail    - The SAS trail ID for logging.
+/// @returns        - The number of calls omitted to keep within max_size.
+size_t write_json_from_call_records(const std::vector<CallListStore::CallFragment>& records,
+                                  CallListWriter& writer,
+                                  size_t max_size,
+                                  SAS::TrailId trail);
+
+/// Converts a list of CallFragments retrieved from the store into a CBOR
+/// (RFC 7049) document with the same structure as the JSON document, passing
+/// it to the supplied writer a call at a time.
+///
+/// @param records  - The list of records to generate CBOR from. No
+///                   ordering is assumed.
+/// @param writer   - The writer to pass the document to.
+/// @param max_size - The maximum size of the equivalent XML document in
+///                   bytes.  0 means there is no limit.
+/// @param trail    - The SAS trail ID for logging.
+/// @returns        - The number of calls omitted to keep within max_size.
+size_t write_cbor_from_call_records(const std::vector<CallListStore::CallFragment>& records,
+                                  CallListWriter& writer,
+                                  size_t max_size,
+                                  SAS::TrailId trail);
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * @file call_list_prefetcher.h Speculative reads of call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_PREFETCHER_H_
+#define CALL_LIST_PREFETCHER_H_
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "call_list_store.h"
+#include "counter.h"
+
+/// Reads call lists ahead of the requests for them.
+///
+/// Almost every request that is challenged for authentication is retried
+/// with credentials straight away.  When a request is challenged, the
+/// prefetcher reads the subscriber's call fragments on the call list store's
+/// worker pool, and holds them for a short time so that the authenticated
+/// retry can use them rather than reading the store itself.
+class CallListPrefetcher
+{
+public:
+  /// Constructor.
+  ///
+  /// @param call_list_store The store to read call fragments from.  This must
+  ///                        have a worker pool.
+  /// @param ttl_ms          How long prefetched fragments are held for.
+  /// @param max_prefetches  The maximum number of prefetches in progress or
+  ///                        held at once.  Further prefetches are skipped, so
+  ///                        that prefetching can't crowd out real reads.
+  /// @param prefetch_count  Counter incremented for each prefetch started.
+  /// @param hit_count       Counter incremented each time prefetched
+  ///                        fragments are used.
+  /// @param wasted_count    Counter incremented each time prefetched
+  ///                        fragments expire without being used.
+  CallListPrefetcher(CallListStore::Store* call_list_store,
+                     int ttl_ms,
+                     int max_prefetches,
+                     Counter* prefetch_count,
+                     Counter* hit_count,
+                     Counter* wasted_count);
+
+  /// Destructor.
+  virtual ~CallListPrefetcher();
+
+  /// Starts reading a subscriber's call fragments, unless they're already
+  /// being read or held.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param trail           SAS trail for the read.
+  void prefetch(const std::string& impu, SAS::TrailId trail);
+
+  /// Takes a subscriber's prefetched call fragments.  Each prefetch can only
+  /// be used once.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param records         Vector to populate with the fragments.
+  /// @returns               true if prefetched fragments were available.
+  bool take(const std::string& impu,
+            std::vector<CallListStore::CallFragment>& records);
+
+  /// Transaction that stores the result of a prefetch.
+  class PrefetchTsx : public CassandraStore::Transaction
+  {
+  public:
+    PrefetchTsx(CallListPrefetcher* prefetcher,
+                const std::string& impu,
+                SAS::TrailId trail) :
+      CassandraStore::Transaction(trail),
+      _prefetcher(prefetcher),
+      _impu(impu)
+    {};
+
+    virtual ~PrefetchTsx() {};
+
+    void on_success(CassandraStore::Operation* op);
+    void on_failure(CassandraStore::Operation* op);
+
+  private:
+    CallListPrefetcher* _prefetcher;
+    std::string _impu;
+  };
+
+private:
+  struct Prefetch
+  {
+    bool ready;
+    unsigned long expiry_ms;
+    std::vector<CallListStore::CallFragment> records;
+  };
+
+  /// Stores the result of a prefetch.
+  ///
+  /// @param impu            The subscriber's public ID.
+  /// @param success         Whether the read succeeded.
+  /// @param records         The fragments read (swapped out of the vector).
+  void prefetch_complete(const std::string& impu,
+                         bool success,
+                         std::vector<CallListStore::CallFragment>& records);
+
+  /// Discards expired prefetches.  Must be called with the lock held.
+  void expire_prefetches(unsigned long now);
+
+  CallListStore::Store* _call_list_store;
+  int _ttl_ms;
+  size_t _max_prefetches;
+
+  pthread_mutex_t _lock;
+  std::unordered_map<std::string, Prefetch> _prefetches;
+
+  /// Prefetched IMPUs in the order they became ready (and so the order they
+  /// expire in), along with their expiry time.
+  std::deque<std::pair<unsigned long, std::string> > _expiry_queue;
+
+  Counter* _prefetch_count;
+  Counter* _hit_count;
+  Counter* _wasted_count;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @file call_list_range.h Time-ranged and size-limited call list reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_RANGE_H_
+#define CALL_LIST_RANGE_H_
+
+#include "call_list_store.h"
+#include "httpconnection.h"
+
+/// The part of a subscriber's call list requested by a client, using the
+/// since, until and limit query parameters.
+struct CallListRange
+{
+  CallListRange() : since(""), until(""), limit(0) {};
+
+  /// Only return calls that started at or after this time (as a
+  /// YYYYMMDDHHMMSS timestamp).  Empty if there is no lower bound.
+  std::string since;
+
+  /// Only return calls that started at or before this time (as a
+  /// YYYYMMDDHHMMSS timestamp).  Empty if there is no upper bound.
+  std::string until;
+
+  /// Only return the most recent `limit` calls.  0 if there is no limit.
+  int limit;
+
+  /// @returns                 Whether any part of the range is restricted.
+  bool is_bounded() const
+  {
+    return (!since.empty() || !until.empty() || (limit > 0));
+  }
+
+  /// Fill in the range from the values of the since, until and limit query
+  /// parameters.  Timestamps may be given in the format used in call list
+  /// documents (e.g. 2002-05-30T09:30:10) or as YYYYMMDDHHMMSS.
+  ///
+  /// @param since_param       Value of the since parameter (may be empty).
+  /// @param until_param       Value of the until parameter (may be empty).
+  /// @param limit_param       Value of the limit parameter (may be empty).
+  ///
+  /// @returns                 HTTP_OK if the parameters are valid, or
+  ///                          HTTP_BAD_REQUEST if not.
+  HTTPCode parse(const std::string& since_param,
+                 const std::string& until_param,
+                 const std::string& limit_param);
+
+  /// Convert a timestamp in a query parameter to the YYYYMMDDHHMMSS format
+  /// used in the call list store.
+  ///
+  /// @param param             The query parameter value.
+  /// @param timestamp         The converted timestamp.
+  ///
+  /// @returns                 Whether the timestamp is valid.
+  static bool parse_timestamp(const std::string& param, std::string& timestamp);
+};
+
+/// Operation that reads the part of a subscriber's call list in a
+/// CallListRange.  The range is applied to the Cassandra column slice, so
+/// only the requested fragments are read from the store.
+class GetCallFragmentsInRange : public CassandraStore::Operation
+{
+public:
+  /// Constructor.
+  ///
+  /// @param impu              The subscriber's public ID.
+  /// @param range             The part of the call list to read.
+  GetCallFragmentsInRange(const std::string& impu, const CallListRange& range);
+  virtual ~GetCallFragmentsInRange();
+
+  /// Get the fragments read from the store.  These are in no particular
+  /// order.
+  ///
+  /// @param fragments         Vector to populate with the fragments.
+  void get_result(std::vector<CallListStore::CallFragment>& fragments);
+
+  /// Build the column slice predicate used to read a range from the store.
+  ///
+  /// @param range             The part of the call list to read.
+  /// @param predicate         The predicate to fill in.
+  static void build_predicate(const CallListRange& range,
+                              org::apache::cassandra::SlicePredicate& predicate);
+
+  /// Convert the columns returned from the store into call fragments.
+  ///
+  /// @param columns           The columns, in the order returned from the
+  ///                          store (newest first).
+  /// @param limit             The maximum number of calls to return (or 0
+  ///                          for no limit).
+  /// @param truncated         Whether the slice hit its column count, in
+  ///                          which case the oldest call in it may be
+  ///                          incomplete.
+  /// @param fragments         Vector to populate with the fragments.
+  ///
+  /// @returns                 Whether the fragments hold `limit` calls that
+  ///                          will be returned to the client (a single
+  ///                          REJECTED fragment, or a BEGIN and an END).
+  ///                          Always false if there is no limit.
+  static bool fragments_from_columns(const std::vector<org::apache::cassandra::ColumnOrSuperColumn>& columns,
+                                     int limit,
+                                     bool truncated,
+                                     std::vector<CallListStore::CallFragment>& fragments);
+
+  /// Progress through a call list read a page of columns at a time.  The
+  /// oldest call on a page that was cut short is held here until the rest
+  /// of it is read from the next page.
+  struct ParseState
+  {
+    ParseState() : call_fragments(), current_call(), num_calls(0) {}
+
+    std::vector<CallListStore::CallFragment> call_fragments;
+    std::string current_call;
+    int num_calls;
+  };
+
+  /// Convert one page of the columns returned from the store into call
+  /// fragments, carrying on from the previous pages.
+  ///
+  /// @param columns           The page of columns (newest first).
+  /// @param first_column      The index of the first column to parse (later
+  ///                          pages start with the last column of the
+  ///                          page before).
+  /// @param limit             The maximum number of calls to return (or 0
+  ///                          for no limit).
+  /// @param truncated         Whether this page hit its column count, in
+  ///                          which case its oldest call is held in `state`
+  ///                          rather than added to `fragments`.
+  /// @param state             Progress through the previous pages.
+  /// @param fragments         Vector to add the fragments to.
+  ///
+  /// @returns                 Whether the fragments from all the pages so
+  ///                          far hold `limit` calls that will be returned
+  ///                          to the client.
+  static bool fragments_from_columns(const std::vector<org::apache::cassandra::ColumnOrSuperColumn>& columns,
+                                     size_t first_column,
+                                     int limit,
+                                     bool truncated,
+                                     ParseState& state,
+                                     std::vector<CallListStore::CallFragment>& fragments);
+
+protected:
+  bool perform(CassandraStore::Client* client, SAS::TrailId trail);
+
+  const std::string _impu;
+  const CallListRange _range;
+  std::vector<CallListStore::CallFragment> _fragments;
+};
+
+#endif
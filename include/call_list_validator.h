@@ -0,0 +1,111 @@
+/**
+ * @file call_list_validator.h Well-formedness checks for call XML.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CALL_LIST_VALIDATOR_H_
+#define CALL_LIST_VALIDATOR_H_
+
+#include <string>
+
+/// Checks that the XML of a call is well formed, without building a DOM.
+///
+/// The validator checks that:
+/// - elements are balanced and properly nested
+/// - tags and attributes are syntactically valid
+/// - character and entity references are valid
+/// - the text is valid UTF-8, with no control characters other than tab,
+///   carriage return and line feed.
+///
+/// Comments, processing instructions, CDATA sections and DOCTYPEs aren't
+/// expected in call fragments, so are treated as invalid.
+///
+/// Almost all of the XML of a call is plain text, so the validator scans
+/// for the few bytes that need checking using SSE2 or AVX2 instructions
+/// (where available), and only checks those bytes one at a time.
+class CallXmlValidator
+{
+public:
+  /// Ways of scanning for the bytes that need checking.
+  enum Implementation
+  {
+    SCALAR = 0,
+    SSE2,
+    AVX2
+  };
+
+  /// @returns               The fastest implementation this CPU supports.
+  static Implementation best_implementation();
+
+  /// Constructor.
+  ///
+  /// @param implementation  How to scan the XML.  If this CPU doesn't
+  ///                        support it, the scalar implementation is used.
+  CallXmlValidator(Implementation implementation = best_implementation());
+
+  /// Destructor.
+  virtual ~CallXmlValidator() {};
+
+  /// Checks a call's XML.  A call's XML can be made up of more than one
+  /// piece (its BEGIN and END fragments), which are checked as if they were
+  /// concatenated, except that a tag can't span two pieces.
+  ///
+  /// @param pieces          The pieces of the XML.
+  /// @param num_pieces      The number of pieces.
+  /// @returns               true if the XML is well formed.
+  bool validate(const std::string* const pieces[], size_t num_pieces);
+
+  /// Checks a single piece of XML.
+  bool validate(const std::string& xml)
+  {
+    const std::string* pieces[] = {&xml};
+    return validate(pieces, 1);
+  }
+
+  /// @returns               Why the last XML checked wasn't well formed.
+  const char* error() const { return _error; }
+
+  /// @returns               The offset of the error in the XML, counting
+  ///                        from the start of the first piece.
+  size_t error_offset() const { return _error_offset; }
+
+private:
+  /// Finds the next byte at or after p that needs checking.
+  typedef const char* (*FindSpecialFn)(const char* p, const char* end);
+
+  bool scan(const char* p, const char* end);
+  bool check_tag(const char*& p, const char* end);
+  bool check_reference(const char*& p, const char* end);
+  bool check_utf8(const char*& p, const char* end);
+  bool check_attributes(const char*& p, const char* end);
+  bool fail(const char* error, const char* p);
+
+  /// Maximum depth of nested elements.  Calls are only a few elements deep,
+  /// so this doesn't need to be large, and means checking never allocates.
+  static const int MAX_DEPTH = 32;
+
+  struct OpenElement
+  {
+    const char* name;
+    size_t length;
+  };
+
+  FindSpecialFn _find_special;
+  OpenElement _open[MAX_DEPTH];
+  int _depth;
+
+  /// Start of the piece being checked, and how far into the XML it starts.
+  const char* _piece_start;
+  size_t _piece_offset;
+
+  const char* _error;
+  size_t _error_offset;
+};
+
+#endif
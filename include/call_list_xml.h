@@ -15,10 +15,120 @@
 
 #include "call_list_store.h"
 #include "log.h"
+#include "rapidxml/rapidxml.hpp"
 #include <vector>
-#include <map>
 #include <string>
 
+/// Interface used to receive a call list document as it is built.  The
+/// document is passed to the writer in pieces, in order, so it never has to
+/// be held in memory in its entirety.
+class CallListWriter
+{
+public:
+  virtual ~CallListWriter() {};
+
+  /// Append the next piece of the document.
+  ///
+  /// @param data     - The data to append.
+  virtual void write(const std::string& data) = 0;
+
+  /// Called with the size of the whole document before it is written, if
+  /// this is known.
+  ///
+  /// @param size     - The size of the document in bytes.
+  virtual void reserve(size_t size) {};
+};
+
+/// Writer that builds the document up in a string.
+class StringCallListWriter : public CallListWriter
+{
+public:
+  StringCallListWriter(std::string& xml) : _xml(xml) {};
+  virtual ~StringCallListWriter() {};
+
+  void write(const std::string& data)
+  {
+    _xml.append(data);
+  }
+
+  void reserve(size_t size)
+  {
+    _xml.reserve(_xml.size() + size);
+  }
+
+private:
+  std::string& _xml;
+};
+
+/// A valid call record.  This is either a single REJECTED fragment (in which
+/// case end is NULL) or a BEGIN/END pair.
+struct CallRecord
+{
+  const CallListStore::CallFragment* begin;
+  const CallListStore::CallFragment* end;
+
+  /// @returns        The size of the call in an XML call list document.
+  size_t xml_size() const;
+};
+
+/// Groups a list of CallFragments retrieved from the store into calls,
+/// discarding any that aren't a single REJECTED or a BEGIN/END pair.  This is
+/// shared by all the call list representations.
+///
+/// @param records  - The list of records to group. No ordering is assumed.
+/// @param calls    - Vector to populate with the valid calls, oldest first.
+///                   The calls point into the records.
+/// @param trail    - The SAS trail ID for logging.
+/// @param validate_xml - Whether to also discard calls whose XML isn't well
+///                   formed (see CallXmlValidator).
+void valid_call_records(const std::vector<CallListStore::CallFragment>& records,
+                        std::vector<CallRecord>& calls,
+                        SAS::TrailId trail,
+                        bool validate_xml = false);
+
+/// Works out which calls to leave out of a call list to keep it within a
+/// size limit.  The limit applies to the size of the XML document, whichever
+/// representation is used, so that the same calls are returned.
+///
+/// @param calls    - The valid calls, oldest first.
+/// @param max_size - The maximum size of the document in bytes.  0 means
+///                   there is no limit.
+/// @returns        - The index of the oldest call to include.
+size_t first_call_within_size(const std::vector<CallRecord>& calls,
+                              size_t max_size);
+
+/// Parses the XML of a call, for conversion to another representation.  The
+/// top-level nodes of the document are the call's fields.
+///
+/// @param call     - The call.
+/// @param buffer   - Buffer to hold the text of the call.  This must outlive
+///                   the document, and can be reused for each call.
+/// @param doc      - The document to parse into.
+/// @returns        - false if the call isn't valid XML.
+bool parse_call_xml(const CallRecord& call,
+                    std::vector<char>& buffer,
+                    rapidxml::xml_document<>& doc);
+
+/// Converts a list of CallFragments retrieved from the store into
+/// valid XML, passing the XML to the supplied writer a call at a time.
+///
+/// @param records  - The list of records to generate XML from. No
+///                   ordering is assumed.
+/// @param writer   - The writer to pass the document to.
+/// @param max_size - The maximum size of the document in bytes.  If the
+///                   complete call list would exceed this, the oldest calls
+///                   are omitted.  0 means there is no limit.
+/// @param trail    - The SAS trail ID for logging.
+/// @param validate_xml - Whether to leave out calls whose XML isn't well
+///                   formed.  If not, the calls' XML is copied into the
+///                   document unchecked.
+/// @returns        - The number of calls omitted to keep within max_size.
+size_t write_xml_from_call_records(const std::vector<CallListStore::CallFragment>& records,
+                                 CallListWriter& writer,
+                                 size_t max_size,
+                                 SAS::TrailId trail,
+                                 bool validate_xml = false);
+
 /// Converts a list of CallFragments retrieved from the store into
 /// valid XML.
 ///
@@ -0,0 +1,110 @@
+/**
+ * @file digest_cache.h In-memory cache of digest records.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DIGEST_CACHE_H_
+#define DIGEST_CACHE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "counter.h"
+#include "sharded_lru_cache.h"
+
+/// Process-local cache of the serialized digest records in the auth store,
+/// keyed by the store key.  The AuthStore uses it to answer reads without
+/// going to memcached.
+///
+/// Each entry has a version, which changes whenever the entry is replaced.
+/// The AuthStore checks the version when a digest read from the cache is
+/// written back, in the same way as memcached checks CAS values, so that
+/// requests on this node that race to update a digest are detected even
+/// before the write reaches memcached.
+///
+/// Like the call list cache, the records are held in a ShardedLRUCache with
+/// the memory budget split between its shards.
+class DigestCache
+{
+public:
+  /// Constructor.
+  ///
+  /// @param max_bytes       The maximum amount of memory to use for cached
+  ///                        records.
+  /// @param ttl_ms          How long records are cached for.  This should be
+  ///                        no longer than they are kept in the store.
+  /// @param hit_count       Counter incremented on each cache hit.
+  /// @param miss_count      Counter incremented on each cache miss.
+  /// @param eviction_count  Counter incremented each time a record is evicted
+  ///                        to make room for another.
+  /// @param num_shards      The number of shards to split the cache into.
+  DigestCache(size_t max_bytes,
+              int ttl_ms,
+              Counter* hit_count,
+              Counter* miss_count,
+              Counter* eviction_count,
+              int num_shards = DEFAULT_NUM_SHARDS);
+
+  /// Destructor.
+  virtual ~DigestCache();
+
+  /// Look up a record.
+  ///
+  /// @param key             The store key of the record.
+  /// @param data            Set to the record, if it is cached.
+  /// @param version         Set to the version of the record, if it is
+  ///                        cached.
+  /// @returns               Whether the record is cached.
+  bool get(const std::string& key, std::string& data, uint64_t& version);
+
+  /// Look up a particular version of a record, without counting a hit or
+  /// miss or refreshing its place in the cache.
+  ///
+  /// @param key             The store key of the record.
+  /// @param version         The version of the record that is wanted.
+  /// @param data            Set to the record, if that version is cached.
+  /// @returns               Whether that version of the record is cached.
+  bool get_version(const std::string& key,
+                   uint64_t version,
+                   std::string& data);
+
+  /// Cache a record, replacing any existing entry.
+  ///
+  /// @param key             The store key of the record.
+  /// @param data            The record.
+  void put(const std::string& key, const std::string& data);
+
+  /// Remove a record from the cache, e.g. because it no longer matches the
+  /// store.
+  void invalidate(const std::string& key);
+
+  /// @returns               The amount of memory used by cached records.
+  size_t bytes_used();
+
+  static const int DEFAULT_NUM_SHARDS = 16;
+
+private:
+  struct CachedRecord
+  {
+    std::string data;
+    uint64_t version;
+  };
+
+  ShardedLRUCache<CachedRecord> _cache;
+
+  /// The last version given to an entry.  Versions are unique across the
+  /// cache, so a version can't be reused by a later entry with the same key.
+  std::atomic<uint64_t> _last_version;
+
+  Counter* _hit_count;
+  Counter* _miss_count;
+};
+
+#endif
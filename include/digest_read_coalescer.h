@@ -0,0 +1,137 @@
+/**
+ * @file digest_read_coalescer.h Coalescing of concurrent digest reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DIGEST_READ_COALESCER_H_
+#define DIGEST_READ_COALESCER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "store.h"
+#include "counter.h"
+#include "accumulator.h"
+
+/// Coalesces concurrent reads of the same digest record from the store.
+///
+/// Clients often send several requests at once with the same nonce, and
+/// each request's worker thread reads the digest.  The first of these
+/// requests becomes the leader, and reads the record as normal.  Requests
+/// for the same record that arrive while the leader's read is in progress
+/// block until it completes, and share its result (including the CAS
+/// value), rather than each making their own round trip to memcached.
+class DigestReadCoalescer
+{
+public:
+  /// How long a request waits for another request's read by default, in
+  /// milliseconds.  This is longer than a healthy memcached read takes, but
+  /// short enough that a stuck read doesn't hold up every request for the
+  /// record until the client gives up.
+  static const int DEFAULT_MAX_WAIT_MS = 500;
+
+  /// How a request got the record.
+  enum Result
+  {
+    LEADER,
+    SHARED,
+    TIMED_OUT
+  };
+
+  /// Constructor.
+  ///
+  /// @param coalesced_count Counter incremented each time a read is avoided
+  ///                        by waiting for another request's read.
+  /// @param batch_size      Statistic recording the number of requests that
+  ///                        each store read serves (may be NULL).
+  /// @param wait_us         Statistic recording how long requests wait for
+  ///                        another request's read, in microseconds (may be
+  ///                        NULL).
+  /// @param max_wait_ms     How long a request waits for another request's
+  ///                        read before reading the record itself.
+  DigestReadCoalescer(Counter* coalesced_count,
+                      StatisticAccumulator* batch_size = NULL,
+                      StatisticAccumulator* wait_us = NULL,
+                      int max_wait_ms = DEFAULT_MAX_WAIT_MS);
+
+  /// Destructor.
+  virtual ~DigestReadCoalescer();
+
+  /// Starts a read of a record, or waits for the read already in progress.
+  ///
+  /// @param key             The store key of the record.
+  /// @param status          Set to the result of the read, if the request
+  ///                        waited for another request's read.
+  /// @param data            Set to the record, if the request waited for
+  ///                        another request's read and it succeeded.
+  /// @param cas             Set to the record's CAS value, if the request
+  ///                        waited for another request's read and it
+  ///                        succeeded.
+  /// @returns               LEADER if the request must read the record and
+  ///                        then call leader_done().  SHARED if the request
+  ///                        has the result of another request's read.
+  ///                        TIMED_OUT if the request gave up waiting for
+  ///                        another request's read, and must read the record
+  ///                        itself without calling leader_done().
+  Result lead_or_wait(const std::string& key,
+                      Store::Status& status,
+                      std::string& data,
+                      uint64_t& cas);
+
+  /// Ends the leader's read, and shares its result with the requests waiting
+  /// for it.  Requests for the record after this start a new read.
+  ///
+  /// @param key             The store key of the record.
+  /// @param status          Result of the leader's read.
+  /// @param data            The record that was read.
+  /// @param cas             The record's CAS value.
+  void leader_done(const std::string& key,
+                   Store::Status status,
+                   const std::string& data,
+                   uint64_t cas);
+
+  /// Used by the UTs to wait until requests are waiting for a read.
+  ///
+  /// @param key             The store key of the record.
+  /// @returns               The number of requests waiting for the read of
+  ///                        the record in progress.
+  int waiters(const std::string& key);
+
+private:
+  /// A read in progress, and its result once it completes.
+  struct Read
+  {
+    Read();
+    ~Read();
+
+    pthread_cond_t done_cond;
+    bool done;
+    int waiters;
+    Store::Status status;
+    std::string data;
+    uint64_t cas;
+  };
+
+  pthread_mutex_t _lock;
+
+  /// The reads in progress.  The requests waiting for a read keep a
+  /// reference to it, so that they can pick up the result after the leader
+  /// has removed it from the map.
+  std::unordered_map<std::string, std::shared_ptr<Read> > _reads;
+
+  Counter* _coalesced_count;
+  StatisticAccumulator* _batch_size;
+  StatisticAccumulator* _wait_us;
+  int _max_wait_ms;
+};
+
+#endif
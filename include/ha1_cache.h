@@ -0,0 +1,147 @@
+/**
+ * @file ha1_cache.h In-memory cache of subscribers' digest credentials.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HA1_CACHE_H_
+#define HA1_CACHE_H_
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+
+#include "counter.h"
+#include "homesteadconnection.h"
+#include "sharded_lru_cache.h"
+
+/// Cache of the HA1 and realm that Homestead returns for each IMPI and IMPU,
+/// so that challenges don't each need a Homestead round trip.
+///
+/// Like the call list cache, the entries are held in a ShardedLRUCache, with
+/// the maximum number of entries split between its shards.  Entries expire
+/// after a configurable time, as credentials can be changed in Homestead.
+/// Once an entry is most of the way to expiring, the next hit on it queues
+/// it to be fetched again on a background thread, so subscribers who are
+/// active don't have to wait for Homestead when their entry expires.
+class HA1Cache
+{
+public:
+  /// Constructor.
+  ///
+  /// @param homestead_conn  The connection to fetch credentials over.
+  /// @param max_entries     The maximum number of entries to cache.
+  /// @param ttl_ms          How long entries are cached for.
+  /// @param hit_count       Counter incremented each time an entry is used,
+  ///                        i.e. for each Homestead round trip avoided.
+  /// @param miss_count      Counter incremented each time credentials have
+  ///                        to be fetched for a request.
+  /// @param refresh_count   Counter incremented each time an entry is
+  ///                        refreshed in the background.
+  /// @param num_shards      The number of shards to split the cache into.
+  HA1Cache(HomesteadConnection* homestead_conn,
+           size_t max_entries,
+           int ttl_ms,
+           Counter* hit_count,
+           Counter* miss_count,
+           Counter* refresh_count,
+           int num_shards = DEFAULT_NUM_SHARDS);
+
+  /// Destructor.  Stops the refresh thread, if it is running.
+  virtual ~HA1Cache();
+
+  /// Starts the thread that refreshes entries.  Without it, entries are only
+  /// fetched when requests miss the cache.
+  ///
+  /// @returns               Whether the thread was started.
+  bool start();
+
+  /// Stops the refresh thread and waits for it to exit.
+  void stop();
+
+  /// Gets a subscriber's credentials, from the cache if possible and from
+  /// Homestead if not.  Takes the same parameters, and returns the same
+  /// codes, as HomesteadConnection::get_digest_data.  Failures aren't
+  /// cached.
+  HTTPCode get_digest_data(const std::string& impi,
+                           const std::string& impu,
+                           std::string& ha1,
+                           std::string& realm,
+                           SAS::TrailId trail);
+
+  /// Removes a subscriber's credentials from the cache, e.g. because they
+  /// didn't match the client's response.
+  void invalidate(const std::string& impi, const std::string& impu);
+
+  /// @returns               The number of cached entries.
+  size_t size();
+
+  static const int DEFAULT_NUM_SHARDS = 16;
+
+  /// Entries are refreshed once they are this proportion (in percent) of the
+  /// way to expiring.
+  static const int REFRESH_PERCENT = 75;
+
+  /// The maximum number of refreshes that can be queued.  Once the queue is
+  /// full, entries expire and are fetched when requests miss them instead.
+  static const size_t MAX_QUEUED_REFRESHES = 1000;
+
+private:
+  struct CachedCredentials
+  {
+    std::string ha1;
+    std::string realm;
+    unsigned long refresh_ms;
+    bool refreshing;
+
+    bool operator==(const CachedCredentials& other) const
+    {
+      return ((ha1 == other.ha1) &&
+              (realm == other.realm) &&
+              (refresh_ms == other.refresh_ms) &&
+              (refreshing == other.refreshing));
+    }
+  };
+
+  struct Refresh
+  {
+    std::string impi;
+    std::string impu;
+  };
+
+  static std::string cache_key(const std::string& impi, const std::string& impu);
+
+  /// Add or replace an entry.
+  void put(const std::string& key, const std::string& ha1, const std::string& realm);
+
+  /// Queues an entry to be refreshed.  Returns false if the queue is full.
+  bool queue_refresh(const std::string& impi, const std::string& impu);
+
+  /// Refreshes all the queued entries, unless the cache is stopping.
+  void refresh_queued();
+
+  static void* refresh_thread_fn(void* cache);
+  void refresh_thread();
+
+  HomesteadConnection* _homestead_conn;
+  ShardedLRUCache<CachedCredentials> _cache;
+  int _ttl_ms;
+
+  Counter* _hit_count;
+  Counter* _miss_count;
+  Counter* _refresh_count;
+
+  pthread_mutex_t _refresh_lock;
+  pthread_cond_t _refresh_cond;
+  std::deque<Refresh> _refresh_queue;
+  pthread_t _refresh_thread;
+  bool _running;
+  bool _stopping;
+};
+
+#endif
@@ -12,20 +12,98 @@
 #ifndef HANDLERS_H__
 #define HANDLERS_H__
 
+#include <pthread.h>
+
 #include "httpstack.h"
 #include "httpstack_utils.h"
 #include "sas.h"
 #include "authstore.h"
 #include "homesteadconnection.h"
 #include "httpdigestauthenticate.h"
+#include "session_token_signer.h"
 #include "call_list_store.h"
+#include "call_list_xml.h"
+#include "call_list_range.h"
+#include "call_list_cache.h"
+#include "call_list_compression.h"
+#include "call_list_coalescer.h"
+#include "call_list_prefetcher.h"
 #include "counter.h"
 #include "accumulator.h"
+#include "stage_timer.h"
 #include "health_checker.h"
+#include "utils.h"
 
-class CallListTask : public HttpStackUtils::Task
+class CallListTask : public HttpStackUtils::Task,
+                     public CallListReadCoalescer::Follower
 {
 public:
+  /// Optional behaviour of call list requests.  Everything is off by
+  /// default.
+  struct Options
+  {
+    Options() :
+      async_store_reads(false),
+      max_call_list_bytes(0),
+      call_list_cache(NULL),
+      compressor(NULL),
+      read_coalescer(NULL),
+      prefetcher(NULL),
+      optimistic_reads(false),
+      validate_call_xml(false),
+      nonce_signer(NULL),
+      session_token_signer(NULL),
+      ha1_cache(NULL)
+    {}
+
+    /// Whether call list reads are handed off to the call list store's own
+    /// worker pool (freeing up the HTTP worker thread while the read is in
+    /// progress), rather than being performed on the HTTP worker thread.
+    bool async_store_reads;
+
+    /// Maximum size of a call list response body.  Larger call lists have
+    /// their oldest calls omitted.  0 means there is no limit.
+    size_t max_call_list_bytes;
+
+    /// Cache of rendered call lists.  NULL if call lists aren't cached.
+    CallListCache* call_list_cache;
+
+    /// Compressor for call list responses.  NULL if responses aren't
+    /// compressed.
+    CallListCompressor* compressor;
+
+    /// Coalesces concurrent reads of the same call list.  NULL if reads
+    /// aren't coalesced.
+    CallListReadCoalescer* read_coalescer;
+
+    /// Reads call lists when requests are challenged, ready for the
+    /// authenticated retry.  NULL if call lists aren't prefetched.
+    CallListPrefetcher* prefetcher;
+
+    /// Whether requests with digest credentials start reading the call list
+    /// while they are being authenticated, rather than afterwards.  Only
+    /// used with async_store_reads.
+    bool optimistic_reads;
+
+    /// Whether calls whose XML isn't well formed are left out of XML call
+    /// lists.  JSON and CBOR call lists always leave them out, as the XML has
+    /// to be parsed to convert it.
+    bool validate_call_xml;
+
+    /// Signs digest nonces, so that challenges aren't stored until they're
+    /// used.  NULL if every challenge is stored.
+    NonceSigner* nonce_signer;
+
+    /// Issues session tokens to clients that authenticate with digest
+    /// credentials, and checks them on later requests.  NULL if session
+    /// tokens aren't used.
+    SessionTokenSigner* session_token_signer;
+
+    /// Caches HA1s from Homestead.  NULL if every HA1 is fetched from
+    /// Homestead.
+    HA1Cache* ha1_cache;
+  };
+
   struct Config
   {
     Config(AuthStore* auth_store,
@@ -34,13 +112,25 @@ public:
            std::string home_domain,
            LastValueCache* stats_aggregator,
            HealthChecker* hc,
-           std::string api_key) :
+           std::string api_key,
+           const Options& options = Options()) :
       _auth_store(auth_store),
       _homestead_conn(homestead_conn),
       _call_list_store(call_list_store),
       _home_domain(home_domain),
       _health_checker(hc),
-      _api_key(api_key)
+      _api_key(api_key),
+      _async_store_reads(options.async_store_reads),
+      _max_call_list_bytes(options.max_call_list_bytes),
+      _call_list_cache(options.call_list_cache),
+      _compressor(options.compressor),
+      _read_coalescer(options.read_coalescer),
+      _prefetcher(options.prefetcher),
+      _optimistic_reads(options.optimistic_reads),
+      _validate_call_xml(options.validate_call_xml),
+      _nonce_signer(options.nonce_signer),
+      _session_token_signer(options.session_token_signer),
+      _ha1_cache(options.ha1_cache)
     {
       _stat_auth_challenge_count = new StatisticCounter("auth_challenges",
                                                         stats_aggregator);
@@ -58,6 +148,18 @@ public:
                                                    stats_aggregator);
       _stat_record_length = new StatisticAccumulator("record_length",
                                                      stats_aggregator);
+      _stat_auth_store_stage = new StageStatistics("auth_store",
+                                                   stats_aggregator);
+      _stat_homestead_stage = new StageStatistics("homestead",
+                                                  stats_aggregator);
+      _stat_call_list_store_stage = new StageStatistics("call_list_store",
+                                                        stats_aggregator);
+      _stat_render_stage = new StageStatistics("call_list_render",
+                                               stats_aggregator);
+      _stat_compress_stage = new StageStatistics("call_list_compress",
+                                                 stats_aggregator);
+      _stat_reply_stage = new StageStatistics("call_list_reply",
+                                              stats_aggregator);
     }
 
     ~Config()
@@ -70,6 +172,12 @@ public:
       delete _stat_cassandra_read_latency;
       delete _stat_record_size;
       delete _stat_record_length;
+      delete _stat_auth_store_stage;
+      delete _stat_homestead_stage;
+      delete _stat_call_list_store_stage;
+      delete _stat_render_stage;
+      delete _stat_compress_stage;
+      delete _stat_reply_stage;
     }
 
     AuthStore* _auth_store;
@@ -78,6 +186,20 @@ public:
     std::string _home_domain;
     HealthChecker* _health_checker;
     std::string _api_key;
+
+    // Set from the Options - see there for what each one does.
+    bool _async_store_reads;
+    size_t _max_call_list_bytes;
+    CallListCache* _call_list_cache;
+    CallListCompressor* _compressor;
+    CallListReadCoalescer* _read_coalescer;
+    CallListPrefetcher* _prefetcher;
+    bool _optimistic_reads;
+    bool _validate_call_xml;
+    NonceSigner* _nonce_signer;
+    SessionTokenSigner* _session_token_signer;
+    HA1Cache* _ha1_cache;
+
     StatisticCounter* _stat_auth_challenge_count;
     StatisticCounter* _stat_auth_attempt_count;
     StatisticCounter* _stat_auth_success_count;
@@ -86,6 +208,17 @@ public:
     StatisticAccumulator* _stat_cassandra_read_latency;
     StatisticAccumulator* _stat_record_size;
     StatisticAccumulator* _stat_record_length;
+
+    /// Time spent in each stage of handling a request.  The call list store
+    /// stage is the time spent on the HTTP worker thread reading the call
+    /// list (or handing the read off to the store's worker pool) - see
+    /// _stat_cassandra_read_latency for the end-to-end read latency.
+    StageStatistics* _stat_auth_store_stage;
+    StageStatistics* _stat_homestead_stage;
+    StageStatistics* _stat_call_list_store_stage;
+    StageStatistics* _stat_render_stage;
+    StageStatistics* _stat_compress_stage;
+    StageStatistics* _stat_reply_stage;
   };
 
   CallListTask(HttpStack::Request& req,
@@ -100,14 +233,85 @@ public:
                                          _cfg->_stat_auth_attempt_count,
                                          _cfg->_stat_auth_success_count,
                                          _cfg->_stat_auth_failure_count,
-                                         _cfg->_stat_auth_stale_count))
-  {};
+                                         _cfg->_stat_auth_stale_count,
+                                         _cfg->_stat_auth_store_stage,
+                                         _cfg->_stat_homestead_stage,
+                                         _cfg->_nonce_signer,
+                                         _cfg->_ha1_cache)),
+    _format(XML),
+    _read_leader(false),
+    _read_prefetched(false),
+    _optimistic_auth_done(false),
+    _optimistic_authenticated(false),
+    _optimistic_read_done(false),
+    _optimistic_db_rc(CassandraStore::OK)
+  {
+    pthread_mutex_init(&_optimistic_lock, NULL);
+
+    if (_cfg->_compressor != NULL)
+    {
+      _cfg->_compressor->request_started();
+    }
+  };
 
   ~CallListTask()
   {
     delete _auth_mod; _auth_mod = NULL;
+    pthread_mutex_destroy(&_optimistic_lock);
+
+    if (_cfg->_compressor != NULL)
+    {
+      _cfg->_compressor->request_complete();
+    }
   }
 
+  /// Transaction used to resume a CallListTask when an asynchronous read of
+  /// the subscriber's call fragments completes.  The call list store owns
+  /// (and deletes) the transaction once one of the callbacks has run.
+  class GetCallFragmentsTsx : public CassandraStore::Transaction
+  {
+  public:
+    GetCallFragmentsTsx(CallListTask* task) :
+      CassandraStore::Transaction(task->trail()),
+      _task(task)
+    {};
+
+    virtual ~GetCallFragmentsTsx() {};
+
+    void on_success(CassandraStore::Operation* op);
+    void on_failure(CassandraStore::Operation* op);
+
+  private:
+    CallListTask* _task;
+  };
+
+  /// Transaction used to pass the result of an optimistic read (one started
+  /// before the request was authenticated) back to the CallListTask.
+  class OptimisticReadTsx : public CassandraStore::Transaction
+  {
+  public:
+    OptimisticReadTsx(CallListTask* task) :
+      CassandraStore::Transaction(task->trail()),
+      _task(task)
+    {};
+
+    virtual ~OptimisticReadTsx() {};
+
+    void on_success(CassandraStore::Operation* op);
+    void on_failure(CassandraStore::Operation* op);
+
+  private:
+    CallListTask* _task;
+  };
+
+  /// Formats that call lists can be sent in.
+  enum Format
+  {
+    XML = 0,
+    JSON,
+    CBOR
+  };
+
   void run();
   HTTPCode parse_request();
   HTTPCode authenticate_request();
@@ -121,9 +325,222 @@ public:
 protected:
   const Config* _cfg;
   HTTPDigestAuthenticate* _auth_mod;
-  void respond_when_authenticated();
+
+  /// Store stage.  Kicks off the read of the subscriber's call fragments.
+  ///
+  /// @returns               true if the response has already been sent, or
+  ///                        false if the task has been suspended waiting for
+  ///                        an asynchronous read (in which case the task
+  ///                        resumes, completes and deletes itself from the
+  ///                        call list store's worker thread).
+  bool respond_when_authenticated();
+
+  /// Starts reading the subscriber's call fragments before the request is
+  /// authenticated, if optimistic reads are enabled and the request carries
+  /// digest credentials (so is likely to be accepted straight away).  If the
+  /// call list is cached or has been prefetched, that is used instead.
+  ///
+  /// @param auth_header     The Authorization header on the request.
+  /// @returns               true if an optimistic read was started.  The
+  ///                        result must then be collected with
+  ///                        on_optimistic_auth_complete.
+  bool start_optimistic_read(const std::string& auth_header);
+
+  /// Joins an optimistic read once authentication has finished.  If the
+  /// request was rejected, the response must already have been sent, and the
+  /// call fragments are discarded.
+  ///
+  /// @param authenticated   Whether the request was authenticated.
+  /// @returns               true if the request is finished, or false if the
+  ///                        read is still in progress (in which case the task
+  ///                        completes and deletes itself from the call list
+  ///                        store's worker thread).
+  bool on_optimistic_auth_complete(bool authenticated);
+
+  /// Joins an optimistic read once the read has finished.
+  ///
+  /// @param db_rc           Result of the call list store read.
+  /// @param records         The retrieved call fragments.
+  /// @returns               true if the request is finished, or false if
+  ///                        authentication is still in progress.
+  bool on_optimistic_read_complete(CassandraStore::ResultCode db_rc,
+                                   std::vector<CallListStore::CallFragment>& records);
+
+  /// Responds using the result of an optimistic read, if the request was
+  /// authenticated.
+  void respond_with_optimistic_read();
+
+  /// Render stage.  Builds and sends the response once the call fragments
+  /// have been retrieved.
+  ///
+  /// @param db_rc           Result of the call list store read.
+  /// @param records         The retrieved call fragments.
+  void on_call_fragments_retrieved(CassandraStore::ResultCode db_rc,
+                                   std::vector<CallListStore::CallFragment>& records);
+
+  /// Writer that streams a call list straight into the response body.
+  class ResponseWriter : public CallListWriter
+  {
+  public:
+    ResponseWriter(HttpStack::Request& req) : _req(req), _bytes(0) {};
+    virtual ~ResponseWriter() {};
+
+    void write(const std::string& data)
+    {
+      _req.add_content(data);
+      _bytes += data.length();
+    }
+
+    /// @returns             The number of bytes written so far.
+    size_t bytes() const { return _bytes; }
+
+  private:
+    HttpStack::Request& _req;
+    size_t _bytes;
+  };
+
+  /// Shares the result of a coalesced read with the requests waiting for it.
+  ///
+  /// @param followers       The waiting requests.
+  /// @param db_rc           Result of the call list store read.
+  /// @param call_list       The call list that was built, or NULL if the
+  ///                        read failed.
+  void share_call_list(std::vector<CallListReadCoalescer::Follower*>& followers,
+                       CassandraStore::ResultCode db_rc,
+                       std::shared_ptr<const CallListCache::Entry> call_list);
+
+  /// Responds with a call list read by another request, and completes the
+  /// task.
+  void on_call_list_shared(CassandraStore::ResultCode db_rc,
+                           std::shared_ptr<const CallListCache::Entry> call_list);
+
+  /// Sends a call list (or a 304 if the client already has it).
+  ///
+  /// @param call_list       The call list.  This includes the validators,
+  ///                        and may include the rendered body.
+  /// @param records         The call fragments to build the body from, or
+  ///                        NULL to send the body in the call_list.
+  void send_call_list(const CallListCache::Entry& call_list,
+                      const std::vector<CallListStore::CallFragment>* records);
+
+  /// Adds the headers describing the call list to the response.
+  ///
+  /// @param call_list       The call list.
+  /// @param encoding        The encoding the call list is sent with.
+  /// @param with_content    Whether to add the headers describing the
+  ///                        content, as well as the validators.
+  void add_call_list_headers(const CallListCache::Entry& call_list,
+                             CallListCompressor::Encoding encoding,
+                             bool with_content);
+
+  /// Tells the client if the oldest calls were left out of the call list to
+  /// keep it within the size limit.
+  ///
+  /// @param omitted_calls   The number of calls left out.
+  void add_calls_omitted_header(size_t omitted_calls);
+
+  /// Works out the validators for a call list.
+  ///
+  /// @param records         The call fragments the call list is built from.
+  /// @param etag            Set to the entity tag of the call list.  This is
+  ///                        a hash of the fragments.
+  /// @param last_modified   Set to when the last fragment was written, or 0
+  ///                        if there are no fragments.
+  static void get_validators(const std::vector<CallListStore::CallFragment>& records,
+                             std::string& etag,
+                             time_t& last_modified);
+
+  /// @returns               The entity tag of a format and encoding of the
+  ///                        call list.
+  static std::string encoded_etag(const std::string& etag,
+                                  Format format,
+                                  CallListCompressor::Encoding encoding);
+
+  /// Picks the format to send the call list in.
+  ///
+  /// @param accept          The Accept header on the request.
+  /// @returns               The preferred format that the client accepts.
+  static Format choose_format(const std::string& accept);
+
+  /// @returns               The short name of a format.
+  static const char* format_name(Format format);
+
+  /// @returns               The media type of a format.
+  static const char* content_type(Format format);
+
+  /// @returns               The key identifying the requested call list (and
+  ///                        format) in the call list cache and read
+  ///                        coalescer.
+  std::string call_list_key();
+
+  /// Compresses the call list.
+  ///
+  /// @param encoding        The encoding to use.
+  /// @param body            The uncompressed call list.
+  /// @param compressed_body String to populate with the compressed call list.
+  /// @returns               true if the call list was compressed.
+  bool compress_call_list(CallListCompressor::Encoding encoding,
+                          const std::string& body,
+                          std::string& compressed_body);
+
+  /// Builds the call list in the requested format.
+  ///
+  /// @param records         The call fragments to build the call list from.
+  /// @param writer          The writer to pass the call list to.
+  /// @returns               The number of the oldest calls left out to keep
+  ///                        the call list within the size limit.
+  size_t write_call_list(const std::vector<CallListStore::CallFragment>& records,
+                       CallListWriter& writer);
+
+  /// @returns               Whether this request can be served from (and
+  ///                        its result stored in) the call list cache.
+  bool use_call_list_cache();
+
+  /// Checks whether the copy of the call list that the client already has
+  /// (as identified by the If-None-Match and If-Modified-Since headers on the
+  /// request) is still current.
+  ///
+  /// @param etag            The entity tag of the current call list.
+  /// @param last_modified   When the current call list was last modified, or
+  ///                        0 if this isn't known.
+  /// @returns               true if the client's copy is current.
+  bool client_copy_is_current(const std::string& etag, time_t last_modified);
+
+  /// Reports the end of the request to SAS and deletes the task.
+  void complete();
+
+  /// Get the call fragments from a completed asynchronous read.
+  ///
+  /// @param op              The read operation.
+  /// @param records         Vector to populate with the call fragments.
+  void get_call_fragments_result(CassandraStore::Operation* op,
+                                 std::vector<CallListStore::CallFragment>& records);
 
   std::string _impu;
+  CallListRange _range;
+  Utils::StopWatch _read_stop_watch;
+
+  /// The format the client wants the call list in.
+  Format _format;
+
+  /// Whether this request is leading a coalesced read.
+  bool _read_leader;
+
+  /// Whether the call fragments were read when the client was challenged,
+  /// rather than for this request.
+  bool _read_prefetched;
+
+  /// State of an optimistic read.  Authentication and the read finish on
+  /// different threads, and whichever finishes second responds.
+  pthread_mutex_t _optimistic_lock;
+  bool _optimistic_auth_done;
+  bool _optimistic_authenticated;
+  bool _optimistic_read_done;
+  CassandraStore::ResultCode _optimistic_db_rc;
+  std::vector<CallListStore::CallFragment> _optimistic_records;
+
+  /// The cached call list, if the optimistic read found one in the cache.
+  std::shared_ptr<const CallListCache::Entry> _optimistic_call_list;
 };
 
 #endif
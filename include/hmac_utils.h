@@ -0,0 +1,31 @@
+/**
+ * @file hmac_utils.h Helpers for signing values with HMAC-SHA256.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HMAC_UTILS_H_
+#define HMAC_UTILS_H_
+
+#include <stddef.h>
+#include <string>
+
+namespace HmacUtils
+{
+  /// @returns               The HMAC-SHA256 of the data, in lower case hex,
+  ///                        truncated to hex_len characters (at most 64).
+  std::string hmac_hex(const std::string& key,
+                       const std::string& data,
+                       size_t hex_len);
+
+  /// Compares two MACs in constant time.
+  /// @returns               Whether they are the same.
+  bool macs_equal(const std::string& mac1, const std::string& mac2);
+}
+
+#endif
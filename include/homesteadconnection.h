@@ -50,6 +50,17 @@ private:
                                         std::string& realm,
                                         SAS::TrailId trail);
 
+  /// parse_digest
+  /// @param json_data  The body of Homestead's response
+  /// @param digest     The parsed digest (as a string)
+  /// @param realm      The parsed realm (as a string)
+  static HTTPCode parse_digest(const std::string& json_data,
+                               std::string& digest,
+                               std::string& realm);
+
   HttpConnection* _http;
+
+  // The microbenchmarks time the parsing of Homestead's response directly.
+  friend class AuthBench;
 };
 #endif
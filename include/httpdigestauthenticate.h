@@ -17,6 +17,9 @@
 #include "homesteadconnection.h"
 #include "authstore.h"
 #include "counter.h"
+#include "stage_timer.h"
+#include "nonce_signer.h"
+#include "ha1_cache.h"
 
 class HTTPDigestAuthenticate
 {
@@ -60,6 +63,14 @@ public:
   /// @param homestead_conn  A pointer to the homestead connection object
   /// @param home_domain     Home domain of the deployment
   /// @param stat_*          Statistics
+  /// @param stat_auth_store_stage  Time spent reading and writing the auth
+  ///                        store (may be NULL).
+  /// @param stat_homestead_stage   Time spent querying Homestead (may be
+  ///                        NULL).
+  /// @param nonce_signer    Signs nonces, so that challenges don't need to be
+  ///                        stored.  If NULL, every challenge is stored.
+  /// @param ha1_cache       Cache of HA1s from Homestead.  If NULL, every HA1
+  ///                        is fetched from Homestead.
   HTTPDigestAuthenticate(AuthStore *auth_store,
                          HomesteadConnection *homestead_conn,
                          std::string home_domain,
@@ -67,7 +78,11 @@ public:
                          Counter* stat_auth_attempt_count,
                          Counter* stat_auth_success_count,
                          Counter* stat_auth_failure_count,
-                         Counter* stat_auth_stale_count);
+                         Counter* stat_auth_stale_count,
+                         StageStatistics* stat_auth_store_stage = NULL,
+                         StageStatistics* stat_homestead_stage = NULL,
+                         NonceSigner* nonce_signer = NULL,
+                         HA1Cache* ha1_cache = NULL);
 
   /// Destructor.
   virtual ~HTTPDigestAuthenticate();
@@ -97,12 +112,41 @@ private:
   /// @param response              Pointer to response built from authorization header
   HTTPCode retrieve_digest_from_store(std::string& www_auth_header, Response* response);
 
+  /// check_signed_nonce
+  /// Checks a response to a challenge that wasn't stored, and stores the
+  /// digest if it is the first valid use of the nonce.
+  /// @param www_auth_header       WWW-Authenticate header to populate
+  /// @param response              Pointer to response built from authorization header
+  HTTPCode check_signed_nonce(std::string& www_auth_header, Response* response);
+
   /// request_digest_and_store
   /// @param www_auth_header       WWW-Authenticate header to populate
   /// @param include_stale         Whether the WWW-Authenticate should include a stale=TRUE parameter
   /// @param response              Pointer to response built from authorization header
   HTTPCode request_digest_and_store(std::string& www_auth_header, bool include_stale, Response* response);
 
+  /// store_nonce_count
+  /// Writes a digest back to the store after a nonce count has been used,
+  /// rereading it and trying again if another request has updated it.  If
+  /// the auth store records nonce counts separately, the nonce count is
+  /// added as its own entry instead.
+  /// @param digest                Pointer to Digest object, with the nonce count used
+  /// @param nonce_count           Nonce count supplied by the client
+  /// @returns                     DATA_CONTENTION if the nonce count couldn't be
+  ///                              recorded, otherwise the status of the write
+  Store::Status store_nonce_count(AuthStore::Digest* digest, uint32_t nonce_count);
+
+  /// get_digest_data
+  /// Gets the HA1 and realm for the request, from the HA1 cache if there is
+  /// one.
+  /// @param ha1                   The retrieved HA1
+  /// @param realm                 The retrieved realm
+  HTTPCode get_digest_data(std::string& ha1, std::string& realm);
+
+  /// invalidate_cached_ha1
+  /// Removes the HA1 for the request from the HA1 cache, if there is one.
+  void invalidate_cached_ha1();
+
   /// check_if_matches
   /// @param digest                Pointer to Digest object built from stored digest
   /// @param www_auth_header       WWW-Authenticate header to populate
@@ -134,6 +178,10 @@ private:
   /// @param trail                 SAS trail
   void set_members(std::string impu, std::string method, std::string impi, SAS::TrailId trail);
 
+  /// The number of times a nonce count is written to the store, if other
+  /// requests using the same nonce keep updating the digest.
+  static const int MAX_NONCE_COUNT_WRITES = 5;
+
   AuthStore* _auth_store;
   HomesteadConnection* _homestead_conn;
   std::string _home_domain;
@@ -143,11 +191,19 @@ private:
   Counter* _stat_auth_success_count;
   Counter* _stat_auth_failure_count;
   Counter* _stat_auth_stale_count;
+  StageStatistics* _stat_auth_store_stage;
+  StageStatistics* _stat_homestead_stage;
+  NonceSigner* _nonce_signer;
+  HA1Cache* _ha1_cache;
 
   std::string _impu;
   SAS::TrailId _trail;
   std::string _impi;
   std::string _method;
+
+  // The microbenchmarks time the header parsing and response checking
+  // directly.
+  friend class AuthBench;
 };
 
 #endif
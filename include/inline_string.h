@@ -0,0 +1,186 @@
+/**
+ * @file inline_string.h String with inline storage for short values.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef INLINE_STRING_H_
+#define INLINE_STRING_H_
+
+#include <string.h>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/// String that stores values of up to N characters in the object itself, so
+/// setting it doesn't allocate.  This suits fields that almost always have a
+/// known length, such as hex encoded hashes and the nonces Memento generates.
+/// Longer values are stored on the heap, so they work, but lose the benefit.
+///
+/// The interface is the subset of std::string's that the digest code uses,
+/// and the string converts to a std::string where one is needed.
+template <size_t N>
+class InlineString
+{
+public:
+  InlineString() : _length(0), _overflow()
+  {
+    _buffer[0] = '\0';
+  }
+
+  InlineString(const std::string& value) : _length(0), _overflow()
+  {
+    assign(value.data(), value.length());
+  }
+
+  InlineString(const char* value) : _length(0), _overflow()
+  {
+    assign(value, strlen(value));
+  }
+
+  InlineString(const InlineString& other) : _length(0), _overflow()
+  {
+    assign(other.data(), other.length());
+  }
+
+  InlineString& operator=(const InlineString& other)
+  {
+    if (this != &other)
+    {
+      assign(other.data(), other.length());
+    }
+
+    return *this;
+  }
+
+  InlineString& operator=(const std::string& value)
+  {
+    assign(value.data(), value.length());
+    return *this;
+  }
+
+  InlineString& operator=(const char* value)
+  {
+    assign(value, strlen(value));
+    return *this;
+  }
+
+  /// Sets the string to the given characters.
+  void assign(const char* value, size_t length)
+  {
+    if (length <= N)
+    {
+      memmove(_buffer, value, length);
+      _buffer[length] = '\0';
+      _overflow.reset();
+    }
+    else if (_overflow)
+    {
+      _overflow->assign(value, length);
+    }
+    else
+    {
+      _overflow.reset(new std::string(value, length));
+    }
+
+    _length = length;
+  }
+
+  const char* data() const { return _overflow ? _overflow->data() : _buffer; }
+  const char* c_str() const { return _overflow ? _overflow->c_str() : _buffer; }
+  size_t length() const { return _length; }
+  size_t size() const { return _length; }
+  bool empty() const { return (_length == 0); }
+  char operator[](size_t index) const { return data()[index]; }
+
+  /// @returns Whether the value is stored in the object.
+  bool is_inline() const { return !_overflow; }
+
+  std::string str() const { return std::string(data(), _length); }
+  operator std::string() const { return str(); }
+
+  bool equals(const char* value, size_t length) const
+  {
+    return ((_length == length) && (memcmp(data(), value, length) == 0));
+  }
+
+  static const size_t CAPACITY = N;
+
+private:
+  char _buffer[N + 1];
+  size_t _length;
+  std::unique_ptr<std::string> _overflow;
+};
+
+template <size_t N, size_t M>
+inline bool operator==(const InlineString<N>& lhs, const InlineString<M>& rhs)
+{
+  return lhs.equals(rhs.data(), rhs.length());
+}
+
+template <size_t N>
+inline bool operator==(const InlineString<N>& lhs, const std::string& rhs)
+{
+  return lhs.equals(rhs.data(), rhs.length());
+}
+
+template <size_t N>
+inline bool operator==(const std::string& lhs, const InlineString<N>& rhs)
+{
+  return rhs.equals(lhs.data(), lhs.length());
+}
+
+template <size_t N>
+inline bool operator==(const InlineString<N>& lhs, const char* rhs)
+{
+  return lhs.equals(rhs, strlen(rhs));
+}
+
+template <size_t N>
+inline bool operator==(const char* lhs, const InlineString<N>& rhs)
+{
+  return rhs.equals(lhs, strlen(lhs));
+}
+
+template <size_t N, size_t M>
+inline bool operator!=(const InlineString<N>& lhs, const InlineString<M>& rhs)
+{
+  return !(lhs == rhs);
+}
+
+template <size_t N>
+inline bool operator!=(const InlineString<N>& lhs, const std::string& rhs)
+{
+  return !(lhs == rhs);
+}
+
+template <size_t N>
+inline bool operator!=(const std::string& lhs, const InlineString<N>& rhs)
+{
+  return !(lhs == rhs);
+}
+
+template <size_t N>
+inline bool operator!=(const InlineString<N>& lhs, const char* rhs)
+{
+  return !(lhs == rhs);
+}
+
+template <size_t N>
+inline bool operator!=(const char* lhs, const InlineString<N>& rhs)
+{
+  return !(lhs == rhs);
+}
+
+template <size_t N>
+inline std::ostream& operator<<(std::ostream& os, const InlineString<N>& value)
+{
+  return os.write(value.data(), value.length());
+}
+
+#endif
@@ -0,0 +1,27 @@
+/**
+ * @file monotonic_clock.h Timestamps for measuring intervals.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef MONOTONIC_CLOCK_H_
+#define MONOTONIC_CLOCK_H_
+
+/// Reads of CLOCK_MONOTONIC, for expiry times and waits that mustn't be
+/// affected by changes to the system time.  Times that are sent to clients
+/// or other nodes must use the real time instead.
+namespace MonotonicClock
+{
+  /// @returns               The current monotonic time in milliseconds.
+  unsigned long now_ms();
+
+  /// @returns               The current monotonic time in microseconds.
+  unsigned long now_us();
+}
+
+#endif
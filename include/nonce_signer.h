@@ -0,0 +1,96 @@
+/**
+ * @file nonce_signer.h Signs and verifies stateless digest nonces.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef NONCE_SIGNER_H_
+#define NONCE_SIGNER_H_
+
+#include <stdint.h>
+#include <string>
+
+/// Signs digest nonces so that they can be checked without storing anything
+/// when the challenge is sent.
+///
+/// A signed nonce has the form
+///   <issue time (ms)>.<random token>.<HA1 fingerprint>.<MAC>
+/// where the MAC is an HMAC-SHA256 (truncated to 128 bits) over the other
+/// fields and the IMPI, IMPU, realm and opaque the nonce was issued for.  The
+/// HA1 fingerprint is also keyed, so that it doesn't allow offline guessing
+/// of the subscriber's password.
+///
+/// Every node that may see the authenticated request must use the same key.
+class NonceSigner
+{
+public:
+  enum Result
+  {
+    VALID,
+    INVALID,
+    EXPIRED
+  };
+
+  /// Constructor.
+  /// @param key             The secret key to sign nonces with.
+  /// @param max_age_s       How long a nonce can be used for, in seconds.
+  NonceSigner(const std::string& key, int max_age_s);
+  virtual ~NonceSigner();
+
+  /// Generates a signed nonce.
+  /// @returns               The nonce.
+  std::string sign(const std::string& impi,
+                   const std::string& impu,
+                   const std::string& realm,
+                   const std::string& opaque,
+                   const std::string& ha1) const;
+
+  /// Checks that a nonce was signed by this signer for the given
+  /// parameters, and hasn't expired.
+  /// @param ha1_fingerprint Set to the HA1 fingerprint from the nonce, if it
+  ///                        is valid.
+  /// @returns               Whether the nonce is valid.
+  Result verify(const std::string& nonce,
+                const std::string& impi,
+                const std::string& impu,
+                const std::string& realm,
+                const std::string& opaque,
+                std::string& ha1_fingerprint) const;
+
+  /// @returns               Whether the fingerprint (from verify) is that of
+  ///                        the HA1.
+  bool matches_ha1(const std::string& ha1_fingerprint,
+                   const std::string& ha1) const;
+
+private:
+  /// Length of the hex encoded HA1 fingerprint and MAC.
+  static const size_t FINGERPRINT_HEX_LEN = 16;
+  static const size_t MAC_HEX_LEN = 32;
+
+  /// How far in the future an issue time may be, to allow for clock
+  /// differences between nodes.
+  static const uint64_t MAX_CLOCK_SKEW_MS = 60000;
+
+  /// Length of the random token in the nonce.
+  static const size_t TOKEN_LEN = 16;
+
+  static uint64_t now_ms();
+
+  std::string mac(const std::string& fields,
+                  const std::string& impi,
+                  const std::string& impu,
+                  const std::string& realm,
+                  const std::string& opaque) const;
+
+  std::string fingerprint(const std::string& ha1) const;
+
+  std::string _key;
+  uint64_t _max_age_ms;
+};
+
+#endif
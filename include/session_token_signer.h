@@ -0,0 +1,59 @@
+/**
+ * @file session_token_signer.h Issues and checks session tokens.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SESSION_TOKEN_SIGNER_H_
+#define SESSION_TOKEN_SIGNER_H_
+
+#include <stdint.h>
+#include <string>
+
+/// Issues session tokens to clients that have authenticated with digest
+/// credentials.  A client can present its token on later requests for the
+/// same IMPU, until the token expires, rather than authenticating again.
+///
+/// A token has the form
+///   <expiry time (ms)>.<epoch>.<MAC>
+/// where the MAC is an HMAC-SHA256 (truncated to 128 bits) over the expiry
+/// time, epoch and IMPU.  Only tokens issued in the current epoch are
+/// accepted, so changing the epoch revokes all outstanding tokens.
+class SessionTokenSigner
+{
+public:
+  /// Constructor.
+  /// @param key             The secret key to sign tokens with.
+  /// @param lifetime_s      How long a token can be used for, in seconds.
+  /// @param epoch           The revocation epoch.
+  SessionTokenSigner(const std::string& key, int lifetime_s, uint32_t epoch);
+  virtual ~SessionTokenSigner();
+
+  /// Issues a token for an IMPU.
+  /// @returns               The token.
+  std::string issue(const std::string& impu) const;
+
+  /// Checks a token presented by a client.
+  /// @returns               Whether the token was issued in this epoch for
+  ///                        this IMPU, and hasn't expired.
+  bool check(const std::string& token, const std::string& impu) const;
+
+private:
+  /// Length of the hex encoded MAC.
+  static const size_t MAC_HEX_LEN = 32;
+
+  static uint64_t now_ms();
+
+  std::string mac(const std::string& fields, const std::string& impu) const;
+
+  std::string _key;
+  uint64_t _lifetime_ms;
+  std::string _epoch;
+};
+
+#endif
@@ -0,0 +1,321 @@
+/**
+ * @file sharded_lru_cache.h Sharded cache with LRU eviction and expiry.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SHARDED_LRU_CACHE_H_
+#define SHARDED_LRU_CACHE_H_
+
+#include <pthread.h>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "counter.h"
+#include "log.h"
+#include "monotonic_clock.h"
+
+/// Cache of values keyed by string, which the call list, digest and HA1
+/// caches are built on.
+///
+/// The cache is split into shards, each with its own lock and its own share
+/// of the capacity, so that requests for different keys rarely contend.
+/// Each entry has a size given by the caller (e.g. its size in bytes, or 1
+/// to limit the number of entries), and each shard evicts its least recently
+/// used entries when it runs out of room.  Entries expire a fixed time after
+/// they are added.
+///
+/// Values are copied in and out of the cache with the shard locked, so V
+/// should be cheap to copy (e.g. a shared pointer to a larger object).
+template <class V>
+class ShardedLRUCache
+{
+public:
+  /// Constructor.
+  ///
+  /// @param description     What the values are, for logs.
+  /// @param max_size        The total size of the entries the cache can
+  ///                        hold.
+  /// @param ttl_ms          How long entries are cached for.
+  /// @param eviction_count  Counter incremented each time an entry is
+  ///                        evicted to make room for another (may be NULL).
+  /// @param num_shards      The number of shards to split the cache into.
+  ShardedLRUCache(const std::string& description,
+                  size_t max_size,
+                  int ttl_ms,
+                  Counter* eviction_count,
+                  int num_shards) :
+    _description(description),
+    _shards(),
+    _max_shard_size((max_size + num_shards - 1) / num_shards),
+    _ttl_ms(ttl_ms),
+    _eviction_count(eviction_count)
+  {
+    for (int ii = 0; ii < num_shards; ii++)
+    {
+      Shard* shard = new Shard();
+      pthread_mutex_init(&shard->lock, NULL);
+      shard->size = 0;
+      _shards.push_back(shard);
+    }
+  }
+
+  virtual ~ShardedLRUCache()
+  {
+    for (typename std::vector<Shard*>::iterator it = _shards.begin();
+         it != _shards.end();
+         ++it)
+    {
+      pthread_mutex_destroy(&(*it)->lock);
+      delete *it; *it = NULL;
+    }
+  }
+
+  /// Look up an entry.
+  ///
+  /// @param key             The key of the entry.
+  /// @param value           Set to the value, if the entry is cached.
+  /// @param touch           Whether to count this as a use of the entry,
+  ///                        moving it to the back of the eviction order.
+  /// @returns               Whether the entry is cached (and not expired).
+  bool get(const std::string& key, V& value, bool touch = true)
+  {
+    Shard* shard = shard_for(key);
+    typename LRUList::iterator entry;
+
+    pthread_mutex_lock(&shard->lock);
+
+    bool found = find_entry(shard, key, entry);
+
+    if (found)
+    {
+      if (touch)
+      {
+        shard->lru.splice(shard->lru.begin(), shard->lru, entry);
+      }
+
+      value = entry->value;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return found;
+  }
+
+  /// Cache an entry, replacing any existing entry for the key.
+  ///
+  /// @param key             The key of the entry.
+  /// @param value           The value to cache.
+  /// @param size            The size of the entry.
+  /// @returns               Whether the entry was cached.  It isn't if it
+  ///                        is larger than a shard, in which case any
+  ///                        existing entry for the key is removed.
+  bool put(const std::string& key, const V& value, size_t size)
+  {
+    if (size > _max_shard_size)
+    {
+      TRC_DEBUG("%s for %s is too large to cache (%zu)",
+                _description.c_str(), key.c_str(), size);
+      invalidate(key);
+      return false;
+    }
+
+    Shard* shard = shard_for(key);
+
+    pthread_mutex_lock(&shard->lock);
+
+    typename Index::iterator it = shard->index.find(key);
+
+    if (it != shard->index.end())
+    {
+      remove_entry(shard, it->second);
+    }
+
+    evict(shard, size, 0);
+
+    CachedEntry entry = {key, value, MonotonicClock::now_ms() + _ttl_ms, size};
+    shard->lru.push_front(entry);
+    shard->index[key] = shard->lru.begin();
+    shard->size += size;
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return true;
+  }
+
+  /// Replace the value of an entry, if it still has the value the caller
+  /// read.  The entry keeps its expiry time, and counts as used.
+  ///
+  /// @param key             The key of the entry.
+  /// @param old_value       The value the caller read.
+  /// @param new_value       The value to replace it with.
+  /// @param size            The size of the entry with the new value.
+  /// @returns               Whether the value was replaced.  It isn't if
+  ///                        the entry has changed or expired, or the new
+  ///                        value is too large.
+  bool replace(const std::string& key,
+               const V& old_value,
+               const V& new_value,
+               size_t size)
+  {
+    if (size > _max_shard_size)
+    {
+      return false;
+    }
+
+    Shard* shard = shard_for(key);
+    typename LRUList::iterator entry;
+    bool replaced = false;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((find_entry(shard, key, entry)) && (entry->value == old_value))
+    {
+      // Move the entry to the front of the LRU list, so it's not evicted to
+      // make room for itself.
+      shard->lru.splice(shard->lru.begin(), shard->lru, entry);
+      shard->size -= entry->size;
+      evict(shard, size, 1);
+
+      entry->value = new_value;
+      entry->size = size;
+      shard->size += size;
+      replaced = true;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return replaced;
+  }
+
+  /// Remove an entry.
+  ///
+  /// @param key             The key of the entry.
+  void invalidate(const std::string& key)
+  {
+    Shard* shard = shard_for(key);
+
+    pthread_mutex_lock(&shard->lock);
+
+    typename Index::iterator it = shard->index.find(key);
+
+    if (it != shard->index.end())
+    {
+      remove_entry(shard, it->second);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  /// @returns               The total size of the cached entries.
+  size_t size()
+  {
+    size_t size = 0;
+
+    for (typename std::vector<Shard*>::iterator it = _shards.begin();
+         it != _shards.end();
+         ++it)
+    {
+      pthread_mutex_lock(&(*it)->lock);
+      size += (*it)->size;
+      pthread_mutex_unlock(&(*it)->lock);
+    }
+
+    return size;
+  }
+
+private:
+  struct CachedEntry
+  {
+    std::string key;
+    V value;
+    unsigned long expiry_ms;
+    size_t size;
+  };
+
+  typedef std::list<CachedEntry> LRUList;
+  typedef std::unordered_map<std::string, typename LRUList::iterator> Index;
+
+  /// A shard of the cache.  The LRU list holds the most recently used entry
+  /// at the front.
+  struct Shard
+  {
+    pthread_mutex_t lock;
+    LRUList lru;
+    Index index;
+    size_t size;
+  };
+
+  Shard* shard_for(const std::string& key)
+  {
+    return _shards[std::hash<std::string>()(key) % _shards.size()];
+  }
+
+  /// Find an unexpired entry, removing it if it has expired.  Must be called
+  /// with the shard locked.
+  bool find_entry(Shard* shard,
+                  const std::string& key,
+                  typename LRUList::iterator& entry)
+  {
+    typename Index::iterator it = shard->index.find(key);
+
+    if (it == shard->index.end())
+    {
+      return false;
+    }
+
+    if (it->second->expiry_ms <= MonotonicClock::now_ms())
+    {
+      TRC_DEBUG("Cached %s for %s has expired",
+                _description.c_str(), key.c_str());
+      remove_entry(shard, it->second);
+      return false;
+    }
+
+    entry = it->second;
+    return true;
+  }
+
+  /// Evict the least recently used entries until there's room for an entry
+  /// of the given size, keeping at least `keep` entries.  Must be called
+  /// with the shard locked.
+  void evict(Shard* shard, size_t size, size_t keep)
+  {
+    while ((shard->size + size > _max_shard_size) &&
+           (shard->lru.size() > keep))
+    {
+      TRC_DEBUG("Evict cached %s for %s",
+                _description.c_str(), shard->lru.back().key.c_str());
+      remove_entry(shard, --shard->lru.end());
+
+      if (_eviction_count != NULL)
+      {
+        _eviction_count->increment();
+      }
+    }
+  }
+
+  /// Remove an entry from a shard.  Must be called with the shard locked.
+  void remove_entry(Shard* shard, typename LRUList::iterator entry)
+  {
+    shard->size -= entry->size;
+    shard->index.erase(entry->key);
+    shard->lru.erase(entry);
+  }
+
+  const std::string _description;
+  std::vector<Shard*> _shards;
+  size_t _max_shard_size;
+  int _ttl_ms;
+  Counter* _eviction_count;
+};
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file stage_timer.h Timing of the stages of a request.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef STAGE_TIMER_H_
+#define STAGE_TIMER_H_
+
+#include <time.h>
+#include <string>
+
+#include "accumulator.h"
+
+/// Statistics for one stage of handling a request.  Each stage reports both
+/// the wall clock time it took (<stage>_latency) and the CPU time the thread
+/// spent on it (<stage>_cpu_time), both in microseconds.  A stage with high
+/// latency but low CPU time is waiting on something else.
+class StageStatistics
+{
+public:
+  /// Constructor.
+  ///
+  /// @param stage           The name of the stage.
+  /// @param stats_aggregator The cache to report the statistics to.
+  StageStatistics(const std::string& stage, LastValueCache* stats_aggregator);
+
+  /// Destructor.
+  virtual ~StageStatistics();
+
+  /// Records one run of the stage.
+  ///
+  /// @param latency_us      Wall clock time taken.
+  /// @param cpu_time_us     CPU time used by the thread.
+  virtual void record(unsigned long latency_us, unsigned long cpu_time_us);
+
+protected:
+  /// Constructor for subclasses that don't report statistics.
+  StageStatistics();
+
+private:
+  StatisticAccumulator* _latency;
+  StatisticAccumulator* _cpu_time;
+};
+
+/// Times a stage of a request, from when the timer is created until it is
+/// stopped or destroyed.  The stage must run on a single thread, so the
+/// thread's CPU time is meaningful.
+class StageTimer
+{
+public:
+  /// Constructor.  Starts the timer.
+  ///
+  /// @param stats           The statistics to record the stage in.  The timer
+  ///                        does nothing if this is NULL.
+  StageTimer(StageStatistics* stats);
+
+  /// Destructor.  Stops the timer, if it hasn't already been stopped.
+  ~StageTimer();
+
+  /// Stops the timer and records the stage.
+  void stop();
+
+private:
+  StageStatistics* _stats;
+  struct timespec _start_wall;
+  struct timespec _start_cpu;
+};
+
+#endif
@@ -12,9 +12,18 @@ memento_test:
 memento_full_test:
 	make -C ${MEMENTO_DIR} full_test
 
+memento_bench_build:
+	make -C ${MEMENTO_DIR} BUILD_BENCH=Y
+
+memento_bench: memento_bench_build
+	LD_LIBRARY_PATH=${ROOT}/usr/lib ${ROOT}/build/bin/memento_bench ${MEMENTO_BENCH_ARGS}
+
+memento_e2e_bench: memento_bench_build
+	LD_LIBRARY_PATH=${ROOT}/usr/lib ${ROOT}/build/bin/memento_e2e_bench ${MEMENTO_E2E_BENCH_ARGS}
+
 memento_clean:
 	make -C ${MEMENTO_DIR} clean
 
 memento_distclean: memento_clean
 
-.PHONY: memento memento_test memento_clean memento_distclean
+.PHONY: memento memento_test memento_bench_build memento_bench memento_e2e_bench memento_clean memento_distclean
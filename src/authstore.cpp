@@ -20,26 +20,47 @@
 #include "mementosasevent.h"
 #include "json_parse_utils.h"
 
+// Digests that don't record which nonce counts have been used (i.e. new
+// digests, and those written before the window was added) treat every nonce
+// count below _nonce_count as used.
+static const uint64_t ALL_NONCE_COUNTS_USED = ~(uint64_t)0;
+
+// Table and contents of the entries that record used nonce counts.  The
+// entries only need to exist, so their contents are just a placeholder.
+static const std::string NONCE_COUNT_TABLE = "AuthStoreNonceCount";
+static const std::string NONCE_COUNT_DATA = "1";
+
 AuthStore::AuthStore(Store* data_store, int expiry) :
   _data_store(data_store),
-  _expiry(expiry)
+  _expiry(expiry),
+  _digest_cache(NULL),
+  _separate_nonce_counts(false),
+  _read_coalescer(NULL)
 {
   _serializer = new JsonSerializerDeserializer();
   _deserializers.push_back(new JsonSerializerDeserializer());
+  build_deserializer_table();
 }
 
 AuthStore::AuthStore(Store* data_store,
                      SerializerDeserializer*& serializer,
                      std::vector<SerializerDeserializer*>& deserializers,
-                     int expiry) :
+                     int expiry,
+                     DigestCache* digest_cache,
+                     bool separate_nonce_counts,
+                     DigestReadCoalescer* read_coalescer) :
   _data_store(data_store),
   _serializer(serializer),
   _deserializers(deserializers),
-  _expiry(expiry)
+  _expiry(expiry),
+  _digest_cache(digest_cache),
+  _separate_nonce_counts(separate_nonce_counts),
+  _read_coalescer(read_coalescer)
 {
   // Take ownership of the (de)serializers.
   serializer = NULL;
   deserializers.clear();
+  build_deserializer_table();
 }
 
 AuthStore::~AuthStore()
@@ -64,12 +85,37 @@ Store::Status AuthStore::set_digest(const std::string& impi,
 
   TRC_DEBUG("Set digest for %s\n%s", key.c_str(), data.c_str());
 
-  Store::Status status = _data_store->set_data("AuthStore",
-                                               key,
-                                               data,
-                                               digest->_cas,
-                                               _expiry,
-                                               trail);
+  uint64_t cas = digest->_cas;
+  Store::Status status = Store::Status::OK;
+
+  if (digest->_cache_version != 0)
+  {
+    status = get_cas_for_cached_digest(key, digest->_cache_version, cas, trail);
+  }
+
+  if (status == Store::Status::OK)
+  {
+    status = _data_store->set_data("AuthStore",
+                                   key,
+                                   data,
+                                   cas,
+                                   _expiry,
+                                   trail);
+  }
+
+  if (_digest_cache != NULL)
+  {
+    // Keep the cache in step with the store.  If the write failed, the
+    // cached record may be out of date, so later reads go to the store.
+    if (status == Store::Status::OK)
+    {
+      _digest_cache->put(key, data);
+    }
+    else
+    {
+      _digest_cache->invalidate(key);
+    }
+  }
 
   if (status != Store::Status::OK)
   {
@@ -98,33 +144,86 @@ Store::Status AuthStore::get_digest(const std::string& impi,
                                     const std::string& nonce,
                                     AuthStore::Digest*& digest,
                                     SAS::TrailId trail)
+{
+  digest = new Digest();
+  Store::Status status = get_digest(impi, nonce, *digest, trail);
+
+  if (status != Store::Status::OK)
+  {
+    delete digest; digest = NULL;
+  }
+
+  return status;
+}
+
+Store::Status AuthStore::get_digest(const std::string& impi,
+                                    const std::string& nonce,
+                                    AuthStore::Digest& digest,
+                                    SAS::TrailId trail)
 {
   std::string key = impi + '\\' + nonce;
   std::string data;
-  uint64_t cas;
-  Store::Status status = _data_store->get_data("AuthStore", key, data, cas, trail);
+  uint64_t cas = 0;
+  uint64_t cache_version = 0;
+  Store::Status status;
 
   TRC_DEBUG("Get digest for %s", key.c_str());
 
+  if ((_digest_cache != NULL) &&
+      (_digest_cache->get(key, data, cache_version)))
+  {
+    status = Store::Status::OK;
+  }
+  else
+  {
+    DigestReadCoalescer::Result read_result = DigestReadCoalescer::LEADER;
+
+    if (_read_coalescer != NULL)
+    {
+      read_result = _read_coalescer->lead_or_wait(key, status, data, cas);
+    }
+
+    if (read_result == DigestReadCoalescer::SHARED)
+    {
+      // Another request has read the record for us.
+      TRC_DEBUG("Shared another request's read of %s", key.c_str());
+    }
+    else
+    {
+      status = _data_store->get_data("AuthStore", key, data, cas, trail);
+
+      // Only the leader shares its read - a request that timed out waiting
+      // for the leader mustn't end the leader's read.
+      if ((_read_coalescer != NULL) &&
+          (read_result == DigestReadCoalescer::LEADER))
+      {
+        _read_coalescer->leader_done(key, status, data, cas);
+      }
+    }
+  }
+
   if (status != Store::Status::OK)
   {
     TRC_DEBUG("Failed to retrieve digest for %s", key.c_str());
     SAS::Event event(trail, SASEvent::AUTHSTORE_GET_FAILURE, 0);
     event.add_var_param(key);
     SAS::report_event(event);
-
-    digest = NULL;
   }
   else
   {
     TRC_DEBUG("Retrieved Digest for %s\n%s", key.c_str(), data.c_str());
-    digest = deserialize_digest(data);
 
-    if (digest != NULL)
+    if (deserialize_digest(data, digest))
     {
-      digest->_cas = cas;
-      digest->_impi = impi;
-      digest->_nonce = nonce;
+      digest._cas = cas;
+      digest._cache_version = cache_version;
+      digest._impi = impi;
+      digest._nonce = nonce;
+
+      if ((_digest_cache != NULL) && (cache_version == 0))
+      {
+        _digest_cache->put(key, data);
+      }
 
       SAS::Event event(trail, SASEvent::AUTHSTORE_GET_SUCCESS, 0);
       event.add_var_param(key);
@@ -139,6 +238,11 @@ Store::Status AuthStore::get_digest(const std::string& impi,
       event.add_var_param(data);
       SAS::report_event(event);
 
+      if (cache_version != 0)
+      {
+        _digest_cache->invalidate(key);
+      }
+
       // Handle as if the digest was not found.
       status = Store::NOT_FOUND;
     }
@@ -147,15 +251,62 @@ Store::Status AuthStore::get_digest(const std::string& impi,
   return status;
 }
 
+bool AuthStore::records_nonce_count_separately(const Digest* digest) const
+{
+  // A digest that isn't in the store yet (e.g. one for a signed nonce that is
+  // being used for the first time) is written with the nonce count in it.
+  return ((_separate_nonce_counts) &&
+          ((digest->_cas != 0) || (digest->_cache_version != 0)));
+}
+
+// Each used nonce count has its own entry, which is added without a CAS
+// value, so only the first request to use the nonce count can add it.  The
+// entries expire with the digest they belong to.
+Store::Status AuthStore::record_nonce_count(const std::string& impi,
+                                            const std::string& nonce,
+                                            uint32_t nonce_count,
+                                            SAS::TrailId trail)
+{
+  std::string key = impi + '\\' + nonce + '\\' + std::to_string(nonce_count);
+
+  TRC_DEBUG("Record nonce count for %s", key.c_str());
+
+  Store::Status status = _data_store->set_data(NONCE_COUNT_TABLE,
+                                               key,
+                                               NONCE_COUNT_DATA,
+                                               0,
+                                               _expiry,
+                                               trail);
+
+  if (status == Store::Status::DATA_CONTENTION)
+  {
+    TRC_DEBUG("Nonce count has already been used for %s", key.c_str());
+  }
+  else if (status != Store::Status::OK)
+  {
+    // LCOV_EXCL_START - Store used in UTs doesn't fail
+    TRC_ERROR("Failed to record nonce count for key %s", key.c_str());
+    SAS::Event event(trail, SASEvent::AUTHSTORE_SET_FAILURE, 0);
+    event.add_var_param(key);
+    event.add_var_param(NONCE_COUNT_DATA);
+    SAS::report_event(event);
+    // LCOV_EXCL_STOP
+  }
+
+  return status;
+}
+
 AuthStore::Digest::Digest() :
-  _ha1(""),
-  _opaque(""),
-  _nonce(""),
+  _ha1(),
+  _opaque(),
+  _nonce(),
+  _nonce_count(1),
+  _nc_window(ALL_NONCE_COUNTS_USED),
   _impi(""),
   _realm(""),
-  _nonce_count(1),
   _impu(""),
-  _cas(0)
+  _cas(0),
+  _cache_version(0)
 {
 }
 
@@ -163,33 +314,142 @@ AuthStore::Digest::~Digest()
 {
 }
 
-AuthStore::Digest* AuthStore::deserialize_digest(const std::string& digest_s)
+bool AuthStore::Digest::use_nonce_count(uint32_t nonce_count)
 {
-  Digest* digest = NULL;
+  if (nonce_count == UINT32_MAX)
+  {
+    // _nonce_count would wrap to 0, after which every nonce count would be
+    // accepted again.  The client must be challenged for a new nonce.
+    return false;
+  }
 
-  for (std::vector<SerializerDeserializer*>::const_iterator it = _deserializers.begin();
-       it != _deserializers.end();
-       ++it)
+  if (nonce_count >= _nonce_count)
   {
-    SerializerDeserializer* deserializer = *it;
-    TRC_DEBUG("Try '%s' deserializer", deserializer->name().c_str());
+    // This is the highest nonce count used so far.  Slide the window up so
+    // that it ends at this nonce count.
+    uint32_t shift = nonce_count - _nonce_count + 1;
+    _nc_window = (shift < NC_WINDOW_SIZE) ? (_nc_window << shift) : 0;
+    _nc_window |= 1;
+    _nonce_count = nonce_count + 1;
+    return true;
+  }
 
-    digest = deserializer->deserialize_digest(digest_s);
+  uint32_t offset = _nonce_count - 1 - nonce_count;
 
-    if (digest != NULL)
-    {
-      TRC_DEBUG("Deserialization successful");
-      break;
-    }
-    else
+  if ((offset >= NC_WINDOW_SIZE) ||
+      ((_nc_window & ((uint64_t)1 << offset)) != 0))
+  {
+    // The nonce count is too old to track, or has already been used.
+    return false;
+  }
+
+  _nc_window |= ((uint64_t)1 << offset);
+  return true;
+}
+
+void AuthStore::build_deserializer_table()
+{
+  for (int byte = 0; byte < 256; byte++)
+  {
+    _deserializer_for_byte[byte] = NULL;
+
+    for (std::vector<SerializerDeserializer*>::const_iterator it = _deserializers.begin();
+         it != _deserializers.end();
+         ++it)
     {
-      TRC_DEBUG("Deserialization failed");
+      if ((*it)->handles((unsigned char)byte))
+      {
+        _deserializer_for_byte[byte] = *it;
+        break;
+      }
     }
   }
+}
+
+// A digest read from the cache has no CAS value, as the store doesn't return
+// the CAS value after a write.  Get the current CAS value from the store, and
+// check that the record in the store is the one that was cached, i.e. that no
+// other node has updated it since.
+Store::Status AuthStore::get_cas_for_cached_digest(const std::string& key,
+                                                   uint64_t cache_version,
+                                                   uint64_t& cas,
+                                                   SAS::TrailId trail)
+{
+  std::string cached_data;
+
+  if (!_digest_cache->get_version(key, cache_version, cached_data))
+  {
+    TRC_DEBUG("Cached digest for %s was updated after it was read",
+              key.c_str());
+    return Store::Status::DATA_CONTENTION;
+  }
+
+  std::string data;
+  Store::Status status = _data_store->get_data("AuthStore", key, data, cas, trail);
+
+  if (status == Store::Status::NOT_FOUND)
+  {
+    // The record has expired or been deleted from the store.  Writing it
+    // with a CAS value would fail in the same way.
+    TRC_DEBUG("Cached digest for %s is no longer in the store", key.c_str());
+    status = Store::Status::DATA_CONTENTION;
+  }
+  else if ((status == Store::Status::OK) && (data != cached_data))
+  {
+    TRC_DEBUG("Digest for %s was updated by another node", key.c_str());
+    status = Store::Status::DATA_CONTENTION;
+  }
+
+  return status;
+}
+
+AuthStore::Digest* AuthStore::SerializerDeserializer::
+  deserialize_digest(const std::string& digest_s)
+{
+  Digest* digest = new Digest();
+
+  if (!deserialize_digest(digest_s, *digest))
+  {
+    delete digest; digest = NULL;
+  }
 
   return digest;
 }
 
+bool AuthStore::deserialize_digest(const std::string& digest_s, Digest& digest)
+{
+  if (digest_s.empty())
+  {
+    TRC_DEBUG("Record is empty");
+    return false;
+  }
+
+  SerializerDeserializer* deserializer =
+                      _deserializer_for_byte[(unsigned char)digest_s[0]];
+
+  if (deserializer == NULL)
+  {
+    TRC_DEBUG("No deserializer for record starting 0x%02x",
+              (unsigned char)digest_s[0]);
+    return false;
+  }
+
+  TRC_DEBUG("Use '%s' deserializer", deserializer->name().c_str());
+  bool success = deserializer->deserialize_digest(digest_s, digest);
+
+  if (success)
+  {
+    TRC_DEBUG("Deserialization successful");
+    deserializer->count_read();
+  }
+  else
+  {
+    TRC_DEBUG("Deserialization failed");
+  }
+
+  return success;
+}
+
 std::string AuthStore::serialize_digest(const AuthStore::Digest* digest)
 {
   return _serializer->serialize_digest(digest);
@@ -210,12 +470,13 @@ std::string AuthStore::BinarySerializerDeserializer::
   oss << digest->_realm << '\0';
   oss.write((const char *)&digest->_nonce_count, sizeof(int));
   oss << digest->_impu << '\0';
+  oss.write((const char *)&digest->_nc_window, sizeof(uint64_t));
 
   return oss.str();
 }
 
-AuthStore::Digest* AuthStore::BinarySerializerDeserializer::
-  deserialize_digest(const std::string& digest_s)
+bool AuthStore::BinarySerializerDeserializer::
+  deserialize_digest(const std::string& digest_s, Digest& digest)
 {
   // Helper macro that bails out if we unexpectedly hit the end of the input
   // stream.
@@ -224,29 +485,42 @@ if ((STREAM).eof())                                                            \
 {                                                                              \
   TRC_INFO("Failed to deserialize binary document (hit EOF at %s:%d)",         \
            __FILE__, __LINE__);                                                \
-  delete digest; digest = NULL;                                                \
-  return NULL;                                                                 \
+  return false;                                                                \
 }
 
   std::istringstream iss(digest_s, std::istringstream::in|std::istringstream::binary);
-  Digest* digest = new Digest();
 
-  getline(iss, digest->_ha1, '\0');
+  // The fixed size fields are read into a scratch string first, as getline
+  // needs a std::string.
+  std::string field;
+
+  getline(iss, field, '\0');
+  digest._ha1 = field;
   ASSERT_NOT_EOF(iss);
-  getline(iss, digest->_opaque, '\0');
+  getline(iss, field, '\0');
+  digest._opaque = field;
   ASSERT_NOT_EOF(iss);
-  getline(iss, digest->_nonce, '\0');
+  getline(iss, field, '\0');
+  digest._nonce = field;
   ASSERT_NOT_EOF(iss);
-  getline(iss, digest->_impi, '\0');
+  getline(iss, digest._impi, '\0');
   ASSERT_NOT_EOF(iss);
-  getline(iss, digest->_realm, '\0');
+  getline(iss, digest._realm, '\0');
   ASSERT_NOT_EOF(iss);
-  iss.read((char *)&digest->_nonce_count, sizeof(uint32_t));
+  iss.read((char *)&digest._nonce_count, sizeof(uint32_t));
   ASSERT_NOT_EOF(iss);
-  getline(iss, digest->_impu, '\0');
-  // Could legitimately be at the end of the stream now.
+  getline(iss, digest._impu, '\0');
+  // Could legitimately be at the end of the stream now, if the record was
+  // written without a nonce count window.
+  uint64_t nc_window;
+  iss.read((char *)&nc_window, sizeof(uint64_t));
 
-  return digest;
+  if (iss.gcount() == sizeof(uint64_t))
+  {
+    digest._nc_window = nc_window;
+  }
+
+  return true;
 }
 
 std::string AuthStore::BinarySerializerDeserializer::name()
@@ -254,6 +528,11 @@ std::string AuthStore::BinarySerializerDeserializer::name()
   return "binary";
 }
 
+bool AuthStore::BinarySerializerDeserializer::handles(unsigned char first_byte)
+{
+  return true;
+}
+
 
 //
 // Definition of the JSON (de)serializer.
@@ -267,6 +546,7 @@ static const char* const JSON_HA1 = "ha1";
 static const char* const JSON_OPAQUE = "opaque";
 static const char* const JSON_IMPU = "impu";
 static const char* const JSON_NC = "nc";
+static const char* const JSON_NC_WINDOW = "nc_window";
 
 std::string AuthStore::JsonSerializerDeserializer::
   serialize_digest(const Digest* digest)
@@ -288,14 +568,15 @@ std::string AuthStore::JsonSerializerDeserializer::
     writer.String(JSON_OPAQUE); writer.String(digest->_opaque.c_str());
     writer.String(JSON_IMPU); writer.String(digest->_impu.c_str());
     writer.String(JSON_NC); writer.Int(digest->_nonce_count);
+    writer.String(JSON_NC_WINDOW); writer.Uint64(digest->_nc_window);
   }
   writer.EndObject();
 
   return sb.GetString();
 }
 
-AuthStore::Digest* AuthStore::JsonSerializerDeserializer::
-  deserialize_digest(const std::string& digest_s)
+bool AuthStore::JsonSerializerDeserializer::
+  deserialize_digest(const std::string& digest_s, Digest& digest)
 {
   TRC_DEBUG("Deserialize JSON document: %s", digest_s.c_str());
 
@@ -305,11 +586,9 @@ AuthStore::Digest* AuthStore::JsonSerializerDeserializer::
   if (doc.HasParseError())
   {
     TRC_DEBUG("Failed to parse document");
-    return NULL;
+    return false;
   }
 
-  Digest* digest = new Digest();
-
   try
   {
     JSON_ASSERT_OBJECT(doc);
@@ -317,26 +596,288 @@ AuthStore::Digest* AuthStore::JsonSerializerDeserializer::
     JSON_ASSERT_OBJECT(doc[JSON_DIGEST]);
     const rapidjson::Value& digest_block = doc[JSON_DIGEST];
     {
-      JSON_GET_STRING_MEMBER(digest_block, JSON_HA1, digest->_ha1);
+      JSON_GET_STRING_MEMBER(digest_block, JSON_HA1, digest._ha1);
       // The QoP is assumed to always be 'auth'.
-      JSON_GET_STRING_MEMBER(digest_block, JSON_REALM, digest->_realm);
+      JSON_GET_STRING_MEMBER(digest_block, JSON_REALM, digest._realm);
     }
 
-    JSON_GET_STRING_MEMBER(doc, JSON_OPAQUE, digest->_opaque);
-    JSON_GET_STRING_MEMBER(doc, JSON_IMPU, digest->_impu);
-    JSON_GET_INT_MEMBER(doc, JSON_NC, digest->_nonce_count);
+    JSON_GET_STRING_MEMBER(doc, JSON_OPAQUE, digest._opaque);
+    JSON_GET_STRING_MEMBER(doc, JSON_IMPU, digest._impu);
+    JSON_GET_INT_MEMBER(doc, JSON_NC, digest._nonce_count);
+
+    // The window is optional, as older records don't have one.  If it is
+    // missing or invalid, every nonce count below _nonce_count is treated as
+    // used.
+    if ((doc.HasMember(JSON_NC_WINDOW)) && (doc[JSON_NC_WINDOW].IsUint64()))
+    {
+      digest._nc_window = doc[JSON_NC_WINDOW].GetUint64();
+    }
   }
   catch(JsonFormatError err)
   {
     TRC_INFO("Failed to deserialize JSON document (hit error at %s:%d)",
              err._file, err._line);
-    delete digest; digest = NULL;
+    return false;
   }
 
-  return digest;
+  return true;
 }
 
 std::string AuthStore::JsonSerializerDeserializer::name()
 {
   return "JSON";
 }
+
+bool AuthStore::JsonSerializerDeserializer::handles(unsigned char first_byte)
+{
+  return (first_byte == '{');
+}
+
+
+//
+// Definition of the compact (de)serializer.
+//
+
+static const size_t PACKED_HA1_SIZE = 16;
+static const size_t MAX_FIELD_LENGTH = 0xFFFF;
+
+static int hex_value(char c)
+{
+  if ((c >= '0') && (c <= '9'))
+  {
+    return c - '0';
+  }
+  else if ((c >= 'a') && (c <= 'f'))
+  {
+    return c - 'a' + 10;
+  }
+
+  return -1;
+}
+
+/// Whether a HA1 can be stored as the bytes it encodes and turned back into
+/// the same string, i.e. it is lower-case hex of the right length.
+template <class T>
+static bool can_pack_ha1(const T& ha1)
+{
+  if (ha1.length() != PACKED_HA1_SIZE * 2)
+  {
+    return false;
+  }
+
+  for (size_t ii = 0; ii < ha1.length(); ii++)
+  {
+    if (hex_value(ha1[ii]) < 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void append_uint(std::string& data, uint64_t value, size_t bytes)
+{
+  for (size_t ii = bytes; ii > 0; ii--)
+  {
+    data.push_back((char)((value >> ((ii - 1) * 8)) & 0xFF));
+  }
+}
+
+template <class T>
+static void append_field(std::string& data, const T& field)
+{
+  append_uint(data, field.length(), 2);
+  data.append(field.data(), field.length());
+}
+
+/// Reads fields from a compact record, checking that it doesn't run off the
+/// end.
+class CompactReader
+{
+public:
+  CompactReader(const std::string& data) :
+    _data((const unsigned char*)data.data()),
+    _remaining(data.length()),
+    _ok(true)
+  {}
+
+  bool ok() const { return _ok; }
+  bool at_end() const { return (_remaining == 0); }
+
+  uint64_t read_uint(size_t bytes)
+  {
+    uint64_t value = 0;
+
+    if (check(bytes))
+    {
+      for (size_t ii = 0; ii < bytes; ii++)
+      {
+        value = (value << 8) | _data[ii];
+      }
+
+      skip(bytes);
+    }
+
+    return value;
+  }
+
+  // The value can be a std::string or an InlineString.
+  template <class T>
+  void read_bytes(size_t bytes, T& value)
+  {
+    if (check(bytes))
+    {
+      value.assign((const char*)_data, bytes);
+      skip(bytes);
+    }
+  }
+
+  template <class T>
+  void read_field(T& value)
+  {
+    size_t length = read_uint(2);
+    read_bytes(length, value);
+  }
+
+  template <class T>
+  void read_packed_ha1(T& ha1)
+  {
+    static const char* const HEX = "0123456789abcdef";
+
+    if (check(PACKED_HA1_SIZE))
+    {
+      char hex[PACKED_HA1_SIZE * 2];
+
+      for (size_t ii = 0; ii < PACKED_HA1_SIZE; ii++)
+      {
+        hex[ii * 2] = HEX[_data[ii] >> 4];
+        hex[ii * 2 + 1] = HEX[_data[ii] & 0x0F];
+      }
+
+      ha1.assign(hex, sizeof(hex));
+      skip(PACKED_HA1_SIZE);
+    }
+  }
+
+private:
+  bool check(size_t bytes)
+  {
+    _ok = _ok && (bytes <= _remaining);
+    return _ok;
+  }
+
+  void skip(size_t bytes)
+  {
+    _data += bytes;
+    _remaining -= bytes;
+  }
+
+  const unsigned char* _data;
+  size_t _remaining;
+  bool _ok;
+};
+
+std::string AuthStore::CompactSerializerDeserializer::
+  serialize_digest(const Digest* digest)
+{
+  if ((digest->_ha1.length() > MAX_FIELD_LENGTH) ||
+      (digest->_opaque.length() > MAX_FIELD_LENGTH) ||
+      (digest->_realm.length() > MAX_FIELD_LENGTH) ||
+      (digest->_impu.length() > MAX_FIELD_LENGTH))
+  {
+    // LCOV_EXCL_START - Fields are never this long in practice
+    // Write an empty record, which is treated as missing when it is read.
+    TRC_ERROR("Digest for %s is too large for the compact format",
+              digest->_impi.c_str());
+    return "";
+    // LCOV_EXCL_STOP
+  }
+
+  bool pack_ha1 = can_pack_ha1(digest->_ha1);
+
+  std::string data;
+  data.reserve(4 + PACKED_HA1_SIZE + 12 +
+               digest->_opaque.length() +
+               digest->_realm.length() +
+               digest->_impu.length() + 6 +
+               (pack_ha1 ? 0 : digest->_ha1.length() + 2));
+
+  data.push_back((char)VERSION_1);
+  data.push_back((char)(pack_ha1 ? FLAG_PACKED_HA1 : 0));
+
+  if (pack_ha1)
+  {
+    for (size_t ii = 0; ii < PACKED_HA1_SIZE; ii++)
+    {
+      data.push_back((char)((hex_value(digest->_ha1[ii * 2]) << 4) |
+                            hex_value(digest->_ha1[ii * 2 + 1])));
+    }
+  }
+  else
+  {
+    append_field(data, digest->_ha1);
+  }
+
+  append_uint(data, digest->_nonce_count, 4);
+  append_uint(data, digest->_nc_window, 8);
+  append_field(data, digest->_opaque);
+  append_field(data, digest->_realm);
+  append_field(data, digest->_impu);
+
+  return data;
+}
+
+bool AuthStore::CompactSerializerDeserializer::
+  deserialize_digest(const std::string& digest_s, Digest& digest)
+{
+  CompactReader reader(digest_s);
+
+  if (reader.read_uint(1) != VERSION_1)
+  {
+    TRC_INFO("Unsupported compact record version");
+    return false;
+  }
+
+  unsigned char flags = reader.read_uint(1);
+
+  if ((flags & ~FLAG_PACKED_HA1) != 0)
+  {
+    TRC_INFO("Unsupported compact record flags 0x%02x", flags);
+    return false;
+  }
+
+  if (flags & FLAG_PACKED_HA1)
+  {
+    reader.read_packed_ha1(digest._ha1);
+  }
+  else
+  {
+    reader.read_field(digest._ha1);
+  }
+
+  digest._nonce_count = reader.read_uint(4);
+  digest._nc_window = reader.read_uint(8);
+  reader.read_field(digest._opaque);
+  reader.read_field(digest._realm);
+  reader.read_field(digest._impu);
+
+  if ((!reader.ok()) || (!reader.at_end()))
+  {
+    TRC_INFO("Failed to deserialize compact record (%s)",
+             reader.ok() ? "trailing data" : "truncated");
+    return false;
+  }
+
+  return true;
+}
+
+std::string AuthStore::CompactSerializerDeserializer::name()
+{
+  return "compact";
+}
+
+bool AuthStore::CompactSerializerDeserializer::handles(unsigned char first_byte)
+{
+  return (first_byte == VERSION_1);
+}
@@ -0,0 +1,204 @@
+/**
+ * @file auth_bench.cpp Microbenchmarks for digest authentication.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+
+#include "memento_bench.h"
+#include "httpdigestauthenticate.h"
+#include "homesteadconnection.h"
+#include "authstore.h"
+#include "fakecounter.h"
+
+// Defined in httpdigestauthenticate.cpp.
+void gen_unique_val(size_t length, std::string& unique_val);
+
+static const std::string IMPU = "sip:6505551234@home.domain";
+static const std::string IMPI = "6505551234@home.domain";
+static const std::string URI = "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml";
+static const std::string AUTH_HEADER =
+  "Digest username=\"6505551234@home.domain\",realm=\"home.domain\","
+  "nonce=\"1496236113142uFykRLmm1ZXBXrWKTefYhB2Hf3tu\","
+  "uri=\"/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml\","
+  "qop=auth,nc=00000001,cnonce=\"0a4f113b\","
+  "response=\"6629fae49393a05397450978507c4ef1\","
+  "opaque=\"1496236113142FhEcW6VqTmdOYIW3ElWdV0zQ5fYg\"";
+
+/// Auth store that accepts every write without storing anything, so that
+/// benchmarks of authentication don't measure the store.
+class NullAuthStore : public AuthStore
+{
+public:
+  NullAuthStore() : AuthStore(NULL, 0) {}
+  virtual ~NullAuthStore() {}
+
+  Store::Status set_digest(const std::string& impi,
+                           const std::string& nonce,
+                           const Digest* digest,
+                           SAS::TrailId trail)
+  {
+    return Store::OK;
+  }
+};
+
+/// Gives the benchmarks access to the private steps of authentication that
+/// they time.
+class AuthBench
+{
+public:
+  static void set_members(HTTPDigestAuthenticate& auth_mod,
+                          const std::string& impu,
+                          const std::string& impi)
+  {
+    auth_mod.set_members(impu, "GET", impi, 0);
+  }
+
+  static HTTPCode parse_auth_header(HTTPDigestAuthenticate& auth_mod,
+                                    const std::string& auth_header,
+                                    bool& auth_info,
+                                    HTTPDigestAuthenticate::Response* response)
+  {
+    return auth_mod.parse_auth_header(auth_header, auth_info, response);
+  }
+
+  static HTTPCode check_if_matches(HTTPDigestAuthenticate& auth_mod,
+                                   AuthStore::Digest* digest,
+                                   std::string& www_auth_header,
+                                   HTTPDigestAuthenticate::Response* response)
+  {
+    return auth_mod.check_if_matches(digest, www_auth_header, response);
+  }
+
+  static HTTPCode parse_digest(const std::string& json_data,
+                               std::string& ha1,
+                               std::string& realm)
+  {
+    return HomesteadConnection::parse_digest(json_data, ha1, realm);
+  }
+};
+
+/// Everything needed to create an HTTPDigestAuthenticate.
+struct AuthFixture
+{
+  AuthFixture() :
+    homestead_conn(NULL),
+    auth_mod(&auth_store,
+             &homestead_conn,
+             "home.domain",
+             &challenge_count,
+             &attempt_count,
+             &success_count,
+             &failure_count,
+             &stale_count)
+  {
+    AuthBench::set_members(auth_mod, IMPU, IMPI);
+  }
+
+  FakeCounter challenge_count;
+  FakeCounter attempt_count;
+  FakeCounter success_count;
+  FakeCounter failure_count;
+  FakeCounter stale_count;
+  NullAuthStore auth_store;
+  HomesteadConnection homestead_conn;
+  HTTPDigestAuthenticate auth_mod;
+};
+
+static void bench_parse_auth_header(BenchState& state)
+{
+  AuthFixture fixture;
+
+  while (state.keep_running())
+  {
+    HTTPDigestAuthenticate::Response response;
+    bool auth_info = false;
+    HTTPCode rc = AuthBench::parse_auth_header(fixture.auth_mod,
+                                               AUTH_HEADER,
+                                               auth_info,
+                                               &response);
+    do_not_optimize(rc);
+  }
+
+  state.set_items_processed(state.iterations());
+}
+MEMENTO_BENCHMARK(bench_parse_auth_header);
+
+static void bench_check_if_matches(BenchState& state)
+{
+  AuthFixture fixture;
+
+  AuthStore::Digest digest;
+  digest._impi = IMPI;
+  digest._impu = IMPU;
+  digest._realm = "home.domain";
+  digest._ha1 = "2c6f9d8b1f4e5a3c7b0e1d2f3a4b5c6d";
+  digest._nonce = "1496236113142uFykRLmm1ZXBXrWKTefYhB2Hf3tu";
+  digest._opaque = "1496236113142FhEcW6VqTmdOYIW3ElWdV0zQ5fYg";
+  digest._nonce_count = 0;
+
+  HTTPDigestAuthenticate::Response response;
+  response.set_members(IMPI,
+                       "home.domain",
+                       digest._nonce,
+                       URI,
+                       "auth",
+                       "00000001",
+                       "0a4f113b",
+                       "6629fae49393a05397450978507c4ef1",
+                       digest._opaque);
+
+  while (state.keep_running())
+  {
+    // The response doesn't match, so this measures the hashing without
+    // updating the digest.
+    std::string www_auth_header;
+    HTTPCode rc = AuthBench::check_if_matches(fixture.auth_mod,
+                                              &digest,
+                                              www_auth_header,
+                                              &response);
+    do_not_optimize(rc);
+  }
+
+  state.set_items_processed(state.iterations());
+}
+MEMENTO_BENCHMARK(bench_check_if_matches);
+
+static void bench_gen_unique_val(BenchState& state)
+{
+  while (state.keep_running())
+  {
+    std::string nonce;
+    gen_unique_val(32, nonce);
+    do_not_optimize(nonce);
+  }
+
+  state.set_items_processed(state.iterations());
+}
+MEMENTO_BENCHMARK(bench_gen_unique_val);
+
+static void bench_homestead_parse_digest(BenchState& state)
+{
+  const std::string json =
+    "{\"digest\": {\"ha1\": \"2c6f9d8b1f4e5a3c7b0e1d2f3a4b5c6d\","
+    "\"qop\": \"auth\","
+    "\"realm\": \"home.domain\"}}";
+
+  while (state.keep_running())
+  {
+    std::string ha1;
+    std::string realm;
+    HTTPCode rc = AuthBench::parse_digest(json, ha1, realm);
+    do_not_optimize(rc);
+  }
+
+  state.set_items_processed(state.iterations());
+  state.set_bytes_processed(state.iterations() * json.length());
+}
+MEMENTO_BENCHMARK(bench_homestead_parse_digest);
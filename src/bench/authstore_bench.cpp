@@ -0,0 +1,96 @@
+/**
+ * @file authstore_bench.cpp Microbenchmarks for the digest (de)serializers.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+
+#include "memento_bench.h"
+#include "authstore.h"
+
+static void fill_digest(AuthStore::Digest& digest)
+{
+  digest._impi = "6505551234@home.domain";
+  digest._impu = "sip:6505551234@home.domain";
+  digest._realm = "home.domain";
+  digest._ha1 = "2c6f9d8b1f4e5a3c7b0e1d2f3a4b5c6d";
+  digest._nonce = "1496236113142uFykRLmm1ZXBXrWKTefYhB2Hf3tu";
+  digest._opaque = "1496236113142FhEcW6VqTmdOYIW3ElWdV0zQ5fYg";
+  digest._nonce_count = 1;
+}
+
+static void serialize(BenchState& state,
+                      AuthStore::SerializerDeserializer& serializer)
+{
+  AuthStore::Digest digest;
+  fill_digest(digest);
+  uint64_t bytes = 0;
+
+  while (state.keep_running())
+  {
+    std::string data = serializer.serialize_digest(&digest);
+    bytes += data.length();
+    do_not_optimize(data);
+  }
+
+  state.set_items_processed(state.iterations());
+  state.set_bytes_processed(bytes);
+}
+
+static void deserialize(BenchState& state,
+                        AuthStore::SerializerDeserializer& serializer)
+{
+  AuthStore::Digest digest;
+  fill_digest(digest);
+  std::string data = serializer.serialize_digest(&digest);
+
+  while (state.keep_running())
+  {
+    AuthStore::Digest* result = serializer.deserialize_digest(data);
+
+    if (result == NULL)
+    {
+      state.set_error("Failed to deserialize digest");
+      return;
+    }
+
+    delete result;
+  }
+
+  state.set_items_processed(state.iterations());
+  state.set_bytes_processed(state.iterations() * data.length());
+}
+
+static void bench_binary_serialize(BenchState& state)
+{
+  AuthStore::BinarySerializerDeserializer serializer;
+  serialize(state, serializer);
+}
+MEMENTO_BENCHMARK(bench_binary_serialize);
+
+static void bench_binary_deserialize(BenchState& state)
+{
+  AuthStore::BinarySerializerDeserializer serializer;
+  deserialize(state, serializer);
+}
+MEMENTO_BENCHMARK(bench_binary_deserialize);
+
+static void bench_json_serialize(BenchState& state)
+{
+  AuthStore::JsonSerializerDeserializer serializer;
+  serialize(state, serializer);
+}
+MEMENTO_BENCHMARK(bench_json_serialize);
+
+static void bench_json_deserialize(BenchState& state)
+{
+  AuthStore::JsonSerializerDeserializer serializer;
+  deserialize(state, serializer);
+}
+MEMENTO_BENCHMARK(bench_json_deserialize);
@@ -0,0 +1,334 @@
+/**
+ * @file bench_main.cpp Runs memento's microbenchmarks.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "memento_bench.h"
+
+struct Benchmark
+{
+  std::string name;
+  BenchFn fn;
+  size_t arg;
+};
+
+/// The registered benchmarks.  This is a function-level static so that it's
+/// constructed before the registrations (which are static objects in other
+/// files) use it.
+static std::vector<Benchmark>& benchmarks()
+{
+  static std::vector<Benchmark> registered;
+  return registered;
+}
+
+BenchRegistration::BenchRegistration(const char* name,
+                                     BenchFn fn,
+                                     const std::vector<size_t>& args)
+{
+  std::vector<size_t> run_args = args;
+
+  if (run_args.empty())
+  {
+    run_args.push_back(0);
+  }
+
+  for (size_t ii = 0; ii < run_args.size(); ii++)
+  {
+    Benchmark benchmark;
+    benchmark.name = name;
+
+    if (!args.empty())
+    {
+      benchmark.name += "/" + std::to_string(run_args[ii]);
+    }
+
+    benchmark.fn = fn;
+    benchmark.arg = run_args[ii];
+    benchmarks().push_back(benchmark);
+  }
+}
+
+static uint64_t now_ns(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+BenchState::BenchState(size_t arg, uint64_t iterations) :
+  _arg(arg),
+  _iterations(iterations),
+  _remaining(iterations),
+  _items(0),
+  _bytes(0),
+  _start_real_ns(0),
+  _start_cpu_ns(0),
+  _real_time_ns(0),
+  _cpu_time_ns(0)
+{
+}
+
+void BenchState::start_timer()
+{
+  _start_real_ns = now_ns(CLOCK_MONOTONIC);
+  _start_cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void BenchState::stop_timer()
+{
+  _real_time_ns = now_ns(CLOCK_MONOTONIC) - _start_real_ns;
+  _cpu_time_ns = now_ns(CLOCK_THREAD_CPUTIME_ID) - _start_cpu_ns;
+}
+
+struct Options
+{
+  std::string filter;
+  double min_time_s;
+  bool json;
+};
+
+static void usage()
+{
+  printf("Usage: memento_bench [options]\n"
+         "\n"
+         " --filter <text>            Only run benchmarks whose names contain this text\n"
+         " --min-time <secs>          Run each benchmark for at least this long (default: 0.5)\n"
+         " --format <console|json>    Output format (default: console)\n"
+         " --help                     Show this help screen\n");
+}
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+  static const struct option long_opt[] =
+  {
+    {"filter",   required_argument, NULL, 'f'},
+    {"min-time", required_argument, NULL, 't'},
+    {"format",   required_argument, NULL, 'o'},
+    {"help",     no_argument,       NULL, 'h'},
+    {NULL,       0,                 NULL, 0},
+  };
+
+  int opt;
+  int long_opt_ind;
+
+  while ((opt = getopt_long(argc, argv, "", long_opt, &long_opt_ind)) != -1)
+  {
+    switch (opt)
+    {
+    case 'f':
+      options.filter = optarg;
+      break;
+
+    case 't':
+      options.min_time_s = atof(optarg);
+      break;
+
+    case 'o':
+      if (std::string(optarg) == "json")
+      {
+        options.json = true;
+      }
+      else if (std::string(optarg) != "console")
+      {
+        fprintf(stderr, "Unknown format %s\n", optarg);
+        return false;
+      }
+      break;
+
+    default:
+      usage();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Runs a benchmark, increasing the number of iterations until the run takes
+/// at least the minimum time.
+static BenchState run_benchmark(const Benchmark& benchmark, double min_time_s)
+{
+  uint64_t min_time_ns = min_time_s * 1e9;
+  uint64_t iterations = 1;
+
+  while (true)
+  {
+    BenchState state(benchmark.arg, iterations);
+    benchmark.fn(state);
+
+    if ((!state.error().empty()) ||
+        (state.real_time_ns() >= min_time_ns) ||
+        (iterations >= 1000000000))
+    {
+      return state;
+    }
+
+    // Estimate how many iterations will take the minimum time, with some
+    // headroom, but don't grow too quickly on the back of a noisy short run.
+    uint64_t next;
+
+    if (state.real_time_ns() == 0)
+    {
+      next = iterations * 100;
+    }
+    else
+    {
+      next = (iterations * min_time_ns * 1.4) / state.real_time_ns();
+      next = std::min(next, iterations * 100);
+    }
+
+    iterations = std::max(next, iterations + 1);
+  }
+}
+
+/// Escapes a string for inclusion in JSON output.  Benchmark names and
+/// errors are plain ASCII, so only quotes and backslashes need escaping.
+static std::string json_escape(const std::string& s)
+{
+  std::string escaped;
+
+  for (size_t ii = 0; ii < s.length(); ii++)
+  {
+    if ((s[ii] == '"') || (s[ii] == '\\'))
+    {
+      escaped += '\\';
+    }
+
+    escaped += s[ii];
+  }
+
+  return escaped;
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  options.min_time_s = 0.5;
+  options.json = false;
+
+  if (!parse_options(argc, argv, options))
+  {
+    return 1;
+  }
+
+  // The JSON output follows the layout of Google Benchmark's, so the same
+  // tools can be used to compare runs.
+  if (options.json)
+  {
+    char hostname[256] = "";
+    gethostname(hostname, sizeof(hostname) - 1);
+    time_t now = time(NULL);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    printf("{\n"
+           "  \"context\": {\n"
+           "    \"date\": \"%s\",\n"
+           "    \"host_name\": \"%s\",\n"
+           "    \"num_cpus\": %ld\n"
+           "  },\n"
+           "  \"benchmarks\": [",
+           date,
+           json_escape(hostname).c_str(),
+           sysconf(_SC_NPROCESSORS_ONLN));
+  }
+  else
+  {
+    printf("%-50s %15s %15s %12s %15s\n",
+           "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "Items/s");
+  }
+
+  bool first = true;
+  int failures = 0;
+
+  for (std::vector<Benchmark>::const_iterator ii = benchmarks().begin();
+       ii != benchmarks().end();
+       ++ii)
+  {
+    if (ii->name.find(options.filter) == std::string::npos)
+    {
+      continue;
+    }
+
+    BenchState state = run_benchmark(*ii, options.min_time_s);
+    double real_ns = (double)state.real_time_ns() / state.iterations();
+    double cpu_ns = (double)state.cpu_time_ns() / state.iterations();
+    double cpu_s = state.cpu_time_ns() / 1e9;
+    double items_per_s = (cpu_s > 0) ? state.items_processed() / cpu_s : 0;
+    double bytes_per_s = (cpu_s > 0) ? state.bytes_processed() / cpu_s : 0;
+
+    if (!state.error().empty())
+    {
+      failures++;
+    }
+
+    if (options.json)
+    {
+      printf("%s\n    {\n"
+             "      \"name\": \"%s\",\n",
+             first ? "" : ",",
+             json_escape(ii->name).c_str());
+
+      if (!state.error().empty())
+      {
+        printf("      \"error_occurred\": true,\n"
+               "      \"error_message\": \"%s\"\n"
+               "    }",
+               json_escape(state.error()).c_str());
+      }
+      else
+      {
+        printf("      \"iterations\": %lu,\n"
+               "      \"real_time\": %.1f,\n"
+               "      \"cpu_time\": %.1f,\n"
+               "      \"time_unit\": \"ns\",\n"
+               "      \"items_per_second\": %.1f,\n"
+               "      \"bytes_per_second\": %.1f\n"
+               "    }",
+               state.iterations(),
+               real_ns,
+               cpu_ns,
+               items_per_s,
+               bytes_per_s);
+      }
+    }
+    else if (!state.error().empty())
+    {
+      printf("%-50s ERROR: %s\n", ii->name.c_str(), state.error().c_str());
+    }
+    else
+    {
+      printf("%-50s %15.1f %15.1f %12lu %15.1f\n",
+             ii->name.c_str(),
+             real_ns,
+             cpu_ns,
+             state.iterations(),
+             items_per_s);
+    }
+
+    fflush(stdout);
+    first = false;
+  }
+
+  if (options.json)
+  {
+    printf("\n  ]\n}\n");
+  }
+
+  return (failures == 0) ? 0 : 1;
+}
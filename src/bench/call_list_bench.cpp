@@ -0,0 +1,141 @@
+/**
+ * @file call_list_bench.cpp Microbenchmarks for building call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "memento_bench.h"
+#include "call_list_store.h"
+#include "call_list_xml.h"
+#include "call_list_validator.h"
+
+static const std::string BEGIN_XML =
+  "<to><URI>alice@example.com</URI><name>Alice Adams</name></to>"
+  "<from><URI>bob@example.com</URI><name>Bob Barker</name></from>"
+  "<answered>1</answered><outgoing>1</outgoing>"
+  "<start-time>2002-05-30T09:30:10</start-time>"
+  "<answer-time>2002-05-30T09:30:20</answer-time>";
+static const std::string END_XML = "<end-time>2002-05-30T09:35:00</end-time>";
+static const std::string REJECTED_XML =
+  "<to><URI>alice@example.com</URI><name>Alice Adams</name></to>"
+  "<from><URI>bob@example.com</URI><name>Bob Barker</name></from>"
+  "<answered>0</answered><outgoing>1</outgoing>"
+  "<start-time>2002-05-30T09:30:10</start-time>";
+
+/// Builds a call list of the given number of fragments, as it would be read
+/// from the store.  Two thirds of the fragments are the BEGIN and END of
+/// answered calls; the rest are rejected calls.
+static void build_records(size_t num_fragments,
+                          std::vector<CallListStore::CallFragment>& records)
+{
+  records.reserve(num_fragments);
+
+  for (size_t ii = 0; records.size() < num_fragments; ii++)
+  {
+    char timestamp[32];
+    snprintf(timestamp, sizeof(timestamp), "20020530%06zu", ii);
+    char id[32];
+    snprintf(id, sizeof(id), "call-%zu", ii);
+
+    CallListStore::CallFragment fragment;
+    fragment.timestamp = timestamp;
+    fragment.id = id;
+
+    if ((ii % 2 == 0) || (records.size() + 1 == num_fragments))
+    {
+      fragment.type = CallListStore::CallFragment::Type::REJECTED;
+      fragment.contents = REJECTED_XML;
+      records.push_back(fragment);
+    }
+    else
+    {
+      fragment.type = CallListStore::CallFragment::Type::BEGIN;
+      fragment.contents = BEGIN_XML;
+      records.push_back(fragment);
+
+      fragment.type = CallListStore::CallFragment::Type::END;
+      fragment.contents = END_XML;
+      records.push_back(fragment);
+    }
+  }
+}
+
+static void write_xml(BenchState& state, bool validate_xml)
+{
+  std::vector<CallListStore::CallFragment> records;
+  build_records(state.arg(), records);
+  uint64_t bytes = 0;
+
+  while (state.keep_running())
+  {
+    std::string xml;
+    StringCallListWriter writer(xml);
+    write_xml_from_call_records(records, writer, 0, 0, validate_xml);
+    bytes += xml.length();
+    do_not_optimize(xml);
+  }
+
+  state.set_items_processed(state.iterations() * state.arg());
+  state.set_bytes_processed(bytes);
+}
+
+static void bench_xml_from_call_records(BenchState& state)
+{
+  write_xml(state, false);
+}
+MEMENTO_BENCHMARK(bench_xml_from_call_records, 10, 100, 1000, 10000);
+
+static void bench_xml_from_call_records_validated(BenchState& state)
+{
+  write_xml(state, true);
+}
+MEMENTO_BENCHMARK(bench_xml_from_call_records_validated, 10, 100, 1000, 10000);
+
+/// Validates arg() KB of call XML with the given implementation.
+static void validate_xml(BenchState& state,
+                         CallXmlValidator::Implementation implementation)
+{
+  std::string xml;
+
+  while (xml.length() < state.arg() * 1024)
+  {
+    xml += BEGIN_XML;
+  }
+
+  CallXmlValidator validator(implementation);
+
+  while (state.keep_running())
+  {
+    bool valid = validator.validate(xml);
+    do_not_optimize(valid);
+  }
+
+  state.set_bytes_processed(state.iterations() * xml.length());
+}
+
+static void bench_validate_call_xml_scalar(BenchState& state)
+{
+  validate_xml(state, CallXmlValidator::SCALAR);
+}
+MEMENTO_BENCHMARK(bench_validate_call_xml_scalar, 1, 64, 4096);
+
+static void bench_validate_call_xml_sse2(BenchState& state)
+{
+  validate_xml(state, CallXmlValidator::SSE2);
+}
+MEMENTO_BENCHMARK(bench_validate_call_xml_sse2, 1, 64, 4096);
+
+static void bench_validate_call_xml_avx2(BenchState& state)
+{
+  validate_xml(state, CallXmlValidator::AVX2);
+}
+MEMENTO_BENCHMARK(bench_validate_call_xml_avx2, 1, 64, 4096);
@@ -0,0 +1,561 @@
+/**
+ * @file http_load.cpp Generates HTTP load against memento's call list API.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <openssl/md5.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <algorithm>
+#include <deque>
+
+#include "http_load.h"
+
+const char* RESPONSE_CLASS_NAMES[NUM_RESPONSE_CLASSES] =
+{
+  "200", "401", "403", "5xx", "other", "error"
+};
+
+uint64_t load_now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+std::string md5_hex(const std::string& data)
+{
+  unsigned char digest[MD5_DIGEST_LENGTH];
+  MD5((const unsigned char*)data.data(), data.length(), digest);
+
+  static const char HEX[] = "0123456789abcdef";
+  std::string hex(MD5_DIGEST_LENGTH * 2, '0');
+
+  for (int ii = 0; ii < MD5_DIGEST_LENGTH; ii++)
+  {
+    hex[ii * 2] = HEX[digest[ii] >> 4];
+    hex[(ii * 2) + 1] = HEX[digest[ii] & 0xf];
+  }
+
+  return hex;
+}
+
+bool parse_challenge(const std::string& header,
+                     std::string& realm,
+                     std::string& nonce,
+                     std::string& opaque,
+                     bool& stale)
+{
+  size_t pos = header.find_first_not_of(" \t");
+
+  if ((pos == std::string::npos) || (header.compare(pos, 6, "Digest") != 0))
+  {
+    return false;
+  }
+
+  pos += 6;
+  realm.clear();
+  nonce.clear();
+  opaque.clear();
+  stale = false;
+
+  while (true)
+  {
+    pos = header.find_first_not_of(" \t\r\n,", pos);
+
+    if (pos == std::string::npos)
+    {
+      break;
+    }
+
+    size_t equals = header.find('=', pos);
+
+    if (equals == std::string::npos)
+    {
+      return false;
+    }
+
+    std::string name = header.substr(pos, equals - pos);
+    name.erase(name.find_last_not_of(" \t") + 1);
+    std::string value;
+    pos = equals + 1;
+
+    if ((pos < header.length()) && (header[pos] == '"'))
+    {
+      size_t end = header.find('"', pos + 1);
+
+      if (end == std::string::npos)
+      {
+        return false;
+      }
+
+      value = header.substr(pos + 1, end - pos - 1);
+      pos = end + 1;
+    }
+    else
+    {
+      size_t end = header.find_first_of(", \t\r\n", pos);
+      end = (end == std::string::npos) ? header.length() : end;
+      value = header.substr(pos, end - pos);
+      pos = end;
+    }
+
+    if (name == "realm")
+    {
+      realm = value;
+    }
+    else if (name == "nonce")
+    {
+      nonce = value;
+    }
+    else if (name == "opaque")
+    {
+      opaque = value;
+    }
+    else if (name == "stale")
+    {
+      stale = (strcasecmp(value.c_str(), "true") == 0);
+    }
+  }
+
+  return !nonce.empty();
+}
+
+LoadOptions::LoadOptions() :
+  start_dn(0),
+  end_dn(0),
+  password("7kkzTyGW"),
+  poisson(false),
+  timeout_ms(10000),
+  max_backlog(100000),
+  insecure(false),
+  compressed(false)
+{
+}
+
+LoadStats::LoadStats() :
+  challenges(0),
+  stale(0),
+  dropped(0)
+{
+}
+
+void LoadStats::add(const LoadStats& other)
+{
+  for (int ii = 0; ii < NUM_RESPONSE_CLASSES; ii++)
+  {
+    latency_us[ii].add(other.latency_us[ii]);
+  }
+
+  challenges += other.challenges;
+  stale += other.stale;
+  dropped += other.dropped;
+}
+
+void LoadStats::reset()
+{
+  for (int ii = 0; ii < NUM_RESPONSE_CLASSES; ii++)
+  {
+    latency_us[ii].reset();
+  }
+
+  challenges = 0;
+  stale = 0;
+  dropped = 0;
+}
+
+uint64_t LoadStats::responses() const
+{
+  uint64_t count = 0;
+
+  for (int ii = 0; ii < NUM_RESPONSE_CLASSES; ii++)
+  {
+    count += latency_us[ii].count();
+  }
+
+  return count;
+}
+
+LoadWorker::LoadWorker(const LoadOptions& options,
+                       int index,
+                       uint64_t first_dn,
+                       uint64_t last_dn,
+                       double rate,
+                       int connections) :
+  _options(options),
+  _rate(rate),
+  _started(false),
+  _stopping(false),
+  _random(std::random_device()() + index),
+  _poisson((rate > 0) ? rate : 1),
+  _next_subscriber(0),
+  _requests(connections)
+{
+  pthread_mutex_init(&_stats_lock, NULL);
+
+  for (uint64_t dn = first_dn; dn <= last_dn; dn++)
+  {
+    LoadSubscriber subscriber;
+    subscriber.impi = std::to_string(dn) + "@" + options.domain;
+    subscriber.uri = "/org.projectclearwater.call-list/users/sip%3A" +
+                     std::to_string(dn) + "%40" + options.domain +
+                     "/call-list.xml";
+    subscriber.url = options.server + subscriber.uri;
+    subscriber.nonce_count = 0;
+    _subscribers.push_back(subscriber);
+  }
+
+  _multi = curl_multi_init();
+  curl_multi_setopt(_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)connections);
+  curl_multi_setopt(_multi, CURLMOPT_MAXCONNECTS, (long)connections);
+
+  for (size_t ii = 0; ii < _requests.size(); ii++)
+  {
+    Request* request = &_requests[ii];
+    request->headers = NULL;
+    request->easy = curl_easy_init();
+    curl_easy_setopt(request->easy, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(request->easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(request->easy, CURLOPT_TIMEOUT_MS, options.timeout_ms);
+    curl_easy_setopt(request->easy, CURLOPT_WRITEFUNCTION, &LoadWorker::write_cb);
+    curl_easy_setopt(request->easy, CURLOPT_HEADERFUNCTION, &LoadWorker::header_cb);
+    curl_easy_setopt(request->easy, CURLOPT_HEADERDATA, request);
+
+    if (options.insecure)
+    {
+      curl_easy_setopt(request->easy, CURLOPT_SSL_VERIFYPEER, 0L);
+      curl_easy_setopt(request->easy, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+
+    if (options.compressed)
+    {
+      // An empty string requests all the encodings curl supports.
+      curl_easy_setopt(request->easy, CURLOPT_ACCEPT_ENCODING, "");
+    }
+
+    _idle.push_back(request);
+  }
+}
+
+LoadWorker::~LoadWorker()
+{
+  stop();
+
+  for (size_t ii = 0; ii < _requests.size(); ii++)
+  {
+    curl_multi_remove_handle(_multi, _requests[ii].easy);
+    curl_easy_cleanup(_requests[ii].easy);
+    curl_slist_free_all(_requests[ii].headers);
+  }
+
+  curl_multi_cleanup(_multi);
+  pthread_mutex_destroy(&_stats_lock);
+}
+
+bool LoadWorker::start()
+{
+  _started = (pthread_create(&_thread, NULL, &LoadWorker::run_fn, this) == 0);
+  return _started;
+}
+
+void LoadWorker::stop()
+{
+  _stopping = true;
+
+  if (_started)
+  {
+    pthread_join(_thread, NULL);
+    _started = false;
+  }
+}
+
+void LoadWorker::take_stats(LoadStats& stats)
+{
+  pthread_mutex_lock(&_stats_lock);
+  stats.add(_stats);
+  _stats.reset();
+  pthread_mutex_unlock(&_stats_lock);
+}
+
+void* LoadWorker::run_fn(void* worker)
+{
+  ((LoadWorker*)worker)->run();
+  return NULL;
+}
+
+void LoadWorker::run()
+{
+  // Times at which requests were due to be sent but couldn't be because all
+  // the connections were busy.
+  std::deque<uint64_t> backlog;
+  uint64_t next_arrival_ns = load_now_ns();
+
+  while (!_stopping)
+  {
+    uint64_t now = load_now_ns();
+
+    if (_rate <= 0)
+    {
+      // Closed-loop - keep every connection busy.
+      while (!_idle.empty())
+      {
+        Request* request = _idle.back();
+        _idle.pop_back();
+        request->subscriber = next_subscriber();
+        request->retried = false;
+        send(request, now);
+      }
+    }
+    else
+    {
+      while (next_arrival_ns <= now)
+      {
+        if (backlog.size() < _options.max_backlog)
+        {
+          backlog.push_back(next_arrival_ns);
+        }
+        else
+        {
+          pthread_mutex_lock(&_stats_lock);
+          _stats.dropped++;
+          pthread_mutex_unlock(&_stats_lock);
+        }
+
+        next_arrival_ns += next_interval_ns();
+      }
+
+      while ((!backlog.empty()) && (!_idle.empty()))
+      {
+        Request* request = _idle.back();
+        _idle.pop_back();
+        request->subscriber = next_subscriber();
+        request->retried = false;
+        send(request, backlog.front());
+        backlog.pop_front();
+      }
+    }
+
+    int running;
+    curl_multi_perform(_multi, &running);
+
+    CURLMsg* msg;
+    int msgs_left;
+
+    while ((msg = curl_multi_info_read(_multi, &msgs_left)) != NULL)
+    {
+      if (msg->msg == CURLMSG_DONE)
+      {
+        CURL* easy = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        Request* request;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char**)&request);
+        curl_multi_remove_handle(_multi, easy);
+        complete(request, result);
+      }
+    }
+
+    // Wait for activity or for the next request to be due.  Don't wait long,
+    // so that we notice promptly when it's time to stop.
+    now = load_now_ns();
+    int timeout_ms = 100;
+
+    if ((!_idle.empty()) && ((_rate <= 0) || (!backlog.empty())))
+    {
+      // Requests completed above and there are more to send.
+      timeout_ms = 0;
+    }
+    else if (_rate > 0)
+    {
+      timeout_ms = (next_arrival_ns > now) ?
+                    std::min((next_arrival_ns - now) / 1000000, (uint64_t)100) : 0;
+    }
+
+    curl_multi_wait(_multi, NULL, 0, timeout_ms, NULL);
+  }
+}
+
+uint64_t LoadWorker::next_interval_ns()
+{
+  if (_options.poisson)
+  {
+    return (uint64_t)(_poisson(_random) * 1e9);
+  }
+
+  return (uint64_t)(1e9 / _rate);
+}
+
+LoadSubscriber* LoadWorker::next_subscriber()
+{
+  LoadSubscriber* subscriber = &_subscribers[_next_subscriber];
+  _next_subscriber = (_next_subscriber + 1) % _subscribers.size();
+  return subscriber;
+}
+
+std::string LoadWorker::authorization(LoadSubscriber* subscriber)
+{
+  subscriber->nonce_count++;
+
+  // Memento reads the nonce count as a decimal number, so send it in decimal
+  // (zero-padded to the usual eight digits) rather than hex.
+  char nc[16];
+  snprintf(nc, sizeof(nc), "%08u", subscriber->nonce_count);
+
+  char cnonce[17];
+  snprintf(cnonce, sizeof(cnonce), "%016llx", (unsigned long long)_random());
+
+  std::string ha2 = md5_hex("GET:" + subscriber->uri);
+  std::string response = md5_hex(subscriber->ha1 + ":" +
+                                 subscriber->nonce + ":" +
+                                 nc + ":" +
+                                 cnonce + ":auth:" +
+                                 ha2);
+
+  return "Authorization: Digest username=\"" + subscriber->impi + "\"," +
+         "realm=\"" + subscriber->realm + "\"," +
+         "nonce=\"" + subscriber->nonce + "\"," +
+         "uri=\"" + subscriber->uri + "\"," +
+         "qop=auth," +
+         "nc=" + nc + "," +
+         "cnonce=\"" + cnonce + "\"," +
+         "response=\"" + response + "\"," +
+         "opaque=\"" + subscriber->opaque + "\"";
+}
+
+void LoadWorker::send(Request* request, uint64_t start_ns)
+{
+  LoadSubscriber* subscriber = request->subscriber;
+  request->start_ns = start_ns;
+  request->www_authenticate.clear();
+
+  curl_slist_free_all(request->headers);
+  request->headers = NULL;
+
+  if (!_options.api_key.empty())
+  {
+    request->headers = curl_slist_append(request->headers,
+                                         ("NGV-API-Key: " + _options.api_key).c_str());
+  }
+  else if (!subscriber->nonce.empty())
+  {
+    // Reuse the nonce from the last challenge.  If we haven't been
+    // challenged yet, send no credentials - memento will challenge us.
+    request->headers = curl_slist_append(request->headers,
+                                         authorization(subscriber).c_str());
+  }
+
+  curl_easy_setopt(request->easy, CURLOPT_URL, subscriber->url.c_str());
+  curl_easy_setopt(request->easy, CURLOPT_HTTPHEADER, request->headers);
+  curl_multi_add_handle(_multi, request->easy);
+}
+
+void LoadWorker::complete(Request* request, CURLcode result)
+{
+  uint64_t latency_us = (load_now_ns() - request->start_ns) / 1000;
+  long status = 0;
+  ResponseClass response_class = RESPONSE_ERROR;
+
+  if (result == CURLE_OK)
+  {
+    curl_easy_getinfo(request->easy, CURLINFO_RESPONSE_CODE, &status);
+
+    if (status == 200)
+    {
+      response_class = RESPONSE_200;
+    }
+    else if (status == 401)
+    {
+      response_class = RESPONSE_401;
+    }
+    else if (status == 403)
+    {
+      response_class = RESPONSE_403;
+    }
+    else if ((status >= 500) && (status < 600))
+    {
+      response_class = RESPONSE_5XX;
+    }
+    else
+    {
+      response_class = RESPONSE_OTHER;
+    }
+  }
+
+  bool retry = false;
+  bool challenged = false;
+  bool stale = false;
+
+  if ((status == 401) && (_options.api_key.empty()))
+  {
+    LoadSubscriber* subscriber = request->subscriber;
+    std::string realm;
+
+    if (parse_challenge(request->www_authenticate,
+                        realm,
+                        subscriber->nonce,
+                        subscriber->opaque,
+                        stale))
+    {
+      challenged = true;
+      subscriber->nonce_count = 0;
+
+      if ((realm != subscriber->realm) || (subscriber->ha1.empty()))
+      {
+        subscriber->realm = realm;
+        subscriber->ha1 = md5_hex(subscriber->impi + ":" +
+                                  realm + ":" +
+                                  _options.password);
+      }
+
+      // Retry with the new nonce, but only once - if we're challenged again
+      // the password is probably wrong.
+      retry = !request->retried;
+    }
+  }
+
+  pthread_mutex_lock(&_stats_lock);
+  _stats.latency_us[response_class].record(latency_us);
+  _stats.challenges += challenged ? 1 : 0;
+  _stats.stale += stale ? 1 : 0;
+  pthread_mutex_unlock(&_stats_lock);
+
+  if ((retry) && (!_stopping))
+  {
+    // The retry is part of the same request, so its latency is still
+    // measured from when the request was due.
+    request->retried = true;
+    send(request, request->start_ns);
+  }
+  else
+  {
+    _idle.push_back(request);
+  }
+}
+
+size_t LoadWorker::write_cb(char* ptr, size_t size, size_t nmemb, void* data)
+{
+  // Discard the call list.
+  return size * nmemb;
+}
+
+size_t LoadWorker::header_cb(char* buffer, size_t size, size_t nitems, void* data)
+{
+  static const char NAME[] = "WWW-Authenticate:";
+  static const size_t NAME_LEN = sizeof(NAME) - 1;
+  size_t length = size * nitems;
+
+  if ((length > NAME_LEN) && (strncasecmp(buffer, NAME, NAME_LEN) == 0))
+  {
+    ((Request*)data)->www_authenticate.assign(buffer + NAME_LEN,
+                                              length - NAME_LEN);
+  }
+
+  return length;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file http_load.h Generates HTTP load against memento's call list API.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef HTTP_LOAD_H_
+#define HTTP_LOAD_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.h"
+
+/// The classes of response that latencies are reported for.
+enum ResponseClass
+{
+  RESPONSE_200 = 0,
+  RESPONSE_401,
+  RESPONSE_403,
+  RESPONSE_5XX,
+  RESPONSE_OTHER,
+  RESPONSE_ERROR,
+  NUM_RESPONSE_CLASSES
+};
+
+extern const char* RESPONSE_CLASS_NAMES[NUM_RESPONSE_CLASSES];
+
+/// @returns                 The current time (CLOCK_MONOTONIC) in ns.
+uint64_t load_now_ns();
+
+/// @returns                 The MD5 hash of the data, in lower case hex.
+std::string md5_hex(const std::string& data);
+
+/// Parses the parameters of a WWW-Authenticate header that are needed to
+/// authenticate.
+///
+/// @returns                 Whether the header is a valid digest challenge.
+bool parse_challenge(const std::string& header,
+                     std::string& realm,
+                     std::string& nonce,
+                     std::string& opaque,
+                     bool& stale);
+
+/// The load to generate.
+struct LoadOptions
+{
+  LoadOptions();
+
+  /// Base URL of the server, e.g. https://memento.example.com
+  std::string server;
+
+  /// The subscribers' home domain and DN range.
+  std::string domain;
+  uint64_t start_dn;
+  uint64_t end_dn;
+
+  /// The password for every subscriber, if using digest authentication.
+  std::string password;
+
+  /// The API key to authenticate with.  If empty, digest authentication is
+  /// used.
+  std::string api_key;
+
+  /// Whether arrivals are a Poisson process (rather than evenly spaced).
+  bool poisson;
+
+  long timeout_ms;
+
+  /// Number of requests per worker that may wait for a connection before
+  /// new ones are dropped.
+  size_t max_backlog;
+
+  bool insecure;
+  bool compressed;
+};
+
+/// A subscriber whose call list is requested, and the digest state for it.
+struct LoadSubscriber
+{
+  std::string impi;
+  std::string url;
+  std::string uri;
+
+  std::string realm;
+  std::string nonce;
+  std::string opaque;
+  std::string ha1;
+  uint32_t nonce_count;
+};
+
+/// Statistics collected by a worker.
+struct LoadStats
+{
+  LoadStats();
+
+  void add(const LoadStats& other);
+  void reset();
+
+  /// @returns               The number of responses of all classes.
+  uint64_t responses() const;
+
+  LatencyHistogram latency_us[NUM_RESPONSE_CLASSES];
+
+  /// Number of challenges received, and how many of them were stale.
+  uint64_t challenges;
+  uint64_t stale;
+
+  /// Number of requests not sent because the backlog was full.
+  uint64_t dropped;
+};
+
+/// Sends requests for a share of the subscribers over a share of the
+/// connections, on its own thread.
+///
+/// If the worker has a rate, the load is open-loop.  Requests are sent when
+/// they're due whether or not earlier ones have completed, and latency is
+/// measured from when each request was due.  Otherwise the load is
+/// closed-loop - each connection sends a new request as soon as the last
+/// one completes.
+///
+/// Digest authentication is done natively.  Each subscriber's nonce is
+/// reused for later requests, with an incrementing nonce count, until the
+/// server challenges again.  A challenged request is retried once with the
+/// new nonce.
+class LoadWorker
+{
+public:
+  /// @param options         The load to generate.  Must outlive the worker.
+  /// @param index           Index of the worker, used to seed it.
+  /// @param first_dn        First of the subscribers this worker requests.
+  /// @param last_dn         Last of the subscribers this worker requests.
+  /// @param rate            Requests per second, or 0 for closed-loop load.
+  /// @param connections     Number of connections to use.
+  LoadWorker(const LoadOptions& options,
+             int index,
+             uint64_t first_dn,
+             uint64_t last_dn,
+             double rate,
+             int connections);
+  ~LoadWorker();
+
+  /// Starts generating load on a new thread.
+  bool start();
+
+  /// Stops generating load, abandoning requests in progress, and waits for
+  /// the thread to exit.
+  void stop();
+
+  /// Adds the statistics collected since the last call to those passed in.
+  void take_stats(LoadStats& stats);
+
+private:
+  struct Request
+  {
+    CURL* easy;
+    struct curl_slist* headers;
+    LoadSubscriber* subscriber;
+    uint64_t start_ns;
+    bool retried;
+    std::string www_authenticate;
+  };
+
+  static void* run_fn(void* worker);
+  void run();
+
+  uint64_t next_interval_ns();
+  LoadSubscriber* next_subscriber();
+  std::string authorization(LoadSubscriber* subscriber);
+  void send(Request* request, uint64_t start_ns);
+  void complete(Request* request, CURLcode result);
+
+  static size_t write_cb(char* ptr, size_t size, size_t nmemb, void* data);
+  static size_t header_cb(char* buffer, size_t size, size_t nitems, void* data);
+
+  const LoadOptions& _options;
+  double _rate;
+  pthread_t _thread;
+  bool _started;
+  std::atomic<bool> _stopping;
+
+  std::mt19937_64 _random;
+  std::exponential_distribution<double> _poisson;
+
+  std::vector<LoadSubscriber> _subscribers;
+  size_t _next_subscriber;
+
+  CURLM* _multi;
+  std::vector<Request> _requests;
+  std::vector<Request*> _idle;
+
+  pthread_mutex_t _stats_lock;
+  LoadStats _stats;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file latency_histogram.cpp Histogram of latencies, for reporting percentiles.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "latency_histogram.h"
+
+LatencyHistogram::LatencyHistogram() :
+  _counts(NUM_BUCKETS, 0),
+  _count(0),
+  _max(0)
+{
+}
+
+size_t LatencyHistogram::bucket(uint64_t value)
+{
+  if (value < SUB_BUCKETS)
+  {
+    return value;
+  }
+
+  // Shift the value down so that it lies in [SUB_BUCKETS / 2, SUB_BUCKETS).
+  // The shift picks the power of two range and the shifted value picks the
+  // bucket within it.
+  int shift = (63 - __builtin_clzll(value)) - (SUB_BUCKET_BITS - 1);
+  uint64_t sub_bucket = value >> shift;
+
+  return SUB_BUCKETS +
+         ((shift - 1) * (SUB_BUCKETS / 2)) +
+         (sub_bucket - (SUB_BUCKETS / 2));
+}
+
+uint64_t LatencyHistogram::highest_in_bucket(size_t bucket)
+{
+  if (bucket < SUB_BUCKETS)
+  {
+    return bucket;
+  }
+
+  int shift = ((bucket - SUB_BUCKETS) / (SUB_BUCKETS / 2)) + 1;
+  uint64_t sub_bucket = ((bucket - SUB_BUCKETS) % (SUB_BUCKETS / 2)) +
+                        (SUB_BUCKETS / 2);
+
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+  value = std::min(value, (uint64_t)MAX_VALUE);
+  _counts[bucket(value)]++;
+  _count++;
+  _max = std::max(_max, value);
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+  for (size_t ii = 0; ii < NUM_BUCKETS; ii++)
+  {
+    _counts[ii] += other._counts[ii];
+  }
+
+  _count += other._count;
+  _max = std::max(_max, other._max);
+}
+
+void LatencyHistogram::reset()
+{
+  std::fill(_counts.begin(), _counts.end(), 0);
+  _count = 0;
+  _max = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const
+{
+  if (_count == 0)
+  {
+    return 0;
+  }
+
+  // Find the bucket holding the value that this percentage of values are at
+  // or below.
+  uint64_t target = (uint64_t)ceil((percentile / 100.0) * _count);
+  target = std::max(target, (uint64_t)1);
+  uint64_t seen = 0;
+
+  for (size_t ii = 0; ii < NUM_BUCKETS; ii++)
+  {
+    seen += _counts[ii];
+
+    if (seen >= target)
+    {
+      return std::min(highest_in_bucket(ii), _max);
+    }
+  }
+
+  return _max;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file latency_histogram.h Histogram of latencies, for reporting percentiles.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// A histogram of latencies in the style of HdrHistogram.  Values are stored
+/// to three significant figures in buckets whose width grows with the value,
+/// so recording is O(1) and the memory used is fixed however many values are
+/// recorded.  Values of up to 2^32 (e.g. about 71 minutes in microseconds)
+/// can be recorded - larger ones are recorded as 2^32 - 1.
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  /// Records a value.
+  void record(uint64_t value);
+
+  /// Adds the values in another histogram to this one.
+  void add(const LatencyHistogram& other);
+
+  /// Removes all values.
+  void reset();
+
+  /// @returns               The number of values recorded.
+  uint64_t count() const { return _count; }
+
+  /// @returns               The largest value recorded.
+  uint64_t max() const { return _max; }
+
+  /// @param percentile      The percentile (between 0 and 100).
+  /// @returns               The value at the given percentile, to three
+  ///                        significant figures, or 0 if there are no values.
+  uint64_t percentile(double percentile) const;
+
+private:
+  /// Values below this are stored exactly.  Above it each power of two range
+  /// is split into SUB_BUCKETS / 2 buckets.
+  static const int SUB_BUCKET_BITS = 11;
+  static const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const uint64_t MAX_VALUE = 0xFFFFFFFF;
+  static const size_t NUM_BUCKETS =
+                        SUB_BUCKETS + ((32 - SUB_BUCKET_BITS) * SUB_BUCKETS / 2);
+
+  static size_t bucket(uint64_t value);
+  static uint64_t highest_in_bucket(size_t bucket);
+
+  std::vector<uint64_t> _counts;
+  uint64_t _count;
+  uint64_t _max;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file memento_bench.h Microbenchmark framework for memento.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef MEMENTO_BENCH_H_
+#define MEMENTO_BENCH_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// State passed to a benchmark.  A benchmark sets up its data, then runs the
+/// code under test for as long as keep_running() returns true:
+///
+///   static void bench_thing(BenchState& state)
+///   {
+///     Thing thing(state.arg());
+///
+///     while (state.keep_running())
+///     {
+///       thing.do_it();
+///     }
+///
+///     state.set_items_processed(state.iterations() * state.arg());
+///   }
+///   MEMENTO_BENCHMARK(bench_thing, 10, 100, 1000);
+///
+/// Only the time spent in the loop is measured.
+class BenchState
+{
+public:
+  BenchState(size_t arg, uint64_t iterations);
+
+  /// @returns               Whether to run another iteration.
+  inline bool keep_running()
+  {
+    if (_remaining == _iterations)
+    {
+      start_timer();
+    }
+
+    if (_remaining == 0)
+    {
+      stop_timer();
+      return false;
+    }
+
+    _remaining--;
+    return true;
+  }
+
+  /// @returns               The benchmark's argument (e.g. the number of
+  ///                        call fragments to use).
+  size_t arg() const { return _arg; }
+
+  /// @returns               The number of iterations being run.
+  uint64_t iterations() const { return _iterations; }
+
+  /// Reports how many items (e.g. call fragments) or bytes were processed,
+  /// so the results include a rate.
+  void set_items_processed(uint64_t items) { _items = items; }
+  void set_bytes_processed(uint64_t bytes) { _bytes = bytes; }
+
+  /// Reports a failure.  The benchmark's results are discarded.
+  void set_error(const std::string& error) { _error = error; }
+
+  uint64_t real_time_ns() const { return _real_time_ns; }
+  uint64_t cpu_time_ns() const { return _cpu_time_ns; }
+  uint64_t items_processed() const { return _items; }
+  uint64_t bytes_processed() const { return _bytes; }
+  const std::string& error() const { return _error; }
+
+private:
+  void start_timer();
+  void stop_timer();
+
+  size_t _arg;
+  uint64_t _iterations;
+  uint64_t _remaining;
+  uint64_t _items;
+  uint64_t _bytes;
+  std::string _error;
+
+  uint64_t _start_real_ns;
+  uint64_t _start_cpu_ns;
+  uint64_t _real_time_ns;
+  uint64_t _cpu_time_ns;
+};
+
+typedef void (*BenchFn)(BenchState& state);
+
+/// Registers a benchmark.  Use the MEMENTO_BENCHMARK macro rather than this
+/// directly.
+class BenchRegistration
+{
+public:
+  BenchRegistration(const char* name,
+                    BenchFn fn,
+                    const std::vector<size_t>& args);
+};
+
+/// Registers a benchmark, to be run once for each of the listed arguments
+/// (or once, with an argument of 0, if there are none).
+#define MEMENTO_BENCHMARK(FN, ...)                                            \
+  static BenchRegistration FN##_registration(#FN, FN, std::vector<size_t>{__VA_ARGS__})
+
+/// Stops the compiler optimizing away a value that a benchmark computes but
+/// doesn't otherwise use.
+template <class T>
+inline void do_not_optimize(const T& value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+#endif
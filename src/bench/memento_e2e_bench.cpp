@@ -0,0 +1,552 @@
+/**
+ * @file memento_e2e_bench.cpp Hermetic end-to-end throughput benchmark.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+// Runs memento's HTTP stack, call list handler and digest authentication
+// against in-process fakes of memcached, Homestead and Cassandra, and
+// measures the throughput and latency of call list requests sent over
+// loopback.  This measures memento itself, independent of the performance
+// of the clusters it depends on.
+//
+// The benchmark is run once for each of a list of HTTP worker thread counts.
+// The load is closed-loop - each client connection sends a new request as
+// soon as the last one completes - so the request rate is memento's
+// throughput.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "httpstack.h"
+#include "httpstack_utils.h"
+#include "handlers.h"
+#include "authstore.h"
+#include "localstore.h"
+#include "homesteadconnection.h"
+#include "call_list_store.h"
+#include "load_monitor.h"
+#include "health_checker.h"
+#include "exception_handler.h"
+#include "memento_lvc.h"
+#include "mementosaslogger.h"
+#include "log.h"
+#include "http_load.h"
+
+static const std::string CALL_LIST_PATH =
+                 "^/org.projectclearwater.call-list/users/[^/]*/call-list.xml$";
+
+static const std::string BEGIN_XML =
+  "<to><URI>alice@example.com</URI><name>Alice Adams</name></to>"
+  "<from><URI>bob@example.com</URI><name>Bob Barker</name></from>"
+  "<answered>1</answered><outgoing>1</outgoing>"
+  "<start-time>2002-05-30T09:30:10</start-time>"
+  "<answer-time>2002-05-30T09:30:20</answer-time>";
+static const std::string END_XML = "<end-time>2002-05-30T09:35:00</end-time>";
+
+/// Homestead connection that returns the digest for a fixed password,
+/// without any network access.
+class BenchHomesteadConnection : public HomesteadConnection
+{
+public:
+  BenchHomesteadConnection(const std::string& realm,
+                           const std::string& password) :
+    HomesteadConnection(NULL),
+    _realm(realm),
+    _password(password)
+  {
+  }
+
+  virtual ~BenchHomesteadConnection() {}
+
+private:
+  HTTPCode get_digest_and_parse(const std::string& path,
+                                std::string& digest,
+                                std::string& realm,
+                                SAS::TrailId trail)
+  {
+    // The path is /impi/<escaped private ID>/av?impu=<escaped public ID>.
+    size_t start = path.find("/impi/");
+    size_t end = path.find("/av");
+
+    if ((start == std::string::npos) || (end == std::string::npos))
+    {
+      return HTTP_NOT_FOUND;
+    }
+
+    start += 6;
+    std::string impi;
+
+    for (size_t ii = start; ii < end; ii++)
+    {
+      if ((path[ii] == '%') && (ii + 2 < end))
+      {
+        impi += (char)strtol(path.substr(ii + 1, 2).c_str(), NULL, 16);
+        ii += 2;
+      }
+      else
+      {
+        impi += path[ii];
+      }
+    }
+
+    digest = md5_hex(impi + ":" + _realm + ":" + _password);
+    realm = _realm;
+    return HTTP_OK;
+  }
+
+  std::string _realm;
+  std::string _password;
+};
+
+/// Call list store that holds the call lists in memory.  The call lists are
+/// set up before the benchmark runs and never change, so no locking is
+/// needed.
+///
+/// Only synchronous reads are supported - with no store latency there's
+/// nothing to gain by handing reads off to a worker pool.
+class InMemoryCallListStore : public CallListStore::Store
+{
+public:
+  virtual ~InMemoryCallListStore() {}
+
+  void add_call_list(const std::string& impu,
+                     const std::vector<CallListStore::CallFragment>& fragments)
+  {
+    _call_lists[impu] = fragments;
+  }
+
+  CassandraStore::ResultCode get_call_fragments_sync(const std::string& impu,
+                                                     std::vector<CallListStore::CallFragment>& fragments,
+                                                     SAS::TrailId trail)
+  {
+    std::map<std::string, std::vector<CallListStore::CallFragment>>::const_iterator it =
+                                                          _call_lists.find(impu);
+
+    if (it == _call_lists.end())
+    {
+      return CassandraStore::NOT_FOUND;
+    }
+
+    fragments = it->second;
+    return CassandraStore::OK;
+  }
+
+private:
+  std::map<std::string, std::vector<CallListStore::CallFragment>> _call_lists;
+};
+
+struct Options
+{
+  LoadOptions load;
+  std::vector<int> worker_threads;
+  int http_threads;
+  int connections;
+  int client_threads;
+  int calls;
+  double duration_s;
+  double warmup_s;
+  int port;
+};
+
+/// The results of running the benchmark with one configuration.
+struct Result
+{
+  int worker_threads;
+  double elapsed_s;
+  LoadStats stats;
+};
+
+static void usage()
+{
+  printf("Usage: memento_e2e_bench [options]\n"
+         "\n"
+         " --worker-threads <n,n,...> HTTP worker thread counts to run with\n"
+         "                            (default: 1,2,4,8,16)\n"
+         " --http-threads <n>         Number of HTTP transport threads (default: 1)\n"
+         " --connections <n>          Number of client connections (default: 64)\n"
+         " --client-threads <n>       Number of client threads (default: 2)\n"
+         " --subscribers <n>          Number of subscribers (default: 1000)\n"
+         " --calls <n>                Calls in each subscriber's call list (default: 10)\n"
+         " --duration <secs>          How long to measure each configuration for\n"
+         "                            (default: 10)\n"
+         " --warmup <secs>            How long to run each configuration before\n"
+         "                            measuring (default: 2)\n"
+         " --api-key                  Authenticate with an API key rather than digest\n"
+         " --port <port>              First loopback port to listen on (default: 18888)\n"
+         " --help                     Show this help screen\n");
+}
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+  enum OptionTypes
+  {
+    WORKER_THREADS = 128,
+    HTTP_THREADS,
+    CONNECTIONS,
+    CLIENT_THREADS,
+    SUBSCRIBERS,
+    CALLS,
+    DURATION,
+    WARMUP,
+    API_KEY,
+    PORT,
+    HELP
+  };
+
+  static const struct option long_opt[] =
+  {
+    {"worker-threads", required_argument, NULL, WORKER_THREADS},
+    {"http-threads",   required_argument, NULL, HTTP_THREADS},
+    {"connections",    required_argument, NULL, CONNECTIONS},
+    {"client-threads", required_argument, NULL, CLIENT_THREADS},
+    {"subscribers",    required_argument, NULL, SUBSCRIBERS},
+    {"calls",          required_argument, NULL, CALLS},
+    {"duration",       required_argument, NULL, DURATION},
+    {"warmup",         required_argument, NULL, WARMUP},
+    {"api-key",        no_argument,       NULL, API_KEY},
+    {"port",           required_argument, NULL, PORT},
+    {"help",           no_argument,       NULL, HELP},
+    {NULL,             0,                 NULL, 0},
+  };
+
+  int opt;
+  int long_opt_ind;
+
+  while ((opt = getopt_long(argc, argv, "", long_opt, &long_opt_ind)) != -1)
+  {
+    switch (opt)
+    {
+    case WORKER_THREADS:
+      {
+        options.worker_threads.clear();
+        std::string list = optarg;
+        size_t pos = 0;
+
+        while (pos < list.length())
+        {
+          size_t comma = list.find(',', pos);
+          comma = (comma == std::string::npos) ? list.length() : comma;
+          options.worker_threads.push_back(atoi(list.substr(pos, comma - pos).c_str()));
+          pos = comma + 1;
+        }
+      }
+      break;
+
+    case HTTP_THREADS:
+      options.http_threads = atoi(optarg);
+      break;
+
+    case CONNECTIONS:
+      options.connections = atoi(optarg);
+      break;
+
+    case CLIENT_THREADS:
+      options.client_threads = atoi(optarg);
+      break;
+
+    case SUBSCRIBERS:
+      {
+        long long subscribers = strtoll(optarg, NULL, 10);
+
+        if (subscribers < 1)
+        {
+          fprintf(stderr, "There must be at least one subscriber\n");
+          return false;
+        }
+
+        options.load.end_dn = options.load.start_dn + subscribers - 1;
+      }
+      break;
+
+    case CALLS:
+      options.calls = atoi(optarg);
+      break;
+
+    case DURATION:
+      options.duration_s = atof(optarg);
+      break;
+
+    case WARMUP:
+      options.warmup_s = atof(optarg);
+      break;
+
+    case API_KEY:
+      options.load.api_key = "BENCHAPIKEY";
+      break;
+
+    case PORT:
+      options.port = atoi(optarg);
+      break;
+
+    default:
+      usage();
+      return false;
+    }
+  }
+
+  for (size_t ii = 0; ii < options.worker_threads.size(); ii++)
+  {
+    if (options.worker_threads[ii] <= 0)
+    {
+      fprintf(stderr, "Worker thread counts must be positive\n");
+      return false;
+    }
+  }
+
+  if ((options.worker_threads.empty()) ||
+      (options.http_threads <= 0) ||
+      (options.client_threads <= 0) ||
+      (options.connections < options.client_threads) ||
+      (options.load.end_dn - options.load.start_dn + 1 < (uint64_t)options.client_threads))
+  {
+    fprintf(stderr, "There must be at least one thread of each type, and a "
+                    "connection and subscriber per client thread\n");
+    return false;
+  }
+
+  return true;
+}
+
+/// Builds the call lists.  Each call has a BEGIN and an END fragment.
+static void populate_call_lists(const Options& options,
+                                InMemoryCallListStore& store)
+{
+  std::vector<CallListStore::CallFragment> fragments;
+
+  for (int ii = 0; ii < options.calls; ii++)
+  {
+    char timestamp[32];
+    snprintf(timestamp, sizeof(timestamp), "20020530%06d", ii);
+
+    CallListStore::CallFragment fragment;
+    fragment.timestamp = timestamp;
+    fragment.id = "call-" + std::to_string(ii);
+    fragment.type = CallListStore::CallFragment::Type::BEGIN;
+    fragment.contents = BEGIN_XML;
+    fragments.push_back(fragment);
+
+    fragment.type = CallListStore::CallFragment::Type::END;
+    fragment.contents = END_XML;
+    fragments.push_back(fragment);
+  }
+
+  for (uint64_t dn = options.load.start_dn; dn <= options.load.end_dn; dn++)
+  {
+    store.add_call_list("sip:" + std::to_string(dn) + "@" + options.load.domain,
+                        fragments);
+  }
+}
+
+/// Runs the load against memento for the warm-up and measurement periods.
+static void run_load(const Options& options, Result& result)
+{
+  std::vector<LoadWorker*> workers;
+  uint64_t num_dns = options.load.end_dn - options.load.start_dn + 1;
+
+  for (int ii = 0; ii < options.client_threads; ii++)
+  {
+    uint64_t first_dn = options.load.start_dn + (num_dns * ii) / options.client_threads;
+    uint64_t last_dn = options.load.start_dn + (num_dns * (ii + 1)) / options.client_threads - 1;
+    int connections = (options.connections * (ii + 1)) / options.client_threads -
+                      (options.connections * ii) / options.client_threads;
+    workers.push_back(new LoadWorker(options.load,
+                                     ii,
+                                     first_dn,
+                                     last_dn,
+                                     0,
+                                     connections));
+    workers.back()->start();
+  }
+
+  // Discard the results from the warm-up, which include the first challenge
+  // for each subscriber.
+  usleep(options.warmup_s * 1000000);
+  LoadStats discard;
+
+  for (size_t ii = 0; ii < workers.size(); ii++)
+  {
+    workers[ii]->take_stats(discard);
+  }
+
+  uint64_t start_ns = load_now_ns();
+  usleep(options.duration_s * 1000000);
+
+  for (size_t ii = 0; ii < workers.size(); ii++)
+  {
+    workers[ii]->take_stats(result.stats);
+  }
+
+  result.elapsed_s = (load_now_ns() - start_ns) / 1e9;
+
+  for (size_t ii = 0; ii < workers.size(); ii++)
+  {
+    delete workers[ii];
+  }
+}
+
+static void print_results(const std::vector<Result>& results)
+{
+  printf("\n%8s %12s %10s %10s %10s %10s %10s %10s\n",
+         "Workers", "Requests/s", "p50 (ms)", "p90 (ms)", "p99 (ms)",
+         "p99.9 (ms)", "max (ms)", "Non-200");
+
+  for (size_t ii = 0; ii < results.size(); ii++)
+  {
+    const Result& result = results[ii];
+    const LatencyHistogram& latency = result.stats.latency_us[RESPONSE_200];
+    uint64_t responses = result.stats.responses();
+
+    printf("%8d %12.1f %10.2f %10.2f %10.2f %10.2f %10.2f %10lu\n",
+           result.worker_threads,
+           latency.count() / result.elapsed_s,
+           latency.percentile(50) / 1000.0,
+           latency.percentile(90) / 1000.0,
+           latency.percentile(99) / 1000.0,
+           latency.percentile(99.9) / 1000.0,
+           latency.max() / 1000.0,
+           responses - latency.count());
+  }
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  options.worker_threads = {1, 2, 4, 8, 16};
+  options.http_threads = 1;
+  options.connections = 64;
+  options.client_threads = 2;
+  options.calls = 10;
+  options.duration_s = 10;
+  options.warmup_s = 2;
+  options.port = 18888;
+  options.load.domain = "home.domain";
+  options.load.start_dn = 6505550000;
+  options.load.end_dn = options.load.start_dn + 999;
+
+  if (!parse_options(argc, argv, options))
+  {
+    return 1;
+  }
+
+  Log::setLoggingLevel(0);
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  // The fakes of memento's backends.
+  LocalStore* local_store = new LocalStore();
+  AuthStore* auth_store = new AuthStore(local_store, 300);
+  BenchHomesteadConnection* homestead_conn =
+               new BenchHomesteadConnection(options.load.domain,
+                                            options.load.password);
+  InMemoryCallListStore* call_list_store = new InMemoryCallListStore();
+  populate_call_lists(options, *call_list_store);
+
+  HealthChecker* hc = new HealthChecker();
+  ExceptionHandler* exception_handler = new ExceptionHandler(3600, false, hc);
+  LastValueCache* stats_aggregator = new MementoLVC();
+
+  // Admit every request - the benchmark is measuring how fast memento can go,
+  // not its overload control.
+  LoadMonitor* load_monitor = new LoadMonitor(100000,
+                                              1000000,
+                                              1000000.0,
+                                              1000000.0,
+                                              0.0);
+  HttpStackUtils::SimpleStatsManager stats_manager(stats_aggregator);
+
+  // Read call lists on the HTTP worker threads - with no store latency
+  // there's nothing to gain from handing them to another thread.
+  CallListTask::Options call_list_options;
+  call_list_options.async_store_reads = false;
+
+  CallListTask::Config call_list_config(auth_store,
+                                        homestead_conn,
+                                        call_list_store,
+                                        options.load.domain,
+                                        stats_aggregator,
+                                        hc,
+                                        "BENCHAPIKEY",
+                                        call_list_options);
+  MementoSasLogger sas_logger;
+  HttpStackUtils::SpawningHandler<CallListTask, CallListTask::Config> call_list_handler(&call_list_config, &sas_logger);
+
+  std::vector<Result> results;
+
+  for (size_t ii = 0; ii < options.worker_threads.size(); ii++)
+  {
+    // Use a new port for each configuration, so connections from the last
+    // one can't interfere.
+    int port = options.port + ii;
+    options.load.server = "http://127.0.0.1:" + std::to_string(port);
+
+    HttpStack* http_stack = new HttpStack(options.http_threads,
+                                          exception_handler,
+                                          NULL,
+                                          load_monitor,
+                                          &stats_manager);
+    HttpStackUtils::HandlerThreadPool* pool =
+      new HttpStackUtils::HandlerThreadPool(options.worker_threads[ii],
+                                            exception_handler);
+
+    try
+    {
+      http_stack->initialize();
+      http_stack->bind_tcp_socket("127.0.0.1", port);
+      http_stack->register_handler(CALL_LIST_PATH.c_str(),
+                                   pool->wrap(&call_list_handler));
+      http_stack->start();
+    }
+    catch (HttpStack::Exception& e)
+    {
+      fprintf(stderr, "Failed to start HttpStack - function %s, rc %d\n",
+              e._func, e._rc);
+      return 2;
+    }
+
+    printf("Running with %d worker threads...\n", options.worker_threads[ii]);
+    fflush(stdout);
+
+    Result result;
+    result.worker_threads = options.worker_threads[ii];
+    run_load(options, result);
+    results.push_back(result);
+
+    try
+    {
+      http_stack->stop();
+      http_stack->wait_stopped();
+    }
+    catch (HttpStack::Exception& e)
+    {
+      fprintf(stderr, "Failed to stop HttpStack - function %s, rc %d\n",
+              e._func, e._rc);
+    }
+
+    delete http_stack; http_stack = NULL;
+    delete pool; pool = NULL;
+  }
+
+  print_results(results);
+
+  delete load_monitor; load_monitor = NULL;
+  delete stats_aggregator; stats_aggregator = NULL;
+  delete exception_handler; exception_handler = NULL;
+  delete hc; hc = NULL;
+  delete call_list_store; call_list_store = NULL;
+  delete homestead_conn; homestead_conn = NULL;
+  delete auth_store; auth_store = NULL;
+  delete local_store; local_store = NULL;
+  curl_global_cleanup();
+
+  return 0;
+}
@@ -0,0 +1,406 @@
+/**
+ * @file memento_http_stress.cpp Open-loop HTTP load generator for memento.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+// Requests call lists from memento at a fixed rate, spread over a range of
+// subscribers, and reports the latencies of the responses.  See LoadWorker
+// for how the load is generated.
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "http_load.h"
+
+struct Options
+{
+  LoadOptions load;
+  double rate;
+  int connections;
+  int threads;
+  double duration_s;
+  double stats_interval_s;
+};
+
+/// Set when the run should stop.
+static std::atomic<bool> stopping(false);
+
+static void print_interval(double elapsed_s, double interval_s, const LoadStats& stats)
+{
+  printf("[%8.1fs] %9.1f resp/s", elapsed_s, stats.responses() / interval_s);
+
+  for (int ii = 0; ii < NUM_RESPONSE_CLASSES; ii++)
+  {
+    const LatencyHistogram& latency = stats.latency_us[ii];
+
+    if (latency.count() > 0)
+    {
+      printf(" | %s: %lu p50 %.1fms p99 %.1fms",
+             RESPONSE_CLASS_NAMES[ii],
+             latency.count(),
+             latency.percentile(50) / 1000.0,
+             latency.percentile(99) / 1000.0);
+    }
+  }
+
+  if (stats.dropped > 0)
+  {
+    printf(" | dropped: %lu", stats.dropped);
+  }
+
+  printf("\n");
+  fflush(stdout);
+}
+
+static void print_summary(double elapsed_s, const LoadStats& stats)
+{
+  static const size_t NUM_PERCENTILES = 5;
+  static const double PERCENTILES[NUM_PERCENTILES] = {50, 90, 99, 99.9, 99.99};
+  static const char* PERCENTILE_NAMES[NUM_PERCENTILES] =
+  {
+    "p50", "p90", "p99", "p99.9", "p99.99"
+  };
+
+  printf("\nRan for %.1fs: %lu responses (%.1f/s), %lu challenges (%lu stale), "
+         "%lu requests dropped\n\n",
+         elapsed_s,
+         stats.responses(),
+         stats.responses() / elapsed_s,
+         stats.challenges,
+         stats.stale,
+         stats.dropped);
+
+  printf("%-6s %10s %10s", "Class", "Count", "Rate/s");
+
+  for (size_t ii = 0; ii < NUM_PERCENTILES; ii++)
+  {
+    printf(" %9s", PERCENTILE_NAMES[ii]);
+  }
+
+  printf(" %9s   (latencies in ms)\n", "max");
+
+  for (int ii = 0; ii < NUM_RESPONSE_CLASSES; ii++)
+  {
+    const LatencyHistogram& latency = stats.latency_us[ii];
+
+    if (latency.count() == 0)
+    {
+      continue;
+    }
+
+    printf("%-6s %10lu %10.1f",
+           RESPONSE_CLASS_NAMES[ii],
+           latency.count(),
+           latency.count() / elapsed_s);
+
+    for (size_t jj = 0; jj < NUM_PERCENTILES; jj++)
+    {
+      printf(" %9.2f", latency.percentile(PERCENTILES[jj]) / 1000.0);
+    }
+
+    printf(" %9.2f\n", latency.max() / 1000.0);
+  }
+}
+
+static void usage()
+{
+  printf("Usage: memento_http_stress [options]\n"
+         "\n"
+         " --server <url>             Memento server, e.g. https://memento.example.com\n"
+         " --domain <domain>          The subscribers' home domain\n"
+         " --start-dn <dn>            Start of the DN range\n"
+         " --end-dn <dn>              End of the DN range\n"
+         " --rate <requests/s>        Target request rate\n"
+         " --arrivals <constant|poisson>\n"
+         "                            Whether requests are evenly spaced or arrive as a\n"
+         "                            Poisson process (default: constant)\n"
+         " --password <password>      Password for all subscribers (default: 7kkzTyGW)\n"
+         " --api-key <key>            Authenticate with this API key rather than digest\n"
+         " --connections <n>          Number of connections to use (default: 100)\n"
+         " --threads <n>              Number of threads to use (default: 4)\n"
+         " --duration <secs>          How long to run for (default: until interrupted)\n"
+         " --stats-interval <secs>    How often to report statistics (default: 10)\n"
+         " --timeout <secs>           Request timeout (default: 10)\n"
+         " --max-backlog <n>          Requests that may wait for a connection, per\n"
+         "                            thread, before new ones are dropped (default: 100000)\n"
+         " --insecure                 Don't check the server's certificate\n"
+         " --compressed               Request a compressed response\n"
+         " --help                     Show this help screen\n");
+}
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+  enum OptionTypes
+  {
+    SERVER = 128,
+    HOME_DOMAIN,
+    START_DN,
+    END_DN,
+    RATE,
+    ARRIVALS,
+    PASSWORD,
+    API_KEY,
+    CONNECTIONS,
+    THREADS,
+    DURATION,
+    STATS_INTERVAL,
+    TIMEOUT,
+    MAX_BACKLOG,
+    INSECURE,
+    COMPRESSED,
+    HELP
+  };
+
+  static const struct option long_opt[] =
+  {
+    {"server",         required_argument, NULL, SERVER},
+    {"domain",         required_argument, NULL, HOME_DOMAIN},
+    {"start-dn",       required_argument, NULL, START_DN},
+    {"end-dn",         required_argument, NULL, END_DN},
+    {"rate",           required_argument, NULL, RATE},
+    {"arrivals",       required_argument, NULL, ARRIVALS},
+    {"password",       required_argument, NULL, PASSWORD},
+    {"api-key",        required_argument, NULL, API_KEY},
+    {"connections",    required_argument, NULL, CONNECTIONS},
+    {"threads",        required_argument, NULL, THREADS},
+    {"duration",       required_argument, NULL, DURATION},
+    {"stats-interval", required_argument, NULL, STATS_INTERVAL},
+    {"timeout",        required_argument, NULL, TIMEOUT},
+    {"max-backlog",    required_argument, NULL, MAX_BACKLOG},
+    {"insecure",       no_argument,       NULL, INSECURE},
+    {"compressed",     no_argument,       NULL, COMPRESSED},
+    {"help",           no_argument,       NULL, HELP},
+    {NULL,             0,                 NULL, 0},
+  };
+
+  bool have_start_dn = false;
+  bool have_end_dn = false;
+  int opt;
+  int long_opt_ind;
+
+  while ((opt = getopt_long(argc, argv, "", long_opt, &long_opt_ind)) != -1)
+  {
+    switch (opt)
+    {
+    case SERVER:
+      options.load.server = optarg;
+      break;
+
+    case HOME_DOMAIN:
+      options.load.domain = optarg;
+      break;
+
+    case START_DN:
+      options.load.start_dn = strtoull(optarg, NULL, 10);
+      have_start_dn = true;
+      break;
+
+    case END_DN:
+      options.load.end_dn = strtoull(optarg, NULL, 10);
+      have_end_dn = true;
+      break;
+
+    case RATE:
+      options.rate = atof(optarg);
+      break;
+
+    case ARRIVALS:
+      if (std::string(optarg) == "poisson")
+      {
+        options.load.poisson = true;
+      }
+      else if (std::string(optarg) != "constant")
+      {
+        fprintf(stderr, "Unknown arrival process %s\n", optarg);
+        return false;
+      }
+      break;
+
+    case PASSWORD:
+      options.load.password = optarg;
+      break;
+
+    case API_KEY:
+      options.load.api_key = optarg;
+      break;
+
+    case CONNECTIONS:
+      options.connections = atoi(optarg);
+      break;
+
+    case THREADS:
+      options.threads = atoi(optarg);
+      break;
+
+    case DURATION:
+      options.duration_s = atof(optarg);
+      break;
+
+    case STATS_INTERVAL:
+      options.stats_interval_s = atof(optarg);
+      break;
+
+    case TIMEOUT:
+      options.load.timeout_ms = (long)(atof(optarg) * 1000);
+      break;
+
+    case MAX_BACKLOG:
+      options.load.max_backlog = strtoull(optarg, NULL, 10);
+      break;
+
+    case INSECURE:
+      options.load.insecure = true;
+      break;
+
+    case COMPRESSED:
+      options.load.compressed = true;
+      break;
+
+    default:
+      usage();
+      return false;
+    }
+  }
+
+  if ((options.load.server.empty()) ||
+      (options.load.domain.empty()) ||
+      (!have_start_dn) ||
+      (!have_end_dn) ||
+      (options.rate <= 0))
+  {
+    fprintf(stderr, "--server, --domain, --start-dn, --end-dn and --rate are required\n");
+    return false;
+  }
+
+  if (options.load.end_dn < options.load.start_dn)
+  {
+    fprintf(stderr, "--end-dn must not be less than --start-dn\n");
+    return false;
+  }
+
+  if ((options.threads <= 0) || (options.connections < options.threads))
+  {
+    fprintf(stderr, "There must be at least one thread, and a connection per thread\n");
+    return false;
+  }
+
+  if (options.load.end_dn - options.load.start_dn + 1 < (uint64_t)options.threads)
+  {
+    fprintf(stderr, "There must be at least one DN per thread\n");
+    return false;
+  }
+
+  if (options.load.server.find("://") == std::string::npos)
+  {
+    options.load.server = "https://" + options.load.server;
+  }
+
+  return true;
+}
+
+static void signal_handler(int sig)
+{
+  stopping = true;
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  options.rate = 0;
+  options.connections = 100;
+  options.threads = 4;
+  options.duration_s = 0;
+  options.stats_interval_s = 10;
+
+  if (!parse_options(argc, argv, options))
+  {
+    return 1;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  signal(SIGINT, signal_handler);
+  signal(SIGTERM, signal_handler);
+
+  // Split the subscribers, rate and connections between the threads.
+  std::vector<LoadWorker*> workers;
+  uint64_t num_dns = options.load.end_dn - options.load.start_dn + 1;
+
+  for (int ii = 0; ii < options.threads; ii++)
+  {
+    uint64_t first_dn = options.load.start_dn + (num_dns * ii) / options.threads;
+    uint64_t last_dn = options.load.start_dn + (num_dns * (ii + 1)) / options.threads - 1;
+    int connections = (options.connections * (ii + 1)) / options.threads -
+                      (options.connections * ii) / options.threads;
+    workers.push_back(new LoadWorker(options.load,
+                                     ii,
+                                     first_dn,
+                                     last_dn,
+                                     options.rate / options.threads,
+                                     connections));
+  }
+
+  uint64_t start_ns = load_now_ns();
+
+  for (size_t ii = 0; ii < workers.size(); ii++)
+  {
+    if (!workers[ii]->start())
+    {
+      fprintf(stderr, "Failed to start thread\n");
+      return 1;
+    }
+  }
+
+  LoadStats total;
+  uint64_t last_stats_ns = start_ns;
+
+  while (!stopping)
+  {
+    usleep(100000);
+    uint64_t now = load_now_ns();
+
+    if ((options.duration_s > 0) && (now - start_ns >= options.duration_s * 1e9))
+    {
+      stopping = true;
+    }
+
+    if ((stopping) || (now - last_stats_ns >= options.stats_interval_s * 1e9))
+    {
+      LoadStats interval;
+
+      for (size_t ii = 0; ii < workers.size(); ii++)
+      {
+        workers[ii]->take_stats(interval);
+      }
+
+      print_interval((now - start_ns) / 1e9, (now - last_stats_ns) / 1e9, interval);
+      total.add(interval);
+      last_stats_ns = now;
+    }
+  }
+
+  for (size_t ii = 0; ii < workers.size(); ii++)
+  {
+    workers[ii]->stop();
+
+    // Pick up anything that completed after the last report.
+    workers[ii]->take_stats(total);
+    delete workers[ii];
+  }
+
+  print_summary((load_now_ns() - start_ns) / 1e9, total);
+  curl_global_cleanup();
+
+  return 0;
+}
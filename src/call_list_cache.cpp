@@ -0,0 +1,100 @@
+/**
+ * @file call_list_cache.cpp In-memory cache of rendered call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "call_list_cache.h"
+#include "log.h"
+
+// Allowance for the memory used by the cache's own structures for each
+// entry (list and hash table nodes, shared pointer control block etc.)
+static const size_t ENTRY_OVERHEAD_BYTES = 256;
+
+CallListCache::CallListCache(size_t max_bytes,
+                             int ttl_ms,
+                             Counter* hit_count,
+                             Counter* miss_count,
+                             Counter* eviction_count,
+                             int num_shards) :
+  _cache("call list", max_bytes, ttl_ms, eviction_count, num_shards),
+  _hit_count(hit_count),
+  _miss_count(miss_count)
+{
+}
+
+CallListCache::~CallListCache()
+{
+}
+
+std::shared_ptr<const CallListCache::Entry> CallListCache::get(const std::string& impu)
+{
+  std::shared_ptr<const Entry> entry;
+
+  if (_cache.get(impu, entry))
+  {
+    TRC_DEBUG("Found cached call list for %s", impu.c_str());
+    _hit_count->increment();
+  }
+  else
+  {
+    _miss_count->increment();
+  }
+
+  return entry;
+}
+
+void CallListCache::put(const std::string& impu,
+                        const std::shared_ptr<const Entry>& entry)
+{
+  _cache.put(impu, entry, entry_size(impu, *entry));
+}
+
+void CallListCache::add_compressed_body(const std::string& impu,
+                                        const std::string& etag,
+                                        CallListCompressor::Encoding encoding,
+                                        const std::string& compressed_body)
+{
+  std::shared_ptr<const Entry> old_entry;
+
+  if ((_cache.get(impu, old_entry, false)) && (old_entry->etag == etag))
+  {
+    // Cached entries are shared with requests that are using them, so must
+    // not be modified.  Replace the entry with a copy that has the compressed
+    // body, unless it has changed since it was read.
+    std::shared_ptr<Entry> entry(new Entry(*old_entry));
+    entry->compressed_bodies[encoding] = compressed_body;
+    _cache.replace(impu,
+                   old_entry,
+                   std::shared_ptr<const Entry>(entry),
+                   entry_size(impu, *entry));
+  }
+}
+
+size_t CallListCache::bytes_used()
+{
+  return _cache.size();
+}
+
+size_t CallListCache::entry_size(const std::string& impu, const Entry& entry)
+{
+  size_t size = (2 * impu.length()) +
+                entry.etag.length() +
+                entry.body.length() +
+                ENTRY_OVERHEAD_BYTES;
+
+  for (std::map<CallListCompressor::Encoding, std::string>::const_iterator ii =
+         entry.compressed_bodies.begin();
+       ii != entry.compressed_bodies.end();
+       ++ii)
+  {
+    size += ii->second.length();
+  }
+
+  return size;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file call_list_coalescer.cpp Coalescing of concurrent call list reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "call_list_coalescer.h"
+#include "log.h"
+
+CallListReadCoalescer::CallListReadCoalescer(Counter* coalesced_count) :
+  _reads(),
+  _coalesced_count(coalesced_count)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+CallListReadCoalescer::~CallListReadCoalescer()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+bool CallListReadCoalescer::lead_or_follow(const std::string& impu,
+                                           Follower* follower)
+{
+  bool leader = false;
+
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, std::vector<Follower*> >::iterator it =
+                                                              _reads.find(impu);
+
+  if (it == _reads.end())
+  {
+    _reads[impu];
+    leader = true;
+  }
+  else
+  {
+    it->second.push_back(follower);
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  if (!leader)
+  {
+    TRC_DEBUG("Wait for read of call list for %s already in progress",
+              impu.c_str());
+    _coalesced_count->increment();
+  }
+
+  return leader;
+}
+
+void CallListReadCoalescer::leader_done(const std::string& impu,
+                                        std::vector<Follower*>& followers)
+{
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, std::vector<Follower*> >::iterator it =
+                                                              _reads.find(impu);
+
+  if (it != _reads.end())
+  {
+    followers.swap(it->second);
+    _reads.erase(it);
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  if (!followers.empty())
+  {
+    TRC_DEBUG("Share call list for %s with %zu waiting requests",
+              impu.c_str(),
+              followers.size());
+  }
+}
@@ -0,0 +1,243 @@
+/**
+ * @file call_list_compression.cpp Compression of call list responses.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "call_list_compression.h"
+#include "log.h"
+
+// Compression levels.  The normal levels are each library's default.
+static const int GZIP_NORMAL_LEVEL = 6;
+static const int GZIP_BUSY_LEVEL = 1;
+static const int ZSTD_NORMAL_LEVEL = 3;
+static const int ZSTD_BUSY_LEVEL = 1;
+
+// gzip wrapper around the deflate stream, with the default 32KB window.
+static const int GZIP_WINDOW_BITS = 15 + 16;
+static const int GZIP_MEM_LEVEL = 8;
+
+CallListCompressor::CallListCompressor(int busy_threshold) :
+  _requests_in_progress(0),
+  _busy_threshold(busy_threshold)
+{
+}
+
+CallListCompressor::~CallListCompressor()
+{
+}
+
+CallListCompressor::Encoding CallListCompressor::choose_encoding(const std::string& accept_encoding)
+{
+  // Find the quality value the client has given each encoding we support.
+  // Encodings the client doesn't mention get the quality value of "*", if
+  // present, and are otherwise unacceptable.
+  float gzip_q = -1;
+  float zstd_q = -1;
+  float any_q = 0;
+
+  size_t start = 0;
+
+  while (start < accept_encoding.length())
+  {
+    size_t end = accept_encoding.find(',', start);
+
+    if (end == std::string::npos)
+    {
+      end = accept_encoding.length();
+    }
+
+    std::string coding = accept_encoding.substr(start, end - start);
+    start = end + 1;
+
+    float q = 1;
+    size_t params = coding.find(';');
+
+    if (params != std::string::npos)
+    {
+      size_t q_param = coding.find("q=", params);
+
+      if (q_param != std::string::npos)
+      {
+        q = strtof(coding.c_str() + q_param + 2, NULL);
+      }
+
+      coding.erase(params);
+    }
+
+    coding.erase(0, coding.find_first_not_of(" \t"));
+    coding.erase(coding.find_last_not_of(" \t") + 1);
+
+    if ((strcasecmp(coding.c_str(), "gzip") == 0) ||
+        (strcasecmp(coding.c_str(), "x-gzip") == 0))
+    {
+      gzip_q = q;
+    }
+    else if (strcasecmp(coding.c_str(), "zstd") == 0)
+    {
+      zstd_q = q;
+    }
+    else if (coding == "*")
+    {
+      any_q = q;
+    }
+  }
+
+  if (gzip_q < 0)
+  {
+    gzip_q = any_q;
+  }
+
+  if (zstd_q < 0)
+  {
+    zstd_q = any_q;
+  }
+
+  // Prefer zstd, as it's both faster and smaller.
+  if ((zstd_q > 0) && (zstd_q >= gzip_q))
+  {
+    return ZSTD;
+  }
+  else if (gzip_q > 0)
+  {
+    return GZIP;
+  }
+
+  return IDENTITY;
+}
+
+const char* CallListCompressor::encoding_name(Encoding encoding)
+{
+  switch (encoding)
+  {
+  case GZIP:
+    return "gzip";
+
+  case ZSTD:
+    return "zstd";
+
+  default:
+    return "identity";
+  }
+}
+
+int CallListCompressor::level(Encoding encoding) const
+{
+  bool busy = (_requests_in_progress > _busy_threshold);
+
+  if (encoding == ZSTD)
+  {
+    return busy ? ZSTD_BUSY_LEVEL : ZSTD_NORMAL_LEVEL;
+  }
+  else
+  {
+    return busy ? GZIP_BUSY_LEVEL : GZIP_NORMAL_LEVEL;
+  }
+}
+
+bool CallListCompressor::compress(Encoding encoding,
+                                  const std::string& body,
+                                  std::string& compressed)
+{
+  int compression_level = level(encoding);
+  TRC_DEBUG("Compress %zu byte call list with %s at level %d",
+            body.length(),
+            encoding_name(encoding),
+            compression_level);
+
+  bool success;
+
+  switch (encoding)
+  {
+  case GZIP:
+    success = gzip(body, compression_level, compressed);
+    break;
+
+  case ZSTD:
+    success = zstd(body, compression_level, compressed);
+    break;
+
+  default:
+    // LCOV_EXCL_START - callers never ask for the identity encoding
+    TRC_ERROR("Asked to compress call list with unknown encoding %d", encoding);
+    success = false;
+    break;
+    // LCOV_EXCL_STOP
+  }
+
+  return success;
+}
+
+bool CallListCompressor::gzip(const std::string& body,
+                              int level,
+                              std::string& compressed)
+{
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+
+  if (deflateInit2(&stream,
+                   level,
+                   Z_DEFLATED,
+                   GZIP_WINDOW_BITS,
+                   GZIP_MEM_LEVEL,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    TRC_ERROR("Failed to initialize gzip compression");
+    return false;
+  }
+
+  // Compress the body in a single pass into a buffer large enough for the
+  // worst case.
+  compressed.resize(deflateBound(&stream, body.length()));
+  stream.next_in = (Bytef*)body.data();
+  stream.avail_in = body.length();
+  stream.next_out = (Bytef*)&compressed[0];
+  stream.avail_out = compressed.length();
+
+  int rc = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+
+  if (rc != Z_STREAM_END)
+  {
+    TRC_ERROR("Failed to gzip call list (rc = %d)", rc);
+    return false;
+  }
+
+  return true;
+}
+
+bool CallListCompressor::zstd(const std::string& body,
+                              int level,
+                              std::string& compressed)
+{
+  compressed.resize(ZSTD_compressBound(body.length()));
+
+  size_t rc = ZSTD_compress(&compressed[0],
+                            compressed.length(),
+                            body.data(),
+                            body.length(),
+                            level);
+
+  if (ZSTD_isError(rc))
+  {
+    TRC_ERROR("Failed to zstd compress call list: %s", ZSTD_getErrorName(rc));
+    compressed.clear();
+    return false;
+  }
+
+  compressed.resize(rc);
+  return true;
+}
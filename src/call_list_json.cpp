@@ -0,0 +1,235 @@
+/**
+ * @file call_list_json.cpp JSON and CBOR representations of call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "call_list_json.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+static const std::string CALLS = "calls";
+
+// CBOR major types.
+static const uint8_t CBOR_TEXT_STRING = 3;
+static const uint8_t CBOR_MAP = 5;
+
+// CBOR bytes for the start of an array of unknown length, and the end of it.
+static const char CBOR_INDEFINITE_ARRAY = '\x9f';
+static const char CBOR_BREAK = '\xff';
+
+/// @returns          Whether an XML element has child elements (as opposed to
+///                   just a value).
+static bool has_child_elements(rapidxml::xml_node<>* node)
+{
+  for (rapidxml::xml_node<>* child = node->first_node();
+       child != NULL;
+       child = child->next_sibling())
+  {
+    if (child->type() == rapidxml::node_element)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Writes the elements in a list of XML nodes as the members of a JSON object.
+static void write_json_members(rapidxml::xml_node<>* first_node,
+                               rapidjson::Writer<rapidjson::StringBuffer>& json)
+{
+  for (rapidxml::xml_node<>* node = first_node;
+       node != NULL;
+       node = node->next_sibling())
+  {
+    if (node->type() != rapidxml::node_element)
+    {
+      continue;
+    }
+
+    json.String(node->name(), node->name_size());
+
+    if (has_child_elements(node))
+    {
+      json.StartObject();
+      write_json_members(node->first_node(), json);
+      json.EndObject();
+    }
+    else
+    {
+      json.String(node->value(), node->value_size());
+    }
+  }
+}
+
+size_t write_json_from_call_records(const std::vector<CallListStore::CallFragment>& records,
+                                  CallListWriter& writer,
+                                  size_t max_size,
+                                  SAS::TrailId trail)
+{
+  std::vector<CallRecord> calls;
+  valid_call_records(records, calls, trail);
+  size_t first_call = first_call_within_size(calls, max_size);
+
+  // The JSON is built up a call at a time in the buffer, which is passed to
+  // the writer and then cleared.
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> json(buffer);
+
+  json.StartObject();
+  json.String(CALLS.c_str(), CALLS.length());
+  json.StartArray();
+
+  std::vector<char> xml_buffer;
+  rapidxml::xml_document<> doc;
+
+  for (size_t ii = first_call; ii < calls.size(); ii++)
+  {
+    if (parse_call_xml(calls[ii], xml_buffer, doc))
+    {
+      json.StartObject();
+      write_json_members(doc.first_node(), json);
+      json.EndObject();
+
+      writer.write(std::string(buffer.GetString(), buffer.GetSize()));
+      buffer.Clear();
+    }
+  }
+
+  json.EndArray();
+  json.EndObject();
+
+  writer.write(std::string(buffer.GetString(), buffer.GetSize()));
+
+  return first_call;
+}
+
+/// Appends the head of a CBOR data item with the given major type and
+/// length.
+static void write_cbor_head(uint8_t major_type, uint64_t length, std::string& cbor)
+{
+  uint8_t type_bits = major_type << 5;
+
+  if (length < 24)
+  {
+    cbor.push_back(type_bits | length);
+  }
+  else
+  {
+    int num_bytes;
+
+    if (length <= 0xff)
+    {
+      cbor.push_back(type_bits | 24);
+      num_bytes = 1;
+    }
+    else if (length <= 0xffff)
+    {
+      cbor.push_back(type_bits | 25);
+      num_bytes = 2;
+    }
+    else if (length <= 0xffffffff)
+    {
+      cbor.push_back(type_bits | 26);
+      num_bytes = 4;
+    }
+    else
+    {
+      cbor.push_back(type_bits | 27); // LCOV_EXCL_LINE
+      num_bytes = 8;                  // LCOV_EXCL_LINE
+    }
+
+    // The length follows in network byte order.
+    for (int ii = num_bytes - 1; ii >= 0; ii--)
+    {
+      cbor.push_back((length >> (8 * ii)) & 0xff);
+    }
+  }
+}
+
+static void write_cbor_string(const char* data, size_t length, std::string& cbor)
+{
+  write_cbor_head(CBOR_TEXT_STRING, length, cbor);
+  cbor.append(data, length);
+}
+
+/// Writes the elements in a list of XML nodes as a CBOR map.
+static void write_cbor_map(rapidxml::xml_node<>* first_node, std::string& cbor)
+{
+  size_t num_members = 0;
+
+  for (rapidxml::xml_node<>* node = first_node;
+       node != NULL;
+       node = node->next_sibling())
+  {
+    if (node->type() == rapidxml::node_element)
+    {
+      num_members++;
+    }
+  }
+
+  write_cbor_head(CBOR_MAP, num_members, cbor);
+
+  for (rapidxml::xml_node<>* node = first_node;
+       node != NULL;
+       node = node->next_sibling())
+  {
+    if (node->type() != rapidxml::node_element)
+    {
+      continue;
+    }
+
+    write_cbor_string(node->name(), node->name_size(), cbor);
+
+    if (has_child_elements(node))
+    {
+      write_cbor_map(node->first_node(), cbor);
+    }
+    else
+    {
+      write_cbor_string(node->value(), node->value_size(), cbor);
+    }
+  }
+}
+
+size_t write_cbor_from_call_records(const std::vector<CallListStore::CallFragment>& records,
+                                  CallListWriter& writer,
+                                  size_t max_size,
+                                  SAS::TrailId trail)
+{
+  std::vector<CallRecord> calls;
+  valid_call_records(records, calls, trail);
+  size_t first_call = first_call_within_size(calls, max_size);
+
+  // The document is a map with a single member, holding the array of calls.
+  // Calls with invalid XML are skipped, so the number of calls isn't known
+  // up front and the array has an indefinite length.
+  std::string cbor;
+  write_cbor_head(CBOR_MAP, 1, cbor);
+  write_cbor_string(CALLS.c_str(), CALLS.length(), cbor);
+  cbor.push_back(CBOR_INDEFINITE_ARRAY);
+
+  std::vector<char> xml_buffer;
+  rapidxml::xml_document<> doc;
+
+  for (size_t ii = first_call; ii < calls.size(); ii++)
+  {
+    if (parse_call_xml(calls[ii], xml_buffer, doc))
+    {
+      write_cbor_map(doc.first_node(), cbor);
+      writer.write(cbor);
+      cbor.clear();
+    }
+  }
+
+  cbor.push_back(CBOR_BREAK);
+  writer.write(cbor);
+
+  return first_call;
+}
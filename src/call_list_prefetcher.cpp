@@ -0,0 +1,163 @@
+/**
+ * @file call_list_prefetcher.cpp Speculative reads of call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "call_list_prefetcher.h"
+#include "log.h"
+#include "monotonic_clock.h"
+
+CallListPrefetcher::CallListPrefetcher(CallListStore::Store* call_list_store,
+                                       int ttl_ms,
+                                       int max_prefetches,
+                                       Counter* prefetch_count,
+                                       Counter* hit_count,
+                                       Counter* wasted_count) :
+  _call_list_store(call_list_store),
+  _ttl_ms(ttl_ms),
+  _max_prefetches(max_prefetches),
+  _prefetches(),
+  _expiry_queue(),
+  _prefetch_count(prefetch_count),
+  _hit_count(hit_count),
+  _wasted_count(wasted_count)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+CallListPrefetcher::~CallListPrefetcher()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+void CallListPrefetcher::prefetch(const std::string& impu, SAS::TrailId trail)
+{
+  pthread_mutex_lock(&_lock);
+
+  expire_prefetches(MonotonicClock::now_ms());
+
+  if ((_prefetches.find(impu) != _prefetches.end()) ||
+      (_prefetches.size() >= _max_prefetches))
+  {
+    // Either this call list has already been prefetched, or we're
+    // prefetching as much as we're allowed to.
+    pthread_mutex_unlock(&_lock);
+    return;
+  }
+
+  Prefetch& prefetch = _prefetches[impu];
+  prefetch.ready = false;
+  prefetch.expiry_ms = 0;
+
+  pthread_mutex_unlock(&_lock);
+
+  TRC_DEBUG("Prefetch call fragments for %s", impu.c_str());
+  _prefetch_count->increment();
+
+  CassandraStore::Operation* op =
+                             _call_list_store->new_get_call_fragments_op(impu);
+  CassandraStore::Transaction* tsx = new PrefetchTsx(this, impu, trail);
+  _call_list_store->do_async(op, tsx);
+}
+
+bool CallListPrefetcher::take(const std::string& impu,
+                              std::vector<CallListStore::CallFragment>& records)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&_lock);
+
+  expire_prefetches(MonotonicClock::now_ms());
+
+  std::unordered_map<std::string, Prefetch>::iterator it = _prefetches.find(impu);
+
+  // If the prefetch is still in progress, don't wait for it.
+  if ((it != _prefetches.end()) && (it->second.ready))
+  {
+    records.swap(it->second.records);
+    _prefetches.erase(it);
+    found = true;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  if (found)
+  {
+    TRC_DEBUG("Use prefetched call fragments for %s", impu.c_str());
+    _hit_count->increment();
+  }
+
+  return found;
+}
+
+void CallListPrefetcher::prefetch_complete(const std::string& impu,
+                                           bool success,
+                                           std::vector<CallListStore::CallFragment>& records)
+{
+  pthread_mutex_lock(&_lock);
+
+  unsigned long now = MonotonicClock::now_ms();
+  std::unordered_map<std::string, Prefetch>::iterator it = _prefetches.find(impu);
+
+  if (it != _prefetches.end())
+  {
+    if (success)
+    {
+      it->second.ready = true;
+      it->second.expiry_ms = now + _ttl_ms;
+      it->second.records.swap(records);
+      _expiry_queue.push_back(std::make_pair(it->second.expiry_ms, impu));
+    }
+    else
+    {
+      _prefetches.erase(it);
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+}
+
+void CallListPrefetcher::expire_prefetches(unsigned long now)
+{
+  while ((!_expiry_queue.empty()) && (_expiry_queue.front().first <= now))
+  {
+    std::unordered_map<std::string, Prefetch>::iterator it =
+                                   _prefetches.find(_expiry_queue.front().second);
+
+    // The prefetch may already have been used (and the IMPU prefetched
+    // again), so check it's the prefetch that this queue entry is for.
+    if ((it != _prefetches.end()) &&
+        (it->second.ready) &&
+        (it->second.expiry_ms == _expiry_queue.front().first))
+    {
+      TRC_DEBUG("Prefetched call fragments for %s expired unused",
+                it->first.c_str());
+      _prefetches.erase(it);
+      _wasted_count->increment();
+    }
+
+    _expiry_queue.pop_front();
+  }
+}
+
+void CallListPrefetcher::PrefetchTsx::on_success(CassandraStore::Operation* op)
+{
+  std::vector<CallListStore::CallFragment> records;
+  ((CallListStore::GetCallFragments*)op)->get_result(records);
+  _prefetcher->prefetch_complete(_impu, true, records);
+}
+
+void CallListPrefetcher::PrefetchTsx::on_failure(CassandraStore::Operation* op)
+{
+  // NOT_FOUND just means the subscriber hasn't made any calls.
+  std::vector<CallListStore::CallFragment> records;
+  _prefetcher->prefetch_complete(_impu,
+                                 (op->get_result_code() == CassandraStore::NOT_FOUND),
+                                 records);
+}
@@ -0,0 +1,339 @@
+/**
+ * @file call_list_range.cpp Time-ranged and size-limited call list reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <strings.h>
+
+#include "call_list_range.h"
+#include "log.h"
+
+namespace cass = org::apache::cassandra;
+
+// The layout of the call list store.  Each call fragment is a column in the
+// subscriber's row, named call_<timestamp>_<id>_<type>.  Columns are sorted by
+// name, and so by timestamp.
+static const std::string COLUMN_FAMILY = "call_lists";
+static const std::string CALL_COLUMN_PREFIX = "call_";
+static const std::string BEGIN_STR = "begin";
+static const std::string END_STR = "end";
+static const std::string REJECTED_STR = "rejected";
+
+// Length of a YYYYMMDDHHMMSS timestamp.
+static const size_t TIMESTAMP_LENGTH = 14;
+
+// Character that sorts after the '_' that follows the timestamp in a column
+// name, and after any digit.  The call_lists comparator is UTF8Type, so
+// slice bounds must be valid UTF-8.
+static const std::string AFTER_TIMESTAMP = "`";
+
+/// @returns                 Whether the fragments of a call (in the order
+///                          read from the store) make up a call that will be
+///                          returned to the client - a single REJECTED
+///                          fragment, or a BEGIN and an END.
+static bool is_complete_call(const std::vector<CallListStore::CallFragment>& fragments)
+{
+  typedef CallListStore::CallFragment::Type FragmentType;
+
+  if (fragments.size() == 1)
+  {
+    return (fragments[0].type == FragmentType::REJECTED);
+  }
+  else if (fragments.size() == 2)
+  {
+    // The slice is read newest first, so the END comes before the BEGIN.
+    return ((fragments[0].type == FragmentType::END) &&
+            (fragments[1].type == FragmentType::BEGIN));
+  }
+
+  return false;
+}
+
+HTTPCode CallListRange::parse(const std::string& since_param,
+                              const std::string& until_param,
+                              const std::string& limit_param)
+{
+  if ((!since_param.empty()) && (!parse_timestamp(since_param, since)))
+  {
+    TRC_DEBUG("Invalid since parameter: %s", since_param.c_str());
+    return HTTP_BAD_REQUEST;
+  }
+
+  if ((!until_param.empty()) && (!parse_timestamp(until_param, until)))
+  {
+    TRC_DEBUG("Invalid until parameter: %s", until_param.c_str());
+    return HTTP_BAD_REQUEST;
+  }
+
+  if (!limit_param.empty())
+  {
+    char* end = NULL;
+    long value = strtol(limit_param.c_str(), &end, 10);
+
+    if ((*end != '\0') ||
+        (value <= 0) ||
+        (value > std::numeric_limits<int>::max() / 2))
+    {
+      TRC_DEBUG("Invalid limit parameter: %s", limit_param.c_str());
+      return HTTP_BAD_REQUEST;
+    }
+
+    limit = (int)value;
+  }
+
+  return HTTP_OK;
+}
+
+bool CallListRange::parse_timestamp(const std::string& param,
+                                    std::string& timestamp)
+{
+  // Strip out the separators used in call list documents, leaving just the
+  // digits.
+  timestamp.clear();
+
+  for (std::string::const_iterator ii = param.begin(); ii != param.end(); ++ii)
+  {
+    if ((*ii >= '0') && (*ii <= '9'))
+    {
+      timestamp.push_back(*ii);
+    }
+    else if ((*ii != '-') && (*ii != 'T') && (*ii != ':'))
+    {
+      return false;
+    }
+  }
+
+  return (timestamp.length() == TIMESTAMP_LENGTH);
+}
+
+GetCallFragmentsInRange::GetCallFragmentsInRange(const std::string& impu,
+                                                 const CallListRange& range) :
+  CassandraStore::Operation(),
+  _impu(impu),
+  _range(range),
+  _fragments()
+{
+}
+
+GetCallFragmentsInRange::~GetCallFragmentsInRange()
+{
+}
+
+void GetCallFragmentsInRange::get_result(std::vector<CallListStore::CallFragment>& fragments)
+{
+  fragments = _fragments;
+}
+
+void GetCallFragmentsInRange::build_predicate(const CallListRange& range,
+                                              cass::SlicePredicate& predicate)
+{
+  // The lower bound sorts before every column for a call at or after the
+  // since time, and the upper bound sorts after every column for a call at or
+  // before the until time.
+  std::string lower = CALL_COLUMN_PREFIX + range.since;
+  std::string upper = CALL_COLUMN_PREFIX + range.until + AFTER_TIMESTAMP;
+
+  // Read the newest calls first, so that a limited slice holds the most
+  // recent calls.  Valid calls have at most two fragments, so this many
+  // columns is enough to hold `limit` calls, plus one to tell whether there
+  // might be more.
+  cass::SliceRange slice_range;
+  slice_range.__set_start(upper);
+  slice_range.__set_finish(lower);
+  slice_range.__set_reversed(true);
+  slice_range.__set_count((range.limit > 0) ?
+                          (2 * range.limit) + 1 :
+                          std::numeric_limits<int32_t>::max());
+
+  predicate.__set_slice_range(slice_range);
+}
+
+bool GetCallFragmentsInRange::fragments_from_columns(const std::vector<cass::ColumnOrSuperColumn>& columns,
+                                                     int limit,
+                                                     bool truncated,
+                                                     std::vector<CallListStore::CallFragment>& fragments)
+{
+  ParseState state;
+  return fragments_from_columns(columns, 0, limit, truncated, state, fragments);
+}
+
+bool GetCallFragmentsInRange::fragments_from_columns(const std::vector<cass::ColumnOrSuperColumn>& columns,
+                                                     size_t first_column,
+                                                     int limit,
+                                                     bool truncated,
+                                                     ParseState& state,
+                                                     std::vector<CallListStore::CallFragment>& fragments)
+{
+  // Fragments for the same call have the same timestamp and ID, so are
+  // adjacent in the slice.  Count the calls that will be returned to the
+  // client as we go - in progress and corrupt calls are dropped when the call
+  // list is built, so don't count towards the limit.
+  std::vector<CallListStore::CallFragment>& call_fragments = state.call_fragments;
+  std::string& current_call = state.current_call;
+  int& num_calls = state.num_calls;
+
+  for (std::vector<cass::ColumnOrSuperColumn>::const_iterator ii =
+         columns.begin() + std::min(first_column, columns.size());
+       ii != columns.end();
+       ++ii)
+  {
+    const std::string& name = ii->column.name;
+
+    // Split the column name into the timestamp, ID and type.  The ID may
+    // itself contain underscores.
+    size_t ts_end = name.find('_', CALL_COLUMN_PREFIX.length());
+    size_t type_start = name.rfind('_');
+
+    if ((name.compare(0, CALL_COLUMN_PREFIX.length(), CALL_COLUMN_PREFIX) != 0) ||
+        (ts_end == std::string::npos) ||
+        (type_start <= ts_end))
+    {
+      TRC_WARNING("Ignoring call list column with invalid name: %s", name.c_str());
+      continue;
+    }
+
+    std::string call = name.substr(0, type_start);
+    std::string type = name.substr(type_start + 1);
+
+    CallListStore::CallFragment fragment;
+    fragment.timestamp = name.substr(CALL_COLUMN_PREFIX.length(),
+                                     ts_end - CALL_COLUMN_PREFIX.length());
+    fragment.id = name.substr(ts_end + 1, type_start - ts_end - 1);
+    fragment.contents = ii->column.value;
+
+    if (strcasecmp(type.c_str(), BEGIN_STR.c_str()) == 0)
+    {
+      fragment.type = CallListStore::CallFragment::Type::BEGIN;
+    }
+    else if (strcasecmp(type.c_str(), END_STR.c_str()) == 0)
+    {
+      fragment.type = CallListStore::CallFragment::Type::END;
+    }
+    else if (strcasecmp(type.c_str(), REJECTED_STR.c_str()) == 0)
+    {
+      fragment.type = CallListStore::CallFragment::Type::REJECTED;
+    }
+    else
+    {
+      TRC_WARNING("Ignoring call list column with invalid type: %s", name.c_str());
+      continue;
+    }
+
+    if (call != current_call)
+    {
+      // This is the first fragment of a new call.  Add the fragments of the
+      // previous call to the results.
+      if (is_complete_call(call_fragments))
+      {
+        num_calls++;
+      }
+
+      fragments.insert(fragments.end(), call_fragments.begin(), call_fragments.end());
+      call_fragments.clear();
+      current_call = call;
+
+      if ((limit > 0) && (num_calls >= limit))
+      {
+        // We've got as many calls as the client wanted.
+        return true;
+      }
+    }
+
+    call_fragments.push_back(fragment);
+  }
+
+  // If the slice was cut short, the oldest call in it may be missing
+  // fragments, so hold it back - the rest of it may be on the next page.
+  if (!truncated)
+  {
+    if (is_complete_call(call_fragments))
+    {
+      num_calls++;
+    }
+
+    fragments.insert(fragments.end(), call_fragments.begin(), call_fragments.end());
+    call_fragments.clear();
+  }
+
+  return ((limit > 0) && (num_calls >= limit));
+}
+
+bool GetCallFragmentsInRange::perform(CassandraStore::Client* client,
+                                      SAS::TrailId trail)
+{
+  TRC_DEBUG("Get call fragments for %s (since: '%s', until: '%s', limit: %d)",
+            _impu.c_str(),
+            _range.since.c_str(),
+            _range.until.c_str(),
+            _range.limit);
+
+  cass::ColumnParent column_parent;
+  column_parent.__set_column_family(COLUMN_FAMILY);
+
+  cass::SlicePredicate predicate;
+  build_predicate(_range, predicate);
+
+  std::vector<cass::ColumnOrSuperColumn> columns;
+
+  // As with the other highly-available reads, try at consistency level ONE
+  // first and retry at QUORUM if nothing is found.
+  cass::ConsistencyLevel::type consistency_level = cass::ConsistencyLevel::ONE;
+  client->get_slice(columns, _impu, column_parent, predicate, consistency_level);
+
+  if (columns.empty())
+  {
+    consistency_level = cass::ConsistencyLevel::QUORUM;
+    client->get_slice(columns, _impu, column_parent, predicate, consistency_level);
+  }
+
+  if (columns.empty())
+  {
+    throw CassandraStore::RowNotFoundException(COLUMN_FAMILY, _impu);
+  }
+
+  size_t page_size = (size_t)predicate.slice_range.count;
+  size_t num_columns = columns.size();
+  bool truncated = ((_range.limit > 0) && (columns.size() >= page_size));
+
+  // Parse each page as it is read, carrying the call in progress at the end
+  // of one page over to the next.
+  ParseState state;
+  size_t first_column = 0;
+
+  while ((!fragments_from_columns(columns,
+                                  first_column,
+                                  _range.limit,
+                                  truncated,
+                                  state,
+                                  _fragments)) &&
+         (truncated))
+  {
+    // The slice was cut short before it held `limit` calls that will be
+    // returned, e.g. because some of the calls are still in progress.  Read
+    // on from the last column.  Slice bounds are inclusive, so the first
+    // column of the next page is the last column again, and is skipped.
+    TRC_DEBUG("Read more call fragments for %s", _impu.c_str());
+    predicate.slice_range.__set_start(columns.back().column.name);
+
+    std::vector<cass::ColumnOrSuperColumn> page;
+    client->get_slice(page, _impu, column_parent, predicate, consistency_level);
+
+    truncated = (page.size() >= page_size);
+    num_columns += (page.size() > 1) ? page.size() - 1 : 0;
+    columns.swap(page);
+    first_column = 1;
+  }
+
+  TRC_DEBUG("Read %zu call fragments from %zu columns",
+            _fragments.size(), num_columns);
+
+  return true;
+}
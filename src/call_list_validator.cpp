@@ -0,0 +1,568 @@
+/**
+ * @file call_list_validator.cpp Well-formedness checks for call XML.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CALL_XML_VALIDATOR_X86
+#endif
+
+#include "call_list_validator.h"
+
+// Bytes that need checking are '<' and '&' (markup), bytes below 0x20
+// (control characters, some of which are allowed) and bytes from 0x80 (the
+// start of multi-byte UTF-8 sequences).  Everything else is plain text.
+static inline bool is_special(unsigned char c)
+{
+  return (c == '<') || (c == '&') || (c < 0x20) || (c >= 0x80);
+}
+
+static const char* find_special_scalar(const char* p, const char* end)
+{
+  while ((p < end) && (!is_special(*p)))
+  {
+    p++;
+  }
+
+  return p;
+}
+
+#ifdef CALL_XML_VALIDATOR_X86
+// SSE2 is part of x86-64, so needs no runtime check.
+__attribute__((target("sse2")))
+static const char* find_special_sse2(const char* p, const char* end)
+{
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i amp = _mm_set1_epi8('&');
+  const __m128i max_control = _mm_set1_epi8(0x1f);
+
+  while (end - p >= 16)
+  {
+    __m128i data = _mm_loadu_si128((const __m128i*)p);
+
+    // A byte is a control character if it is unchanged by taking the
+    // (unsigned) minimum of it and 0x1f.  The top bit of each byte (which
+    // marks UTF-8 sequences) comes straight from the data.
+    __m128i special = _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(data, lt),
+                                     _mm_cmpeq_epi8(data, amp)),
+                        _mm_cmpeq_epi8(_mm_min_epu8(data, max_control), data));
+    int mask = _mm_movemask_epi8(special) | _mm_movemask_epi8(data);
+
+    if (mask != 0)
+    {
+      return p + __builtin_ctz(mask);
+    }
+
+    p += 16;
+  }
+
+  return find_special_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* find_special_avx2(const char* p, const char* end)
+{
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i max_control = _mm256_set1_epi8(0x1f);
+
+  while (end - p >= 32)
+  {
+    __m256i data = _mm256_loadu_si256((const __m256i*)p);
+    __m256i special = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(data, lt),
+                                        _mm256_cmpeq_epi8(data, amp)),
+                        _mm256_cmpeq_epi8(_mm256_min_epu8(data, max_control), data));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(special) |
+                        (unsigned int)_mm256_movemask_epi8(data);
+
+    if (mask != 0)
+    {
+      return p + __builtin_ctz(mask);
+    }
+
+    p += 32;
+  }
+
+  return find_special_sse2(p, end);
+}
+#endif
+
+CallXmlValidator::Implementation CallXmlValidator::best_implementation()
+{
+#ifdef CALL_XML_VALIDATOR_X86
+  if (__builtin_cpu_supports("avx2"))
+  {
+    return AVX2;
+  }
+
+  return SSE2;
+#else
+  return SCALAR;
+#endif
+}
+
+CallXmlValidator::CallXmlValidator(Implementation implementation) :
+  _find_special(find_special_scalar),
+  _depth(0),
+  _piece_start(NULL),
+  _piece_offset(0),
+  _error(NULL),
+  _error_offset(0)
+{
+#ifdef CALL_XML_VALIDATOR_X86
+  if ((implementation == AVX2) && (__builtin_cpu_supports("avx2")))
+  {
+    _find_special = find_special_avx2;
+  }
+  else if (implementation != SCALAR)
+  {
+    _find_special = find_special_sse2;
+  }
+#endif
+}
+
+bool CallXmlValidator::validate(const std::string* const pieces[],
+                                size_t num_pieces)
+{
+  _depth = 0;
+  _piece_offset = 0;
+  _error = NULL;
+  _error_offset = 0;
+
+  for (size_t ii = 0; ii < num_pieces; ii++)
+  {
+    _piece_start = pieces[ii]->data();
+
+    if (!scan(_piece_start, _piece_start + pieces[ii]->length()))
+    {
+      return false;
+    }
+
+    _piece_offset += pieces[ii]->length();
+  }
+
+  if (_depth != 0)
+  {
+    return fail("Unclosed element", _piece_start);
+  }
+
+  return true;
+}
+
+bool CallXmlValidator::scan(const char* p, const char* end)
+{
+  while (true)
+  {
+    p = _find_special(p, end);
+
+    if (p == end)
+    {
+      return true;
+    }
+
+    bool ok;
+    unsigned char c = *p;
+
+    if (c == '<')
+    {
+      ok = check_tag(p, end);
+    }
+    else if (c == '&')
+    {
+      ok = check_reference(p, end);
+    }
+    else if (c >= 0x80)
+    {
+      ok = check_utf8(p, end);
+    }
+    else if ((c == '\t') || (c == '\n') || (c == '\r'))
+    {
+      p++;
+      ok = true;
+    }
+    else
+    {
+      ok = fail("Control character", p);
+    }
+
+    if (!ok)
+    {
+      return false;
+    }
+  }
+}
+
+static inline bool is_space(char c)
+{
+  return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+/// Whether a character can be part of an element or attribute name.  Names
+/// can contain any non-ASCII character, so these aren't checked further.
+static inline bool is_name_char(char c)
+{
+  return ((c >= 'a') && (c <= 'z')) ||
+         ((c >= 'A') && (c <= 'Z')) ||
+         ((c >= '0') && (c <= '9')) ||
+         (c == '_') || (c == ':') || (c == '-') || (c == '.') ||
+         ((unsigned char)c >= 0x80);
+}
+
+static inline bool is_name_start_char(char c)
+{
+  return (is_name_char(c)) &&
+         (!((c >= '0') && (c <= '9'))) && (c != '-') && (c != '.');
+}
+
+/// Skips over a name, returning the character after it.
+static inline const char* skip_name(const char* p, const char* end)
+{
+  if ((p < end) && (is_name_start_char(*p)))
+  {
+    do
+    {
+      p++;
+    }
+    while ((p < end) && (is_name_char(*p)));
+  }
+
+  return p;
+}
+
+static inline const char* skip_space(const char* p, const char* end)
+{
+  while ((p < end) && (is_space(*p)))
+  {
+    p++;
+  }
+
+  return p;
+}
+
+bool CallXmlValidator::check_tag(const char*& p, const char* end)
+{
+  const char* tag = p;
+  p++;
+
+  if ((p < end) && ((*p == '!') || (*p == '?')))
+  {
+    return fail("Unsupported markup", tag);
+  }
+
+  if ((p < end) && (*p == '/'))
+  {
+    // End tag.  This must close the most recently opened element.
+    const char* name = ++p;
+    p = skip_name(p, end);
+    size_t length = p - name;
+    p = skip_space(p, end);
+
+    if ((length == 0) || (p == end) || (*p != '>'))
+    {
+      return fail("Invalid end tag", tag);
+    }
+
+    p++;
+
+    if ((_depth == 0) ||
+        (_open[_depth - 1].length != length) ||
+        (memcmp(_open[_depth - 1].name, name, length) != 0))
+    {
+      return fail("Mismatched end tag", tag);
+    }
+
+    _depth--;
+    return true;
+  }
+
+  // Start tag or empty element tag.
+  const char* name = p;
+  p = skip_name(p, end);
+  size_t length = p - name;
+
+  if (length == 0)
+  {
+    return fail("Invalid start tag", tag);
+  }
+
+  if (!check_attributes(p, end))
+  {
+    return false;
+  }
+
+  if (*p == '/')
+  {
+    // Empty element.  p can't be at the end, as check_attributes only stops
+    // at a '>' or a "/>".
+    p += 2;
+    return true;
+  }
+
+  p++;
+
+  if (_depth == MAX_DEPTH)
+  {
+    return fail("Elements too deeply nested", tag);
+  }
+
+  _open[_depth].name = name;
+  _open[_depth].length = length;
+  _depth++;
+
+  return true;
+}
+
+bool CallXmlValidator::check_attributes(const char*& p, const char* end)
+{
+  while (true)
+  {
+    const char* after_name = p;
+    p = skip_space(p, end);
+
+    if (p == end)
+    {
+      return fail("Unterminated tag", p);
+    }
+
+    if (*p == '>')
+    {
+      return true;
+    }
+
+    if (*p == '/')
+    {
+      if ((p + 1 == end) || (p[1] != '>'))
+      {
+        return fail("Invalid empty element tag", p);
+      }
+
+      return true;
+    }
+
+    // An attribute, which must be separated from what came before it.
+    if (p == after_name)
+    {
+      return fail("Invalid attribute", p);
+    }
+
+    const char* name = p;
+    p = skip_name(p, end);
+
+    if (p == name)
+    {
+      return fail("Invalid attribute", p);
+    }
+
+    p = skip_space(p, end);
+
+    if ((p == end) || (*p != '='))
+    {
+      return fail("Invalid attribute", p);
+    }
+
+    p = skip_space(p + 1, end);
+
+    if ((p == end) || ((*p != '"') && (*p != '\'')))
+    {
+      return fail("Invalid attribute value", p);
+    }
+
+    char quote = *p++;
+
+    while ((p < end) && (*p != quote))
+    {
+      unsigned char c = *p;
+
+      if (c == '<')
+      {
+        return fail("Invalid attribute value", p);
+      }
+      else if (c == '&')
+      {
+        if (!check_reference(p, end))
+        {
+          return false;
+        }
+      }
+      else if (c >= 0x80)
+      {
+        if (!check_utf8(p, end))
+        {
+          return false;
+        }
+      }
+      else if ((c < 0x20) && (c != '\t') && (c != '\n') && (c != '\r'))
+      {
+        return fail("Control character", p);
+      }
+      else
+      {
+        p++;
+      }
+    }
+
+    if (p == end)
+    {
+      return fail("Unterminated attribute value", p);
+    }
+
+    p++;
+  }
+}
+
+bool CallXmlValidator::check_reference(const char*& p, const char* end)
+{
+  const char* reference = p;
+  p++;
+
+  if ((p < end) && (*p == '#'))
+  {
+    // Character reference - &#<decimal>; or &#x<hex>;
+    p++;
+    bool hex = ((p < end) && (*p == 'x'));
+    unsigned long code_point = 0;
+    int digits = 0;
+
+    if (hex)
+    {
+      p++;
+    }
+
+    for (; (p < end) && (*p != ';'); p++, digits++)
+    {
+      char c = *p;
+      int value;
+
+      if ((c >= '0') && (c <= '9'))
+      {
+        value = c - '0';
+      }
+      else if ((hex) && (c >= 'a') && (c <= 'f'))
+      {
+        value = c - 'a' + 10;
+      }
+      else if ((hex) && (c >= 'A') && (c <= 'F'))
+      {
+        value = c - 'A' + 10;
+      }
+      else
+      {
+        return fail("Invalid character reference", reference);
+      }
+
+      code_point = (code_point * (hex ? 16 : 10)) + value;
+
+      if (code_point > 0x10FFFF)
+      {
+        return fail("Invalid character reference", reference);
+      }
+    }
+
+    if ((p == end) ||
+        (digits == 0) ||
+        ((code_point < 0x20) &&
+         (code_point != '\t') && (code_point != '\n') && (code_point != '\r')) ||
+        ((code_point >= 0xD800) && (code_point <= 0xDFFF)) ||
+        (code_point == 0xFFFE) ||
+        (code_point == 0xFFFF))
+    {
+      return fail("Invalid character reference", reference);
+    }
+
+    p++;
+    return true;
+  }
+
+  // Entity reference.  Without a DTD only the predefined entities are
+  // defined.
+  const char* name = p;
+
+  while ((p < end) && (*p != ';') && (p - name <= 4))
+  {
+    p++;
+  }
+
+  if (p < end)
+  {
+    size_t length = p - name;
+
+    if (((length == 2) && (memcmp(name, "lt", 2) == 0)) ||
+        ((length == 2) && (memcmp(name, "gt", 2) == 0)) ||
+        ((length == 3) && (memcmp(name, "amp", 3) == 0)) ||
+        ((length == 4) && (memcmp(name, "apos", 4) == 0)) ||
+        ((length == 4) && (memcmp(name, "quot", 4) == 0)))
+    {
+      p++;
+      return true;
+    }
+  }
+
+  return fail("Invalid entity reference", reference);
+}
+
+bool CallXmlValidator::check_utf8(const char*& p, const char* end)
+{
+  const unsigned char* s = (const unsigned char*)p;
+  size_t available = end - p;
+  size_t length;
+
+  // The valid ranges of the second byte depend on the first, to rule out
+  // overlong encodings, surrogates and code points beyond U+10FFFF.
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+
+  if ((s[0] >= 0xC2) && (s[0] <= 0xDF))
+  {
+    length = 2;
+  }
+  else if ((s[0] >= 0xE0) && (s[0] <= 0xEF))
+  {
+    length = 3;
+    min = (s[0] == 0xE0) ? 0xA0 : 0x80;
+    max = (s[0] == 0xED) ? 0x9F : 0xBF;
+  }
+  else if ((s[0] >= 0xF0) && (s[0] <= 0xF4))
+  {
+    length = 4;
+    min = (s[0] == 0xF0) ? 0x90 : 0x80;
+    max = (s[0] == 0xF4) ? 0x8F : 0xBF;
+  }
+  else
+  {
+    return fail("Invalid UTF-8", p);
+  }
+
+  if ((available < length) || (s[1] < min) || (s[1] > max))
+  {
+    return fail("Invalid UTF-8", p);
+  }
+
+  for (size_t ii = 2; ii < length; ii++)
+  {
+    if ((s[ii] < 0x80) || (s[ii] > 0xBF))
+    {
+      return fail("Invalid UTF-8", p);
+    }
+  }
+
+  p += length;
+  return true;
+}
+
+bool CallXmlValidator::fail(const char* error, const char* p)
+{
+  _error = error;
+  _error_offset = _piece_offset + (p - _piece_start);
+  return false;
+}
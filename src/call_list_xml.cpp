@@ -11,105 +11,311 @@
 
 
 #include "call_list_xml.h"
+#include "call_list_validator.h"
 #include "mementosasevent.h"
 #include "rapidxml/rapidxml.hpp"
-#include <set>
+#include <algorithm>
+#include <memory>
 
 typedef CallListStore::CallFragment::Type FragmentType;
 
-std::string xml_from_call_records(const std::vector<CallListStore::CallFragment>& records, SAS::TrailId trail)
+static const std::string CALL_LIST_START = "<call-list><calls>";
+static const std::string CALL_LIST_END = "</calls></call-list>";
+static const std::string CALL_START = "<call>";
+static const std::string CALL_END = "</call>";
+
+size_t CallRecord::xml_size() const
+{
+  return CALL_START.length() +
+         begin->contents.length() +
+         ((end != NULL) ? end->contents.length() : 0) +
+         CALL_END.length();
+}
+
+/// Orders fragments by call (timestamp, then ID), keeping fragments of the
+/// same call in the order they were retrieved in.  Timestamps are all the
+/// same length, so this is the same order as the "<timestamp>_<id>" record
+/// IDs that calls are known by.
+static bool fragment_order(const CallListStore::CallFragment* lhs,
+                           const CallListStore::CallFragment* rhs)
+{
+  int rc = lhs->timestamp.compare(rhs->timestamp);
+
+  if (rc == 0)
+  {
+    rc = lhs->id.compare(rhs->id);
+  }
+
+  // The fragments all live in the same vector, so their addresses give the
+  // order they were retrieved in.
+  return (rc != 0) ? (rc < 0) : (lhs < rhs);
+}
+
+/// @returns        Whether two fragments are part of the same call.
+static bool same_call(const CallListStore::CallFragment* lhs,
+                      const CallListStore::CallFragment* rhs)
+{
+  return (lhs->timestamp == rhs->timestamp) && (lhs->id == rhs->id);
+}
+
+/// Checks that the XML of a call is well formed, reporting it if not.
+static bool call_xml_valid(CallXmlValidator& validator,
+                           const CallRecord& call,
+                           SAS::TrailId trail)
+{
+  const std::string* pieces[] = {&call.begin->contents,
+                                 (call.end != NULL) ? &call.end->contents : NULL};
+  int num_fragments = (call.end != NULL) ? 2 : 1;
+
+  if (validator.validate(pieces, num_fragments))
+  {
+    return true;
+  }
+
+  // Report the call as an invalid record.  The instance ID distinguishes
+  // this from records with the wrong number of fragments.
+  SAS::Event invalid_record(trail, SASEvent::CALL_LIST_DB_INVALID_RECORD, 1);
+  invalid_record.add_var_param(call.begin->id);
+  invalid_record.add_var_param(call.begin->timestamp);
+  invalid_record.add_static_param(num_fragments);
+  SAS::report_event(invalid_record);
+
+  TRC_WARNING("Ignoring call record %s_%s with invalid XML: %s at offset %zu",
+              call.begin->timestamp.c_str(),
+              call.begin->id.c_str(),
+              validator.error(),
+              validator.error_offset());
+  return false;
+}
+
+void valid_call_records(const std::vector<CallListStore::CallFragment>& records,
+                        std::vector<CallRecord>& calls,
+                        SAS::TrailId trail,
+                        bool validate_xml)
 {
-  std::map<std::string, std::vector<CallListStore::CallFragment> > ids_to_records;
+  // Only set up the validator if it's needed.
+  std::unique_ptr<CallXmlValidator> validator;
+
+  if (validate_xml)
+  {
+    validator.reset(new CallXmlValidator());
+  }
+
+  // Group the fragments by time and record ID by sorting pointers to them,
+  // rather than copying them into a map keyed on the record ID.  This keeps
+  // the number of allocations independent of the number of fragments.
+  std::vector<const CallListStore::CallFragment*> fragments;
+  fragments.reserve(records.size());
 
-  // Group all entries by time and record ID
   for (std::vector<CallListStore::CallFragment>::const_iterator ii = records.begin();
        ii != records.end();
        ii++)
   {
-    std::string record_id = ((ii->timestamp) + "_" + (ii->id));
-    ids_to_records[record_id].push_back(*ii);
+    fragments.push_back(&(*ii));
   }
 
-  // Build an XML document from the valid call records, discarding any
-  // that aren't a single REJECTED, a BEGIN/END pair, or which have
-  // invalid XML.
-  std::string final_xml = "<call-list><calls>";
-  for (std::map<std::string, std::vector<CallListStore::CallFragment> >::const_iterator ii = ids_to_records.begin();
-       ii != ids_to_records.end();
-       ii++)
+  std::sort(fragments.begin(), fragments.end(), fragment_order);
+
+  // Pick out the valid call records, discarding any that aren't a single
+  // REJECTED or a BEGIN/END pair.  Each call has at least one fragment, so
+  // there can't be more calls than fragments.
+  calls.reserve(fragments.size());
+
+  size_t group_start = 0;
+
+  while (group_start < fragments.size())
   {
-    std::string record_id = ii->first;
-    std::vector<CallListStore::CallFragment> record_fragments = ii->second;
+    size_t group_end = group_start + 1;
+
+    while ((group_end < fragments.size()) &&
+           (same_call(fragments[group_start], fragments[group_end])))
+    {
+      group_end++;
+    }
 
-    if (record_fragments.size() == 1)
+    const CallListStore::CallFragment* const* record_fragments = &fragments[group_start];
+    size_t num_fragments = group_end - group_start;
+    group_start = group_end;
+
+    if (num_fragments == 1)
     {
       // REJECTED is the only record type where having one fragment is valid
-      if (record_fragments[0].type == FragmentType::REJECTED)
+      if (record_fragments[0]->type == FragmentType::REJECTED)
       {
-        std::string xml = "<call>" + record_fragments[0].contents + "</call>";
-        final_xml.append(xml);
+        CallRecord call = {record_fragments[0], NULL};
+
+        if ((!validate_xml) || (call_xml_valid(*validator, call, trail)))
+        {
+          calls.push_back(call);
+        }
       }
       else
       {
         SAS::Event invalid_record(trail, SASEvent::CALL_LIST_DB_INVALID_RECORD_1, 0);
-        invalid_record.add_var_param(record_fragments[0].id);
-        invalid_record.add_var_param(record_fragments[0].timestamp);
-        invalid_record.add_static_param(record_fragments[0].type);
+        invalid_record.add_var_param(record_fragments[0]->id);
+        invalid_record.add_var_param(record_fragments[0]->timestamp);
+        invalid_record.add_static_param(record_fragments[0]->type);
         SAS::report_event(invalid_record);
 
-        TRC_WARNING("Only one entry for call record %s but it was not REJECTED", record_id.c_str());
+        TRC_WARNING("Only one entry for call record %s_%s but it was not REJECTED",
+                    record_fragments[0]->timestamp.c_str(),
+                    record_fragments[0]->id.c_str());
       }
     }
-    else if (record_fragments.size() == 2)
+    else if (num_fragments == 2)
     {
       // If it's not a REJECTED record, it must be BEGIN and END
-      if ((record_fragments[0].type == FragmentType::BEGIN) &&
-          (record_fragments[1].type == FragmentType::END))
+      if ((record_fragments[0]->type == FragmentType::BEGIN) &&
+          (record_fragments[1]->type == FragmentType::END))
       {
-        std::string xml = "<call>" + record_fragments[0].contents + record_fragments[1].contents + "</call>";
-        final_xml.append(xml);
+        CallRecord call = {record_fragments[0], record_fragments[1]};
+
+        if ((!validate_xml) || (call_xml_valid(*validator, call, trail)))
+        {
+          calls.push_back(call);
+        }
       }
       else
       {
         SAS::Event invalid_record(trail, SASEvent::CALL_LIST_DB_INVALID_RECORD_2, 0);
-        invalid_record.add_var_param(record_fragments[0].id);
-        invalid_record.add_var_param(record_fragments[0].timestamp);
-        invalid_record.add_static_param(record_fragments[0].type);
-        invalid_record.add_static_param(record_fragments[1].type);
+        invalid_record.add_var_param(record_fragments[0]->id);
+        invalid_record.add_var_param(record_fragments[0]->timestamp);
+        invalid_record.add_static_param(record_fragments[0]->type);
+        invalid_record.add_static_param(record_fragments[1]->type);
         SAS::report_event(invalid_record);
 
-        TRC_WARNING("Found two entries for call record %s but it was not a BEGIN followed by an END",
-                    record_id.c_str());
+        TRC_WARNING("Found two entries for call record %s_%s but it was not a BEGIN followed by an END",
+                    record_fragments[0]->timestamp.c_str(),
+                    record_fragments[0]->id.c_str());
       }
     }
     else
     {
       SAS::Event invalid_record(trail, SASEvent::CALL_LIST_DB_INVALID_RECORD, 0);
-
-      // record_fragments should always be nonempty at this point, so exclude the
-      // else branch from coverage
-      if (!record_fragments.empty())
-      {
-        invalid_record.add_var_param(record_fragments[0].id);
-        invalid_record.add_var_param(record_fragments[0].timestamp);
-      }
-      else
-      {
-        invalid_record.add_var_param(record_id); // LCOV_EXCL_LINE
-        invalid_record.add_var_param(record_id); // LCOV_EXCL_LINE
-      }
-      invalid_record.add_static_param(record_fragments.size());
+      invalid_record.add_var_param(record_fragments[0]->id);
+      invalid_record.add_var_param(record_fragments[0]->timestamp);
+      invalid_record.add_static_param(num_fragments);
       SAS::report_event(invalid_record);
 
-      TRC_WARNING("Found %d entries for call record %s, expected 1 (REJECTED) or 2 (BEGIN/END)",
-                  record_fragments.size(),
-                  record_id.c_str());
+      TRC_WARNING("Found %zu entries for call record %s_%s, expected 1 (REJECTED) or 2 (BEGIN/END)",
+                  num_fragments,
+                  record_fragments[0]->timestamp.c_str(),
+                  record_fragments[0]->id.c_str());
+    }
+  }
+}
+
+size_t first_call_within_size(const std::vector<CallRecord>& calls,
+                              size_t max_size)
+{
+  // The calls are ordered oldest first.  If there's a size limit, work back
+  // from the newest call to find the oldest call we have room for.
+  size_t first_call = 0;
+
+  if (max_size > 0)
+  {
+    size_t size = CALL_LIST_START.length() + CALL_LIST_END.length();
+    first_call = calls.size();
+
+    while ((first_call > 0) &&
+           (size + calls[first_call - 1].xml_size() <= max_size))
+    {
+      size += calls[first_call - 1].xml_size();
+      first_call--;
     }
 
+    if (first_call > 0)
+    {
+      TRC_INFO("Call list exceeds %zu bytes - omitting the oldest %zu of %zu calls",
+               max_size,
+               first_call,
+               calls.size());
+    }
   }
 
-  final_xml.append("</calls></call-list>");
+  return first_call;
+}
 
-  return final_xml;
+bool parse_call_xml(const CallRecord& call,
+                    std::vector<char>& buffer,
+                    rapidxml::xml_document<>& doc)
+{
+  // rapidxml parses in place, so copy the fragments into the buffer, which
+  // must outlive the parsed document.
+  buffer.clear();
+  buffer.insert(buffer.end(), call.begin->contents.begin(), call.begin->contents.end());
+
+  if (call.end != NULL)
+  {
+    buffer.insert(buffer.end(), call.end->contents.begin(), call.end->contents.end());
+  }
+
+  buffer.push_back('\0');
+  doc.clear();
+
+  try
+  {
+    doc.parse<0>(&buffer[0]);
+  }
+  catch (rapidxml::parse_error& err)
+  {
+    TRC_WARNING("Ignoring call record %s_%s with invalid XML: %s",
+                call.begin->timestamp.c_str(),
+                call.begin->id.c_str(),
+                err.what());
+    return false;
+  }
+
+  return true;
 }
 
+size_t write_xml_from_call_records(const std::vector<CallListStore::CallFragment>& records,
+                                 CallListWriter& writer,
+                                 size_t max_size,
+                                 SAS::TrailId trail,
+                                 bool validate_xml)
+{
+  std::vector<CallRecord> calls;
+  valid_call_records(records, calls, trail, validate_xml);
+  size_t first_call = first_call_within_size(calls, max_size);
+
+  // Work out exactly how big the document is, so a writer that holds the
+  // whole document can allocate it in one go.
+  size_t size = CALL_LIST_START.length() + CALL_LIST_END.length();
+
+  for (size_t ii = first_call; ii < calls.size(); ii++)
+  {
+    size += calls[ii].xml_size();
+  }
+
+  writer.reserve(size);
+
+  // Pass the document to the writer a piece at a time.
+  writer.write(CALL_LIST_START);
+
+  for (size_t ii = first_call; ii < calls.size(); ii++)
+  {
+    writer.write(CALL_START);
+    writer.write(calls[ii].begin->contents);
+
+    if (calls[ii].end != NULL)
+    {
+      writer.write(calls[ii].end->contents);
+    }
+
+    writer.write(CALL_END);
+  }
+
+  writer.write(CALL_LIST_END);
+
+  return first_call;
+}
+
+std::string xml_from_call_records(const std::vector<CallListStore::CallFragment>& records, SAS::TrailId trail)
+{
+  std::string final_xml;
+  StringCallListWriter writer(final_xml);
+  write_xml_from_call_records(records, writer, 0, trail);
+
+  return final_xml;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file digest_cache.cpp In-memory cache of digest records.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "digest_cache.h"
+#include "log.h"
+
+// Allowance for the memory used by the cache's own structures for each
+// entry (list and hash table nodes etc.)
+static const size_t ENTRY_OVERHEAD_BYTES = 128;
+
+DigestCache::DigestCache(size_t max_bytes,
+                         int ttl_ms,
+                         Counter* hit_count,
+                         Counter* miss_count,
+                         Counter* eviction_count,
+                         int num_shards) :
+  _cache("digest", max_bytes, ttl_ms, eviction_count, num_shards),
+  _last_version(0),
+  _hit_count(hit_count),
+  _miss_count(miss_count)
+{
+}
+
+DigestCache::~DigestCache()
+{
+}
+
+bool DigestCache::get(const std::string& key,
+                      std::string& data,
+                      uint64_t& version)
+{
+  CachedRecord record;
+  bool found = _cache.get(key, record);
+
+  if (found)
+  {
+    TRC_DEBUG("Found cached digest for %s", key.c_str());
+    data = record.data;
+    version = record.version;
+    _hit_count->increment();
+  }
+  else
+  {
+    _miss_count->increment();
+  }
+
+  return found;
+}
+
+bool DigestCache::get_version(const std::string& key,
+                              uint64_t version,
+                              std::string& data)
+{
+  CachedRecord record;
+  bool found = ((_cache.get(key, record, false)) &&
+                (record.version == version));
+
+  if (found)
+  {
+    data = record.data;
+  }
+
+  return found;
+}
+
+void DigestCache::put(const std::string& key, const std::string& data)
+{
+  size_t size = (2 * key.length()) + data.length() + ENTRY_OVERHEAD_BYTES;
+  CachedRecord record = {data, ++_last_version};
+  _cache.put(key, record, size);
+}
+
+void DigestCache::invalidate(const std::string& key)
+{
+  TRC_DEBUG("Invalidate cached digest for %s", key.c_str());
+  _cache.invalidate(key);
+}
+
+size_t DigestCache::bytes_used()
+{
+  return _cache.size();
+}
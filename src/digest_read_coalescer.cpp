@@ -0,0 +1,189 @@
+/**
+ * @file digest_read_coalescer.cpp Coalescing of concurrent digest reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "digest_read_coalescer.h"
+#include "log.h"
+#include "monotonic_clock.h"
+
+DigestReadCoalescer::Read::Read() :
+  done(false),
+  waiters(0),
+  status(Store::Status::OK),
+  data(),
+  cas(0)
+{
+  // Waits for the read are timed against the monotonic clock, so aren't
+  // affected by changes to the system time.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&done_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+}
+
+DigestReadCoalescer::Read::~Read()
+{
+  pthread_cond_destroy(&done_cond);
+}
+
+DigestReadCoalescer::DigestReadCoalescer(Counter* coalesced_count,
+                                         StatisticAccumulator* batch_size,
+                                         StatisticAccumulator* wait_us,
+                                         int max_wait_ms) :
+  _reads(),
+  _coalesced_count(coalesced_count),
+  _batch_size(batch_size),
+  _wait_us(wait_us),
+  _max_wait_ms(max_wait_ms)
+{
+  pthread_mutex_init(&_lock, NULL);
+}
+
+DigestReadCoalescer::~DigestReadCoalescer()
+{
+  pthread_mutex_destroy(&_lock);
+}
+
+DigestReadCoalescer::Result DigestReadCoalescer::lead_or_wait(const std::string& key,
+                                                              Store::Status& status,
+                                                              std::string& data,
+                                                              uint64_t& cas)
+{
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, std::shared_ptr<Read> >::iterator it =
+                                                              _reads.find(key);
+
+  if (it == _reads.end())
+  {
+    _reads[key] = std::make_shared<Read>();
+    pthread_mutex_unlock(&_lock);
+    return LEADER;
+  }
+
+  TRC_DEBUG("Wait for read of digest for %s already in progress", key.c_str());
+  unsigned long start_us = MonotonicClock::now_us();
+
+  std::shared_ptr<Read> read = it->second;
+  read->waiters++;
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += _max_wait_ms / 1000;
+  deadline.tv_nsec += (_max_wait_ms % 1000) * 1000000;
+
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  int rc = 0;
+
+  while ((!read->done) && (rc != ETIMEDOUT))
+  {
+    rc = pthread_cond_timedwait(&read->done_cond, &_lock, &deadline);
+  }
+
+  if (!read->done)
+  {
+    // The leader's read is taking too long, so stop waiting for it and read
+    // the record directly.
+    read->waiters--;
+    pthread_mutex_unlock(&_lock);
+
+    TRC_INFO("Timed out after %dms waiting for read of digest for %s",
+             _max_wait_ms,
+             key.c_str());
+    return TIMED_OUT;
+  }
+
+  status = read->status;
+  data = read->data;
+  cas = read->cas;
+
+  pthread_mutex_unlock(&_lock);
+
+  _coalesced_count->increment();
+
+  if (_wait_us != NULL)
+  {
+    _wait_us->accumulate(MonotonicClock::now_us() - start_us);
+  }
+
+  return SHARED;
+}
+
+void DigestReadCoalescer::leader_done(const std::string& key,
+                                      Store::Status status,
+                                      const std::string& data,
+                                      uint64_t cas)
+{
+  int waiters = 0;
+
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, std::shared_ptr<Read> >::iterator it =
+                                                              _reads.find(key);
+
+  if (it != _reads.end())
+  {
+    std::shared_ptr<Read> read = it->second;
+    _reads.erase(it);
+
+    waiters = read->waiters;
+
+    if (waiters > 0)
+    {
+      read->status = status;
+      read->data = data;
+      read->cas = cas;
+      read->done = true;
+      pthread_cond_broadcast(&read->done_cond);
+    }
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  if (waiters > 0)
+  {
+    TRC_DEBUG("Share digest for %s with %d waiting requests",
+              key.c_str(),
+              waiters);
+  }
+
+  if (_batch_size != NULL)
+  {
+    _batch_size->accumulate(waiters + 1);
+  }
+}
+
+int DigestReadCoalescer::waiters(const std::string& key)
+{
+  int waiters = 0;
+
+  pthread_mutex_lock(&_lock);
+
+  std::unordered_map<std::string, std::shared_ptr<Read> >::iterator it =
+                                                              _reads.find(key);
+
+  if (it != _reads.end())
+  {
+    waiters = it->second->waiters;
+  }
+
+  pthread_mutex_unlock(&_lock);
+
+  return waiters;
+}
@@ -0,0 +1,239 @@
+/**
+ * @file ha1_cache.cpp In-memory cache of subscribers' digest credentials.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "ha1_cache.h"
+#include "log.h"
+#include "monotonic_clock.h"
+
+HA1Cache::HA1Cache(HomesteadConnection* homestead_conn,
+                   size_t max_entries,
+                   int ttl_ms,
+                   Counter* hit_count,
+                   Counter* miss_count,
+                   Counter* refresh_count,
+                   int num_shards) :
+  _homestead_conn(homestead_conn),
+  _cache("HA1", max_entries, ttl_ms, NULL, num_shards),
+  _ttl_ms(ttl_ms),
+  _hit_count(hit_count),
+  _miss_count(miss_count),
+  _refresh_count(refresh_count),
+  _refresh_queue(),
+  _running(false),
+  _stopping(false)
+{
+  pthread_mutex_init(&_refresh_lock, NULL);
+  pthread_cond_init(&_refresh_cond, NULL);
+}
+
+HA1Cache::~HA1Cache()
+{
+  stop();
+
+  pthread_cond_destroy(&_refresh_cond);
+  pthread_mutex_destroy(&_refresh_lock);
+}
+
+bool HA1Cache::start()
+{
+  int rc = pthread_create(&_refresh_thread, NULL, refresh_thread_fn, this);
+
+  if (rc != 0)
+  {
+    // LCOV_EXCL_START - Thread creation doesn't fail in UT
+    TRC_ERROR("Failed to start HA1 cache refresh thread: %d", rc);
+    return false;
+    // LCOV_EXCL_STOP
+  }
+
+  _running = true;
+  return true;
+}
+
+void HA1Cache::stop()
+{
+  if (!_running)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&_refresh_lock);
+  _stopping = true;
+  pthread_cond_signal(&_refresh_cond);
+  pthread_mutex_unlock(&_refresh_lock);
+
+  pthread_join(_refresh_thread, NULL);
+  _running = false;
+}
+
+HTTPCode HA1Cache::get_digest_data(const std::string& impi,
+                                   const std::string& impu,
+                                   std::string& ha1,
+                                   std::string& realm,
+                                   SAS::TrailId trail)
+{
+  std::string key = cache_key(impi, impu);
+  CachedCredentials credentials;
+
+  if (_cache.get(key, credentials))
+  {
+    TRC_DEBUG("Found cached HA1 for %s, %s", impi.c_str(), impu.c_str());
+    ha1 = credentials.ha1;
+    realm = credentials.realm;
+    _hit_count->increment();
+
+    // Only one request queues each refresh - the one that marks the entry as
+    // refreshing.
+    if ((credentials.refresh_ms <= MonotonicClock::now_ms()) &&
+        (!credentials.refreshing))
+    {
+      CachedCredentials refreshing = credentials;
+      refreshing.refreshing = true;
+
+      if ((_cache.replace(key, credentials, refreshing, 1)) &&
+          (!queue_refresh(impi, impu)))
+      {
+        // The queue is full.  Let a later hit try again.
+        _cache.replace(key, refreshing, credentials, 1);
+      }
+    }
+
+    return HTTP_OK;
+  }
+
+  _miss_count->increment();
+  HTTPCode rc = _homestead_conn->get_digest_data(impi, impu, ha1, realm, trail);
+
+  if (rc == HTTP_OK)
+  {
+    put(key, ha1, realm);
+  }
+
+  return rc;
+}
+
+void HA1Cache::invalidate(const std::string& impi, const std::string& impu)
+{
+  TRC_DEBUG("Invalidate cached HA1 for %s, %s", impi.c_str(), impu.c_str());
+  _cache.invalidate(cache_key(impi, impu));
+}
+
+size_t HA1Cache::size()
+{
+  // Each entry has a size of 1.
+  return _cache.size();
+}
+
+// The IDs are separated by a NUL, which can't appear in either.
+std::string HA1Cache::cache_key(const std::string& impi, const std::string& impu)
+{
+  std::string key = impi;
+  key.push_back('\0');
+  key.append(impu);
+  return key;
+}
+
+void HA1Cache::put(const std::string& key,
+                   const std::string& ha1,
+                   const std::string& realm)
+{
+  CachedCredentials credentials = {ha1,
+                                   realm,
+                                   MonotonicClock::now_ms() +
+                                     (_ttl_ms * REFRESH_PERCENT) / 100,
+                                   false};
+  _cache.put(key, credentials, 1);
+}
+
+bool HA1Cache::queue_refresh(const std::string& impi, const std::string& impu)
+{
+  bool queued = false;
+
+  pthread_mutex_lock(&_refresh_lock);
+
+  if (_refresh_queue.size() < MAX_QUEUED_REFRESHES)
+  {
+    Refresh refresh = {impi, impu};
+    _refresh_queue.push_back(refresh);
+    pthread_cond_signal(&_refresh_cond);
+    queued = true;
+  }
+
+  pthread_mutex_unlock(&_refresh_lock);
+
+  return queued;
+}
+
+void HA1Cache::refresh_queued()
+{
+  pthread_mutex_lock(&_refresh_lock);
+
+  // Stop part way through the queue if the cache is being stopped, rather
+  // than holding up shutdown with a request to Homestead per entry.
+  while ((!_stopping) && (!_refresh_queue.empty()))
+  {
+    Refresh refresh = _refresh_queue.front();
+    _refresh_queue.pop_front();
+    pthread_mutex_unlock(&_refresh_lock);
+
+    TRC_DEBUG("Refresh cached HA1 for %s, %s",
+              refresh.impi.c_str(), refresh.impu.c_str());
+    _refresh_count->increment();
+
+    std::string ha1;
+    std::string realm;
+    HTTPCode rc = _homestead_conn->get_digest_data(refresh.impi,
+                                                   refresh.impu,
+                                                   ha1,
+                                                   realm,
+                                                   0);
+
+    if (rc == HTTP_OK)
+    {
+      put(cache_key(refresh.impi, refresh.impu), ha1, realm);
+    }
+    else
+    {
+      // Don't keep using credentials that Homestead won't confirm.
+      invalidate(refresh.impi, refresh.impu);
+    }
+
+    pthread_mutex_lock(&_refresh_lock);
+  }
+
+  pthread_mutex_unlock(&_refresh_lock);
+}
+
+void* HA1Cache::refresh_thread_fn(void* cache)
+{
+  ((HA1Cache*)cache)->refresh_thread();
+  return NULL;
+}
+
+void HA1Cache::refresh_thread()
+{
+  pthread_mutex_lock(&_refresh_lock);
+
+  while (!_stopping)
+  {
+    if (_refresh_queue.empty())
+    {
+      pthread_cond_wait(&_refresh_cond, &_refresh_lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&_refresh_lock);
+    refresh_queued();
+    pthread_mutex_lock(&_refresh_lock);
+  }
+
+  pthread_mutex_unlock(&_refresh_lock);
+}
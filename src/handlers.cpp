@@ -14,6 +14,72 @@
 #include "mementosasevent.h"
 #include "call_list_store.h"
 #include "call_list_xml.h"
+#include "call_list_json.h"
+#include <strings.h>
+#include <time.h>
+#include <openssl/md5.h>
+
+// Format of the Last-Modified and If-Modified-Since headers.
+static const char* const HTTP_DATE_FORMAT = "%a, %d %b %Y %H:%M:%S GMT";
+
+// Media types of the call list formats.
+static const char* const XML_CONTENT_TYPE = "application/vnd.projectclearwater.call-list+xml";
+static const char* const JSON_CONTENT_TYPE = "application/json";
+static const char* const CBOR_CONTENT_TYPE = "application/cbor";
+
+// Header that session tokens are issued and presented in.
+static const char* const SESSION_TOKEN_HEADER = "NGV-Session-Token";
+
+// Header that tells the client how many of the oldest calls were left out of
+// the call list to keep it within the size limit.  Clients can read them by
+// asking for the calls until the start of the oldest call they were sent.
+static const char* const CALLS_OMITTED_HEADER = "NGV-Calls-Omitted";
+
+/// Converts a call fragment timestamp (YYYYMMDDHHMMSS, in UTC) to a time.
+static bool time_from_fragment_timestamp(const std::string& timestamp,
+                                         time_t& time)
+{
+  struct tm tm = {0};
+
+  if ((timestamp.empty()) ||
+      (strptime(timestamp.c_str(), "%Y%m%d%H%M%S", &tm) == NULL))
+  {
+    return false;
+  }
+
+  time = timegm(&tm);
+  return true;
+}
+
+/// @returns                 The time (YYYYMMDDHHMMSS, in UTC) of the event a
+///                          call fragment was written for - the end time of
+///                          the call for an END fragment, and the start time
+///                          for the others.
+static std::string fragment_event_time(const CallListStore::CallFragment& fragment)
+{
+  static const std::string END_TIME_TAG = "<end-time>";
+
+  if (fragment.type == CallListStore::CallFragment::Type::END)
+  {
+    size_t start = fragment.contents.find(END_TIME_TAG);
+
+    if (start != std::string::npos)
+    {
+      start += END_TIME_TAG.length();
+      size_t end = fragment.contents.find('<', start);
+      std::string end_time;
+
+      if ((end != std::string::npos) &&
+          (CallListRange::parse_timestamp(fragment.contents.substr(start, end - start),
+                                          end_time)))
+      {
+        return end_time;
+      }
+    }
+  }
+
+  return fragment.timestamp;
+}
 
 // This handler deals with requests to the call list URL
 void CallListTask::run()
@@ -46,11 +112,25 @@ void CallListTask::run()
   called_dn.add_var_param(dn);
   SAS::report_marker(called_dn);
 
+  // Set if the request is waiting on an asynchronous store read.  In that
+  // case the task is resumed (and deleted) when the read completes.
+  bool suspended = false;
+
   std::string api_key_header = _req.header("NGV-API-Key");
+  std::string session_token = _req.header(SESSION_TOKEN_HEADER);
   if (!api_key_header.empty() && api_key_header == _cfg->_api_key)
   {
     TRC_DEBUG("Authenticating using API key");
-    respond_when_authenticated();
+    suspended = !respond_when_authenticated();
+  }
+  else if ((_cfg->_session_token_signer != NULL) &&
+           (!session_token.empty()) &&
+           (_cfg->_session_token_signer->check(session_token, _impu)))
+  {
+    // The client authenticated recently, so there's no need to check its
+    // credentials again.
+    TRC_DEBUG("Authenticating using session token");
+    suspended = !respond_when_authenticated();
   }
   else
   {
@@ -58,13 +138,31 @@ void CallListTask::run()
     std::string auth_header = _req.header("Authorization");
     std::string method = _req.method_as_str();
 
+    // Read the call list while the digest is looked up, rather than after.
+    bool optimistic = start_optimistic_read(auth_header);
+
     rc = _auth_mod->authenticate_request(_impu, auth_header, www_auth_header, method, trail());
 
+    if ((rc == HTTP_OK) && (_cfg->_session_token_signer != NULL))
+    {
+      // Let the client skip authentication on its next few requests.
+      _req.add_header(SESSION_TOKEN_HEADER,
+                      _cfg->_session_token_signer->issue(_impu));
+    }
+
     //LCOV_EXCL_START - These cases are tested thoroughly in individual tests
     if (rc == HTTP_UNAUTHORIZED)
     {
       TRC_DEBUG("Authorization data missing or out of date, responding with 401");
       _req.add_header("WWW-Authenticate", www_auth_header);
+
+      // The client will almost certainly retry with credentials, so start
+      // reading the call list now.
+      if ((_cfg->_prefetcher != NULL) && (!_range.is_bounded()) && (!optimistic))
+      {
+        _cfg->_prefetcher->prefetch(_impu, trail());
+      }
+
       send_http_reply(rc);
     }
     else if (rc != HTTP_OK)
@@ -72,28 +170,314 @@ void CallListTask::run()
       TRC_DEBUG("Authorization failed, responding with %d", rc);
       send_http_reply(rc);
     }
-    else
+    else if (!optimistic)
     {
-      respond_when_authenticated();
+      suspended = !respond_when_authenticated();
     }
     // LCOV_EXCL_STOP
+
+    if (optimistic)
+    {
+      suspended = !on_optimistic_auth_complete(rc == HTTP_OK);
+    }
+  }
+
+  if (!suspended)
+  {
+    complete();
   }
+}
 
+void CallListTask::complete()
+{
   SAS::Marker end_marker(trail(), MARKER_ID_END, 1u);
   SAS::report_marker(end_marker);
 
   delete this;
-  return;
 }
 
-void CallListTask::respond_when_authenticated()
+bool CallListTask::respond_when_authenticated()
 {
-  Utils::StopWatch stop_watch;
-  stop_watch.start();
+  _read_stop_watch.start();
+
+  if (use_call_list_cache())
+  {
+    std::shared_ptr<const CallListCache::Entry> call_list =
+                                         _cfg->_call_list_cache->get(call_list_key());
+
+    if (call_list != NULL)
+    {
+      // The call list is cached, so there's no need to read it from the
+      // store.
+      send_call_list(*call_list, NULL);
+      return true;
+    }
+  }
+
+  if ((_cfg->_prefetcher != NULL) && (!_range.is_bounded()))
+  {
+    std::vector<CallListStore::CallFragment> records;
+
+    if (_cfg->_prefetcher->take(_impu, records))
+    {
+      // The call fragments were read when this client was challenged, so
+      // there's no need to read them again.
+      _read_prefetched = true;
+      on_call_fragments_retrieved(CassandraStore::OK, records);
+      return true;
+    }
+  }
+
+  if ((_cfg->_read_coalescer != NULL) && (!_range.is_bounded()))
+  {
+    _read_leader = _cfg->_read_coalescer->lead_or_follow(call_list_key(), this);
+
+    if (!_read_leader)
+    {
+      // Another request is already reading this call list.  Wait for it to
+      // share the call list with us - the task is resumed, completed and
+      // deleted from that request's thread.
+      return false;
+    }
+  }
+
+  if (_range.is_bounded())
+  {
+    // The client only wants part of the call list.  Read just that part
+    // from the store.
+    TRC_DEBUG("Retrieve call fragments in range for %s", _impu.c_str());
+    GetCallFragmentsInRange* op = new GetCallFragmentsInRange(_impu, _range);
+
+    if (_cfg->_async_store_reads)
+    {
+      CassandraStore::Operation* base_op = op;
+      CassandraStore::Transaction* tsx = new GetCallFragmentsTsx(this);
+      StageTimer store_timer(_cfg->_stat_call_list_store_stage);
+      _cfg->_call_list_store->do_async(base_op, tsx);
+      return false;
+    }
+
+    std::vector<CallListStore::CallFragment> records;
+    StageTimer store_timer(_cfg->_stat_call_list_store_stage);
+    _cfg->_call_list_store->do_sync(op, trail());
+    store_timer.stop();
+    CassandraStore::ResultCode db_rc = op->get_result_code();
+
+    if (db_rc == CassandraStore::OK)
+    {
+      op->get_result(records);
+    }
+
+    delete op; op = NULL;
+    on_call_fragments_retrieved(db_rc, records);
+
+    return true;
+  }
+
+  if (_cfg->_async_store_reads)
+  {
+    // Hand the read off to the call list store's worker pool.  This frees up
+    // the HTTP worker thread - the task is resumed by the transaction once the
+    // read completes.
+    TRC_DEBUG("Retrieve call fragments for %s asynchronously", _impu.c_str());
+    CassandraStore::Operation* op =
+                           _cfg->_call_list_store->new_get_call_fragments_op(_impu);
+    CassandraStore::Transaction* tsx = new GetCallFragmentsTsx(this);
+
+    // The task may be resumed (and deleted) before do_async returns, so the
+    // timer mustn't refer to it.
+    StageTimer store_timer(_cfg->_stat_call_list_store_stage);
+    _cfg->_call_list_store->do_async(op, tsx);
+    return false;
+  }
 
   std::vector<CallListStore::CallFragment> records;
+  StageTimer store_timer(_cfg->_stat_call_list_store_stage);
   CassandraStore::ResultCode db_rc =
     _cfg->_call_list_store->get_call_fragments_sync(_impu, records, trail());
+  store_timer.stop();
+  on_call_fragments_retrieved(db_rc, records);
+
+  return true;
+}
+
+bool CallListTask::start_optimistic_read(const std::string& auth_header)
+{
+  // Only requests that carry a response to a challenge can be authenticated
+  // without a further round trip, so only they are worth reading for.
+  if ((!_cfg->_optimistic_reads) ||
+      (!_cfg->_async_store_reads) ||
+      (auth_header.compare(0, 6, "Digest") != 0) ||
+      (auth_header.find("response=") == std::string::npos))
+  {
+    return false;
+  }
+
+  _read_stop_watch.start();
+
+  if (use_call_list_cache())
+  {
+    _optimistic_call_list = _cfg->_call_list_cache->get(call_list_key());
+
+    if (_optimistic_call_list != NULL)
+    {
+      // The call list is cached, so there's nothing to read.
+      _optimistic_read_done = true;
+      return true;
+    }
+  }
+
+  if ((_cfg->_prefetcher != NULL) && (!_range.is_bounded()))
+  {
+    std::vector<CallListStore::CallFragment> records;
+
+    if (_cfg->_prefetcher->take(_impu, records))
+    {
+      // The call list was read when this client was challenged.
+      _read_prefetched = true;
+      on_optimistic_read_complete(CassandraStore::OK, records);
+      return true;
+    }
+  }
+
+  TRC_DEBUG("Retrieve call fragments for %s before authentication",
+            _impu.c_str());
+  CassandraStore::Operation* op;
+
+  if (_range.is_bounded())
+  {
+    op = new GetCallFragmentsInRange(_impu, _range);
+  }
+  else
+  {
+    op = _cfg->_call_list_store->new_get_call_fragments_op(_impu);
+  }
+
+  CassandraStore::Transaction* tsx = new OptimisticReadTsx(this);
+  StageTimer store_timer(_cfg->_stat_call_list_store_stage);
+  _cfg->_call_list_store->do_async(op, tsx);
+
+  return true;
+}
+
+bool CallListTask::on_optimistic_auth_complete(bool authenticated)
+{
+  pthread_mutex_lock(&_optimistic_lock);
+  _optimistic_auth_done = true;
+  _optimistic_authenticated = authenticated;
+  bool read_done = _optimistic_read_done;
+  pthread_mutex_unlock(&_optimistic_lock);
+
+  if (!read_done)
+  {
+    // The read's transaction finishes the request.
+    return false;
+  }
+
+  respond_with_optimistic_read();
+  return true;
+}
+
+bool CallListTask::on_optimistic_read_complete(CassandraStore::ResultCode db_rc,
+                                               std::vector<CallListStore::CallFragment>& records)
+{
+  pthread_mutex_lock(&_optimistic_lock);
+  _optimistic_read_done = true;
+  _optimistic_db_rc = db_rc;
+  _optimistic_records.swap(records);
+  bool auth_done = _optimistic_auth_done;
+  pthread_mutex_unlock(&_optimistic_lock);
+
+  if (!auth_done)
+  {
+    // Authentication finishes the request.
+    return false;
+  }
+
+  respond_with_optimistic_read();
+  return true;
+}
+
+void CallListTask::respond_with_optimistic_read()
+{
+  if (!_optimistic_authenticated)
+  {
+    // The response has already been sent.
+    TRC_DEBUG("Discard call list for %s read before failed authentication",
+              _impu.c_str());
+  }
+  else if (_optimistic_call_list != NULL)
+  {
+    send_call_list(*_optimistic_call_list, NULL);
+  }
+  else
+  {
+    on_call_fragments_retrieved(_optimistic_db_rc, _optimistic_records);
+  }
+}
+
+void CallListTask::get_call_fragments_result(CassandraStore::Operation* op,
+                                             std::vector<CallListStore::CallFragment>& records)
+{
+  if (_range.is_bounded())
+  {
+    ((GetCallFragmentsInRange*)op)->get_result(records);
+  }
+  else
+  {
+    ((CallListStore::GetCallFragments*)op)->get_result(records);
+  }
+}
+
+void CallListTask::GetCallFragmentsTsx::on_success(CassandraStore::Operation* op)
+{
+  std::vector<CallListStore::CallFragment> records;
+  _task->get_call_fragments_result(op, records);
+
+  _task->on_call_fragments_retrieved(CassandraStore::OK, records);
+  _task->complete();
+}
+
+void CallListTask::GetCallFragmentsTsx::on_failure(CassandraStore::Operation* op)
+{
+  std::vector<CallListStore::CallFragment> records;
+
+  _task->on_call_fragments_retrieved(op->get_result_code(), records);
+  _task->complete();
+}
+
+void CallListTask::OptimisticReadTsx::on_success(CassandraStore::Operation* op)
+{
+  std::vector<CallListStore::CallFragment> records;
+  _task->get_call_fragments_result(op, records);
+
+  if (_task->on_optimistic_read_complete(CassandraStore::OK, records))
+  {
+    _task->complete();
+  }
+}
+
+void CallListTask::OptimisticReadTsx::on_failure(CassandraStore::Operation* op)
+{
+  std::vector<CallListStore::CallFragment> records;
+
+  if (_task->on_optimistic_read_complete(op->get_result_code(), records))
+  {
+    _task->complete();
+  }
+}
+
+void CallListTask::on_call_fragments_retrieved(CassandraStore::ResultCode db_rc,
+                                               std::vector<CallListStore::CallFragment>& records)
+{
+  // If this request is leading a coalesced read, pick up the requests that
+  // are waiting for it.  Any later requests start a new read.
+  std::vector<CallListReadCoalescer::Follower*> followers;
+
+  if (_read_leader)
+  {
+    _cfg->_read_coalescer->leader_done(call_list_key(), followers);
+  }
 
   // We know this is a valid subscriber because of authentication, so
   // NOT_FOUND just means they haven't made any calls and should still
@@ -106,12 +490,14 @@ void CallListTask::respond_when_authenticated()
 
     TRC_DEBUG("get_call_records_sync failed with result code %d", db_rc);
     send_http_reply(HTTP_SERVER_ERROR);
+    share_call_list(followers, db_rc, NULL);
     return;
   }
 
-  // Update the latency statistics.
+  // Update the latency statistics.  A prefetched read didn't wait for the
+  // store, so would skew them.
   unsigned long latency_us = 0;
-  if (stop_watch.read(latency_us))
+  if ((!_read_prefetched) && (_read_stop_watch.read(latency_us)))
   {
     _cfg->_stat_cassandra_read_latency->accumulate(latency_us);
   }
@@ -121,22 +507,473 @@ void CallListTask::respond_when_authenticated()
   db_event.add_var_param(_impu);
   SAS::report_event(db_event);
 
-  // Request has authenticated, so attempt to get the call lists.
-  std::string calllists = xml_from_call_records(records, trail());
-  _req.add_header("Content-Type", "application/vnd.projectclearwater.call-list+xml");
-  _req.add_content(calllists);
+  std::shared_ptr<CallListCache::Entry> call_list(new CallListCache::Entry());
+  get_validators(records, call_list->etag, call_list->last_modified);
+  call_list->num_records = records.size();
 
-  // Update statistics about the size and number of records in the result.
-  _cfg->_stat_record_size->accumulate(calllists.length());
-  _cfg->_stat_record_length->accumulate(records.size());
+  if ((use_call_list_cache()) || (!followers.empty()))
+  {
+    // Build the whole call list so it can be cached or shared, and serve
+    // this request from the built copy.
+    StringCallListWriter writer(call_list->body);
+    call_list->omitted_calls = write_call_list(records, writer);
+
+    if (use_call_list_cache())
+    {
+      _cfg->_call_list_cache->put(call_list_key(), call_list);
+    }
+
+    send_call_list(*call_list, NULL);
+    share_call_list(followers, db_rc, call_list);
+  }
+  else
+  {
+    send_call_list(*call_list, &records);
+  }
+}
+
+void CallListTask::share_call_list(std::vector<CallListReadCoalescer::Follower*>& followers,
+                                   CassandraStore::ResultCode db_rc,
+                                   std::shared_ptr<const CallListCache::Entry> call_list)
+{
+  for (std::vector<CallListReadCoalescer::Follower*>::iterator ii = followers.begin();
+       ii != followers.end();
+       ++ii)
+  {
+    (*ii)->on_call_list_shared(db_rc, call_list);
+  }
+}
+
+void CallListTask::on_call_list_shared(CassandraStore::ResultCode db_rc,
+                                       std::shared_ptr<const CallListCache::Entry> call_list)
+{
+  if (call_list == NULL)
+  {
+    TRC_DEBUG("Shared read of call list for %s failed with result code %d",
+              _impu.c_str(),
+              db_rc);
+    send_http_reply(HTTP_SERVER_ERROR);
+  }
+  else
+  {
+    TRC_DEBUG("Respond with shared call list for %s", _impu.c_str());
+    send_call_list(*call_list, NULL);
+  }
+
+  complete();
+}
+
+void CallListTask::send_call_list(const CallListCache::Entry& call_list,
+                                  const std::vector<CallListStore::CallFragment>* records)
+{
+  CallListCompressor::Encoding encoding = CallListCompressor::IDENTITY;
+
+  if (_cfg->_compressor != NULL)
+  {
+    encoding = CallListCompressor::choose_encoding(_req.header("Accept-Encoding"));
+  }
+
+  HTTPCode rc = HTTP_OK;
+
+  if (client_copy_is_current(encoded_etag(call_list.etag, _format, encoding),
+                             call_list.last_modified))
+  {
+    // The client already has this version of the call list, so there's no
+    // need to build it or send it again.
+    TRC_DEBUG("Call list for %s not modified", _impu.c_str());
+    add_call_list_headers(call_list, encoding, false);
+    rc = EVHTP_RES_NOTMOD;
+  }
+  else if (_req.method() == htp_method_HEAD)
+  {
+    // The client just wants to check the validators, so there's no need to
+    // build the call list.
+    TRC_DEBUG("HEAD request for %s - not building call list", _impu.c_str());
+    add_call_list_headers(call_list, encoding, true);
+    add_calls_omitted_header(call_list.omitted_calls);
+  }
+  else if ((records != NULL) && (encoding == CallListCompressor::IDENTITY))
+  {
+    // Request has authenticated, so build the call list.  Each call is
+    // written straight into the response as it is built, rather than
+    // building up the whole document and copying it into the response.
+    add_call_list_headers(call_list, encoding, true);
+    ResponseWriter writer(_req);
+    size_t omitted_calls = write_call_list(*records, writer);
+
+    // The headers aren't sent until the reply is, so can still be added
+    // once the body is written.
+    add_calls_omitted_header(omitted_calls);
+
+    // Update statistics about the size and number of records in the result.
+    _cfg->_stat_record_size->accumulate(writer.bytes());
+    _cfg->_stat_record_length->accumulate(records->size());
+  }
+  else
+  {
+    // The call list has to be built in full before it can be compressed.
+    std::string built_body;
+    const std::string* body = &call_list.body;
+    size_t omitted_calls = call_list.omitted_calls;
+
+    if (records != NULL)
+    {
+      StringCallListWriter writer(built_body);
+      omitted_calls = write_call_list(*records, writer);
+      body = &built_body;
+    }
+
+    // Use the compressed copy of the body from the cache if there is one,
+    // and otherwise compress the body now.
+    std::string compressed_body;
+    const std::string* content = body;
+
+    if (encoding != CallListCompressor::IDENTITY)
+    {
+      std::map<CallListCompressor::Encoding, std::string>::const_iterator it =
+                                      call_list.compressed_bodies.find(encoding);
+
+      if (it != call_list.compressed_bodies.end())
+      {
+        content = &it->second;
+      }
+      else if (compress_call_list(encoding, *body, compressed_body))
+      {
+        content = &compressed_body;
+
+        if ((records == NULL) && (use_call_list_cache()))
+        {
+          _cfg->_call_list_cache->add_compressed_body(call_list_key(),
+                                                      call_list.etag,
+                                                      encoding,
+                                                      compressed_body);
+        }
+      }
+      else
+      {
+        // Fall back to sending the call list uncompressed.
+        encoding = CallListCompressor::IDENTITY;
+      }
+    }
+
+    add_call_list_headers(call_list, encoding, true);
+    add_calls_omitted_header(omitted_calls);
+    _req.add_content(*content);
+
+    // Update statistics about the size and number of records in the result.
+    _cfg->_stat_record_size->accumulate(body->length());
+    _cfg->_stat_record_length->accumulate(call_list.num_records);
+  }
 
   SAS::Event tx_event(trail(), SASEvent::CALL_LIST_RSP_TX, 0);
   tx_event.add_var_param(_impu);
   SAS::report_event(tx_event);
 
-  // 200 OK response - we're still active and providing service
-  _cfg->_health_checker->health_check_passed();  
-  send_http_reply(HTTP_OK);
+  // Successful response - we're still active and providing service
+  _cfg->_health_checker->health_check_passed();
+
+  StageTimer reply_timer(_cfg->_stat_reply_stage);
+  send_http_reply(rc);
+}
+
+bool CallListTask::compress_call_list(CallListCompressor::Encoding encoding,
+                                      const std::string& body,
+                                      std::string& compressed_body)
+{
+  StageTimer compress_timer(_cfg->_stat_compress_stage);
+  return _cfg->_compressor->compress(encoding, body, compressed_body);
+}
+
+void CallListTask::add_call_list_headers(const CallListCache::Entry& call_list,
+                                         CallListCompressor::Encoding encoding,
+                                         bool with_content)
+{
+  _req.add_header("ETag", encoded_etag(call_list.etag, _format, encoding));
+
+  if (call_list.last_modified != 0)
+  {
+    char last_modified_str[64];
+    struct tm tm;
+    strftime(last_modified_str,
+             sizeof(last_modified_str),
+             HTTP_DATE_FORMAT,
+             gmtime_r(&call_list.last_modified, &tm));
+    _req.add_header("Last-Modified", last_modified_str);
+  }
+
+  _req.add_header("Vary",
+                  (_cfg->_compressor != NULL) ? "Accept, Accept-Encoding" : "Accept");
+
+  if (with_content)
+  {
+    _req.add_header("Content-Type", content_type(_format));
+
+    if (encoding != CallListCompressor::IDENTITY)
+    {
+      _req.add_header("Content-Encoding",
+                      CallListCompressor::encoding_name(encoding));
+    }
+  }
+}
+
+void CallListTask::add_calls_omitted_header(size_t omitted_calls)
+{
+  if (omitted_calls > 0)
+  {
+    _req.add_header(CALLS_OMITTED_HEADER, std::to_string(omitted_calls));
+  }
+}
+
+void CallListTask::get_validators(const std::vector<CallListStore::CallFragment>& records,
+                                  std::string& etag,
+                                  time_t& last_modified)
+{
+  // The entity tag is a hash over every fragment, so changes whenever a
+  // fragment is written or ages out.  Each field is length-delimited so that
+  // different fragments can't hash the same.
+  MD5_CTX md5_ctx;
+  MD5_Init(&md5_ctx);
+  std::string latest_time;
+
+  for (std::vector<CallListStore::CallFragment>::const_iterator ii = records.begin();
+       ii != records.end();
+       ++ii)
+  {
+    std::string fields = ii->timestamp + '\0' +
+                         ii->id + '\0' +
+                         std::to_string((int)ii->type) + '\0' +
+                         std::to_string(ii->contents.length()) + '\0';
+    MD5_Update(&md5_ctx, fields.data(), fields.length());
+    MD5_Update(&md5_ctx, ii->contents.data(), ii->contents.length());
+
+    // Each fragment is written when the call it belongs to starts, ends or
+    // is rejected, so the call list was last modified at the latest of
+    // these times.
+    std::string time = fragment_event_time(*ii);
+    if (time > latest_time)
+    {
+      latest_time = time;
+    }
+  }
+
+  unsigned char hash[Utils::MD5_HASH_SIZE];
+  unsigned char hash_hex[Utils::HEX_HASH_SIZE + 1];
+  MD5_Final(hash, &md5_ctx);
+  Utils::hashToHex(hash, hash_hex);
+  etag = "\"" + std::string((const char*)hash_hex) + "\"";
+
+  last_modified = 0;
+  time_from_fragment_timestamp(latest_time, last_modified);
+}
+
+std::string CallListTask::encoded_etag(const std::string& etag,
+                                       Format format,
+                                       CallListCompressor::Encoding encoding)
+{
+  // Each format and encoding of the call list is a different
+  // representation, so needs a different entity tag.
+  if (etag.length() < 2)
+  {
+    return etag;
+  }
+
+  std::string suffix;
+
+  if (format != XML)
+  {
+    suffix += std::string("-") + format_name(format);
+  }
+
+  if (encoding != CallListCompressor::IDENTITY)
+  {
+    suffix += std::string("-") + CallListCompressor::encoding_name(encoding);
+  }
+
+  return etag.substr(0, etag.length() - 1) + suffix + "\"";
+}
+
+CallListTask::Format CallListTask::choose_format(const std::string& accept)
+{
+  // Pick the supported media type with the highest quality value.  Types the
+  // client doesn't ask for explicitly (including wildcards) get XML, so
+  // existing clients are unaffected.
+  Format format = XML;
+  float best_q = 0;
+  std::vector<std::string> media_ranges;
+  Utils::split_string(accept, ',', media_ranges, 0, true);
+
+  for (std::vector<std::string>::iterator ii = media_ranges.begin();
+       ii != media_ranges.end();
+       ++ii)
+  {
+    std::string media_type = *ii;
+    float q = 1;
+    size_t params = media_type.find(';');
+
+    if (params != std::string::npos)
+    {
+      size_t q_param = media_type.find("q=", params);
+
+      if (q_param != std::string::npos)
+      {
+        q = strtof(media_type.c_str() + q_param + 2, NULL);
+      }
+
+      media_type.erase(params);
+    }
+
+    Utils::trim(media_type);
+    Format candidate;
+
+    if (strcasecmp(media_type.c_str(), JSON_CONTENT_TYPE) == 0)
+    {
+      candidate = JSON;
+    }
+    else if (strcasecmp(media_type.c_str(), CBOR_CONTENT_TYPE) == 0)
+    {
+      candidate = CBOR;
+    }
+    else if (strcasecmp(media_type.c_str(), XML_CONTENT_TYPE) == 0)
+    {
+      candidate = XML;
+    }
+    else
+    {
+      continue;
+    }
+
+    if (q > best_q)
+    {
+      format = candidate;
+      best_q = q;
+    }
+  }
+
+  return format;
+}
+
+const char* CallListTask::format_name(Format format)
+{
+  switch (format)
+  {
+  case JSON:
+    return "json";
+
+  case CBOR:
+    return "cbor";
+
+  default:
+    return "xml";
+  }
+}
+
+const char* CallListTask::content_type(Format format)
+{
+  switch (format)
+  {
+  case JSON:
+    return JSON_CONTENT_TYPE;
+
+  case CBOR:
+    return CBOR_CONTENT_TYPE;
+
+  default:
+    return XML_CONTENT_TYPE;
+  }
+}
+
+std::string CallListTask::call_list_key()
+{
+  // Each format of the call list is cached and read separately.
+  if (_format == XML)
+  {
+    return _impu;
+  }
+
+  return _impu + ";" + format_name(_format);
+}
+
+size_t CallListTask::write_call_list(const std::vector<CallListStore::CallFragment>& records,
+                                     CallListWriter& writer)
+{
+  StageTimer render_timer(_cfg->_stat_render_stage);
+
+  switch (_format)
+  {
+  case JSON:
+    return write_json_from_call_records(records,
+                                        writer,
+                                        _cfg->_max_call_list_bytes,
+                                        trail());
+
+  case CBOR:
+    return write_cbor_from_call_records(records,
+                                        writer,
+                                        _cfg->_max_call_list_bytes,
+                                        trail());
+
+  default:
+    return write_xml_from_call_records(records,
+                                       writer,
+                                       _cfg->_max_call_list_bytes,
+                                       trail(),
+                                       _cfg->_validate_call_xml);
+  }
+}
+
+bool CallListTask::use_call_list_cache()
+{
+  // Only whole call lists are cached.
+  return ((_cfg->_call_list_cache != NULL) && (!_range.is_bounded()));
+}
+
+bool CallListTask::client_copy_is_current(const std::string& etag,
+                                          time_t last_modified)
+{
+  // If-None-Match takes precedence over If-Modified-Since (RFC 7232).
+  std::string if_none_match = _req.header("If-None-Match");
+
+  if (!if_none_match.empty())
+  {
+    std::vector<std::string> client_etags;
+    Utils::split_string(if_none_match, ',', client_etags, 0, true, true);
+
+    for (std::vector<std::string>::iterator ii = client_etags.begin();
+         ii != client_etags.end();
+         ++ii)
+    {
+      // Use the weak comparison function, so ignore any W/ prefix.
+      std::string client_etag = *ii;
+      if (client_etag.compare(0, 2, "W/") == 0)
+      {
+        client_etag = client_etag.substr(2);
+      }
+
+      if ((client_etag == "*") || (client_etag == etag))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  std::string if_modified_since = _req.header("If-Modified-Since");
+
+  if ((!if_modified_since.empty()) && (last_modified != 0))
+  {
+    struct tm tm = {0};
+
+    if (strptime(if_modified_since.c_str(), HTTP_DATE_FORMAT, &tm) != NULL)
+    {
+      return (last_modified <= timegm(&tm));
+    }
+
+    TRC_DEBUG("Ignoring invalid If-Modified-Since header: %s",
+              if_modified_since.c_str());
+  }
+
+  return false;
 }
 
 HTTPCode CallListTask::parse_request()
@@ -146,11 +983,19 @@ HTTPCode CallListTask::parse_request()
 
   _impu = path.substr(prefix.length(), path.find_first_of("/", prefix.length()) - prefix.length());
 
-  if (_req.method() != htp_method_GET)
+  if ((_req.method() != htp_method_GET) &&
+      (_req.method() != htp_method_HEAD))
   {
     return HTTP_BADMETHOD;
   }
-  return HTTP_OK;
+
+  // The client can ask for the call list in other formats.
+  _format = choose_format(_req.header("Accept"));
+
+  // The client can ask for just part of the call list.
+  return _range.parse(_req.param("since"),
+                      _req.param("until"),
+                      _req.param("limit"));
 }
 
 std::string CallListTask::user_from_impu(std::string impu)
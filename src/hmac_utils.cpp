@@ -0,0 +1,50 @@
+/**
+ * @file hmac_utils.cpp Helpers for signing values with HMAC-SHA256.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "hmac_utils.h"
+
+std::string HmacUtils::hmac_hex(const std::string& key,
+                                const std::string& data,
+                                size_t hex_len)
+{
+  static const char HEX[] = "0123456789abcdef";
+  unsigned char hmac[EVP_MAX_MD_SIZE];
+  unsigned int hmac_len = 0;
+
+  HMAC(EVP_sha256(),
+       key.data(),
+       key.length(),
+       (const unsigned char*)data.data(),
+       data.length(),
+       hmac,
+       &hmac_len);
+
+  std::string hex;
+  hex.reserve(hex_len);
+
+  for (unsigned int ii = 0; (ii < hmac_len) && (hex.length() < hex_len); ii++)
+  {
+    hex.push_back(HEX[hmac[ii] >> 4]);
+    hex.push_back(HEX[hmac[ii] & 0x0f]);
+  }
+
+  return hex;
+}
+
+bool HmacUtils::macs_equal(const std::string& mac1, const std::string& mac2)
+{
+  return ((mac1.length() == mac2.length()) &&
+          (CRYPTO_memcmp(mac1.data(), mac2.data(), mac1.length()) == 0));
+}
@@ -63,10 +63,7 @@ HTTPCode HomesteadConnection::get_digest_data(const std::string& private_user_id
   return rc;
 }
 
-/// Parse received digest. This must be valid JSON and have the format:
-/// { "digest" : { "ha1": "ha1",
-///                "qop": "qop",
-///                "realm": "realm" }}
+/// Retrieve and parse the digest.
 HTTPCode HomesteadConnection::get_digest_and_parse(const std::string& path,
                                                    std::string& digest,
                                                    std::string& realm,
@@ -81,57 +78,71 @@ HTTPCode HomesteadConnection::get_digest_and_parse(const std::string& path,
 
   if (rc == HTTP_OK)
   {
-    std::string json_data = response.get_body();
-    rapidjson::Document doc;
-    doc.Parse<0>(json_data.c_str());
+    rc = parse_digest(response.get_body(), digest, realm);
+  }
+  else if (rc == HTTP_SERVER_UNAVAILABLE)
+  {
+    // Change a 503 response to 504 as we don't want to trigger retries -
+    // as httpconnection will already have retried for us.
+    rc = HTTP_GATEWAY_TIMEOUT;
+  }
+
+  return rc;
+}
+
+/// Parse received digest. This must be valid JSON and have the format:
+/// { "digest" : { "ha1": "ha1",
+///                "qop": "qop",
+///                "realm": "realm" }}
+HTTPCode HomesteadConnection::parse_digest(const std::string& json_data,
+                                           std::string& digest,
+                                           std::string& realm)
+{
+  HTTPCode rc = HTTP_OK;
+
+  rapidjson::Document doc;
+  doc.Parse<0>(json_data.c_str());
+
+  if (doc.HasParseError())
+  {
+    TRC_WARNING("Failed to parse JSON body %s", json_data.c_str());
+    rc = HTTP_BAD_REQUEST;
+  }
+  else if (!doc.HasMember("digest"))
+  {
+    TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
+    rc = HTTP_BAD_REQUEST;
+  }
+
+  if (rc == HTTP_OK)
+  {
+    rapidjson::Value& digest_v = doc["digest"];
 
-    if (doc.HasParseError())
+    if (!digest_v.HasMember("ha1"))
     {
-      TRC_WARNING("Failed to parse JSON body %s", json_data.c_str());
+      TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
       rc = HTTP_BAD_REQUEST;
     }
-    else if (!doc.HasMember("digest"))
+    else if (!digest_v.HasMember("qop"))
     {
       TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
       rc = HTTP_BAD_REQUEST;
     }
-
-    if (rc == HTTP_OK)
+    else if (std::string(digest_v["qop"].GetString()) != "auth")
     {
-      rapidjson::Value& digest_v = doc["digest"];
-
-      if (!digest_v.HasMember("ha1"))
-      {
-        TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
-        rc = HTTP_BAD_REQUEST;
-      }
-      else if (!digest_v.HasMember("qop"))
-      {
-        TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
-        rc = HTTP_BAD_REQUEST;
-      }
-      else if (std::string(digest_v["qop"].GetString()) != "auth")
-      {
-        TRC_WARNING("Returned Digest is invalid. QoP isn't auth (%s)", digest_v["qop"].GetString());
-        rc = HTTP_BAD_REQUEST;
-      }
-      else if (!digest_v.HasMember("realm"))
-      {
-        TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
-        rc = HTTP_BAD_REQUEST;
-      }
-      else
-      {
-        digest = digest_v["ha1"].GetString();
-        realm = digest_v["realm"].GetString();
-      }
+      TRC_WARNING("Returned Digest is invalid. QoP isn't auth (%s)", digest_v["qop"].GetString());
+      rc = HTTP_BAD_REQUEST;
+    }
+    else if (!digest_v.HasMember("realm"))
+    {
+      TRC_WARNING("Returned Digest is invalid. JSON is: %s", json_data.c_str());
+      rc = HTTP_BAD_REQUEST;
+    }
+    else
+    {
+      digest = digest_v["ha1"].GetString();
+      realm = digest_v["realm"].GetString();
     }
-  }
-  else if (rc == HTTP_SERVER_UNAVAILABLE)
-  {
-    // Change a 503 response to 504 as we don't want to trigger retries -
-    // as httpconnection will already have retried for us.
-    rc = HTTP_GATEWAY_TIMEOUT;
   }
 
   return rc;
@@ -21,7 +21,11 @@ HTTPDigestAuthenticate::HTTPDigestAuthenticate(AuthStore* auth_store,
                                                Counter* stat_auth_attempt_count,
                                                Counter* stat_auth_success_count,
                                                Counter* stat_auth_failure_count,
-                                               Counter* stat_auth_stale_count) :
+                                               Counter* stat_auth_stale_count,
+                                               StageStatistics* stat_auth_store_stage,
+                                               StageStatistics* stat_homestead_stage,
+                                               NonceSigner* nonce_signer,
+                                               HA1Cache* ha1_cache) :
   _auth_store(auth_store),
   _homestead_conn(homestead_conn),
   _home_domain(home_domain),
@@ -29,7 +33,11 @@ HTTPDigestAuthenticate::HTTPDigestAuthenticate(AuthStore* auth_store,
   _stat_auth_attempt_count(stat_auth_attempt_count),
   _stat_auth_success_count(stat_auth_success_count),
   _stat_auth_failure_count(stat_auth_failure_count),
-  _stat_auth_stale_count(stat_auth_stale_count)
+  _stat_auth_stale_count(stat_auth_stale_count),
+  _stat_auth_store_stage(stat_auth_store_stage),
+  _stat_homestead_stage(stat_homestead_stage),
+  _nonce_signer(nonce_signer),
+  _ha1_cache(ha1_cache)
 {
 }
 
@@ -263,14 +271,22 @@ HTTPCode HTTPDigestAuthenticate::retrieve_digest_from_store(std::string& www_aut
 
   _stat_auth_attempt_count->increment();
 
-  AuthStore::Digest* digest;
+  AuthStore::Digest digest;
+  StageTimer auth_store_timer(_stat_auth_store_stage);
   Store::Status store_rc = _auth_store->get_digest(_impi, response->_nonce, digest, _trail);
+  auth_store_timer.stop();
 
   if (store_rc == Store::OK)
   {
     // Successfully retrieved digest, so check whether it matches
     // the response sent by the client
-    rc = check_if_matches(digest, www_auth_header, response);
+    rc = check_if_matches(&digest, www_auth_header, response);
+  }
+  else if (_nonce_signer != NULL)
+  {
+    // Digest wasn't found in the store, but the nonce may be a signed one
+    // that hasn't been used yet.
+    rc = check_signed_nonce(www_auth_header, response);
   }
   else
   {
@@ -282,12 +298,72 @@ HTTPCode HTTPDigestAuthenticate::retrieve_digest_from_store(std::string& www_aut
     rc = request_digest_and_store(www_auth_header, true, response);
   }
 
-  delete digest; digest = NULL;
   return rc;
 }
 
-// Request a digest from Homestead, store it in memcached, and generate
-// the WWW-Authenticate header.
+// Check the response to a challenge with a signed nonce.  The nonce carries
+// everything needed to check it apart from the HA1, which is fetched from
+// Homestead again.  If the response is valid, the digest is stored so that the
+// nonce count is checked on later uses of the nonce.
+HTTPCode HTTPDigestAuthenticate::check_signed_nonce(std::string& www_auth_header,
+                                                    Response* response)
+{
+  std::string ha1_fingerprint;
+  NonceSigner::Result result = _nonce_signer->verify(response->_nonce,
+                                                     _impi,
+                                                     _impu,
+                                                     response->_realm,
+                                                     response->_opaque,
+                                                     ha1_fingerprint);
+
+  if (result != NonceSigner::VALID)
+  {
+    // Either the nonce has expired, or it wasn't issued to this subscriber
+    // for this IMPU. Rechallenge.
+    TRC_DEBUG("Nonce isn't a valid signed nonce (%d)", result);
+    SAS::Event event(_trail, SASEvent::AUTHENTICATION_OUT_OF_DATE, 0);
+    SAS::report_event(event);
+
+    return request_digest_and_store(www_auth_header, true, response);
+  }
+
+  std::string ha1;
+  std::string realm;
+  HTTPCode rc = get_digest_data(ha1, realm);
+
+  if (rc != HTTP_OK)
+  {
+    return rc;
+  }
+
+  if (!_nonce_signer->matches_ha1(ha1_fingerprint, ha1))
+  {
+    // The subscriber's password has changed since the challenge, or the
+    // cached HA1 is out of date. Rechallenge.
+    TRC_DEBUG("HA1 has changed since the nonce was issued");
+    invalidate_cached_ha1();
+    SAS::Event event(_trail, SASEvent::AUTHENTICATION_OUT_OF_DATE, 0);
+    SAS::report_event(event);
+
+    return request_digest_and_store(www_auth_header, true, response);
+  }
+
+  // The digest has no CAS, so if the response is valid it is added to the
+  // store.  If another request has used the nonce in the meantime, the add
+  // fails and this request is rechallenged.
+  AuthStore::Digest digest;
+  digest._ha1 = ha1;
+  digest._impi = _impi;
+  digest._realm = response->_realm;
+  digest._impu = _impu;
+  digest._nonce = response->_nonce;
+  digest._opaque = response->_opaque;
+
+  return check_if_matches(&digest, www_auth_header, response);
+}
+
+// Request a digest from Homestead, store it in memcached (unless the nonce is
+// signed), and generate the WWW-Authenticate header.
 HTTPCode HTTPDigestAuthenticate::request_digest_and_store(std::string& www_auth_header,
                                                           bool include_stale,
                                                           Response* response)
@@ -298,15 +374,23 @@ HTTPCode HTTPDigestAuthenticate::request_digest_and_store(std::string& www_auth_
   TRC_DEBUG("Request digest for IMPU: %s, IMPI: %s", _impu.c_str(), _impi.c_str());
 
   // Request the digest from homestead
-  rc = _homestead_conn->get_digest_data(_impi, _impu, ha1, realm, _trail);
+  rc = get_digest_data(ha1, realm);
 
   if (rc == HTTP_OK)
   {
-    // Generate the digest structure and store it in memcached
-    TRC_DEBUG("Store digest for IMPU: %s, IMPI: %s", _impu.c_str(), _impi.c_str());
-    AuthStore::Digest* digest = new AuthStore::Digest();
-    generate_digest(ha1, realm, digest);
-    Store::Status status = _auth_store->set_digest(_impi, digest->_nonce, digest, _trail);
+    // Generate the digest structure and store it in memcached.  A signed
+    // nonce isn't stored until it is used.
+    AuthStore::Digest digest;
+    generate_digest(ha1, realm, &digest);
+    Store::Status status = Store::OK;
+
+    if (_nonce_signer == NULL)
+    {
+      TRC_DEBUG("Store digest for IMPU: %s, IMPI: %s", _impu.c_str(), _impi.c_str());
+      StageTimer auth_store_timer(_stat_auth_store_stage);
+      status = _auth_store->set_digest(_impi, digest._nonce, &digest, _trail);
+      auth_store_timer.stop();
+    }
 
     if (status == Store::OK)
     {
@@ -321,7 +405,7 @@ HTTPCode HTTPDigestAuthenticate::request_digest_and_store(std::string& www_auth_
       }
 
       // Create the WWW-Authenticate header
-      generate_www_auth_header(www_auth_header, include_stale, digest);
+      generate_www_auth_header(www_auth_header, include_stale, &digest);
       rc = HTTP_UNAUTHORIZED;
     }
     else
@@ -331,7 +415,6 @@ HTTPCode HTTPDigestAuthenticate::request_digest_and_store(std::string& www_auth_
       rc = HTTP_SERVER_ERROR;
       // LCOV_EXCL_STOP
     }
-    delete digest; digest = NULL;
   }
 
   return rc;
@@ -400,10 +483,12 @@ HTTPCode HTTPDigestAuthenticate::check_if_matches(AuthStore::Digest* digest,
     // and the nonce will be treated as stale.
     uint32_t client_count = atoi(response->_nc.c_str());
 
-    // Nonce count is stale. Request the digest from Homestead again.
-    if (client_count < digest->_nonce_count)
+    // Nonce count is stale (it has already been used, or is too old to tell).
+    // Request the digest from Homestead again.
+    if (!digest->use_nonce_count(client_count))
     {
-      TRC_DEBUG("Client response's nonce count is too low");
+      TRC_DEBUG("Client response's nonce count %u has already been used",
+                client_count);
       SAS::Event event(_trail, SASEvent::AUTHENTICATION_OUT_OF_DATE, 0);
       SAS::report_event(event);
 
@@ -422,19 +507,15 @@ HTTPCode HTTPDigestAuthenticate::check_if_matches(AuthStore::Digest* digest,
     }
     else
     {
-      // Authentication successful. Increment the stored nonce count
-      digest->_nonce_count++;
-      Store::Status store_rc = _auth_store->set_digest(_impi,
-                                                       digest->_nonce,
-                                                       digest,
-                                                       _trail);
+      // Authentication successful. Record the nonce count in the store.
+      Store::Status store_rc = store_nonce_count(digest, client_count);
       TRC_DEBUG("Updating nonce count - store returned %d", store_rc);
 
       if (store_rc == Store::DATA_CONTENTION)
       {
-        // The write to the store failed due to a CAS mismatch.  This means that
-        // the digest has already been used to authenticate another request, so
-        // the authentication on this request is stale. Rechallenge.
+        // The nonce count couldn't be recorded, because another request has
+        // used it since the digest was read, or the digest has gone from the
+        // store.  The authentication on this request is stale. Rechallenge.
         TRC_DEBUG("Failed to update nonce count - rechallenge");
         SAS::Event event(_trail, SASEvent::AUTHENTICATION_OUT_OF_DATE, 1);
         SAS::report_event(event);
@@ -462,12 +543,109 @@ HTTPCode HTTPDigestAuthenticate::check_if_matches(AuthStore::Digest* digest,
 
     _stat_auth_failure_count->increment();
 
+    // The password may have changed since the HA1 was cached, so fetch it
+    // from Homestead when the client is next challenged.
+    invalidate_cached_ha1();
+
     rc = HTTP_FORBIDDEN;
   }
 
   return rc;
 }
 
+// Write a digest back to the store once a nonce count has been used.  If the
+// write fails due to a CAS mismatch, another request has used the digest since
+// it was read - usually because the client is sending requests in parallel with
+// the same nonce, and different nonce counts.  Reread the digest and record the
+// nonce count again, so that only a genuine reuse of the nonce count fails.
+//
+// If the auth store records nonce counts separately, the digest isn't written
+// at all - the nonce count is added as its own entry instead.
+//
+// Returns DATA_CONTENTION if the nonce count couldn't be recorded.
+Store::Status HTTPDigestAuthenticate::store_nonce_count(AuthStore::Digest* digest,
+                                                        uint32_t nonce_count)
+{
+  StageTimer auth_store_timer(_stat_auth_store_stage);
+
+  if (_auth_store->records_nonce_count_separately(digest))
+  {
+    // The nonce count is recorded with a single add, which only fails if the
+    // nonce count has been used before - so there's nothing to retry.
+    Store::Status store_rc = _auth_store->record_nonce_count(_impi,
+                                                             digest->_nonce,
+                                                             nonce_count,
+                                                             _trail);
+    auth_store_timer.stop();
+    return store_rc;
+  }
+
+  Store::Status store_rc = _auth_store->set_digest(_impi,
+                                                   digest->_nonce,
+                                                   digest,
+                                                   _trail);
+
+  for (int attempts = 1;
+       (store_rc == Store::DATA_CONTENTION) && (attempts < MAX_NONCE_COUNT_WRITES);
+       attempts++)
+  {
+    AuthStore::Digest current_digest;
+    Store::Status get_rc = _auth_store->get_digest(_impi,
+                                                   digest->_nonce,
+                                                   current_digest,
+                                                   _trail);
+
+    if (get_rc != Store::OK)
+    {
+      TRC_DEBUG("Digest has gone from the store (%d)", get_rc);
+      break;
+    }
+
+    if (!current_digest.use_nonce_count(nonce_count))
+    {
+      TRC_DEBUG("Nonce count %u was used by another request", nonce_count);
+      break;
+    }
+
+    TRC_DEBUG("Digest was updated by another request - retry");
+    store_rc = _auth_store->set_digest(_impi,
+                                       current_digest._nonce,
+                                       &current_digest,
+                                       _trail);
+  }
+
+  auth_store_timer.stop();
+  return store_rc;
+}
+
+// Get the HA1 and realm, from the HA1 cache if there is one.
+HTTPCode HTTPDigestAuthenticate::get_digest_data(std::string& ha1,
+                                                 std::string& realm)
+{
+  StageTimer homestead_timer(_stat_homestead_stage);
+  HTTPCode rc;
+
+  if (_ha1_cache != NULL)
+  {
+    rc = _ha1_cache->get_digest_data(_impi, _impu, ha1, realm, _trail);
+  }
+  else
+  {
+    rc = _homestead_conn->get_digest_data(_impi, _impu, ha1, realm, _trail);
+  }
+
+  homestead_timer.stop();
+  return rc;
+}
+
+void HTTPDigestAuthenticate::invalidate_cached_ha1()
+{
+  if (_ha1_cache != NULL)
+  {
+    _ha1_cache->invalidate(_impi, _impu);
+  }
+}
+
 void gen_unique_val(size_t length, std::string& unique_val)
 {
   unique_val.reserve(length);
@@ -492,8 +670,20 @@ void HTTPDigestAuthenticate::generate_digest(std::string ha1, std::string realm,
   digest->_realm = realm;
   digest->_impu = _impu;
 
-  gen_unique_val(32, digest->_nonce);
-  gen_unique_val(32, digest->_opaque);
+  std::string opaque;
+  gen_unique_val(32, opaque);
+  digest->_opaque = opaque;
+
+  if (_nonce_signer != NULL)
+  {
+    digest->_nonce = _nonce_signer->sign(_impi, _impu, realm, opaque, ha1);
+  }
+  else
+  {
+    std::string nonce;
+    gen_unique_val(32, nonce);
+    digest->_nonce = nonce;
+  }
 }
 
 // Generate a WWW-Authenticate header. This has the format:
@@ -507,8 +697,12 @@ void HTTPDigestAuthenticate::generate_www_auth_header(std::string& www_auth_head
   www_auth_header = "Digest";
   www_auth_header.append(" realm=\"").append(_home_domain).append("\"");
   www_auth_header.append(",qop=\"").append("auth").append("\"");
-  www_auth_header.append(",nonce=\"").append(digest->_nonce).append("\"");
-  www_auth_header.append(",opaque=\"").append(digest->_opaque).append("\"");
+  www_auth_header.append(",nonce=\"")
+                 .append(digest->_nonce.data(), digest->_nonce.length())
+                 .append("\"");
+  www_auth_header.append(",opaque=\"")
+                 .append(digest->_opaque.data(), digest->_opaque.length())
+                 .append("\"");
 
   if (include_stale)
   {
@@ -13,6 +13,8 @@
 #include <signal.h>
 #include <semaphore.h>
 #include <strings.h>
+#include <fstream>
+#include <sstream>
 
 #include "memcachedstore.h"
 #include "httpstack.h"
@@ -36,6 +38,7 @@ enum MemcachedWriteFormat
 {
   BINARY,
   JSON,
+  COMPACT,
 };
 
 struct options
@@ -45,8 +48,23 @@ struct options
   unsigned short http_port;
   int http_threads;
   int http_worker_threads;
+  int cassandra_threads;
+  int max_call_list_bytes;
+  int call_list_cache_size;
+  int call_list_cache_ttl;
+  int call_list_prefetch_ttl;
+  bool optimistic_call_list_reads;
+  bool validate_call_xml;
   std::string homestead_http_name;
+  int ha1_cache_size;
+  int ha1_cache_ttl;
   int digest_timeout;
+  int digest_cache_size;
+  bool separate_nonce_counts;
+  bool coalesce_digest_reads;
+  std::string nonce_key;
+  int session_token_lifetime;
+  uint32_t session_token_epoch;
   std::string home_domain;
   std::string sas_system_name;
   bool access_log_enabled;
@@ -77,8 +95,23 @@ enum OptionTypes
   HTTP_ADDRESS,
   HTTP_THREADS,
   HTTP_WORKER_THREADS,
+  CASSANDRA_THREADS,
+  MAX_CALL_LIST_BYTES,
+  CALL_LIST_CACHE_SIZE,
+  CALL_LIST_CACHE_TTL,
+  CALL_LIST_PREFETCH_TTL,
+  OPTIMISTIC_CALL_LIST_READS,
+  VALIDATE_CALL_XML,
   HOMESTEAD_HTTP_NAME,
+  HA1_CACHE_SIZE,
+  HA1_CACHE_TTL,
   DIGEST_TIMEOUT,
+  DIGEST_CACHE_SIZE,
+  SEPARATE_NONCE_COUNTS,
+  COALESCE_DIGEST_READS,
+  NONCE_KEY_FILE,
+  SESSION_TOKEN_LIFETIME,
+  SESSION_TOKEN_EPOCH,
   HOME_DOMAIN,
   SAS_CONFIG,
   ACCESS_LOG,
@@ -108,8 +141,23 @@ const static struct option long_opt[] =
   {"http",                       required_argument, NULL, HTTP_ADDRESS},
   {"http-threads",               required_argument, NULL, HTTP_THREADS},
   {"http-worker-threads",        required_argument, NULL, HTTP_WORKER_THREADS},
+  {"cassandra-threads",          required_argument, NULL, CASSANDRA_THREADS},
+  {"max-call-list-bytes",        required_argument, NULL, MAX_CALL_LIST_BYTES},
+  {"call-list-cache-size",       required_argument, NULL, CALL_LIST_CACHE_SIZE},
+  {"call-list-cache-ttl",        required_argument, NULL, CALL_LIST_CACHE_TTL},
+  {"call-list-prefetch-ttl",     required_argument, NULL, CALL_LIST_PREFETCH_TTL},
+  {"optimistic-call-list-reads", no_argument,       NULL, OPTIMISTIC_CALL_LIST_READS},
+  {"validate-call-xml",          no_argument,       NULL, VALIDATE_CALL_XML},
   {"homestead-http-name",        required_argument, NULL, HOMESTEAD_HTTP_NAME},
+  {"ha1-cache-size",             required_argument, NULL, HA1_CACHE_SIZE},
+  {"ha1-cache-ttl",              required_argument, NULL, HA1_CACHE_TTL},
   {"digest-timeout",             required_argument, NULL, DIGEST_TIMEOUT},
+  {"digest-cache-size",          required_argument, NULL, DIGEST_CACHE_SIZE},
+  {"separate-nonce-counts",      no_argument,       NULL, SEPARATE_NONCE_COUNTS},
+  {"coalesce-digest-reads",      no_argument,       NULL, COALESCE_DIGEST_READS},
+  {"nonce-key-file",             required_argument, NULL, NONCE_KEY_FILE},
+  {"session-token-lifetime",     required_argument, NULL, SESSION_TOKEN_LIFETIME},
+  {"session-token-epoch",        required_argument, NULL, SESSION_TOKEN_EPOCH},
   {"home-domain",                required_argument, NULL, HOME_DOMAIN},
   {"sas",                        required_argument, NULL, SAS_CONFIG},
   {"access-log",                 required_argument, NULL, ACCESS_LOG},
@@ -142,9 +190,61 @@ void usage(void)
        "                            Set HTTP bind address and port (default: 0.0.0.0:11888)\n"
        " --http-threads N           Number of HTTP threads (default: 1)\n"
        " --http-worker-threads N    Number of HTTP worker threads (default: 50)\n"
+       " --cassandra-threads N      Number of threads used to read call lists from Cassandra.\n"
+       "                            HTTP worker threads are released while these reads are in\n"
+       "                            progress. If 0, reads are made on the HTTP worker threads\n"
+       "                            (default: 10)\n"
+       " --max-call-list-bytes N    Maximum size of a call list response. If a subscriber's call\n"
+       "                            list is larger than this, the oldest calls are omitted\n"
+       "                            and counted in an NGV-Calls-Omitted header. This limits\n"
+       "                            the response, not the memory used to build it.\n"
+       "                            If 0, there is no limit (default: 0)\n"
+       " --call-list-cache-size N   Amount of memory (in MB) used to cache call lists. If 0, call\n"
+       "                            lists are not cached (default: 0)\n"
+       " --call-list-cache-ttl <secs>\n"
+       "                            How long a call list is cached for. Calls made during this\n"
+       "                            time may not appear in the call list (default: 10)\n"
+       " --call-list-prefetch-ttl <secs>\n"
+       "                            When a request is challenged for authentication, read the call\n"
+       "                            list in the background and hold it for this long for the\n"
+       "                            authenticated retry, e.g. 5. Requires --cassandra-threads.\n"
+       "                            If 0, call lists are not prefetched (default: 0)\n"
+       " --optimistic-call-list-reads\n"
+       "                            Start reading the call list for a request with digest\n"
+       "                            credentials while the credentials are checked, rather than\n"
+       "                            afterwards. Requires --cassandra-threads\n"
+       " --validate-call-xml        Check that the XML of each call is well formed, and leave out\n"
+       "                            calls that aren't, rather than copying it into call lists\n"
+       "                            unchecked\n"
        " --homestead-http-name <name>\n"
        "                            Set HTTP address to contact Homestead\n"
+       " --ha1-cache-size N         Number of subscribers' credentials from Homestead to cache.\n"
+       "                            If 0, credentials are not cached (default: 0)\n"
+       " --ha1-cache-ttl <secs>     How long credentials are cached for. Password changes may\n"
+       "                            not take effect for this long (default: 60)\n"
        " --digest-timeout N         Time a digest is stored in memcached (in seconds)\n"
+       " --digest-cache-size N      Amount of memory (in MB) used to cache digests, so that\n"
+       "                            they can be read without going to memcached. Writes still\n"
+       "                            go to memcached. If 0, digests are not cached (default: 0)\n"
+       " --separate-nonce-counts    Record each nonce count used as its own memcached entry,\n"
+       "                            rather than rewriting the digest. Digests then expire the\n"
+       "                            digest timeout after they were stored, so clients are\n"
+       "                            re-challenged (and their HA1 looked up) that often.\n"
+       "                            Replays are only detected once every node has this option\n"
+       "                            turned on\n"
+       " --coalesce-digest-reads    Let requests that need the same digest at the same time\n"
+       "                            share a single memcached read. Requests wait at most 500ms\n"
+       "                            for another request's read before reading it themselves\n"
+       " --nonce-key-file <file>    Sign digest nonces with the key in this file, rather than\n"
+       "                            storing every challenge in memcached. Digests are only\n"
+       "                            stored when first used. All nodes must use the same key\n"
+       " --session-token-lifetime <secs>\n"
+       "                            Give clients that authenticate a session token, signed with\n"
+       "                            the key from --nonce-key-file, that lets them skip\n"
+       "                            authentication for this long. If 0, session tokens are not\n"
+       "                            used (default: 0)\n"
+       " --session-token-epoch N    Only accept session tokens issued with this epoch. Changing\n"
+       "                            it revokes all session tokens (default: 0)\n"
        " --home-domain <domain>     The home domain of the deployment\n"
        " --sas <system name>\n"
        "                            Use specified system name to identify this system to SAS.\n"
@@ -159,8 +259,9 @@ void usage(void)
        "                            (default: localhost)\n"
        " --memcached-write-format\n"
        "                            The data format to use when writing authentication\n"
-       "                            digests to memcached. Values are 'binary' and 'json'\n"
-       "                            (defaults to 'json')\n"
+       "                            digests to memcached. Values are 'binary', 'json' and\n"
+       "                            'compact'. Only use 'compact' once every node can read\n"
+       "                            it (defaults to 'json')\n"
        " --target-latency-us <usecs>\n"
        "                            Target latency above which throttling applies (default: 100000)\n"
        " --max-tokens N             Maximum number of tokens allowed in the token bucket (used by\n"
@@ -249,11 +350,98 @@ int init_options(int argc, char**argv, struct options& options)
       options.http_worker_threads = atoi(optarg);
       break;
 
+    case CASSANDRA_THREADS:
+      TRC_INFO("Number of Cassandra threads: %s", optarg);
+      options.cassandra_threads = atoi(optarg);
+      break;
+
+    case MAX_CALL_LIST_BYTES:
+      options.max_call_list_bytes = atoi(optarg);
+
+      if (options.max_call_list_bytes < 0)
+      {
+        TRC_ERROR("Invalid --max-call-list-bytes option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("Maximum call list size: %s bytes", optarg);
+      break;
+
+    case CALL_LIST_CACHE_SIZE:
+      options.call_list_cache_size = atoi(optarg);
+
+      if (options.call_list_cache_size < 0)
+      {
+        TRC_ERROR("Invalid --call-list-cache-size option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("Call list cache size: %s MB", optarg);
+      break;
+
+    case CALL_LIST_CACHE_TTL:
+      options.call_list_cache_ttl = atoi(optarg);
+
+      if (options.call_list_cache_ttl <= 0)
+      {
+        TRC_ERROR("Invalid --call-list-cache-ttl option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("Call list cache TTL: %s seconds", optarg);
+      break;
+
+    case CALL_LIST_PREFETCH_TTL:
+      options.call_list_prefetch_ttl = atoi(optarg);
+
+      if (options.call_list_prefetch_ttl < 0)
+      {
+        TRC_ERROR("Invalid --call-list-prefetch-ttl option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("Call list prefetch TTL: %s seconds", optarg);
+      break;
+
+    case OPTIMISTIC_CALL_LIST_READS:
+      TRC_INFO("Optimistic call list reads enabled");
+      options.optimistic_call_list_reads = true;
+      break;
+
+    case VALIDATE_CALL_XML:
+      TRC_INFO("Call XML validation enabled");
+      options.validate_call_xml = true;
+      break;
+
     case HOMESTEAD_HTTP_NAME:
       TRC_INFO("Homestead HTTP address: %s", optarg);
       options.homestead_http_name = std::string(optarg);
       break;
 
+    case HA1_CACHE_SIZE:
+      options.ha1_cache_size = atoi(optarg);
+
+      if (options.ha1_cache_size < 0)
+      {
+        TRC_ERROR("Invalid --ha1-cache-size option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("HA1 cache size: %s entries", optarg);
+      break;
+
+    case HA1_CACHE_TTL:
+      options.ha1_cache_ttl = atoi(optarg);
+
+      if (options.ha1_cache_ttl <= 0)
+      {
+        TRC_ERROR("Invalid --ha1-cache-ttl option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("HA1 cache TTL: %s seconds", optarg);
+      break;
+
     case DIGEST_TIMEOUT:
       options.digest_timeout = atoi(optarg);
 
@@ -267,6 +455,66 @@ int init_options(int argc, char**argv, struct options& options)
       TRC_INFO("Digest timeout: %s", optarg);
       break;
 
+    case DIGEST_CACHE_SIZE:
+      options.digest_cache_size = atoi(optarg);
+
+      if (options.digest_cache_size < 0)
+      {
+        TRC_ERROR("Invalid --digest-cache-size option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("Digest cache size: %s MB", optarg);
+      break;
+
+    case SEPARATE_NONCE_COUNTS:
+      TRC_INFO("Nonce counts recorded separately");
+      options.separate_nonce_counts = true;
+      break;
+
+    case COALESCE_DIGEST_READS:
+      TRC_INFO("Digest reads coalesced");
+      options.coalesce_digest_reads = true;
+      break;
+
+    case NONCE_KEY_FILE:
+      {
+        std::ifstream key_file(optarg);
+        std::stringstream key_ss;
+        key_ss << key_file.rdbuf();
+        options.nonce_key = key_ss.str();
+
+        // Ignore any trailing whitespace, such as a final newline.
+        size_t key_end = options.nonce_key.find_last_not_of(" \t\r\n");
+        options.nonce_key.erase((key_end == std::string::npos) ? 0 : key_end + 1);
+
+        if ((!key_file.is_open()) || (options.nonce_key.length() < 16))
+        {
+          TRC_ERROR("Unable to read a nonce key of at least 16 bytes from %s", optarg);
+          return -1;
+        }
+
+        TRC_INFO("Signing nonces with the key in %s", optarg);
+      }
+      break;
+
+    case SESSION_TOKEN_LIFETIME:
+      options.session_token_lifetime = atoi(optarg);
+
+      if (options.session_token_lifetime < 0)
+      {
+        TRC_ERROR("Invalid --session-token-lifetime option %s", optarg);
+        return -1;
+      }
+
+      TRC_INFO("Session token lifetime: %d", options.session_token_lifetime);
+      break;
+
+    case SESSION_TOKEN_EPOCH:
+      options.session_token_epoch = strtoul(optarg, NULL, 10);
+      TRC_INFO("Session token epoch: %u", options.session_token_epoch);
+      break;
+
     case HOME_DOMAIN:
       options.home_domain = std::string(optarg);
       TRC_INFO("Home domain: %s", optarg);
@@ -306,12 +554,18 @@ int init_options(int argc, char**argv, struct options& options)
         TRC_INFO("Memcached write format set to 'json'");
         options.memcached_write_format = MemcachedWriteFormat::JSON;
       }
+      else if (strcmp(optarg, "compact") == 0)
+      {
+        TRC_INFO("Memcached write format set to 'compact'");
+        options.memcached_write_format = MemcachedWriteFormat::COMPACT;
+      }
       else
       {
         TRC_WARNING("Invalid value for memcached-write-format, using '%s'."
-                    "Got '%s', valid vales are 'json' and 'binary'",
-                    ((options.memcached_write_format == MemcachedWriteFormat::JSON) ?
-                     "json" : "binary"),
+                    "Got '%s', valid vales are 'json', 'binary' and 'compact'",
+                    ((options.memcached_write_format == MemcachedWriteFormat::JSON) ? "json" :
+                     (options.memcached_write_format == MemcachedWriteFormat::COMPACT) ? "compact" :
+                     "binary"),
                     optarg);
       }
       break;
@@ -468,8 +722,23 @@ int main(int argc, char**argv)
   options.http_port = 11888;
   options.http_threads = 1;
   options.http_worker_threads = 50;
+  options.cassandra_threads = 10;
+  options.max_call_list_bytes = 0;
+  options.call_list_cache_size = 0;
+  options.call_list_cache_ttl = 10;
+  options.call_list_prefetch_ttl = 0;
+  options.optimistic_call_list_reads = false;
+  options.validate_call_xml = false;
   options.homestead_http_name = "homestead-http-name.unknown";
+  options.ha1_cache_size = 0;
+  options.ha1_cache_ttl = 60;
   options.digest_timeout = 300;
+  options.digest_cache_size = 0;
+  options.separate_nonce_counts = false;
+  options.coalesce_digest_reads = false;
+  options.nonce_key = "";
+  options.session_token_lifetime = 0;
+  options.session_token_epoch = 0;
   options.home_domain = "home.domain";
   options.sas_system_name = "";
   options.access_log_enabled = false;
@@ -611,6 +880,8 @@ int main(int argc, char**argv)
                                                               false,
                                                               astaire_comm_monitor);
 
+  LastValueCache* stats_aggregator = new MementoLVC();
+
   AuthStore::SerializerDeserializer* serializer;
   std::vector<AuthStore::SerializerDeserializer*> deserializers;
 
@@ -618,18 +889,96 @@ int main(int argc, char**argv)
   {
     serializer = new AuthStore::JsonSerializerDeserializer();
   }
+  else if (options.memcached_write_format == MemcachedWriteFormat::COMPACT)
+  {
+    serializer = new AuthStore::CompactSerializerDeserializer();
+  }
   else
   {
     serializer = new AuthStore::BinarySerializerDeserializer();
   }
 
-  deserializers.push_back(new AuthStore::JsonSerializerDeserializer());
-  deserializers.push_back(new AuthStore::BinarySerializerDeserializer());
+  // Count the digests read in the older formats, to show how far a migration
+  // to the compact format has got.  The binary deserializer handles any record
+  // the others don't, so must come last.
+  StatisticCounter* json_digest_read_count =
+            new StatisticCounter("auth_store_json_reads", stats_aggregator);
+  StatisticCounter* binary_digest_read_count =
+            new StatisticCounter("auth_store_binary_reads", stats_aggregator);
+  deserializers.push_back(new AuthStore::CompactSerializerDeserializer());
+  deserializers.push_back(new AuthStore::JsonSerializerDeserializer(json_digest_read_count));
+  deserializers.push_back(new AuthStore::BinarySerializerDeserializer(binary_digest_read_count));
+
+  // Cached digests last as long as they do in memcached.
+  StatisticCounter* digest_cache_hit_count = NULL;
+  StatisticCounter* digest_cache_miss_count = NULL;
+  StatisticCounter* digest_cache_eviction_count = NULL;
+  DigestCache* digest_cache = NULL;
+
+  if (options.digest_cache_size > 0)
+  {
+    digest_cache_hit_count = new StatisticCounter("digest_cache_hits",
+                                                  stats_aggregator);
+    digest_cache_miss_count = new StatisticCounter("digest_cache_misses",
+                                                   stats_aggregator);
+    digest_cache_eviction_count = new StatisticCounter("digest_cache_evictions",
+                                                       stats_aggregator);
+    digest_cache = new DigestCache((size_t)options.digest_cache_size * 1024 * 1024,
+                                   options.digest_timeout * 1000,
+                                   digest_cache_hit_count,
+                                   digest_cache_miss_count,
+                                   digest_cache_eviction_count);
+  }
+
+  StatisticCounter* digest_reads_coalesced_count = NULL;
+  StatisticAccumulator* digest_read_batch_size = NULL;
+  StatisticAccumulator* digest_read_wait_us = NULL;
+  DigestReadCoalescer* digest_read_coalescer = NULL;
+
+  if (options.coalesce_digest_reads)
+  {
+    digest_reads_coalesced_count = new StatisticCounter("auth_store_reads_coalesced",
+                                                        stats_aggregator);
+    digest_read_batch_size = new StatisticAccumulator("auth_store_read_batch_size",
+                                                      stats_aggregator);
+    digest_read_wait_us = new StatisticAccumulator("auth_store_read_wait",
+                                                   stats_aggregator);
+    digest_read_coalescer = new DigestReadCoalescer(digest_reads_coalesced_count,
+                                                    digest_read_batch_size,
+                                                    digest_read_wait_us);
+  }
 
   AuthStore* auth_store = new AuthStore(memcached_store,
                                         serializer,
                                         deserializers,
-                                        options.digest_timeout);
+                                        options.digest_timeout,
+                                        digest_cache,
+                                        options.separate_nonce_counts,
+                                        digest_read_coalescer);
+
+  // Nonces signed with the key last as long as the digests in the store.
+  NonceSigner* nonce_signer = NULL;
+
+  if (options.nonce_key != "")
+  {
+    nonce_signer = new NonceSigner(options.nonce_key, options.digest_timeout);
+  }
+
+  SessionTokenSigner* session_token_signer = NULL;
+
+  if (options.session_token_lifetime > 0)
+  {
+    if (options.nonce_key != "")
+    {
+      session_token_signer = new SessionTokenSigner(options.nonce_key,
+                                                    options.session_token_lifetime,
+                                                    options.session_token_epoch);
+    }
+    else
+    {
+      TRC_WARNING("Session tokens need a key - use --nonce-key-file");
+    }
+  }
 
   LoadMonitor* load_monitor = new LoadMonitor(options.target_latency_us,
                                               options.max_tokens,
@@ -637,8 +986,6 @@ int main(int argc, char**argv)
                                               options.min_token_rate,
                                               options.max_token_rate);
 
-  LastValueCache* stats_aggregator = new MementoLVC();
-
   // Create a HTTP specific resolver.
   HttpResolver* http_resolver = new HttpResolver(dns_resolver,
                                                  af,
@@ -656,6 +1003,29 @@ int main(int argc, char**argv)
 
   HomesteadConnection* homestead_conn = new HomesteadConnection(http_connection);
 
+  // Create the HA1 cache, if enabled.
+  StatisticCounter* ha1_cache_hit_count = NULL;
+  StatisticCounter* ha1_cache_miss_count = NULL;
+  StatisticCounter* ha1_cache_refresh_count = NULL;
+  HA1Cache* ha1_cache = NULL;
+
+  if (options.ha1_cache_size > 0)
+  {
+    ha1_cache_hit_count = new StatisticCounter("ha1_cache_hits",
+                                               stats_aggregator);
+    ha1_cache_miss_count = new StatisticCounter("ha1_cache_misses",
+                                                stats_aggregator);
+    ha1_cache_refresh_count = new StatisticCounter("ha1_cache_refreshes",
+                                                   stats_aggregator);
+    ha1_cache = new HA1Cache(homestead_conn,
+                             options.ha1_cache_size,
+                             options.ha1_cache_ttl * 1000,
+                             ha1_cache_hit_count,
+                             ha1_cache_miss_count,
+                             ha1_cache_refresh_count);
+    ha1_cache->start();
+  }
+
   // Default to a 30s blacklist/graylist duration and port 9160
   CassandraResolver* cass_resolver = new CassandraResolver(dns_resolver,
                                                            af,
@@ -679,6 +1049,13 @@ int main(int argc, char**argv)
   CallListStore::Store* call_list_store = new CallListStore::Store();
   call_list_store->configure_connection(options.cassandra, 9160, cass_comm_monitor, cass_resolver);
 
+  if (options.cassandra_threads > 0)
+  {
+    call_list_store->configure_workers(exception_handler,
+                                       options.cassandra_threads,
+                                       0);
+  }
+
   // Test Cassandra connectivity.
   CassandraStore::ResultCode store_rc = call_list_store->connection_test();
 
@@ -694,6 +1071,65 @@ int main(int argc, char**argv)
     exit(3);
   }
 
+  // Create the call list cache, if enabled.
+  StatisticCounter* cache_hit_count = NULL;
+  StatisticCounter* cache_miss_count = NULL;
+  StatisticCounter* cache_eviction_count = NULL;
+  CallListCache* call_list_cache = NULL;
+
+  if (options.call_list_cache_size > 0)
+  {
+    cache_hit_count = new StatisticCounter("call_list_cache_hits",
+                                           stats_aggregator);
+    cache_miss_count = new StatisticCounter("call_list_cache_misses",
+                                            stats_aggregator);
+    cache_eviction_count = new StatisticCounter("call_list_cache_evictions",
+                                                stats_aggregator);
+    call_list_cache = new CallListCache((size_t)options.call_list_cache_size * 1024 * 1024,
+                                        options.call_list_cache_ttl * 1000,
+                                        cache_hit_count,
+                                        cache_miss_count,
+                                        cache_eviction_count);
+  }
+
+  // Call list responses are compressed at the fastest level once there are
+  // more requests in progress than there are HTTP worker threads to handle
+  // them.
+  CallListCompressor* compressor =
+                        new CallListCompressor(options.http_worker_threads);
+
+  // Concurrent requests for the same call list share a single read.
+  StatisticCounter* reads_coalesced_count =
+                  new StatisticCounter("call_list_reads_coalesced", stats_aggregator);
+  CallListReadCoalescer* read_coalescer =
+                                new CallListReadCoalescer(reads_coalesced_count);
+
+  // Prefetch call lists when requests are challenged, if the call list store
+  // has a worker pool to do it on.
+  StatisticCounter* prefetch_count = NULL;
+  StatisticCounter* prefetch_hit_count = NULL;
+  StatisticCounter* prefetch_wasted_count = NULL;
+  CallListPrefetcher* prefetcher = NULL;
+
+  if ((options.call_list_prefetch_ttl > 0) && (options.cassandra_threads > 0))
+  {
+    prefetch_count = new StatisticCounter("call_list_prefetches",
+                                          stats_aggregator);
+    prefetch_hit_count = new StatisticCounter("call_list_prefetch_hits",
+                                              stats_aggregator);
+    prefetch_wasted_count = new StatisticCounter("call_list_prefetches_wasted",
+                                                 stats_aggregator);
+
+    // Limit the prefetches to a small multiple of the read workers, so they
+    // can't swamp the store.
+    prefetcher = new CallListPrefetcher(call_list_store,
+                                        options.call_list_prefetch_ttl * 1000,
+                                        options.cassandra_threads * 10,
+                                        prefetch_count,
+                                        prefetch_hit_count,
+                                        prefetch_wasted_count);
+  }
+
   HttpStackUtils::SimpleStatsManager stats_manager(stats_aggregator);
   HttpStack* http_stack = new HttpStack(options.http_threads,
                                         exception_handler,
@@ -701,7 +1137,27 @@ int main(int argc, char**argv)
                                         load_monitor,
                                         &stats_manager);
 
-  CallListTask::Config call_list_config(auth_store, homestead_conn, call_list_store, options.home_domain, stats_aggregator, hc, options.api_key);
+  CallListTask::Options call_list_options;
+  call_list_options.async_store_reads = (options.cassandra_threads > 0);
+  call_list_options.max_call_list_bytes = options.max_call_list_bytes;
+  call_list_options.call_list_cache = call_list_cache;
+  call_list_options.compressor = compressor;
+  call_list_options.read_coalescer = read_coalescer;
+  call_list_options.prefetcher = prefetcher;
+  call_list_options.optimistic_reads = options.optimistic_call_list_reads;
+  call_list_options.validate_call_xml = options.validate_call_xml;
+  call_list_options.nonce_signer = nonce_signer;
+  call_list_options.session_token_signer = session_token_signer;
+  call_list_options.ha1_cache = ha1_cache;
+
+  CallListTask::Config call_list_config(auth_store,
+                                        homestead_conn,
+                                        call_list_store,
+                                        options.home_domain,
+                                        stats_aggregator,
+                                        hc,
+                                        options.api_key,
+                                        call_list_options);
 
   MementoSasLogger sas_logger;
   HttpStackUtils::PingHandler ping_handler;
@@ -714,6 +1170,8 @@ int main(int argc, char**argv)
     http_stack->bind_tcp_socket(options.http_address,
                                 options.http_port);
     http_stack->register_handler("^/ping$", &ping_handler);
+    // The call list URL takes optional since, until and limit query
+    // parameters, which are handled by the CallListTask.
     http_stack->register_handler("^/org.projectclearwater.call-list/users/[^/]*/call-list.xml$",
                                     pool.wrap(&call_list_handler));
     http_stack->start();
@@ -743,15 +1201,47 @@ int main(int argc, char**argv)
 
   hc->stop_thread();
 
+  if (ha1_cache != NULL)
+  {
+    ha1_cache->stop();
+  }
+
+  delete ha1_cache; ha1_cache = NULL;
+  delete ha1_cache_hit_count; ha1_cache_hit_count = NULL;
+  delete ha1_cache_miss_count; ha1_cache_miss_count = NULL;
+  delete ha1_cache_refresh_count; ha1_cache_refresh_count = NULL;
   delete homestead_conn; homestead_conn = NULL;
   delete http_connection; http_connection = NULL;
   delete http_client; http_client = NULL;
   delete call_list_store; call_list_store = NULL;
+  delete call_list_cache; call_list_cache = NULL;
+  delete compressor; compressor = NULL;
+  delete read_coalescer; read_coalescer = NULL;
+  delete reads_coalesced_count; reads_coalesced_count = NULL;
+  delete prefetcher; prefetcher = NULL;
+  delete prefetch_count; prefetch_count = NULL;
+  delete prefetch_hit_count; prefetch_hit_count = NULL;
+  delete prefetch_wasted_count; prefetch_wasted_count = NULL;
+  delete cache_hit_count; cache_hit_count = NULL;
+  delete cache_miss_count; cache_miss_count = NULL;
+  delete cache_eviction_count; cache_eviction_count = NULL;
   delete http_resolver; http_resolver = NULL;
   delete cass_resolver; cass_resolver = NULL;
   delete dns_resolver; dns_resolver = NULL;
   delete load_monitor; load_monitor = NULL;
   delete auth_store; auth_store = NULL;
+  delete json_digest_read_count; json_digest_read_count = NULL;
+  delete binary_digest_read_count; binary_digest_read_count = NULL;
+  delete digest_cache; digest_cache = NULL;
+  delete digest_cache_hit_count; digest_cache_hit_count = NULL;
+  delete digest_cache_miss_count; digest_cache_miss_count = NULL;
+  delete digest_cache_eviction_count; digest_cache_eviction_count = NULL;
+  delete digest_read_coalescer; digest_read_coalescer = NULL;
+  delete digest_reads_coalesced_count; digest_reads_coalesced_count = NULL;
+  delete digest_read_batch_size; digest_read_batch_size = NULL;
+  delete digest_read_wait_us; digest_read_wait_us = NULL;
+  delete nonce_signer; nonce_signer = NULL;
+  delete session_token_signer; session_token_signer = NULL;
   delete call_list_store; call_list_store = NULL;
   delete astaire_resolver; astaire_resolver = NULL;
   delete memcached_store; memcached_store = NULL;
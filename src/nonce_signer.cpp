@@ -0,0 +1,134 @@
+/**
+ * @file nonce_signer.cpp Signs and verifies stateless digest nonces.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "nonce_signer.h"
+#include "hmac_utils.h"
+#include "utils.h"
+#include "log.h"
+
+NonceSigner::NonceSigner(const std::string& key, int max_age_s) :
+  _key(key),
+  _max_age_ms((uint64_t)max_age_s * 1000)
+{
+}
+
+NonceSigner::~NonceSigner()
+{
+}
+
+std::string NonceSigner::sign(const std::string& impi,
+                              const std::string& impu,
+                              const std::string& realm,
+                              const std::string& opaque,
+                              const std::string& ha1) const
+{
+  std::string token;
+  Utils::create_random_token(TOKEN_LEN, token);
+
+  std::string fields = std::to_string(now_ms());
+  fields.append(".").append(token);
+  fields.append(".").append(fingerprint(ha1));
+
+  return fields + "." + mac(fields, impi, impu, realm, opaque);
+}
+
+NonceSigner::Result NonceSigner::verify(const std::string& nonce,
+                                        const std::string& impi,
+                                        const std::string& impu,
+                                        const std::string& realm,
+                                        const std::string& opaque,
+                                        std::string& ha1_fingerprint) const
+{
+  // Split the nonce from the right, as only the issue time, fingerprint and
+  // MAC have a fixed form.
+  size_t mac_pos = nonce.rfind('.');
+  size_t fingerprint_pos = ((mac_pos == std::string::npos) || (mac_pos == 0)) ?
+                               std::string::npos :
+                               nonce.rfind('.', mac_pos - 1);
+  size_t token_pos = nonce.find('.');
+
+  if ((fingerprint_pos == std::string::npos) ||
+      (token_pos == fingerprint_pos) ||
+      (mac_pos - fingerprint_pos - 1 != FINGERPRINT_HEX_LEN) ||
+      (nonce.length() - mac_pos - 1 != MAC_HEX_LEN))
+  {
+    TRC_DEBUG("Nonce %s isn't a signed nonce", nonce.c_str());
+    return INVALID;
+  }
+
+  std::string fields = nonce.substr(0, mac_pos);
+  std::string expected_mac = mac(fields, impi, impu, realm, opaque);
+
+  if (!HmacUtils::macs_equal(expected_mac, nonce.substr(mac_pos + 1)))
+  {
+    TRC_DEBUG("Nonce %s has an invalid signature", nonce.c_str());
+    return INVALID;
+  }
+
+  // The nonce was signed by us, so the issue time is well formed.
+  uint64_t issued_ms = strtoull(nonce.substr(0, token_pos).c_str(), NULL, 10);
+  uint64_t now = now_ms();
+
+  if ((issued_ms > now + MAX_CLOCK_SKEW_MS) ||
+      (now > issued_ms + _max_age_ms))
+  {
+    TRC_DEBUG("Nonce %s has expired", nonce.c_str());
+    return EXPIRED;
+  }
+
+  ha1_fingerprint = nonce.substr(fingerprint_pos + 1, FINGERPRINT_HEX_LEN);
+  return VALID;
+}
+
+bool NonceSigner::matches_ha1(const std::string& ha1_fingerprint,
+                              const std::string& ha1) const
+{
+  return HmacUtils::macs_equal(fingerprint(ha1), ha1_fingerprint);
+}
+
+uint64_t NonceSigner::now_ms()
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
+  return (uint64_t)spec.tv_sec * 1000 + (spec.tv_nsec / 1000000);
+}
+
+// The inputs are separated by NULs, which can't appear in them, so that
+// different inputs can't give the same MAC.  The MAC and the fingerprint
+// are prefixed differently so that one can't be used as the other.
+std::string NonceSigner::mac(const std::string& fields,
+                             const std::string& impi,
+                             const std::string& impu,
+                             const std::string& realm,
+                             const std::string& opaque) const
+{
+  std::string data("nonce");
+  data.push_back('\0');
+  data.append(fields).push_back('\0');
+  data.append(impi).push_back('\0');
+  data.append(impu).push_back('\0');
+  data.append(realm).push_back('\0');
+  data.append(opaque);
+
+  return HmacUtils::hmac_hex(_key, data, MAC_HEX_LEN);
+}
+
+std::string NonceSigner::fingerprint(const std::string& ha1) const
+{
+  std::string data("ha1");
+  data.push_back('\0');
+  data.append(ha1);
+
+  return HmacUtils::hmac_hex(_key, data, FINGERPRINT_HEX_LEN);
+}
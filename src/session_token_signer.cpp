@@ -0,0 +1,96 @@
+/**
+ * @file session_token_signer.cpp Issues and checks session tokens.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "session_token_signer.h"
+#include "hmac_utils.h"
+#include "log.h"
+
+SessionTokenSigner::SessionTokenSigner(const std::string& key,
+                                       int lifetime_s,
+                                       uint32_t epoch) :
+  _key(key),
+  _lifetime_ms((uint64_t)lifetime_s * 1000),
+  _epoch(std::to_string(epoch))
+{
+}
+
+SessionTokenSigner::~SessionTokenSigner()
+{
+}
+
+std::string SessionTokenSigner::issue(const std::string& impu) const
+{
+  std::string fields = std::to_string(now_ms() + _lifetime_ms);
+  fields.append(".").append(_epoch);
+
+  return fields + "." + mac(fields, impu);
+}
+
+bool SessionTokenSigner::check(const std::string& token,
+                               const std::string& impu) const
+{
+  size_t epoch_pos = token.find('.');
+  size_t mac_pos = (epoch_pos == std::string::npos) ?
+                     std::string::npos :
+                     token.find('.', epoch_pos + 1);
+
+  if ((mac_pos == std::string::npos) ||
+      (token.compare(epoch_pos + 1, mac_pos - epoch_pos - 1, _epoch) != 0))
+  {
+    TRC_DEBUG("Session token %s is malformed or from another epoch",
+              token.c_str());
+    return false;
+  }
+
+  std::string fields = token.substr(0, mac_pos);
+
+  if (!HmacUtils::macs_equal(mac(fields, impu), token.substr(mac_pos + 1)))
+  {
+    TRC_DEBUG("Session token %s has an invalid signature for %s",
+              token.c_str(), impu.c_str());
+    return false;
+  }
+
+  // The token was issued by us, so the expiry time is well formed.
+  uint64_t expiry_ms = strtoull(token.substr(0, epoch_pos).c_str(), NULL, 10);
+
+  if (now_ms() > expiry_ms)
+  {
+    TRC_DEBUG("Session token %s has expired", token.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+uint64_t SessionTokenSigner::now_ms()
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
+  return (uint64_t)spec.tv_sec * 1000 + (spec.tv_nsec / 1000000);
+}
+
+// The inputs are separated by a NUL, which can't appear in either, and
+// prefixed so that a token's MAC can't be used for anything else signed with
+// the same key.
+std::string SessionTokenSigner::mac(const std::string& fields,
+                                    const std::string& impu) const
+{
+  std::string data("session");
+  data.push_back('\0');
+  data.append(fields).push_back('\0');
+  data.append(impu);
+
+  return HmacUtils::hmac_hex(_key, data, MAC_HEX_LEN);
+}
@@ -0,0 +1,77 @@
+/**
+ * @file stage_timer.cpp Timing of the stages of a request.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "stage_timer.h"
+
+StageStatistics::StageStatistics(const std::string& stage,
+                                 LastValueCache* stats_aggregator) :
+  _latency(new StatisticAccumulator(stage + "_latency", stats_aggregator)),
+  _cpu_time(new StatisticAccumulator(stage + "_cpu_time", stats_aggregator))
+{
+}
+
+StageStatistics::StageStatistics() :
+  _latency(NULL),
+  _cpu_time(NULL)
+{
+}
+
+StageStatistics::~StageStatistics()
+{
+  delete _latency; _latency = NULL;
+  delete _cpu_time; _cpu_time = NULL;
+}
+
+void StageStatistics::record(unsigned long latency_us,
+                             unsigned long cpu_time_us)
+{
+  _latency->accumulate(latency_us);
+  _cpu_time->accumulate(cpu_time_us);
+}
+
+/// @returns                 The time between two timespecs, in microseconds.
+static unsigned long elapsed_us(const struct timespec& start,
+                                const struct timespec& end)
+{
+  long us = ((end.tv_sec - start.tv_sec) * 1000000) +
+            ((end.tv_nsec - start.tv_nsec) / 1000);
+  return (us > 0) ? us : 0;
+}
+
+StageTimer::StageTimer(StageStatistics* stats) :
+  _stats(stats)
+{
+  if (_stats != NULL)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &_start_wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &_start_cpu);
+  }
+}
+
+StageTimer::~StageTimer()
+{
+  stop();
+}
+
+void StageTimer::stop()
+{
+  if (_stats != NULL)
+  {
+    struct timespec end_wall;
+    struct timespec end_cpu;
+    clock_gettime(CLOCK_MONOTONIC, &end_wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end_cpu);
+
+    _stats->record(elapsed_us(_start_wall, end_wall),
+                   elapsed_us(_start_cpu, end_cpu));
+    _stats = NULL;
+  }
+}
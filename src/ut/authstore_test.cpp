@@ -8,7 +8,10 @@
  * Otherwise no rights are granted except for those provided to you by
  * Metaswitch Networks in a separate written agreement.
  */
+#include <atomic>
+#include <pthread.h>
 #include <string>
+#include <unistd.h>
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -16,16 +19,21 @@
 #include "sas.h"
 #include "localstore.h"
 #include "authstore.h"
+#include "digest_cache.h"
+#include "digest_read_coalescer.h"
 #include "test_utils.hpp"
 #include "test_interposer.hpp"
 #include "mock_store.h"
+#include "counting_counter.h"
 
 using namespace std;
 
 using ::testing::_;
 using ::testing::DoAll;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::SetArgReferee;
+using ::testing::SaveArg;
 
 // These tests use "typed tests" to run the same tests over different
 // (de)serializers. For more information see:
@@ -34,7 +42,8 @@ using ::testing::SetArgReferee;
 /// The types of (de)serializer that we want to test.
 typedef ::testing::Types<
   AuthStore::BinarySerializerDeserializer,
-  AuthStore::JsonSerializerDeserializer
+  AuthStore::JsonSerializerDeserializer,
+  AuthStore::CompactSerializerDeserializer
 > SerializerDeserializerTypes;
 
 /// Fixture for BasicAuthStoreTest.  This uses a single AuthStore,
@@ -87,6 +96,7 @@ TYPED_TEST(BasicAuthStoreTest, SimpleWriteRead)
   digest->_opaque = "opaque";
   digest->_realm = "cw-ngv.com";
   digest->_nonce_count = 3;
+  digest->_nc_window = 0x5;
   digest->_impu = "sip:" + impi;
 
   this->_auth_store->set_digest(impi, nonce, digest, 0);
@@ -103,11 +113,52 @@ TYPED_TEST(BasicAuthStoreTest, SimpleWriteRead)
   ASSERT_EQ(digest->_opaque, digest2->_opaque);
   ASSERT_EQ(digest->_impu, digest2->_impu);
   ASSERT_EQ(digest->_nonce_count, digest2->_nonce_count);
+  ASSERT_EQ(digest->_nc_window, digest2->_nc_window);
 
   delete digest; digest = NULL;
   delete digest2; digest2 = NULL;
 }
 
+TYPED_TEST(BasicAuthStoreTest, ReadIntoDigestOnStack)
+{
+  std::string impi = "6505551234@cw-ngv.com";
+  std::string nonce = "1234567890123456789012345678901234567890";
+
+  AuthStore::Digest digest;
+  digest._impi = impi;
+  digest._nonce = nonce;
+  digest._ha1 = "0123456789abcdef0123456789abcdef";
+  digest._opaque = "0123456789abcdef0123456789abcdef";
+  digest._realm = "cw-ngv.com";
+  digest._impu = "sip:" + impi;
+
+  this->_auth_store->set_digest(impi, nonce, &digest, 0);
+
+  // The fixed length fields fit in the digest, so aren't allocated.
+  AuthStore::Digest digest2;
+  ASSERT_EQ(Store::OK, this->_auth_store->get_digest(impi, nonce, digest2, 0));
+  EXPECT_EQ(digest._nonce, digest2._nonce);
+  EXPECT_EQ(digest._ha1, digest2._ha1);
+  EXPECT_EQ(digest._opaque, digest2._opaque);
+  EXPECT_EQ(digest._impu, digest2._impu);
+  EXPECT_TRUE(digest2._nonce.is_inline());
+  EXPECT_TRUE(digest2._ha1.is_inline());
+  EXPECT_TRUE(digest2._opaque.is_inline());
+
+  // Longer fields still work.
+  std::string long_nonce(AuthStore::Digest::NONCE_LENGTH + 1, 'n');
+  digest._nonce = long_nonce;
+  digest._opaque = std::string(AuthStore::Digest::OPAQUE_LENGTH + 1, 'x');
+  this->_auth_store->set_digest(impi, long_nonce, &digest, 0);
+
+  AuthStore::Digest digest3;
+  ASSERT_EQ(Store::OK,
+            this->_auth_store->get_digest(impi, long_nonce, digest3, 0));
+  EXPECT_EQ(long_nonce, digest3._nonce);
+  EXPECT_EQ(digest._opaque, digest3._opaque);
+  EXPECT_FALSE(digest3._opaque.is_inline());
+}
+
 TYPED_TEST(BasicAuthStoreTest, ReadExpired)
 {
   cwtest_completely_control_time();
@@ -174,6 +225,7 @@ class MultiFormatAuthStoreTest : public ::testing::Test
       AuthStore::SerializerDeserializer* serializer =
         new AuthStore::JsonSerializerDeserializer();
       std::vector<AuthStore::SerializerDeserializer*> deserializers = {
+        new AuthStore::CompactSerializerDeserializer(),
         new AuthStore::JsonSerializerDeserializer(),
         new AuthStore::BinarySerializerDeserializer(),
       };
@@ -215,6 +267,7 @@ TYPED_TEST(MultiFormatAuthStoreTest, CanReadAllFormats)
   digest->_opaque = "opaque";
   digest->_realm = "cw-ngv.com";
   digest->_nonce_count = 3;
+  digest->_nc_window = 0x5;
   digest->_impu = "sip:" + impi;
 
   this->_single_store->set_digest(impi, nonce, digest, 0);
@@ -231,6 +284,7 @@ TYPED_TEST(MultiFormatAuthStoreTest, CanReadAllFormats)
   ASSERT_EQ(digest->_opaque, digest2->_opaque);
   ASSERT_EQ(digest->_impu, digest2->_impu);
   ASSERT_EQ(digest->_nonce_count, digest2->_nonce_count);
+  ASSERT_EQ(digest->_nc_window, digest2->_nc_window);
 
   delete digest; digest = NULL;
   delete digest2; digest2 = NULL;
@@ -310,3 +364,702 @@ TEST_F(CorruptDataAuthStoreTest, SemanticallyInvalidJson)
   ASSERT_TRUE(digest == NULL);
   EXPECT_EQ(Store::NOT_FOUND, rc);
 }
+
+
+TEST_F(CorruptDataAuthStoreTest, JsonWithoutNonceCountWindow)
+{
+  AuthStore::Digest* digest;
+  Store::Status rc;
+
+  std::string impi = "kermit@cw-ngv.com";
+  std::string nonce = "987654321";
+
+  // Records written before the window was added have no "nc_window".  Every
+  // nonce count below "nc" is treated as used.
+  EXPECT_CALL(*_mock_store, get_data(_, _, _, _, _))
+    .WillOnce(DoAll(SetArgReferee<2>(std::string("{ \"digest\": {"
+                                                   "\"realm\": \"cw-ngv.com\", "
+                                                   "\"qop\": \"auth\", "
+                                                   "\"ha1\": \"12345\"}, "
+                                                   "\"opaque\": \"blahblahblah\", "
+                                                   "\"impu\": \"kermit@cw-ngv.com\", "
+                                                   "\"nc\": 3}")),
+                    SetArgReferee<3>(1), // CAS
+                    Return(Store::OK)));
+
+  rc = _auth_store->get_digest(impi, nonce, digest, 0);
+  ASSERT_TRUE(digest != NULL);
+  EXPECT_EQ(Store::OK, rc);
+  EXPECT_EQ(3u, digest->_nonce_count);
+  EXPECT_FALSE(digest->use_nonce_count(2));
+  EXPECT_TRUE(digest->use_nonce_count(3));
+
+  delete digest; digest = NULL;
+}
+
+
+TEST(DigestNonceCountTest, InOrder)
+{
+  AuthStore::Digest digest;
+
+  EXPECT_FALSE(digest.use_nonce_count(0));
+  EXPECT_TRUE(digest.use_nonce_count(1));
+  EXPECT_TRUE(digest.use_nonce_count(2));
+  EXPECT_TRUE(digest.use_nonce_count(3));
+  EXPECT_EQ(4u, digest._nonce_count);
+
+  // Each nonce count can only be used once.
+  EXPECT_FALSE(digest.use_nonce_count(1));
+  EXPECT_FALSE(digest.use_nonce_count(3));
+}
+
+
+TEST(DigestNonceCountTest, OutOfOrder)
+{
+  AuthStore::Digest digest;
+
+  // Parallel requests can arrive in any order.
+  EXPECT_TRUE(digest.use_nonce_count(3));
+  EXPECT_TRUE(digest.use_nonce_count(1));
+  EXPECT_FALSE(digest.use_nonce_count(1));
+  EXPECT_TRUE(digest.use_nonce_count(2));
+  EXPECT_FALSE(digest.use_nonce_count(2));
+  EXPECT_FALSE(digest.use_nonce_count(3));
+  EXPECT_EQ(4u, digest._nonce_count);
+}
+
+
+TEST(DigestNonceCountTest, OutsideWindow)
+{
+  AuthStore::Digest digest;
+
+  EXPECT_TRUE(digest.use_nonce_count(100));
+
+  // Nonce counts more than the window size below the highest used one can't
+  // be tracked, so are treated as used.
+  EXPECT_FALSE(digest.use_nonce_count(100 - AuthStore::Digest::NC_WINDOW_SIZE));
+  EXPECT_TRUE(digest.use_nonce_count(101 - AuthStore::Digest::NC_WINDOW_SIZE));
+
+  // Jumping more than the window size forgets the old window.
+  EXPECT_TRUE(digest.use_nonce_count(300));
+  EXPECT_FALSE(digest.use_nonce_count(300));
+  EXPECT_TRUE(digest.use_nonce_count(299));
+  EXPECT_FALSE(digest.use_nonce_count(100));
+}
+
+// The highest nonce count is rejected, as recording it would wrap the
+// nonce count round and allow every nonce count to be used again.
+TEST(DigestNonceCountTest, MaximumNonceCount)
+{
+  AuthStore::Digest digest;
+  digest._nonce_count = 1;
+
+  EXPECT_FALSE(digest.use_nonce_count(UINT32_MAX));
+  EXPECT_EQ(1u, digest._nonce_count);
+
+  EXPECT_TRUE(digest.use_nonce_count(UINT32_MAX - 1));
+  EXPECT_EQ(UINT32_MAX, digest._nonce_count);
+  EXPECT_FALSE(digest.use_nonce_count(UINT32_MAX));
+  EXPECT_FALSE(digest.use_nonce_count(UINT32_MAX - 1));
+  EXPECT_FALSE(digest.use_nonce_count(1));
+}
+
+
+/// Fixture for tests of the compact format, which reads and writes it through
+/// a mock store.
+class CompactAuthStoreTest : public ::testing::Test
+{
+  CompactAuthStoreTest()
+  {
+    _mock_store = new MockStore();
+
+    AuthStore::SerializerDeserializer* serializer =
+      new AuthStore::CompactSerializerDeserializer();
+    std::vector<AuthStore::SerializerDeserializer*> deserializers = {
+      new AuthStore::CompactSerializerDeserializer(&_compact_reads),
+      new AuthStore::JsonSerializerDeserializer(&_json_reads),
+      new AuthStore::BinarySerializerDeserializer(&_binary_reads),
+    };
+
+    _auth_store = new AuthStore(_mock_store,
+                                serializer,
+                                deserializers,
+                                300);
+  }
+
+  virtual ~CompactAuthStoreTest()
+  {
+    delete _mock_store; _mock_store = NULL;
+    delete _auth_store; _auth_store = NULL;
+  }
+
+  /// Reads a record from the auth store.
+  Store::Status get_record(const std::string& record, AuthStore::Digest*& digest)
+  {
+    EXPECT_CALL(*_mock_store, get_data(_, _, _, _, _))
+      .WillOnce(DoAll(SetArgReferee<2>(record),
+                      SetArgReferee<3>(1), // CAS
+                      Return(Store::OK)));
+
+    return _auth_store->get_digest("kermit@cw-ngv.com", "987654321", digest, 0);
+  }
+
+  MockStore* _mock_store;
+  AuthStore* _auth_store;
+  CountingCounter _compact_reads;
+  CountingCounter _json_reads;
+  CountingCounter _binary_reads;
+};
+
+
+TEST_F(CompactAuthStoreTest, PackedHA1)
+{
+  AuthStore::Digest digest;
+  digest._ha1 = "0123456789abcdef0123456789abcdef";
+  digest._opaque = "opaque";
+  digest._realm = "cw-ngv.com";
+  digest._impu = "sip:kermit@cw-ngv.com";
+  digest.use_nonce_count(3);
+
+  std::string record;
+  EXPECT_CALL(*_mock_store, set_data(_, _, _, _, _, _))
+    .WillOnce(DoAll(SaveArg<2>(&record), Return(Store::OK)));
+  _auth_store->set_digest("kermit@cw-ngv.com", "987654321", &digest, 0);
+
+  // The HA1 is stored in 16 bytes.
+  EXPECT_EQ((size_t)(2 + 16 + 4 + 8 + 2 + 6 + 2 + 10 + 2 + 21), record.length());
+  EXPECT_EQ((char)AuthStore::CompactSerializerDeserializer::VERSION_1, record[0]);
+
+  AuthStore::Digest* digest2 = NULL;
+  EXPECT_EQ(Store::OK, get_record(record, digest2));
+  ASSERT_TRUE(digest2 != NULL);
+  EXPECT_EQ(digest._ha1, digest2->_ha1);
+  EXPECT_EQ(digest._opaque, digest2->_opaque);
+  EXPECT_EQ(digest._realm, digest2->_realm);
+  EXPECT_EQ(digest._impu, digest2->_impu);
+  EXPECT_EQ(digest._nonce_count, digest2->_nonce_count);
+  EXPECT_EQ(digest._nc_window, digest2->_nc_window);
+  delete digest2; digest2 = NULL;
+}
+
+
+TEST_F(CompactAuthStoreTest, UnpackedHA1)
+{
+  // This HA1 isn't lower-case hex, so is stored as it is.
+  AuthStore::Digest digest;
+  digest._ha1 = "0123456789ABCDEF0123456789ABCDEF";
+
+  std::string record;
+  EXPECT_CALL(*_mock_store, set_data(_, _, _, _, _, _))
+    .WillOnce(DoAll(SaveArg<2>(&record), Return(Store::OK)));
+  _auth_store->set_digest("kermit@cw-ngv.com", "987654321", &digest, 0);
+
+  AuthStore::Digest* digest2 = NULL;
+  EXPECT_EQ(Store::OK, get_record(record, digest2));
+  ASSERT_TRUE(digest2 != NULL);
+  EXPECT_EQ(digest._ha1, digest2->_ha1);
+  delete digest2; digest2 = NULL;
+}
+
+
+TEST_F(CompactAuthStoreTest, CorruptRecord)
+{
+  AuthStore::CompactSerializerDeserializer serializer;
+  AuthStore::Digest digest;
+  digest._ha1 = "0123456789abcdef0123456789abcdef";
+  digest._impu = "sip:kermit@cw-ngv.com";
+  std::string record = serializer.serialize_digest(&digest);
+  AuthStore::Digest* digest2 = NULL;
+
+  // Truncated.
+  EXPECT_EQ(Store::NOT_FOUND, get_record(record.substr(0, record.length() - 1), digest2));
+  EXPECT_TRUE(digest2 == NULL);
+
+  // Trailing data.
+  EXPECT_EQ(Store::NOT_FOUND, get_record(record + "x", digest2));
+  EXPECT_TRUE(digest2 == NULL);
+
+  // Unknown flags.
+  std::string bad_flags = record;
+  bad_flags[1] = 0x02;
+  EXPECT_EQ(Store::NOT_FOUND, get_record(bad_flags, digest2));
+  EXPECT_TRUE(digest2 == NULL);
+
+  // Empty.
+  EXPECT_EQ(Store::NOT_FOUND, get_record("", digest2));
+  EXPECT_TRUE(digest2 == NULL);
+
+  EXPECT_EQ(0, _compact_reads.count);
+}
+
+
+TEST_F(CompactAuthStoreTest, CountsReadsByFormat)
+{
+  AuthStore::Digest digest;
+  digest._ha1 = "123123123";
+  digest._impu = "sip:kermit@cw-ngv.com";
+  AuthStore::Digest* digest2 = NULL;
+
+  // Each record is parsed only by the deserializer for its format.
+  AuthStore::JsonSerializerDeserializer json;
+  EXPECT_EQ(Store::OK, get_record(json.serialize_digest(&digest), digest2));
+  delete digest2; digest2 = NULL;
+
+  AuthStore::BinarySerializerDeserializer binary;
+  EXPECT_EQ(Store::OK, get_record(binary.serialize_digest(&digest), digest2));
+  EXPECT_EQ("123123123", digest2->_ha1);
+  delete digest2; digest2 = NULL;
+
+  AuthStore::CompactSerializerDeserializer compact;
+  EXPECT_EQ(Store::OK, get_record(compact.serialize_digest(&digest), digest2));
+  delete digest2; digest2 = NULL;
+
+  EXPECT_EQ(1, _compact_reads.count);
+  EXPECT_EQ(1, _json_reads.count);
+  EXPECT_EQ(1, _binary_reads.count);
+}
+
+
+/// Fixture for tests of the local digest cache.  Two AuthStores share a
+/// local store, as two nodes share memcached - one with a cache, and one
+/// without.
+class CachedAuthStoreTest : public ::testing::Test
+{
+  CachedAuthStoreTest() :
+    _digest_cache(1024 * 1024, 300000, &_hit_count, &_miss_count, &_eviction_count)
+  {
+    _local_data_store = new LocalStore();
+
+    AuthStore::SerializerDeserializer* serializer =
+      new AuthStore::CompactSerializerDeserializer();
+    std::vector<AuthStore::SerializerDeserializer*> deserializers = {
+      new AuthStore::CompactSerializerDeserializer(),
+    };
+
+    _auth_store = new AuthStore(_local_data_store,
+                                serializer,
+                                deserializers,
+                                300,
+                                &_digest_cache);
+    AuthStore::SerializerDeserializer* other_serializer =
+      new AuthStore::CompactSerializerDeserializer();
+    std::vector<AuthStore::SerializerDeserializer*> other_deserializers = {
+      new AuthStore::CompactSerializerDeserializer(),
+    };
+
+    _other_auth_store = new AuthStore(_local_data_store,
+                                      other_serializer,
+                                      other_deserializers,
+                                      300);
+
+    _digest._impi = IMPI;
+    _digest._nonce = NONCE;
+    _digest._ha1 = "0123456789abcdef0123456789abcdef";
+    _digest._opaque = "opaque";
+    _digest._realm = "cw-ngv.com";
+    _digest._impu = "sip:kermit@cw-ngv.com";
+  }
+
+  virtual ~CachedAuthStoreTest()
+  {
+    delete _auth_store; _auth_store = NULL;
+    delete _other_auth_store; _other_auth_store = NULL;
+    delete _local_data_store; _local_data_store = NULL;
+  }
+
+  static const std::string IMPI;
+  static const std::string NONCE;
+
+  CountingCounter _hit_count;
+  CountingCounter _miss_count;
+  CountingCounter _eviction_count;
+  DigestCache _digest_cache;
+  LocalStore* _local_data_store;
+  AuthStore* _auth_store;
+  AuthStore* _other_auth_store;
+  AuthStore::Digest _digest;
+};
+
+const std::string CachedAuthStoreTest::IMPI = "kermit@cw-ngv.com";
+const std::string CachedAuthStoreTest::NONCE = "987654321";
+
+
+TEST_F(CachedAuthStoreTest, ReadsServedFromCache)
+{
+  ASSERT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &_digest, 0));
+
+  AuthStore::Digest digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest, 0));
+  EXPECT_EQ(_digest._ha1, digest._ha1);
+  EXPECT_EQ(_digest._impu, digest._impu);
+  EXPECT_EQ(IMPI, digest._impi);
+  EXPECT_EQ(NONCE, digest._nonce);
+  EXPECT_EQ(1, _hit_count.count);
+  EXPECT_EQ(0, _miss_count.count);
+}
+
+
+TEST_F(CachedAuthStoreTest, WriteThrough)
+{
+  ASSERT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &_digest, 0));
+
+  // Record a nonce count on a digest read from the cache.  The write reaches
+  // the store.
+  AuthStore::Digest digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest, 0));
+  EXPECT_TRUE(digest.use_nonce_count(1));
+  EXPECT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &digest, 0));
+
+  AuthStore::Digest digest2;
+  ASSERT_EQ(Store::OK, _other_auth_store->get_digest(IMPI, NONCE, digest2, 0));
+  EXPECT_EQ(2u, digest2._nonce_count);
+
+  // The cache is updated too.
+  AuthStore::Digest digest3;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest3, 0));
+  EXPECT_EQ(2u, digest3._nonce_count);
+  EXPECT_EQ(2, _hit_count.count);
+}
+
+
+TEST_F(CachedAuthStoreTest, MissReadsFromStore)
+{
+  // The digest was written by another node.
+  ASSERT_EQ(Store::OK, _other_auth_store->set_digest(IMPI, NONCE, &_digest, 0));
+
+  AuthStore::Digest digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest, 0));
+  EXPECT_EQ(_digest._ha1, digest._ha1);
+  EXPECT_EQ(1, _miss_count.count);
+
+  // The digest is cached now.
+  AuthStore::Digest digest2;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest2, 0));
+  EXPECT_EQ(1, _hit_count.count);
+
+  // A digest that isn't in the store isn't found.
+  AuthStore::Digest digest3;
+  EXPECT_EQ(Store::NOT_FOUND, _auth_store->get_digest(IMPI, "123", digest3, 0));
+}
+
+
+TEST_F(CachedAuthStoreTest, LocalContention)
+{
+  ASSERT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &_digest, 0));
+
+  // Two requests read the digest from the cache, and both try to update it.
+  // Only the first succeeds.
+  AuthStore::Digest digest1;
+  AuthStore::Digest digest2;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest1, 0));
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest2, 0));
+  digest1.use_nonce_count(1);
+  digest2.use_nonce_count(2);
+  EXPECT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &digest1, 0));
+  EXPECT_EQ(Store::DATA_CONTENTION, _auth_store->set_digest(IMPI, NONCE, &digest2, 0));
+
+  // The second request rereads the digest, from the store, and sees the
+  // first's update.
+  AuthStore::Digest digest3;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest3, 0));
+  EXPECT_EQ(2u, digest3._nonce_count);
+  EXPECT_EQ(1, _miss_count.count);
+  EXPECT_TRUE(digest3.use_nonce_count(2));
+  EXPECT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &digest3, 0));
+}
+
+
+TEST_F(CachedAuthStoreTest, UpdatedByOtherNode)
+{
+  ASSERT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &_digest, 0));
+
+  AuthStore::Digest digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest, 0));
+
+  // Another node uses the nonce.
+  AuthStore::Digest other_digest;
+  ASSERT_EQ(Store::OK, _other_auth_store->get_digest(IMPI, NONCE, other_digest, 0));
+  other_digest.use_nonce_count(1);
+  ASSERT_EQ(Store::OK, _other_auth_store->set_digest(IMPI, NONCE, &other_digest, 0));
+
+  // The cached copy is out of date, so the write fails, and the next read
+  // goes to the store.
+  digest.use_nonce_count(1);
+  EXPECT_EQ(Store::DATA_CONTENTION, _auth_store->set_digest(IMPI, NONCE, &digest, 0));
+
+  AuthStore::Digest digest2;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest2, 0));
+  EXPECT_FALSE(digest2.use_nonce_count(1));
+  EXPECT_EQ(1, _miss_count.count);
+}
+
+
+/// Test fixture for an AuthStore that records nonce counts separately.
+class SeparateNonceCountAuthStoreTest : public ::testing::Test
+{
+  SeparateNonceCountAuthStoreTest()
+  {
+    _local_data_store = new LocalStore();
+
+    AuthStore::SerializerDeserializer* serializer =
+      new AuthStore::CompactSerializerDeserializer();
+    std::vector<AuthStore::SerializerDeserializer*> deserializers = {
+      new AuthStore::CompactSerializerDeserializer(),
+    };
+
+    _auth_store = new AuthStore(_local_data_store,
+                                serializer,
+                                deserializers,
+                                300,
+                                NULL,
+                                true);
+
+    _digest._impi = IMPI;
+    _digest._nonce = NONCE;
+    _digest._ha1 = "0123456789abcdef0123456789abcdef";
+    _digest._opaque = "opaque";
+    _digest._realm = "cw-ngv.com";
+    _digest._impu = "sip:kermit@cw-ngv.com";
+  }
+
+  virtual ~SeparateNonceCountAuthStoreTest()
+  {
+    delete _auth_store; _auth_store = NULL;
+    delete _local_data_store; _local_data_store = NULL;
+  }
+
+  static const std::string IMPI;
+  static const std::string NONCE;
+
+  LocalStore* _local_data_store;
+  AuthStore* _auth_store;
+  AuthStore::Digest _digest;
+};
+
+const std::string SeparateNonceCountAuthStoreTest::IMPI = "kermit@cw-ngv.com";
+const std::string SeparateNonceCountAuthStoreTest::NONCE = "987654321";
+
+
+TEST_F(SeparateNonceCountAuthStoreTest, OnlyStoredDigestsUseSeparateEntries)
+{
+  // A digest that hasn't been stored yet is written with its nonce count.
+  EXPECT_FALSE(_auth_store->records_nonce_count_separately(&_digest));
+  ASSERT_EQ(Store::OK, _auth_store->set_digest(IMPI, NONCE, &_digest, 0));
+
+  AuthStore::Digest digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest(IMPI, NONCE, digest, 0));
+  EXPECT_TRUE(_auth_store->records_nonce_count_separately(&digest));
+}
+
+
+TEST_F(SeparateNonceCountAuthStoreTest, NonceCountsUsedOnce)
+{
+  EXPECT_EQ(Store::OK, _auth_store->record_nonce_count(IMPI, NONCE, 1, 0));
+  EXPECT_EQ(Store::OK, _auth_store->record_nonce_count(IMPI, NONCE, 2, 0));
+  EXPECT_EQ(Store::DATA_CONTENTION, _auth_store->record_nonce_count(IMPI, NONCE, 1, 0));
+
+  // Nonce counts for other nonces are separate.
+  EXPECT_EQ(Store::OK, _auth_store->record_nonce_count(IMPI, "123", 1, 0));
+}
+
+
+/// A digest read on its own thread.
+struct DigestRead
+{
+  AuthStore* auth_store;
+  Store::Status status;
+  AuthStore::Digest digest;
+};
+
+static void* read_digest(void* arg)
+{
+  DigestRead* read = (DigestRead*)arg;
+  read->status = read->auth_store->get_digest("kermit@cw-ngv.com",
+                                              "987654321",
+                                              read->digest,
+                                              0);
+  return NULL;
+}
+
+/// Fixture for tests of coalescing concurrent digest reads, which reads and
+/// writes digests through a mock store.
+class CoalescedAuthStoreTest : public ::testing::Test
+{
+public:
+  CoalescedAuthStoreTest() :
+    _coalescer(&_coalesced_count),
+    _read_started(false),
+    _read_released(false)
+  {
+    _mock_store = new MockStore();
+
+    AuthStore::SerializerDeserializer* serializer =
+      new AuthStore::CompactSerializerDeserializer();
+    std::vector<AuthStore::SerializerDeserializer*> deserializers = {
+      new AuthStore::CompactSerializerDeserializer(),
+    };
+
+    _auth_store = new AuthStore(_mock_store,
+                                serializer,
+                                deserializers,
+                                300,
+                                NULL,
+                                false,
+                                &_coalescer);
+
+    AuthStore::Digest digest;
+    digest._ha1 = "0123456789abcdef0123456789abcdef";
+    digest._opaque = "opaque";
+    digest._realm = "cw-ngv.com";
+    digest._impu = "sip:kermit@cw-ngv.com";
+    _record = AuthStore::CompactSerializerDeserializer().serialize_digest(&digest);
+  }
+
+  virtual ~CoalescedAuthStoreTest()
+  {
+    delete _auth_store; _auth_store = NULL;
+    delete _mock_store; _mock_store = NULL;
+  }
+
+  /// Stands in for a slow memcached read, which completes when the test
+  /// releases it.
+  Store::Status slow_get_data(const std::string& table,
+                              const std::string& key,
+                              std::string& data,
+                              uint64_t& cas,
+                              SAS::TrailId trail)
+  {
+    _read_started = true;
+
+    while (!_read_released)
+    {
+      usleep(1000);
+    }
+
+    data = _record;
+    cas = 1;
+    return Store::OK;
+  }
+
+  /// Starts reading the digest on another thread, and waits for the read to
+  /// reach the store.
+  void start_leader(DigestRead& read, pthread_t& thread)
+  {
+    read.auth_store = _auth_store;
+    pthread_create(&thread, NULL, read_digest, &read);
+
+    while (!_read_started)
+    {
+      usleep(1000);
+    }
+  }
+
+  /// Starts reading the digest on another thread, and waits until it is
+  /// waiting for the read in progress.
+  void start_waiter(DigestRead& read, pthread_t& thread)
+  {
+    read.auth_store = _auth_store;
+    pthread_create(&thread, NULL, read_digest, &read);
+
+    while (_coalescer.waiters(KEY) == 0)
+    {
+      usleep(1000);
+    }
+  }
+
+  static const std::string KEY;
+
+  CountingCounter _coalesced_count;
+  DigestReadCoalescer _coalescer;
+  MockStore* _mock_store;
+  AuthStore* _auth_store;
+  std::string _record;
+  std::atomic<bool> _read_started;
+  std::atomic<bool> _read_released;
+};
+
+const std::string CoalescedAuthStoreTest::KEY = "kermit@cw-ngv.com\\987654321";
+
+
+TEST_F(CoalescedAuthStoreTest, ConcurrentReadsShareOneStoreRead)
+{
+  // Only one read of the digest reaches the store.
+  EXPECT_CALL(*_mock_store, get_data("AuthStore", KEY, _, _, _))
+    .WillOnce(Invoke(this, &CoalescedAuthStoreTest::slow_get_data));
+
+  DigestRead leader;
+  pthread_t leader_thread;
+  start_leader(leader, leader_thread);
+
+  DigestRead waiter;
+  pthread_t waiter_thread;
+  start_waiter(waiter, waiter_thread);
+
+  _read_released = true;
+  pthread_join(leader_thread, NULL);
+  pthread_join(waiter_thread, NULL);
+
+  // Both requests get the digest, with the CAS value of the shared read.
+  ASSERT_EQ(Store::OK, leader.status);
+  ASSERT_EQ(Store::OK, waiter.status);
+  EXPECT_EQ(1u, leader.digest._cas);
+  EXPECT_EQ(1u, waiter.digest._cas);
+  EXPECT_EQ(leader.digest._ha1, waiter.digest._ha1);
+  EXPECT_EQ(1, _coalesced_count.count);
+
+  // Both requests write back the nonce count they used with that CAS value,
+  // so only the first write succeeds.
+  EXPECT_CALL(*_mock_store, set_data("AuthStore", KEY, _, 1, _, _))
+    .WillOnce(Return(Store::OK))
+    .WillOnce(Return(Store::DATA_CONTENTION));
+
+  EXPECT_TRUE(leader.digest.use_nonce_count(1));
+  EXPECT_EQ(Store::OK, _auth_store->set_digest("kermit@cw-ngv.com", "987654321", &leader.digest, 0));
+  EXPECT_TRUE(waiter.digest.use_nonce_count(2));
+  EXPECT_EQ(Store::DATA_CONTENTION, _auth_store->set_digest("kermit@cw-ngv.com", "987654321", &waiter.digest, 0));
+
+  // The losing request rereads the digest, which now goes to the store as
+  // there's no read in progress, and writes it back with the new CAS value.
+  std::string updated_record =
+    AuthStore::CompactSerializerDeserializer().serialize_digest(&leader.digest);
+  EXPECT_CALL(*_mock_store, get_data("AuthStore", KEY, _, _, _))
+    .WillOnce(DoAll(SetArgReferee<2>(updated_record),
+                    SetArgReferee<3>(2),
+                    Return(Store::OK)));
+  EXPECT_CALL(*_mock_store, set_data("AuthStore", KEY, _, 2, _, _))
+    .WillOnce(Return(Store::OK));
+
+  AuthStore::Digest current_digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest("kermit@cw-ngv.com", "987654321", current_digest, 0));
+  EXPECT_EQ(2u, current_digest._cas);
+  EXPECT_FALSE(current_digest.use_nonce_count(1));
+  EXPECT_TRUE(current_digest.use_nonce_count(2));
+  EXPECT_EQ(Store::OK, _auth_store->set_digest("kermit@cw-ngv.com", "987654321", &current_digest, 0));
+  EXPECT_EQ(1, _coalesced_count.count);
+}
+
+TEST_F(CoalescedAuthStoreTest, WaiterTimesOutAndReadsStore)
+{
+  // The leader's read is stuck, so the second request gives up waiting for it
+  // and makes its own read.
+  EXPECT_CALL(*_mock_store, get_data("AuthStore", KEY, _, _, _))
+    .WillOnce(Invoke(this, &CoalescedAuthStoreTest::slow_get_data))
+    .WillOnce(DoAll(SetArgReferee<2>(_record),
+                    SetArgReferee<3>(2),
+                    Return(Store::OK)));
+
+  DigestRead leader;
+  pthread_t leader_thread;
+  start_leader(leader, leader_thread);
+
+  AuthStore::Digest digest;
+  ASSERT_EQ(Store::OK, _auth_store->get_digest("kermit@cw-ngv.com", "987654321", digest, 0));
+  EXPECT_EQ(2u, digest._cas);
+  EXPECT_EQ(0, _coalesced_count.count);
+
+  // The leader still gets the result of its own read.
+  _read_released = true;
+  pthread_join(leader_thread, NULL);
+  ASSERT_EQ(Store::OK, leader.status);
+  EXPECT_EQ(1u, leader.digest._cas);
+}
@@ -0,0 +1,156 @@
+/**
+ * @file call_list_cache_test.cpp UT for the call list cache.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_list_cache.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+#include "counting_counter.h"
+
+class CallListCacheTest : public ::testing::Test
+{
+public:
+  CallListCacheTest() {}
+
+  virtual ~CallListCacheTest()
+  {
+    cwtest_reset_time();
+  }
+
+  /// Build a cache entry with a body of the given length.
+  std::shared_ptr<const CallListCache::Entry> make_entry(const std::string& etag,
+                                                         size_t body_length)
+  {
+    std::shared_ptr<CallListCache::Entry> entry(new CallListCache::Entry());
+    entry->etag = etag;
+    entry->body = std::string(body_length, 'x');
+    return entry;
+  }
+
+  CountingCounter _hit_count;
+  CountingCounter _miss_count;
+  CountingCounter _eviction_count;
+};
+
+TEST_F(CallListCacheTest, HitAndMiss)
+{
+  CallListCache cache(1024 * 1024, 10000, &_hit_count, &_miss_count, &_eviction_count);
+
+  EXPECT_TRUE(cache.get("sip:alice@home.domain") == NULL);
+  cache.put("sip:alice@home.domain", make_entry("\"1\"", 100));
+
+  std::shared_ptr<const CallListCache::Entry> entry = cache.get("sip:alice@home.domain");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ("\"1\"", entry->etag);
+  EXPECT_TRUE(cache.get("sip:bob@home.domain") == NULL);
+
+  EXPECT_EQ(1, _hit_count.count);
+  EXPECT_EQ(2, _miss_count.count);
+  EXPECT_EQ(0, _eviction_count.count);
+}
+
+TEST_F(CallListCacheTest, Replace)
+{
+  CallListCache cache(1024 * 1024, 10000, &_hit_count, &_miss_count, &_eviction_count);
+
+  cache.put("sip:alice@home.domain", make_entry("\"1\"", 100));
+  size_t bytes = cache.bytes_used();
+  cache.put("sip:alice@home.domain", make_entry("\"2\"", 100));
+
+  EXPECT_EQ("\"2\"", cache.get("sip:alice@home.domain")->etag);
+  EXPECT_EQ(bytes, cache.bytes_used());
+  EXPECT_EQ(0, _eviction_count.count);
+}
+
+TEST_F(CallListCacheTest, Expiry)
+{
+  cwtest_completely_control_time();
+  CallListCache cache(1024 * 1024, 10000, &_hit_count, &_miss_count, &_eviction_count);
+
+  cache.put("sip:alice@home.domain", make_entry("\"1\"", 100));
+
+  cwtest_advance_time_ms(9000);
+  EXPECT_TRUE(cache.get("sip:alice@home.domain") != NULL);
+
+  cwtest_advance_time_ms(2000);
+  EXPECT_TRUE(cache.get("sip:alice@home.domain") == NULL);
+  EXPECT_EQ(0u, cache.bytes_used());
+}
+
+// Check the least recently used entry is evicted when the cache is full.
+TEST_F(CallListCacheTest, Eviction)
+{
+  // Use a single shard with room for two entries.
+  CallListCache cache(3000, 10000, &_hit_count, &_miss_count, &_eviction_count, 1);
+
+  cache.put("sip:alice@home.domain", make_entry("\"1\"", 1000));
+  cache.put("sip:bob@home.domain", make_entry("\"1\"", 1000));
+
+  // Use Alice's call list, so Bob's is the least recently used.
+  EXPECT_TRUE(cache.get("sip:alice@home.domain") != NULL);
+
+  cache.put("sip:carol@home.domain", make_entry("\"1\"", 1000));
+
+  EXPECT_TRUE(cache.get("sip:alice@home.domain") != NULL);
+  EXPECT_TRUE(cache.get("sip:bob@home.domain") == NULL);
+  EXPECT_TRUE(cache.get("sip:carol@home.domain") != NULL);
+  EXPECT_EQ(1, _eviction_count.count);
+  EXPECT_LE(cache.bytes_used(), 3000u);
+}
+
+// Check call lists too large for the cache aren't cached.
+TEST_F(CallListCacheTest, TooLarge)
+{
+  CallListCache cache(3000, 10000, &_hit_count, &_miss_count, &_eviction_count, 1);
+
+  cache.put("sip:alice@home.domain", make_entry("\"1\"", 1000));
+  cache.put("sip:bob@home.domain", make_entry("\"1\"", 5000));
+
+  EXPECT_TRUE(cache.get("sip:alice@home.domain") != NULL);
+  EXPECT_TRUE(cache.get("sip:bob@home.domain") == NULL);
+  EXPECT_EQ(0, _eviction_count.count);
+}
+
+TEST_F(CallListCacheTest, AddCompressedBody)
+{
+  CallListCache cache(1024 * 1024, 10000, &_hit_count, &_miss_count, &_eviction_count);
+
+  cache.put("sip:alice@home.domain", make_entry("\"1\"", 1000));
+  std::shared_ptr<const CallListCache::Entry> old_entry = cache.get("sip:alice@home.domain");
+  size_t bytes = cache.bytes_used();
+
+  cache.add_compressed_body("sip:alice@home.domain", "\"1\"", CallListCompressor::GZIP, "gzipped");
+
+  std::shared_ptr<const CallListCache::Entry> entry = cache.get("sip:alice@home.domain");
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ("gzipped", entry->compressed_bodies.at(CallListCompressor::GZIP));
+  EXPECT_EQ(bytes + 7, cache.bytes_used());
+
+  // The entry that was already read is unchanged.
+  EXPECT_TRUE(old_entry->compressed_bodies.empty());
+}
+
+// Check a compressed body isn't added to a call list that has changed since
+// it was compressed.
+TEST_F(CallListCacheTest, AddCompressedBodyChanged)
+{
+  CallListCache cache(1024 * 1024, 10000, &_hit_count, &_miss_count, &_eviction_count);
+
+  cache.put("sip:alice@home.domain", make_entry("\"2\"", 1000));
+  cache.add_compressed_body("sip:alice@home.domain", "\"1\"", CallListCompressor::GZIP, "gzipped");
+  cache.add_compressed_body("sip:bob@home.domain", "\"1\"", CallListCompressor::GZIP, "gzipped");
+
+  EXPECT_TRUE(cache.get("sip:alice@home.domain")->compressed_bodies.empty());
+  EXPECT_TRUE(cache.get("sip:bob@home.domain") == NULL);
+}
@@ -0,0 +1,85 @@
+/**
+ * @file call_list_coalescer_test.cpp UT for coalescing of call list reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_list_coalescer.h"
+#include "test_utils.hpp"
+#include "fakecounter.h"
+
+/// Follower that records the call list shared with it.
+class TestFollower : public CallListReadCoalescer::Follower
+{
+public:
+  TestFollower() : shared(false), db_rc(CassandraStore::OK) {}
+
+  void on_call_list_shared(CassandraStore::ResultCode rc,
+                           std::shared_ptr<const CallListCache::Entry> entry)
+  {
+    shared = true;
+    db_rc = rc;
+    call_list = entry;
+  }
+
+  bool shared;
+  CassandraStore::ResultCode db_rc;
+  std::shared_ptr<const CallListCache::Entry> call_list;
+};
+
+class CallListCoalescerTest : public ::testing::Test
+{
+public:
+  CallListCoalescerTest() : _coalescer(&_coalesced_count) {}
+  virtual ~CallListCoalescerTest() {}
+
+  FakeCounter _coalesced_count;
+  CallListReadCoalescer _coalescer;
+};
+
+TEST_F(CallListCoalescerTest, SingleRequest)
+{
+  TestFollower leader;
+  EXPECT_TRUE(_coalescer.lead_or_follow("sip:alice@home.domain", &leader));
+
+  std::vector<CallListReadCoalescer::Follower*> followers;
+  _coalescer.leader_done("sip:alice@home.domain", followers);
+  EXPECT_TRUE(followers.empty());
+
+  // The next request leads a new read.
+  EXPECT_TRUE(_coalescer.lead_or_follow("sip:alice@home.domain", &leader));
+}
+
+TEST_F(CallListCoalescerTest, ConcurrentRequests)
+{
+  TestFollower leader;
+  TestFollower follower1;
+  TestFollower follower2;
+  TestFollower other;
+
+  EXPECT_TRUE(_coalescer.lead_or_follow("sip:alice@home.domain", &leader));
+  EXPECT_FALSE(_coalescer.lead_or_follow("sip:alice@home.domain", &follower1));
+  EXPECT_FALSE(_coalescer.lead_or_follow("sip:alice@home.domain", &follower2));
+
+  // Requests for other call lists aren't affected.
+  EXPECT_TRUE(_coalescer.lead_or_follow("sip:bob@home.domain", &other));
+
+  std::vector<CallListReadCoalescer::Follower*> followers;
+  _coalescer.leader_done("sip:alice@home.domain", followers);
+  ASSERT_EQ(2u, followers.size());
+  EXPECT_EQ(&follower1, followers[0]);
+  EXPECT_EQ(&follower2, followers[1]);
+
+  followers.clear();
+  _coalescer.leader_done("sip:bob@home.domain", followers);
+  EXPECT_TRUE(followers.empty());
+}
@@ -0,0 +1,157 @@
+/**
+ * @file call_list_compression_test.cpp UT for call list compression.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <zlib.h>
+#include <zstd.h>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_list_compression.h"
+#include "test_utils.hpp"
+
+class CallListCompressionTest : public ::testing::Test
+{
+public:
+  CallListCompressionTest() {}
+  virtual ~CallListCompressionTest() {}
+
+  /// Build a call list body with the given number of calls.
+  static std::string call_list(int num_calls)
+  {
+    std::string body = "<call-list><calls>";
+
+    for (int ii = 0; ii < num_calls; ii++)
+    {
+      body += "<call><to><URI>sip:6505551234@home.domain</URI></to>"
+              "<start-time>2002-05-30T09:30:10</start-time></call>";
+    }
+
+    return body + "</calls></call-list>";
+  }
+
+  /// Decompress a gzip body.
+  static std::string gunzip(const std::string& compressed)
+  {
+    z_stream stream = {};
+    inflateInit2(&stream, 15 + 16);
+
+    std::string body;
+    char buffer[4096];
+    stream.next_in = (Bytef*)compressed.data();
+    stream.avail_in = compressed.length();
+    int rc;
+
+    do
+    {
+      stream.next_out = (Bytef*)buffer;
+      stream.avail_out = sizeof(buffer);
+      rc = inflate(&stream, Z_NO_FLUSH);
+      body.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    while (rc == Z_OK);
+
+    inflateEnd(&stream);
+    EXPECT_EQ(Z_STREAM_END, rc);
+    return body;
+  }
+
+  /// Decompress a zstd body.
+  static std::string unzstd(const std::string& compressed)
+  {
+    unsigned long long size = ZSTD_getFrameContentSize(compressed.data(),
+                                                       compressed.length());
+    std::string body(size, '\0');
+    size_t rc = ZSTD_decompress(&body[0], body.length(),
+                                compressed.data(), compressed.length());
+    EXPECT_FALSE(ZSTD_isError(rc));
+    return body;
+  }
+};
+
+TEST_F(CallListCompressionTest, ChooseEncoding)
+{
+  EXPECT_EQ(CallListCompressor::IDENTITY, CallListCompressor::choose_encoding(""));
+  EXPECT_EQ(CallListCompressor::IDENTITY, CallListCompressor::choose_encoding("identity"));
+  EXPECT_EQ(CallListCompressor::IDENTITY, CallListCompressor::choose_encoding("deflate, br"));
+  EXPECT_EQ(CallListCompressor::GZIP, CallListCompressor::choose_encoding("gzip"));
+  EXPECT_EQ(CallListCompressor::GZIP, CallListCompressor::choose_encoding("deflate, GZIP"));
+  EXPECT_EQ(CallListCompressor::GZIP, CallListCompressor::choose_encoding("x-gzip"));
+  EXPECT_EQ(CallListCompressor::ZSTD, CallListCompressor::choose_encoding("gzip, deflate, zstd"));
+  EXPECT_EQ(CallListCompressor::ZSTD, CallListCompressor::choose_encoding("*"));
+}
+
+TEST_F(CallListCompressionTest, ChooseEncodingQualityValues)
+{
+  EXPECT_EQ(CallListCompressor::GZIP, CallListCompressor::choose_encoding("zstd;q=0.5, gzip"));
+  EXPECT_EQ(CallListCompressor::GZIP, CallListCompressor::choose_encoding("zstd;q=0, *"));
+  EXPECT_EQ(CallListCompressor::ZSTD, CallListCompressor::choose_encoding("gzip;q=0.8, zstd ; q=0.9"));
+  EXPECT_EQ(CallListCompressor::IDENTITY, CallListCompressor::choose_encoding("gzip;q=0"));
+  EXPECT_EQ(CallListCompressor::IDENTITY, CallListCompressor::choose_encoding("*;q=0"));
+}
+
+TEST_F(CallListCompressionTest, Gzip)
+{
+  CallListCompressor compressor(10);
+  std::string body = call_list(100);
+  std::string compressed;
+
+  ASSERT_TRUE(compressor.compress(CallListCompressor::GZIP, body, compressed));
+  EXPECT_LT(compressed.length(), body.length());
+  EXPECT_EQ(body, gunzip(compressed));
+}
+
+TEST_F(CallListCompressionTest, Zstd)
+{
+  CallListCompressor compressor(10);
+  std::string body = call_list(100);
+  std::string compressed;
+
+  ASSERT_TRUE(compressor.compress(CallListCompressor::ZSTD, body, compressed));
+  EXPECT_LT(compressed.length(), body.length());
+  EXPECT_EQ(body, unzstd(compressed));
+}
+
+TEST_F(CallListCompressionTest, EmptyBody)
+{
+  CallListCompressor compressor(10);
+  std::string compressed;
+
+  ASSERT_TRUE(compressor.compress(CallListCompressor::GZIP, "", compressed));
+  EXPECT_EQ("", gunzip(compressed));
+}
+
+// Check the compressor drops to the fastest level when busy.
+TEST_F(CallListCompressionTest, LevelAdaptsToLoad)
+{
+  CallListCompressor compressor(2);
+  int normal_gzip_level = compressor.level(CallListCompressor::GZIP);
+  int normal_zstd_level = compressor.level(CallListCompressor::ZSTD);
+
+  compressor.request_started();
+  compressor.request_started();
+  EXPECT_EQ(normal_gzip_level, compressor.level(CallListCompressor::GZIP));
+
+  compressor.request_started();
+  EXPECT_EQ(1, compressor.level(CallListCompressor::GZIP));
+  EXPECT_EQ(1, compressor.level(CallListCompressor::ZSTD));
+  EXPECT_LT(1, normal_gzip_level);
+  EXPECT_LT(1, normal_zstd_level);
+
+  // Output at the fast level is still valid.
+  std::string body = call_list(10);
+  std::string compressed;
+  ASSERT_TRUE(compressor.compress(CallListCompressor::GZIP, body, compressed));
+  EXPECT_EQ(body, gunzip(compressed));
+
+  compressor.request_complete();
+  EXPECT_EQ(normal_gzip_level, compressor.level(CallListCompressor::GZIP));
+}
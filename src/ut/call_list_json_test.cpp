@@ -0,0 +1,160 @@
+/**
+ * @file call_list_json_test.cpp UT for JSON and CBOR call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_list_json.h"
+#include "test_utils.hpp"
+
+typedef CallListStore::CallFragment::Type FragmentType;
+
+class CallListJsonTest : public ::testing::Test
+{
+public:
+  CallListJsonTest() {}
+  virtual ~CallListJsonTest() {}
+
+  /// Adds a call fragment to the records.
+  void add_fragment(FragmentType type,
+                    const std::string& timestamp,
+                    const std::string& id,
+                    const std::string& contents)
+  {
+    CallListStore::CallFragment fragment;
+    fragment.type = type;
+    fragment.timestamp = timestamp;
+    fragment.id = id;
+    fragment.contents = contents;
+    _records.push_back(fragment);
+  }
+
+  std::string json()
+  {
+    std::string doc;
+    StringCallListWriter writer(doc);
+    write_json_from_call_records(_records, writer, 0, 0);
+    return doc;
+  }
+
+  std::string cbor()
+  {
+    std::string doc;
+    StringCallListWriter writer(doc);
+    write_cbor_from_call_records(_records, writer, 0, 0);
+    return doc;
+  }
+
+  std::vector<CallListStore::CallFragment> _records;
+};
+
+TEST_F(CallListJsonTest, Empty)
+{
+  EXPECT_EQ("{\"calls\":[]}", json());
+
+  // map(1) { "calls": [_ ] }
+  EXPECT_EQ(std::string("\xa1\x65" "calls" "\x9f\xff"), cbor());
+}
+
+TEST_F(CallListJsonTest, Calls)
+{
+  add_fragment(FragmentType::BEGIN,
+               "20020530093010",
+               "a",
+               "<to><URI>alice@example.com</URI><name>Alice &amp; Co</name></to>"
+               "<answered>1</answered>");
+  add_fragment(FragmentType::END,
+               "20020530093010",
+               "a",
+               "<end-time>2002-05-30T09:35:00</end-time>");
+  add_fragment(FragmentType::REJECTED,
+               "20020530094010",
+               "b",
+               "<answered>0</answered>");
+
+  EXPECT_EQ("{\"calls\":["
+              "{\"to\":{\"URI\":\"alice@example.com\",\"name\":\"Alice & Co\"},"
+               "\"answered\":\"1\","
+               "\"end-time\":\"2002-05-30T09:35:00\"},"
+              "{\"answered\":\"0\"}"
+            "]}",
+            json());
+
+  std::string expected_cbor =
+    "\xa1\x65" "calls" "\x9f"
+      "\xa3"
+        "\x62" "to" "\xa2"
+          "\x63" "URI" "\x71" "alice@example.com"
+          "\x64" "name" "\x6a" "Alice & Co"
+        "\x68" "answered" "\x61" "1"
+        "\x68" "end-time" "\x73" "2002-05-30T09:35:00"
+      "\xa1"
+        "\x68" "answered" "\x61" "0"
+    "\xff";
+  EXPECT_EQ(expected_cbor, cbor());
+}
+
+// Check calls with invalid XML are left out.
+TEST_F(CallListJsonTest, InvalidXml)
+{
+  add_fragment(FragmentType::REJECTED, "20020530093010", "a", "<answered>0</answered");
+  add_fragment(FragmentType::REJECTED, "20020530094010", "b", "<answered>1</answered>");
+
+  EXPECT_EQ("{\"calls\":[{\"answered\":\"1\"}]}", json());
+}
+
+// Check invalid call records are left out, as for XML.
+TEST_F(CallListJsonTest, InvalidRecords)
+{
+  add_fragment(FragmentType::BEGIN, "20020530093010", "a", "<answered>1</answered>");
+  add_fragment(FragmentType::END, "20020530094010", "b", "<end-time>2002-05-30T09:35:00</end-time>");
+
+  EXPECT_EQ("{\"calls\":[]}", json());
+}
+
+// Check the oldest calls are left out to keep within the size limit, and
+// counted.
+TEST_F(CallListJsonTest, MaxSize)
+{
+  add_fragment(FragmentType::REJECTED, "20020530093010", "a", "<answered>0</answered>");
+  add_fragment(FragmentType::REJECTED, "20020530094010", "b", "<answered>1</answered>");
+
+  // There's room for the newest call in the equivalent XML document.
+  size_t max_size = std::string("<call-list><calls>"
+                                  "<call><answered>1</answered></call>"
+                                "</calls></call-list>").length();
+
+  std::string doc;
+  StringCallListWriter json_writer(doc);
+  EXPECT_EQ(1u, write_json_from_call_records(_records, json_writer, max_size, 0));
+  EXPECT_EQ("{\"calls\":[{\"answered\":\"1\"}]}", doc);
+
+  doc.clear();
+  StringCallListWriter cbor_writer(doc);
+  EXPECT_EQ(1u, write_cbor_from_call_records(_records, cbor_writer, max_size, 0));
+
+  doc.clear();
+  StringCallListWriter unlimited_writer(doc);
+  EXPECT_EQ(0u, write_json_from_call_records(_records, unlimited_writer, 0, 0));
+}
+
+// Check long strings get multi-byte CBOR lengths.
+TEST_F(CallListJsonTest, CborLongString)
+{
+  std::string name(300, 'x');
+  add_fragment(FragmentType::REJECTED, "20020530093010", "a", "<name>" + name + "</name>");
+
+  std::string expected_cbor =
+    std::string("\xa1\x65" "calls" "\x9f" "\xa1" "\x64" "name" "\x79\x01\x2c") +
+    name + "\xff";
+  EXPECT_EQ(expected_cbor, cbor());
+}
@@ -0,0 +1,171 @@
+/**
+ * @file call_list_prefetcher_test.cpp UT for speculative reads of call lists.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_list_prefetcher.h"
+#include "mock_call_list_store.h"
+#include "counting_counter.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+
+using ::testing::_;
+using ::testing::Return;
+using ::testing::SaveArg;
+
+static const std::string IMPU = "sip:alice@home.domain";
+
+class CallListPrefetcherTest : public ::testing::Test
+{
+public:
+  CallListPrefetcherTest() :
+    _prefetcher(&_call_store,
+                5000,
+                2,
+                &_prefetch_count,
+                &_hit_count,
+                &_wasted_count)
+  {
+    cwtest_completely_control_time();
+  }
+
+  virtual ~CallListPrefetcherTest()
+  {
+    cwtest_reset_time();
+  }
+
+  /// Expects a read of the call list, and returns the operation and
+  /// transaction so the test can complete it.
+  void expect_read(const std::string& impu,
+                   CallListStore::GetCallFragments*& op,
+                   CassandraStore::Transaction*& tsx)
+  {
+    op = new CallListStore::GetCallFragments(impu);
+    tsx = NULL;
+
+    EXPECT_CALL(_call_store, new_get_call_fragments_op(impu))
+      .WillOnce(Return(op));
+    EXPECT_CALL(_call_store, do_async(_, _))
+      .WillOnce(SaveArg<1>(&tsx));
+  }
+
+  MockCallListStore _call_store;
+  CountingCounter _prefetch_count;
+  CountingCounter _hit_count;
+  CountingCounter _wasted_count;
+  CallListPrefetcher _prefetcher;
+};
+
+// Check prefetched call fragments are used once.
+TEST_F(CallListPrefetcherTest, Take)
+{
+  CallListStore::GetCallFragments* op;
+  CassandraStore::Transaction* tsx;
+  expect_read(IMPU, op, tsx);
+  _prefetcher.prefetch(IMPU, 0);
+  ASSERT_TRUE(tsx != NULL);
+  EXPECT_EQ(1, _prefetch_count.count);
+
+  // The read hasn't finished, so there's nothing to take yet.
+  std::vector<CallListStore::CallFragment> records;
+  EXPECT_FALSE(_prefetcher.take(IMPU, records));
+
+  tsx->on_success(op);
+
+  EXPECT_TRUE(_prefetcher.take(IMPU, records));
+  EXPECT_FALSE(_prefetcher.take(IMPU, records));
+  EXPECT_EQ(1, _hit_count.count);
+  EXPECT_EQ(0, _wasted_count.count);
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Check a call list that is already being prefetched isn't read again.
+TEST_F(CallListPrefetcherTest, DuplicatePrefetch)
+{
+  CallListStore::GetCallFragments* op;
+  CassandraStore::Transaction* tsx;
+  expect_read(IMPU, op, tsx);
+  _prefetcher.prefetch(IMPU, 0);
+  _prefetcher.prefetch(IMPU, 0);
+  EXPECT_EQ(1, _prefetch_count.count);
+
+  tsx->on_success(op);
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Check prefetched call fragments that aren't used in time are discarded.
+TEST_F(CallListPrefetcherTest, Expiry)
+{
+  CallListStore::GetCallFragments* op;
+  CassandraStore::Transaction* tsx;
+  expect_read(IMPU, op, tsx);
+  _prefetcher.prefetch(IMPU, 0);
+  tsx->on_success(op);
+
+  cwtest_advance_time_ms(5001);
+
+  std::vector<CallListStore::CallFragment> records;
+  EXPECT_FALSE(_prefetcher.take(IMPU, records));
+  EXPECT_EQ(0, _hit_count.count);
+  EXPECT_EQ(1, _wasted_count.count);
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Check a failed prefetch is discarded, so the request reads the store itself.
+TEST_F(CallListPrefetcherTest, Failure)
+{
+  CallListStore::GetCallFragments* op;
+  CassandraStore::Transaction* tsx;
+  expect_read(IMPU, op, tsx);
+  _prefetcher.prefetch(IMPU, 0);
+
+  tsx->on_failure(op);
+
+  std::vector<CallListStore::CallFragment> records;
+  EXPECT_FALSE(_prefetcher.take(IMPU, records));
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Check no more than the maximum number of prefetches are outstanding.
+TEST_F(CallListPrefetcherTest, MaxPrefetches)
+{
+  CallListStore::GetCallFragments* op1;
+  CassandraStore::Transaction* tsx1;
+  expect_read("sip:alice@home.domain", op1, tsx1);
+  _prefetcher.prefetch("sip:alice@home.domain", 0);
+
+  CallListStore::GetCallFragments* op2;
+  CassandraStore::Transaction* tsx2;
+  expect_read("sip:bob@home.domain", op2, tsx2);
+  _prefetcher.prefetch("sip:bob@home.domain", 0);
+
+  // This prefetch is skipped, so the store isn't called again.
+  _prefetcher.prefetch("sip:carol@home.domain", 0);
+  EXPECT_EQ(2, _prefetch_count.count);
+
+  tsx1->on_success(op1);
+  tsx2->on_success(op2);
+
+  delete tsx1; tsx1 = NULL;
+  delete op1; op1 = NULL;
+  delete tsx2; tsx2 = NULL;
+  delete op2; op2 = NULL;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file call_list_range_test.cpp UT for time-ranged call list reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "call_list_range.h"
+#include "test_utils.hpp"
+
+namespace cass = org::apache::cassandra;
+
+class CallListRangeTest : public ::testing::Test
+{
+public:
+  CallListRangeTest() {}
+  virtual ~CallListRangeTest() {}
+
+  /// Add a column to a vector of columns, as returned from the store.
+  void add_column(std::vector<cass::ColumnOrSuperColumn>& columns,
+                  const std::string& name,
+                  const std::string& value)
+  {
+    cass::ColumnOrSuperColumn csc;
+    cass::Column column;
+    column.__set_name(name);
+    column.__set_value(value);
+    csc.__set_column(column);
+    columns.push_back(csc);
+  }
+};
+
+TEST_F(CallListRangeTest, NoParameters)
+{
+  CallListRange range;
+  EXPECT_EQ(HTTP_OK, range.parse("", "", ""));
+  EXPECT_FALSE(range.is_bounded());
+}
+
+TEST_F(CallListRangeTest, AllParameters)
+{
+  CallListRange range;
+  EXPECT_EQ(HTTP_OK, range.parse("2002-05-30T09:30:10", "20020531000000", "20"));
+  EXPECT_TRUE(range.is_bounded());
+  EXPECT_EQ("20020530093010", range.since);
+  EXPECT_EQ("20020531000000", range.until);
+  EXPECT_EQ(20, range.limit);
+}
+
+TEST_F(CallListRangeTest, InvalidTimestamps)
+{
+  CallListRange range;
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("yesterday", "", ""));
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("", "2002-05-30", ""));
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("2002-05-30T09:30:10Z", "", ""));
+}
+
+TEST_F(CallListRangeTest, InvalidLimits)
+{
+  CallListRange range;
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("", "", "0"));
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("", "", "-1"));
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("", "", "20calls"));
+  EXPECT_EQ(HTTP_BAD_REQUEST, range.parse("", "", "99999999999"));
+}
+
+// Check the slice covers exactly the requested calls, newest first.
+TEST_F(CallListRangeTest, Predicate)
+{
+  CallListRange range;
+  range.parse("20020530093010", "20020531000000", "20");
+
+  cass::SlicePredicate predicate;
+  GetCallFragmentsInRange::build_predicate(range, predicate);
+
+  EXPECT_TRUE(predicate.slice_range.reversed);
+  EXPECT_EQ(41, predicate.slice_range.count);
+
+  // The slice is reversed, so runs from the upper to the lower bound.
+  const std::string& upper = predicate.slice_range.start;
+  const std::string& lower = predicate.slice_range.finish;
+  EXPECT_LE(lower, std::string("call_20020530093010_a_begin"));
+  EXPECT_GT(lower, std::string("call_20020530093009_a_rejected"));
+  EXPECT_GE(upper, std::string("call_20020531000000_z_rejected"));
+  EXPECT_LT(upper, std::string("call_20020531000001_a_begin"));
+}
+
+// Check the slice bounds are valid UTF-8, as the call list columns are
+// compared as UTF8Type, and still cover the whole call list when there are no
+// time bounds.
+TEST_F(CallListRangeTest, PredicateBoundsAreAscii)
+{
+  CallListRange range;
+  range.parse("", "20020531000000", "");
+
+  cass::SlicePredicate predicate;
+  GetCallFragmentsInRange::build_predicate(range, predicate);
+  EXPECT_EQ("call_20020531000000`", predicate.slice_range.start);
+
+  CallListRange unbounded;
+  unbounded.limit = 20;
+  GetCallFragmentsInRange::build_predicate(unbounded, predicate);
+  const std::string& upper = predicate.slice_range.start;
+
+  for (std::string::const_iterator ii = upper.begin(); ii != upper.end(); ++ii)
+  {
+    EXPECT_LT((unsigned char)*ii, 0x80);
+  }
+
+  EXPECT_GT(upper, std::string("call_99991231235959_z_rejected"));
+  EXPECT_EQ("call_", predicate.slice_range.finish);
+}
+
+TEST_F(CallListRangeTest, FragmentsFromColumns)
+{
+  std::vector<cass::ColumnOrSuperColumn> columns;
+  add_column(columns, "call_20020530094010_b_rejected", "<b/>");
+  add_column(columns, "call_20020530093010_a_id_end", "<a-end/>");
+  add_column(columns, "call_20020530093010_a_id_begin", "<a-begin/>");
+  add_column(columns, "invalid", "<invalid/>");
+
+  std::vector<CallListStore::CallFragment> fragments;
+  GetCallFragmentsInRange::fragments_from_columns(columns, 0, false, fragments);
+
+  ASSERT_EQ(3u, fragments.size());
+  EXPECT_EQ("20020530094010", fragments[0].timestamp);
+  EXPECT_EQ("b", fragments[0].id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::REJECTED, fragments[0].type);
+  EXPECT_EQ("<b/>", fragments[0].contents);
+  EXPECT_EQ("a_id", fragments[1].id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::END, fragments[1].type);
+  EXPECT_EQ("a_id", fragments[2].id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::BEGIN, fragments[2].type);
+}
+
+// Check that only the newest calls are returned when there's a limit.
+TEST_F(CallListRangeTest, FragmentsFromColumnsLimit)
+{
+  std::vector<cass::ColumnOrSuperColumn> columns;
+  add_column(columns, "call_20020530095010_c_rejected", "<c/>");
+  add_column(columns, "call_20020530094010_b_end", "<b-end/>");
+  add_column(columns, "call_20020530094010_b_begin", "<b-begin/>");
+  add_column(columns, "call_20020530093010_a_end", "<a-end/>");
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_TRUE(GetCallFragmentsInRange::fragments_from_columns(columns, 2, false, fragments));
+
+  ASSERT_EQ(3u, fragments.size());
+  EXPECT_EQ("c", fragments[0].id);
+  EXPECT_EQ("b", fragments[1].id);
+  EXPECT_EQ("b", fragments[2].id);
+}
+
+// Check that the oldest call is dropped if the slice was cut short.
+TEST_F(CallListRangeTest, FragmentsFromColumnsTruncated)
+{
+  std::vector<cass::ColumnOrSuperColumn> columns;
+  add_column(columns, "call_20020530095010_c_rejected", "<c/>");
+  add_column(columns, "call_20020530094010_b_end", "<b-end/>");
+  add_column(columns, "call_20020530094010_b_begin", "<b-begin/>");
+  add_column(columns, "call_20020530093010_a_end", "<a-end/>");
+
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_FALSE(GetCallFragmentsInRange::fragments_from_columns(columns, 5, true, fragments));
+
+  ASSERT_EQ(3u, fragments.size());
+  EXPECT_EQ("c", fragments[0].id);
+  EXPECT_EQ("b", fragments[2].id);
+}
+
+// Check that calls that won't be returned to the client don't count towards
+// the limit.
+TEST_F(CallListRangeTest, FragmentsFromColumnsLimitSkipsIncompleteCalls)
+{
+  std::vector<cass::ColumnOrSuperColumn> columns;
+  add_column(columns, "call_20020530096010_d_begin", "<d-begin/>");
+  add_column(columns, "call_20020530095010_c_rejected", "<c/>");
+  add_column(columns, "call_20020530094010_b_begin", "<b-begin/>");
+  add_column(columns, "call_20020530093010_a_end", "<a-end/>");
+  add_column(columns, "call_20020530093010_a_begin", "<a-begin/>");
+
+  // The in-progress calls d and b are read, but only c and a count.
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_FALSE(GetCallFragmentsInRange::fragments_from_columns(columns, 2, true, fragments));
+  ASSERT_EQ(3u, fragments.size());
+
+  fragments.clear();
+  EXPECT_TRUE(GetCallFragmentsInRange::fragments_from_columns(columns, 2, false, fragments));
+  ASSERT_EQ(5u, fragments.size());
+  EXPECT_EQ("d", fragments[0].id);
+  EXPECT_EQ("a", fragments[4].id);
+}
+
+// Check that a call split across two pages is carried over from one page to
+// the next, and that the repeated column at the start of the second page is
+// skipped.
+TEST_F(CallListRangeTest, FragmentsFromColumnsAcrossPages)
+{
+  std::vector<cass::ColumnOrSuperColumn> page1;
+  add_column(page1, "call_20020530095010_c_rejected", "<c/>");
+  add_column(page1, "call_20020530094010_b_end", "<b-end/>");
+
+  std::vector<cass::ColumnOrSuperColumn> page2;
+  add_column(page2, "call_20020530094010_b_end", "<b-end/>");
+  add_column(page2, "call_20020530094010_b_begin", "<b-begin/>");
+  add_column(page2, "call_20020530093010_a_rejected", "<a/>");
+
+  GetCallFragmentsInRange::ParseState state;
+  std::vector<CallListStore::CallFragment> fragments;
+  EXPECT_FALSE(GetCallFragmentsInRange::fragments_from_columns(page1, 0, 3, true, state, fragments));
+  ASSERT_EQ(1u, fragments.size());
+
+  EXPECT_TRUE(GetCallFragmentsInRange::fragments_from_columns(page2, 1, 3, false, state, fragments));
+  ASSERT_EQ(4u, fragments.size());
+  EXPECT_EQ("c", fragments[0].id);
+  EXPECT_EQ("b", fragments[1].id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::END, fragments[1].type);
+  EXPECT_EQ("b", fragments[2].id);
+  EXPECT_EQ(CallListStore::CallFragment::Type::BEGIN, fragments[2].type);
+  EXPECT_EQ("a", fragments[3].id);
+}
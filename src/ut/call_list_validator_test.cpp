@@ -0,0 +1,149 @@
+/**
+ * @file call_list_validator_test.cpp UT for well-formedness checks of call XML.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "call_list_validator.h"
+
+static const std::string CALL_XML =
+  "<to><URI>alice@example.com</URI><name>Alice Adams</name></to>"
+  "<from><URI>bob@example.com</URI><name>Bob &amp; Barker</name></from>"
+  "<answered>1</answered><outgoing>1</outgoing>"
+  "<start-time>2002-05-30T09:30:10</start-time>"
+  "<answer-time>2002-05-30T09:30:20</answer-time>";
+
+/// The tests run against each implementation, so that the vectorized scans
+/// are checked against the scalar one.
+class CallListValidatorTest :
+  public ::testing::TestWithParam<CallXmlValidator::Implementation>
+{
+public:
+  CallListValidatorTest() : _validator(GetParam()) {}
+  virtual ~CallListValidatorTest() {}
+
+  bool valid(const std::string& xml)
+  {
+    return _validator.validate(xml);
+  }
+
+  CallXmlValidator _validator;
+};
+
+INSTANTIATE_TEST_CASE_P(Implementations,
+                        CallListValidatorTest,
+                        ::testing::Values(CallXmlValidator::SCALAR,
+                                          CallXmlValidator::SSE2,
+                                          CallXmlValidator::AVX2));
+
+TEST_P(CallListValidatorTest, Valid)
+{
+  EXPECT_TRUE(valid(""));
+  EXPECT_TRUE(valid(CALL_XML));
+  EXPECT_TRUE(valid("<a/><b />"));
+  EXPECT_TRUE(valid("<a x=\"1\" y='2'>text</a>"));
+  EXPECT_TRUE(valid("<a>\t\r\n</a>"));
+  EXPECT_TRUE(valid("<a>&lt;&gt;&amp;&apos;&quot;&#65;&#x1F600;</a>"));
+  EXPECT_TRUE(valid("<name>Zo\xc3\xab \xe2\x82\xac \xf0\x9f\x98\x80</name>"));
+}
+
+TEST_P(CallListValidatorTest, Unbalanced)
+{
+  EXPECT_FALSE(valid("<a>"));
+  EXPECT_FALSE(valid("</a>"));
+  EXPECT_FALSE(valid("<a><b></a></b>"));
+  EXPECT_FALSE(valid("<a></ab>"));
+  EXPECT_STREQ("Mismatched end tag", _validator.error());
+}
+
+TEST_P(CallListValidatorTest, InvalidTags)
+{
+  EXPECT_FALSE(valid("<>"));
+  EXPECT_FALSE(valid("<1a/>"));
+  EXPECT_FALSE(valid("<a"));
+  EXPECT_FALSE(valid("<a x=1/>"));
+  EXPECT_FALSE(valid("<a x=\"1\"y=\"2\"/>"));
+  EXPECT_FALSE(valid("<a x=\"<\"/>"));
+  EXPECT_FALSE(valid("<a x=\"1/>"));
+  EXPECT_FALSE(valid("<a / >"));
+  EXPECT_FALSE(valid("<!-- comment -->"));
+  EXPECT_FALSE(valid("a < b"));
+}
+
+TEST_P(CallListValidatorTest, InvalidReferences)
+{
+  EXPECT_FALSE(valid("Bob & Barker"));
+  EXPECT_FALSE(valid("&nbsp;"));
+  EXPECT_FALSE(valid("&#;"));
+  EXPECT_FALSE(valid("&#x;"));
+  EXPECT_FALSE(valid("&#12a;"));
+  EXPECT_FALSE(valid("&#0;"));
+  EXPECT_FALSE(valid("&#xD800;"));
+  EXPECT_FALSE(valid("&#x110000;"));
+  EXPECT_FALSE(valid("&amp"));
+}
+
+TEST_P(CallListValidatorTest, InvalidCharacters)
+{
+  EXPECT_FALSE(valid(std::string("<a>\0</a>", 8)));
+  EXPECT_FALSE(valid("<a>\x1b</a>"));
+  EXPECT_STREQ("Control character", _validator.error());
+  EXPECT_EQ(3u, _validator.error_offset());
+
+  // Invalid UTF-8 - a lone continuation byte, an overlong encoding, a
+  // surrogate, a truncated sequence and a code point beyond U+10FFFF.
+  EXPECT_FALSE(valid("\x80"));
+  EXPECT_FALSE(valid("\xc0\xaf"));
+  EXPECT_FALSE(valid("\xed\xa0\x80"));
+  EXPECT_FALSE(valid("\xe2\x82"));
+  EXPECT_FALSE(valid("\xf4\x90\x80\x80"));
+}
+
+// Check that bytes needing checks are found wherever they are in a block
+// scanned by the vectorized implementations.
+TEST_P(CallListValidatorTest, AllPositions)
+{
+  for (size_t ii = 0; ii < 70; ii++)
+  {
+    std::string xml(70, 'x');
+    xml[ii] = '\x01';
+    EXPECT_FALSE(valid(xml));
+    EXPECT_EQ(ii, _validator.error_offset());
+  }
+}
+
+// Check that a call's BEGIN and END fragments are checked together.
+TEST_P(CallListValidatorTest, Pieces)
+{
+  std::string begin = "<a><b>1</b>";
+  std::string end = "<c>2</c></a>";
+  const std::string* pieces[] = {&begin, &end};
+  EXPECT_TRUE(_validator.validate(pieces, 2));
+
+  end = "<c>2</c>";
+  EXPECT_FALSE(_validator.validate(pieces, 2));
+
+  end = "<c>\x01</c></a>";
+  EXPECT_FALSE(_validator.validate(pieces, 2));
+  EXPECT_EQ(begin.length() + 3, _validator.error_offset());
+}
+
+TEST_P(CallListValidatorTest, TooDeep)
+{
+  std::string xml;
+
+  for (int ii = 0; ii < 33; ii++)
+  {
+    xml = "<a>" + xml + "</a>";
+  }
+
+  EXPECT_FALSE(valid(xml));
+}
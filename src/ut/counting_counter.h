@@ -0,0 +1,26 @@
+/**
+ * @file counting_counter.h Counter that records its count, for UT.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef COUNTING_COUNTER_H_
+#define COUNTING_COUNTER_H_
+
+#include "fakecounter.h"
+
+/// Counter that records how many times it has been incremented.
+class CountingCounter : public FakeCounter
+{
+public:
+  CountingCounter() : FakeCounter(), count(0) {}
+  virtual void increment() { count++; }
+  int count;
+};
+
+#endif
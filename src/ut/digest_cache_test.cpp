@@ -0,0 +1,135 @@
+/**
+ * @file digest_cache_test.cpp UT for the digest cache.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "digest_cache.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+#include "counting_counter.h"
+
+class DigestCacheTest : public ::testing::Test
+{
+public:
+  DigestCacheTest() :
+    _cache(1024 * 1024, 10000, &_hit_count, &_miss_count, &_eviction_count)
+  {
+    cwtest_completely_control_time();
+  }
+
+  virtual ~DigestCacheTest()
+  {
+    cwtest_reset_time();
+  }
+
+  CountingCounter _hit_count;
+  CountingCounter _miss_count;
+  CountingCounter _eviction_count;
+  DigestCache _cache;
+};
+
+TEST_F(DigestCacheTest, HitAndMiss)
+{
+  std::string data;
+  uint64_t version = 0;
+  EXPECT_FALSE(_cache.get("impi\\nonce", data, version));
+
+  _cache.put("impi\\nonce", "record");
+  EXPECT_TRUE(_cache.get("impi\\nonce", data, version));
+  EXPECT_EQ("record", data);
+  EXPECT_NE(0u, version);
+
+  EXPECT_EQ(1, _hit_count.count);
+  EXPECT_EQ(1, _miss_count.count);
+}
+
+TEST_F(DigestCacheTest, Versions)
+{
+  std::string data;
+  uint64_t version1 = 0;
+  uint64_t version2 = 0;
+
+  _cache.put("impi\\nonce", "record1");
+  _cache.get("impi\\nonce", data, version1);
+  EXPECT_TRUE(_cache.get_version("impi\\nonce", version1, data));
+  EXPECT_EQ("record1", data);
+
+  // Replacing the record changes the version, even if the record is the
+  // same.
+  _cache.put("impi\\nonce", "record1");
+  _cache.get("impi\\nonce", data, version2);
+  EXPECT_NE(version1, version2);
+  EXPECT_FALSE(_cache.get_version("impi\\nonce", version1, data));
+  EXPECT_TRUE(_cache.get_version("impi\\nonce", version2, data));
+
+  // Versions aren't reused once a record is removed.
+  _cache.invalidate("impi\\nonce");
+  EXPECT_FALSE(_cache.get_version("impi\\nonce", version2, data));
+  _cache.put("impi\\nonce", "record1");
+  EXPECT_FALSE(_cache.get_version("impi\\nonce", version2, data));
+}
+
+TEST_F(DigestCacheTest, Invalidate)
+{
+  std::string data;
+  uint64_t version = 0;
+
+  _cache.put("impi\\nonce", "record");
+  EXPECT_LT(0u, _cache.bytes_used());
+
+  _cache.invalidate("impi\\nonce");
+  EXPECT_FALSE(_cache.get("impi\\nonce", data, version));
+  EXPECT_EQ(0u, _cache.bytes_used());
+
+  // Invalidating a record that isn't cached does nothing.
+  _cache.invalidate("impi\\nonce");
+}
+
+TEST_F(DigestCacheTest, Expiry)
+{
+  std::string data;
+  uint64_t version = 0;
+
+  _cache.put("impi\\nonce", "record");
+  cwtest_advance_time_ms(9999);
+  EXPECT_TRUE(_cache.get("impi\\nonce", data, version));
+
+  cwtest_advance_time_ms(1);
+  EXPECT_FALSE(_cache.get("impi\\nonce", data, version));
+  EXPECT_FALSE(_cache.get_version("impi\\nonce", version, data));
+  EXPECT_EQ(0u, _cache.bytes_used());
+}
+
+TEST_F(DigestCacheTest, Eviction)
+{
+  // A single shard, with room for two records.
+  std::string record(200, 'x');
+  DigestCache cache(2 * (2 * 10 + 200 + 128),
+                    10000,
+                    &_hit_count,
+                    &_miss_count,
+                    &_eviction_count,
+                    1);
+  std::string data;
+  uint64_t version = 0;
+
+  cache.put("impi\\nonc1", record);
+  cache.put("impi\\nonc2", record);
+  EXPECT_TRUE(cache.get("impi\\nonc1", data, version));
+
+  // The second record was used least recently, so is evicted.
+  cache.put("impi\\nonc3", record);
+  EXPECT_EQ(1, _eviction_count.count);
+  EXPECT_TRUE(cache.get("impi\\nonc1", data, version));
+  EXPECT_FALSE(cache.get("impi\\nonc2", data, version));
+  EXPECT_TRUE(cache.get("impi\\nonc3", data, version));
+}
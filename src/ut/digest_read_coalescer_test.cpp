@@ -0,0 +1,162 @@
+/**
+ * @file digest_read_coalescer_test.cpp UT for coalescing of digest reads.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "digest_read_coalescer.h"
+#include "test_utils.hpp"
+#include "counting_counter.h"
+
+static const std::string KEY = "kermit@cw-ngv.com\\987654321";
+
+/// A request that waits for the leader's read on its own thread.
+struct WaitingRequest
+{
+  DigestReadCoalescer* coalescer;
+  DigestReadCoalescer::Result result;
+  Store::Status status;
+  std::string data;
+  uint64_t cas;
+};
+
+static void* wait_for_read(void* arg)
+{
+  WaitingRequest* request = (WaitingRequest*)arg;
+  request->result = request->coalescer->lead_or_wait(KEY,
+                                                     request->status,
+                                                     request->data,
+                                                     request->cas);
+  return NULL;
+}
+
+class DigestReadCoalescerTest : public ::testing::Test
+{
+public:
+  DigestReadCoalescerTest() : _coalescer(&_coalesced_count) {}
+  virtual ~DigestReadCoalescerTest() {}
+
+  /// Starts a request on another thread, and waits until it is waiting for
+  /// the read in progress.
+  void start_waiting_request(WaitingRequest& request,
+                             pthread_t& thread,
+                             DigestReadCoalescer& coalescer)
+  {
+    request.coalescer = &coalescer;
+    request.result = DigestReadCoalescer::LEADER;
+    request.status = Store::Status::OK;
+    request.cas = 0;
+
+    int waiters = coalescer.waiters(KEY);
+    pthread_create(&thread, NULL, wait_for_read, &request);
+
+    while (coalescer.waiters(KEY) == waiters)
+    {
+      usleep(1000);
+    }
+  }
+
+  void start_waiting_request(WaitingRequest& request, pthread_t& thread)
+  {
+    start_waiting_request(request, thread, _coalescer);
+  }
+
+  CountingCounter _coalesced_count;
+  DigestReadCoalescer _coalescer;
+};
+
+TEST_F(DigestReadCoalescerTest, SingleRequest)
+{
+  Store::Status status;
+  std::string data;
+  uint64_t cas = 0;
+  EXPECT_EQ(DigestReadCoalescer::LEADER, _coalescer.lead_or_wait(KEY, status, data, cas));
+  _coalescer.leader_done(KEY, Store::Status::OK, "record", 1);
+
+  // The next request leads a new read.
+  EXPECT_EQ(DigestReadCoalescer::LEADER, _coalescer.lead_or_wait(KEY, status, data, cas));
+  _coalescer.leader_done(KEY, Store::Status::OK, "record", 1);
+  EXPECT_EQ(0, _coalesced_count.count);
+}
+
+TEST_F(DigestReadCoalescerTest, ConcurrentRequests)
+{
+  Store::Status status;
+  std::string data;
+  uint64_t cas = 0;
+  EXPECT_EQ(DigestReadCoalescer::LEADER, _coalescer.lead_or_wait(KEY, status, data, cas));
+
+  // Reads of other records aren't affected.
+  EXPECT_EQ(DigestReadCoalescer::LEADER, _coalescer.lead_or_wait("kermit@cw-ngv.com\\123", status, data, cas));
+  _coalescer.leader_done("kermit@cw-ngv.com\\123", Store::Status::NOT_FOUND, "", 0);
+
+  WaitingRequest request;
+  pthread_t thread;
+  start_waiting_request(request, thread);
+
+  // The waiting request gets the leader's record and CAS.
+  _coalescer.leader_done(KEY, Store::Status::OK, "record", 7);
+  pthread_join(thread, NULL);
+
+  EXPECT_EQ(DigestReadCoalescer::SHARED, request.result);
+  EXPECT_EQ(Store::Status::OK, request.status);
+  EXPECT_EQ("record", request.data);
+  EXPECT_EQ(7u, request.cas);
+  EXPECT_EQ(1, _coalesced_count.count);
+}
+
+TEST_F(DigestReadCoalescerTest, FailureShared)
+{
+  Store::Status status;
+  std::string data;
+  uint64_t cas = 0;
+  EXPECT_EQ(DigestReadCoalescer::LEADER, _coalescer.lead_or_wait(KEY, status, data, cas));
+
+  WaitingRequest request;
+  pthread_t thread;
+  start_waiting_request(request, thread);
+
+  _coalescer.leader_done(KEY, Store::Status::NOT_FOUND, "", 0);
+  pthread_join(thread, NULL);
+
+  EXPECT_EQ(DigestReadCoalescer::SHARED, request.result);
+  EXPECT_EQ(Store::Status::NOT_FOUND, request.status);
+}
+
+TEST_F(DigestReadCoalescerTest, WaitTimesOut)
+{
+  CountingCounter coalesced_count;
+  DigestReadCoalescer coalescer(&coalesced_count, NULL, NULL, 10);
+
+  Store::Status status;
+  std::string data;
+  uint64_t cas = 0;
+  EXPECT_EQ(DigestReadCoalescer::LEADER, coalescer.lead_or_wait(KEY, status, data, cas));
+
+  // The leader's read doesn't finish, so the waiting request gives up on it
+  // and is no longer counted as waiting.
+  WaitingRequest request;
+  pthread_t thread;
+  start_waiting_request(request, thread, coalescer);
+  pthread_join(thread, NULL);
+
+  EXPECT_EQ(DigestReadCoalescer::TIMED_OUT, request.result);
+  EXPECT_EQ(0, coalescer.waiters(KEY));
+  EXPECT_EQ(0, coalesced_count.count);
+
+  // The leader's read is still in progress until it finishes.
+  EXPECT_EQ(DigestReadCoalescer::TIMED_OUT, coalescer.lead_or_wait(KEY, status, data, cas));
+  coalescer.leader_done(KEY, Store::Status::OK, "record", 1);
+  EXPECT_EQ(DigestReadCoalescer::LEADER, coalescer.lead_or_wait(KEY, status, data, cas));
+  coalescer.leader_done(KEY, Store::Status::OK, "record", 1);
+}
@@ -0,0 +1,239 @@
+/**
+ * @file ha1_cache_test.cpp UT for the HA1 cache.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <unistd.h>
+#include "gtest/gtest.h"
+
+#include "ha1_cache.h"
+#include "fakehomesteadconnection.hpp"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+#include "counting_counter.h"
+
+static const std::string IMPI = "1231231231@home.domain";
+static const std::string IMPU = "sip:1231231231@home.domain";
+static const std::string URL = "/impi/1231231231%40home.domain/av?impu=sip%3A1231231231%40home.domain";
+
+class HA1CacheTest : public ::testing::Test
+{
+public:
+  HA1CacheTest() :
+    _hc(),
+    _cache(&_hc, 100, 10000, &_hit_count, &_miss_count, &_refresh_count)
+  {
+    cwtest_completely_control_time();
+    set_ha1("123123123");
+  }
+
+  virtual ~HA1CacheTest()
+  {
+    cwtest_reset_time();
+  }
+
+  void set_ha1(const std::string& ha1)
+  {
+    std::vector<std::string> result = {ha1, "home.domain"};
+    _hc.set_result(URL, result);
+  }
+
+  HTTPCode get(std::string& ha1)
+  {
+    std::string realm;
+    return _cache.get_digest_data(IMPI, IMPU, ha1, realm, 0);
+  }
+
+  CountingCounter _hit_count;
+  CountingCounter _miss_count;
+  CountingCounter _refresh_count;
+  FakeHomesteadConnection _hc;
+  HA1Cache _cache;
+};
+
+TEST_F(HA1CacheTest, HitAndMiss)
+{
+  std::string ha1;
+  std::string realm;
+  EXPECT_EQ(HTTP_OK, _cache.get_digest_data(IMPI, IMPU, ha1, realm, 0));
+  EXPECT_EQ("123123123", ha1);
+  EXPECT_EQ("home.domain", realm);
+
+  // Change the HA1 in Homestead.  The cached HA1 is still used.
+  set_ha1("321321321");
+  ha1 = "";
+  realm = "";
+  EXPECT_EQ(HTTP_OK, _cache.get_digest_data(IMPI, IMPU, ha1, realm, 0));
+  EXPECT_EQ("123123123", ha1);
+  EXPECT_EQ("home.domain", realm);
+
+  EXPECT_EQ(1, _hit_count.count);
+  EXPECT_EQ(1, _miss_count.count);
+  EXPECT_EQ(1u, _cache.size());
+}
+
+TEST_F(HA1CacheTest, KeyedByIMPIAndIMPU)
+{
+  std::string ha1;
+  std::string realm;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  // A different IMPU for the same IMPI isn't found.
+  EXPECT_EQ(HTTP_NOT_FOUND,
+            _cache.get_digest_data(IMPI, "sip:1231231232@home.domain", ha1, realm, 0));
+  EXPECT_EQ(0, _hit_count.count);
+  EXPECT_EQ(2, _miss_count.count);
+}
+
+TEST_F(HA1CacheTest, FailuresNotCached)
+{
+  _hc.set_rc(URL, HTTP_SERVER_UNAVAILABLE);
+
+  std::string ha1;
+  EXPECT_EQ(HTTP_SERVER_UNAVAILABLE, get(ha1));
+  EXPECT_EQ(0u, _cache.size());
+
+  _hc.delete_rc(URL);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_EQ("123123123", ha1);
+  EXPECT_EQ(2, _miss_count.count);
+}
+
+TEST_F(HA1CacheTest, Invalidate)
+{
+  std::string ha1;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  set_ha1("321321321");
+  _cache.invalidate(IMPI, IMPU);
+  EXPECT_EQ(0u, _cache.size());
+
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_EQ("321321321", ha1);
+  EXPECT_EQ(0, _hit_count.count);
+  EXPECT_EQ(2, _miss_count.count);
+}
+
+TEST_F(HA1CacheTest, Expiry)
+{
+  std::string ha1;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  set_ha1("321321321");
+  cwtest_advance_time_ms(10001);
+
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_EQ("321321321", ha1);
+  EXPECT_EQ(0, _hit_count.count);
+  EXPECT_EQ(2, _miss_count.count);
+}
+
+TEST_F(HA1CacheTest, Eviction)
+{
+  HA1Cache cache(&_hc, 2, 10000, &_hit_count, &_miss_count, &_refresh_count, 1);
+  std::string ha1;
+  std::string realm;
+
+  EXPECT_EQ(HTTP_OK, cache.get_digest_data(IMPI, IMPU, ha1, realm, 0));
+  EXPECT_EQ(HTTP_OK, cache.get_digest_data(IMPI, IMPU, ha1, realm, 0));
+  _hc.set_result("/impi/1231231231%40home.domain/av?impu=sip%3A1231231232%40home.domain",
+                 {"123123123", "home.domain"});
+  _hc.set_result("/impi/1231231231%40home.domain/av?impu=sip%3A1231231233%40home.domain",
+                 {"123123123", "home.domain"});
+  EXPECT_EQ(HTTP_OK, cache.get_digest_data(IMPI, "sip:1231231232@home.domain", ha1, realm, 0));
+  EXPECT_EQ(2u, cache.size());
+
+  // The first entry was used most recently, so the second is evicted.
+  EXPECT_EQ(HTTP_OK, cache.get_digest_data(IMPI, IMPU, ha1, realm, 0));
+  EXPECT_EQ(HTTP_OK, cache.get_digest_data(IMPI, "sip:1231231233@home.domain", ha1, realm, 0));
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(HTTP_OK, cache.get_digest_data(IMPI, IMPU, ha1, realm, 0));
+  EXPECT_EQ(3, _hit_count.count);
+  EXPECT_EQ(3, _miss_count.count);
+}
+
+TEST_F(HA1CacheTest, RefreshAhead)
+{
+  std::string ha1;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  // Before the refresh point, hits don't queue a refresh.
+  cwtest_advance_time_ms(7000);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  _cache.refresh_queued();
+  EXPECT_EQ(0, _refresh_count.count);
+
+  // After it, the first hit queues one and still uses the cached HA1.
+  set_ha1("321321321");
+  cwtest_advance_time_ms(1000);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_EQ("123123123", ha1);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  _cache.refresh_queued();
+  EXPECT_EQ(1, _refresh_count.count);
+
+  // The refreshed entry lasts for another TTL.
+  cwtest_advance_time_ms(9000);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_EQ("321321321", ha1);
+  EXPECT_EQ(4, _hit_count.count);
+  EXPECT_EQ(1, _miss_count.count);
+}
+
+TEST_F(HA1CacheTest, FailedRefreshInvalidates)
+{
+  std::string ha1;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  cwtest_advance_time_ms(8000);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  _hc.set_rc(URL, HTTP_NOT_FOUND);
+  _cache.refresh_queued();
+  EXPECT_EQ(1, _refresh_count.count);
+  EXPECT_EQ(0u, _cache.size());
+}
+
+TEST_F(HA1CacheTest, NoRefreshWhenStopping)
+{
+  std::string ha1;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  cwtest_advance_time_ms(8000);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  // Queued entries aren't refreshed once the cache is stopping.
+  _cache._stopping = true;
+  _cache.refresh_queued();
+  EXPECT_EQ(0, _refresh_count.count);
+}
+
+TEST_F(HA1CacheTest, RefreshThread)
+{
+  std::string ha1;
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_TRUE(_cache.start());
+
+  set_ha1("321321321");
+  cwtest_advance_time_ms(8000);
+  EXPECT_EQ(HTTP_OK, get(ha1));
+
+  // Wait for the thread to refresh the entry.
+  for (int ii = 0; (ii < 1000) && (_refresh_count.count == 0); ii++)
+  {
+    usleep(1000);
+  }
+
+  _cache.stop();
+  EXPECT_EQ(1, _refresh_count.count);
+
+  EXPECT_EQ(HTTP_OK, get(ha1));
+  EXPECT_EQ("321321321", ha1);
+}
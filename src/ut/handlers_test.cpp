@@ -18,9 +18,11 @@
 #include "fakehomesteadconnection.hpp"
 #include "memento_lvc.h"
 #include "mock_health_checker.hpp"
+#include "fakecounter.h"
 
 using ::testing::Return;
 using ::testing::SetArgReferee;
+using ::testing::SaveArg;
 using ::testing::_;
 using ::testing::Invoke;
 using ::testing::WithArgs;
@@ -127,6 +129,101 @@ TEST_F(HandlersTest, ApiKey)
   EXPECT_EQ("<call-list><calls></calls></call-list>", req.content());
 }
 
+// Test that a read handed off to the call list store's worker pool suspends
+// the task, and that the task completes when the read does.
+TEST_F(HandlersTest, AsyncStoreRead)
+{
+  CallListTask::Options options;
+  options.async_store_reads = true;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  CallListStore::GetCallFragments* op =
+    new CallListStore::GetCallFragments("sip:6505551234@home.domain");
+  CassandraStore::Transaction* tsx = NULL;
+
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op("sip:6505551234@home.domain"))
+    .WillOnce(Return(op));
+  EXPECT_CALL(*_call_store, do_async(_, _))
+    .WillOnce(SaveArg<1>(&tsx));
+
+  // No response is sent until the read completes.
+  EXPECT_CALL(*_httpstack, send_reply(_, _, _)).Times(0);
+  handler->run();
+  Mock::VerifyAndClearExpectations(_httpstack);
+  ASSERT_TRUE(tsx != NULL);
+
+  // Complete the read. This resumes the task, which responds and deletes
+  // itself.
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  tsx->on_success(op);
+
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req.content());
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Test that a request for part of the call list reads just that part from
+// the store.
+TEST_F(HandlersTest, RangedStoreRead)
+{
+  CallListTask::Options options;
+  options.async_store_reads = true;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "?since=2002-05-30T09:30:10&limit=20");
+  req.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  CassandraStore::Operation* op = NULL;
+  CassandraStore::Transaction* tsx = NULL;
+
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op(_)).Times(0);
+  EXPECT_CALL(*_call_store, do_async(_, _))
+    .WillOnce(DoAll(SaveArg<0>(&op), SaveArg<1>(&tsx)));
+  handler->run();
+
+  ASSERT_TRUE(op != NULL);
+  GetCallFragmentsInRange* range_op = dynamic_cast<GetCallFragmentsInRange*>(op);
+  ASSERT_TRUE(range_op != NULL);
+  EXPECT_EQ("20020530093010", range_op->_range.since);
+  EXPECT_EQ("", range_op->_range.until);
+  EXPECT_EQ(20, range_op->_range.limit);
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  tsx->on_success(op);
+
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req.content());
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Test that a request with invalid query parameters is rejected.
+TEST_F(HandlersTest, InvalidRange)
+{
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "?limit=none");
+  req.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 400, _));
+  handler->run();
+}
+
 TEST_F(HandlersTest, InvalidApiKey)
 {
   std::vector<CallListStore::CallFragment> records;
@@ -158,6 +255,54 @@ TEST_F(HandlersTest, EmptyApiKey)
   handler->run();
 }
 
+// Test that a client with a session token for the IMPU isn't authenticated
+// again.
+TEST_F(HandlersTest, SessionToken)
+{
+  std::vector<CallListStore::CallFragment> records;
+  SessionTokenSigner signer("0123456789abcdef", 600, 0);
+  CallListTask::Options options;
+  options.session_token_signer = &signer;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("NGV-Session-Token", signer.issue("sip:6505551234@home.domain"));
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->run();
+
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req.content());
+}
+
+// Test that a session token for another IMPU is ignored, and the request is
+// authenticated as normal.
+TEST_F(HandlersTest, SessionTokenWrongIMPU)
+{
+  SessionTokenSigner signer("0123456789abcdef", 600, 0);
+  CallListTask::Options options;
+  options.session_token_signer = &signer;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("NGV-Session-Token", signer.issue("sip:6505551235@home.domain"));
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  // The request to get the digest from homestead will fail, so the response
+  // will be a 404.
+  EXPECT_CALL(*_httpstack, send_reply(_, 404, _));
+  handler->run();
+}
+
 TEST_F(HandlersTest, Mainline)
 {
   std::vector<CallListStore::CallFragment> records;
@@ -245,6 +390,261 @@ TEST_F(HandlersTest, Mainline)
   delete handler;
 }
 
+// Test that the oldest calls are omitted if the call list would exceed the
+// configured maximum size.
+TEST_F(HandlersTest, MaxCallListSize)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record1;
+  CallListStore::CallFragment record2;
+  CallListStore::CallFragment record3;
+  record1.type = CallListStore::CallFragment::Type::BEGIN;
+  record1.timestamp = "20020530093010";
+  record1.id = "a";
+  record1.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  record2.type = CallListStore::CallFragment::Type::END;
+  record2.timestamp = "20020530093010";
+  record2.id = "a";
+  record2.contents = "<end-time>2002-05-30T09:35:00</end-time>";
+  record3.type = CallListStore::CallFragment::Type::REJECTED;
+  record3.timestamp = "20020530094010";
+  record3.id = "b";
+  record3.contents = "<start-time>2002-05-30T09:40:10</start-time>";
+  records.push_back(record3);
+  records.push_back(record1);
+  records.push_back(record2);
+
+  std::string expected = "<call-list><calls>"
+                           "<call><start-time>2002-05-30T09:40:10</start-time></call>"
+                         "</calls></call-list>";
+
+  // Only leave room for the newest call.
+  CallListTask::Options options;
+  options.max_call_list_bytes = expected.length() + 1;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+
+  EXPECT_EQ(expected, req.content());
+  delete handler;
+
+  // The older call is counted as omitted.
+  std::string xml;
+  StringCallListWriter writer(xml);
+  EXPECT_EQ(1u, write_xml_from_call_records(records, writer, expected.length() + 1, 0));
+  EXPECT_EQ(expected, xml);
+}
+
+// Test that a client that already has the current call list gets a 304,
+// with no body.
+TEST_F(HandlersTest, IfNoneMatch)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  std::string etag;
+  time_t last_modified;
+  CallListTask::get_validators(records, etag, last_modified);
+
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+  req.add_header_to_incoming_req("If-None-Match", "\"other\", W/" + etag);
+
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 304, _));
+  handler->respond_when_authenticated();
+
+  EXPECT_EQ("", req.content());
+  delete handler;
+}
+
+// Test that a client with an out of date call list gets the current one.
+TEST_F(HandlersTest, IfNoneMatchModified)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+  req.add_header_to_incoming_req("If-None-Match", "\"20020530093010-2\"");
+
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+
+  EXPECT_EQ("<call-list><calls>"
+              "<call><start-time>2002-05-30T09:30:10</start-time></call>"
+            "</calls></call-list>",
+            req.content());
+  delete handler;
+}
+
+TEST_F(HandlersTest, IfModifiedSince)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  // Not modified since the client's copy.
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+  req.add_header_to_incoming_req("If-Modified-Since", "Thu, 30 May 2002 09:30:10 GMT");
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_httpstack, send_reply(_, 304, _));
+  handler->respond_when_authenticated();
+  EXPECT_EQ("", req.content());
+  delete handler;
+
+  // Modified since the client's copy.
+  MockHttpStack::Request req2(_httpstack, "/", "", "");
+  req2.add_header_to_incoming_req("If-Modified-Since", "Thu, 30 May 2002 09:30:09 GMT");
+  handler = new CallListTask(req2, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+  EXPECT_NE("", req2.content());
+  delete handler;
+}
+
+// Test that ending a call changes both validators, even though the END
+// fragment has the call's start timestamp.
+TEST_F(HandlersTest, ValidatorsChangeWhenCallEnds)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::BEGIN;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  std::string etag;
+  time_t last_modified;
+  CallListTask::get_validators(records, etag, last_modified);
+
+  record.type = CallListStore::CallFragment::Type::END;
+  record.contents = "<end-time>2002-05-30T09:35:00</end-time>";
+  records.push_back(record);
+
+  std::string new_etag;
+  time_t new_last_modified;
+  CallListTask::get_validators(records, new_etag, new_last_modified);
+
+  EXPECT_NE(etag, new_etag);
+  EXPECT_EQ(last_modified + 290, new_last_modified);
+
+  // A client that fetched the call list before the call ended gets the new
+  // call list.
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+  req.add_header_to_incoming_req("If-Modified-Since", "Thu, 30 May 2002 09:30:10 GMT");
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+  delete handler;
+}
+
+// Test that the entity tag changes when a call ends at the same time as an
+// old call ages out, leaving the same number of fragments.
+TEST_F(HandlersTest, EtagChangesWhenFragmentsReplaced)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020529093010";
+  record.id = "old";
+  record.contents = "<start-time>2002-05-29T09:30:10</start-time>";
+  records.push_back(record);
+  record.type = CallListStore::CallFragment::Type::BEGIN;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  std::string etag;
+  time_t last_modified;
+  CallListTask::get_validators(records, etag, last_modified);
+
+  records.erase(records.begin());
+  record.type = CallListStore::CallFragment::Type::END;
+  record.contents = "<end-time>2002-05-30T09:35:00</end-time>";
+  records.push_back(record);
+
+  std::string new_etag;
+  time_t new_last_modified;
+  CallListTask::get_validators(records, new_etag, new_last_modified);
+
+  EXPECT_NE(etag, new_etag);
+
+  // The same fragments always give the same entity tag.
+  std::string same_etag;
+  CallListTask::get_validators(records, same_etag, new_last_modified);
+  EXPECT_EQ(new_etag, same_etag);
+}
+
+// Test that a HEAD request doesn't build the call list.
+TEST_F(HandlersTest, Head)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "",
+                             "",
+                             htp_method_HEAD);
+  req.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->run();
+
+  EXPECT_EQ("", req.content());
+}
+
 TEST_F(HandlersTest, DuplicatedBegin)
 {
   std::vector<CallListStore::CallFragment> records;
@@ -410,6 +810,88 @@ TEST_F(HandlersTest, WrongOrder)
   delete handler;
 }
 
+// Test that the fragments of different calls are grouped correctly when they
+// are retrieved interleaved.
+TEST_F(HandlersTest, InterleavedCalls)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.timestamp = "20020530093010";
+  record.type = CallListStore::CallFragment::Type::BEGIN;
+  record.id = "b";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:11</start-time>";
+  records.push_back(record);
+  record.type = CallListStore::CallFragment::Type::END;
+  record.contents = "<end-time>2002-05-30T09:35:00</end-time>";
+  records.push_back(record);
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093000";
+  record.id = "c";
+  record.contents = "<start-time>2002-05-30T09:30:00</start-time>";
+  records.push_back(record);
+  record.type = CallListStore::CallFragment::Type::END;
+  record.timestamp = "20020530093010";
+  record.id = "b";
+  record.contents = "<end-time>2002-05-30T09:36:00</end-time>";
+  records.push_back(record);
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+
+  // Calls are ordered by timestamp and then ID.
+  EXPECT_EQ(("<call-list><calls>"
+             "<call><start-time>2002-05-30T09:30:00</start-time></call>"
+             "<call><start-time>2002-05-30T09:30:11</start-time><end-time>2002-05-30T09:35:00</end-time></call>"
+             "<call><start-time>2002-05-30T09:30:10</start-time><end-time>2002-05-30T09:36:00</end-time></call>"
+             "</calls></call-list>")
+            , req.content());
+  delete handler;
+}
+
+// Test that calls with invalid XML are left out of the call list when XML
+// validation is enabled.
+TEST_F(HandlersTest, ValidateCallXml)
+{
+  CallListTask::Options options;
+  options.validate_call_xml = true;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+  record.id = "b";
+  record.contents = "<start-time>2002-05-30T09:30:10";
+  records.push_back(record);
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+
+  EXPECT_EQ(("<call-list><calls>"
+             "<call><start-time>2002-05-30T09:30:10</start-time></call>"
+             "</calls></call-list>")
+            , req.content());
+  delete handler;
+}
+
 TEST_F(HandlersTest, MissingEnd)
 {
   std::vector<CallListStore::CallFragment> records;
@@ -514,3 +996,395 @@ TEST_F(HandlersTest, HTTPErrorFailsHealthCheck)
   delete handler;
 }
 
+
+// Test that a second request for the same call list is served from the call
+// list cache, without reading from the store.
+TEST_F(HandlersTest, CallListCacheHit)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  FakeCounter hit_count;
+  FakeCounter miss_count;
+  FakeCounter eviction_count;
+  CallListCache cache(1024 * 1024, 10000, &hit_count, &miss_count, &eviction_count);
+  CallListTask::Options options;
+  options.call_list_cache = &cache;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  std::string expected = "<call-list><calls>"
+                           "<call><start-time>2002-05-30T09:30:10</start-time></call>"
+                         "</calls></call-list>";
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+
+  MockHttpStack::Request req1(_httpstack, "/", "", "");
+  CallListTask* handler = new CallListTask(req1, &cfg, 0);
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+  EXPECT_EQ(expected, req1.content());
+  delete handler;
+
+  MockHttpStack::Request req2(_httpstack, "/", "", "");
+  handler = new CallListTask(req2, &cfg, 0);
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+  EXPECT_EQ(expected, req2.content());
+  delete handler;
+}
+
+// Test that ranged requests bypass the call list cache.
+TEST_F(HandlersTest, CallListCacheRangedRequest)
+{
+  FakeCounter hit_count;
+  FakeCounter miss_count;
+  FakeCounter eviction_count;
+  CallListCache cache(1024 * 1024, 10000, &hit_count, &miss_count, &eviction_count);
+  CallListTask::Options options;
+  options.call_list_cache = &cache;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  MockHttpStack::Request req(_httpstack, "/", "", "?limit=5");
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+  EXPECT_EQ(HTTP_OK, handler->parse_request());
+  EXPECT_FALSE(handler->use_call_list_cache());
+  delete handler;
+}
+
+// Test that a client that accepts gzip gets a gzipped call list, with an
+// entity tag specific to the encoding.
+TEST_F(HandlersTest, GzipResponse)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  CallListCompressor compressor(10);
+  CallListTask::Options options;
+  options.compressor = &compressor;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+  req.add_header_to_incoming_req("Accept-Encoding", "gzip, deflate");
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+
+  // Check for the gzip magic number.
+  std::string content = req.content();
+  ASSERT_LE(2u, content.length());
+  EXPECT_EQ('\x1f', content[0]);
+  EXPECT_EQ('\x8b', content[1]);
+  delete handler;
+
+  EXPECT_EQ("\"20020530093010-1-gzip\"",
+            CallListTask::encoded_etag("\"20020530093010-1\"", CallListTask::XML, CallListCompressor::GZIP));
+  EXPECT_EQ("\"20020530093010-1\"",
+            CallListTask::encoded_etag("\"20020530093010-1\"", CallListTask::XML, CallListCompressor::IDENTITY));
+}
+
+// Test that the compressed call list is kept in the call list cache, so that
+// it isn't recompressed for the next request.
+TEST_F(HandlersTest, GzipResponseCached)
+{
+  std::vector<CallListStore::CallFragment> records;
+
+  FakeCounter hit_count;
+  FakeCounter miss_count;
+  FakeCounter eviction_count;
+  CallListCache cache(1024 * 1024, 10000, &hit_count, &miss_count, &eviction_count);
+  CallListCompressor compressor(10);
+  CallListTask::Options options;
+  options.call_list_cache = &cache;
+  options.compressor = &compressor;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  MockHttpStack::Request req(_httpstack, "/", "", "");
+  req.add_header_to_incoming_req("Accept-Encoding", "zstd");
+
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->respond_when_authenticated();
+  std::string impu = handler->_impu;
+  delete handler;
+
+  std::shared_ptr<const CallListCache::Entry> entry = cache.get(impu);
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_EQ(1u, entry->compressed_bodies.count(CallListCompressor::ZSTD));
+  EXPECT_EQ(req.content(), entry->compressed_bodies.at(CallListCompressor::ZSTD));
+}
+
+// Test that a request for a call list that is already being read waits for
+// that read, rather than reading the call list again.
+TEST_F(HandlersTest, CoalescedRead)
+{
+  FakeCounter coalesced_count;
+  CallListReadCoalescer coalescer(&coalesced_count);
+  CallListTask::Options options;
+  options.async_store_reads = true;
+  options.read_coalescer = &coalescer;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  MockHttpStack::Request req1(_httpstack,
+                              "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                              "",
+                              "");
+  req1.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+  MockHttpStack::Request req2(_httpstack,
+                              "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                              "",
+                              "");
+  req2.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+
+  CallListStore::GetCallFragments* op =
+    new CallListStore::GetCallFragments("sip:6505551234@home.domain");
+  CassandraStore::Transaction* tsx = NULL;
+
+  // Only the first request reads the call list.
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op("sip:6505551234@home.domain"))
+    .WillOnce(Return(op));
+  EXPECT_CALL(*_call_store, do_async(_, _))
+    .WillOnce(SaveArg<1>(&tsx));
+  EXPECT_CALL(*_httpstack, send_reply(_, _, _)).Times(0);
+
+  CallListTask* handler1 = new CallListTask(req1, &cfg, 0);
+  handler1->run();
+  CallListTask* handler2 = new CallListTask(req2, &cfg, 0);
+  handler2->run();
+
+  Mock::VerifyAndClearExpectations(_httpstack);
+  ASSERT_TRUE(tsx != NULL);
+
+  // Complete the read.  Both requests get the call list.
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _)).Times(2);
+  tsx->on_success(op);
+
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req1.content());
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req2.content());
+
+  // The next request starts a new read.
+  EXPECT_TRUE(coalescer.lead_or_follow("sip:6505551234@home.domain", NULL));
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Test that a request uses a call list prefetched when it was challenged.
+TEST_F(HandlersTest, PrefetchedRead)
+{
+  FakeCounter prefetch_count;
+  FakeCounter hit_count;
+  FakeCounter wasted_count;
+  CallListPrefetcher prefetcher(_call_store, 5000, 10, &prefetch_count, &hit_count, &wasted_count);
+  CallListTask::Options options;
+  options.async_store_reads = true;
+  options.prefetcher = &prefetcher;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  CallListStore::GetCallFragments* op =
+    new CallListStore::GetCallFragments("sip:6505551234@home.domain");
+  CassandraStore::Transaction* tsx = NULL;
+
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op("sip:6505551234@home.domain"))
+    .WillOnce(Return(op));
+  EXPECT_CALL(*_call_store, do_async(_, _))
+    .WillOnce(SaveArg<1>(&tsx));
+  prefetcher.prefetch("sip:6505551234@home.domain", 0);
+  ASSERT_TRUE(tsx != NULL);
+  tsx->on_success(op);
+  Mock::VerifyAndClearExpectations(_call_store);
+
+  // The request doesn't read the store.
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op(_)).Times(0);
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->run();
+
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req.content());
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Test that a request with digest credentials reads its call list while it is
+// being authenticated.
+TEST_F(HandlersTest, OptimisticRead)
+{
+  CallListTask::Options options;
+  options.async_store_reads = true;
+  options.optimistic_reads = true;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  // Write the digest that the client was challenged with.
+  AuthStore::Digest digest;
+  digest._impi = "6505551234@home.domain";
+  digest._nonce = "nonce";
+  digest._ha1 = "123123123";
+  digest._opaque = "opaque";
+  digest._realm = "home.domain";
+  digest._impu = "sip:6505551234@home.domain";
+  _auth_store->set_digest(digest._impi, digest._nonce, &digest, 0);
+
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("Authorization", "Digest username=6505551234@home.domain,realm=home.domain,nonce=nonce,uri=/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml,qop=auth,nc=00001,cnonce=cnonce,response=7d34b5e99bfa047280bd13fc9cbbd78b,opaque=opaque");
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  CallListStore::GetCallFragments* op =
+    new CallListStore::GetCallFragments("sip:6505551234@home.domain");
+  CassandraStore::Transaction* tsx = NULL;
+
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op("sip:6505551234@home.domain"))
+    .WillOnce(Return(op));
+  EXPECT_CALL(*_call_store, do_async(_, _))
+    .WillOnce(SaveArg<1>(&tsx));
+
+  // Authentication succeeds, but there's no response until the read
+  // completes.
+  EXPECT_CALL(*_httpstack, send_reply(_, _, _)).Times(0);
+  handler->run();
+  Mock::VerifyAndClearExpectations(_httpstack);
+  ASSERT_TRUE(tsx != NULL);
+
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  tsx->on_success(op);
+
+  EXPECT_EQ("<call-list><calls></calls></call-list>", req.content());
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Test that a call list read before authentication fails isn't sent.
+TEST_F(HandlersTest, OptimisticReadRejected)
+{
+  CallListTask::Options options;
+  options.async_store_reads = true;
+  options.optimistic_reads = true;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  // There's no stored digest for these credentials, and Homestead doesn't
+  // know the subscriber, so the request is rejected.
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("Authorization", "Digest username=6505551234@home.domain,realm=home.domain,nonce=nonce,uri=/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml,qop=auth,nc=00001,cnonce=cnonce,response=7d34b5e99bfa047280bd13fc9cbbd78b,opaque=opaque");
+  CallListTask* handler = new CallListTask(req, &cfg, 0);
+
+  CallListStore::GetCallFragments* op =
+    new CallListStore::GetCallFragments("sip:6505551234@home.domain");
+  CassandraStore::Transaction* tsx = NULL;
+
+  EXPECT_CALL(*_call_store, new_get_call_fragments_op("sip:6505551234@home.domain"))
+    .WillOnce(Return(op));
+  EXPECT_CALL(*_call_store, do_async(_, _))
+    .WillOnce(SaveArg<1>(&tsx));
+  EXPECT_CALL(*_httpstack, send_reply(_, 404, _));
+  handler->run();
+  Mock::VerifyAndClearExpectations(_httpstack);
+  ASSERT_TRUE(tsx != NULL);
+
+  // The read completes after the response has been sent, and is discarded.
+  EXPECT_CALL(*_httpstack, send_reply(_, _, _)).Times(0);
+  tsx->on_success(op);
+
+  EXPECT_EQ("", req.content());
+
+  delete tsx; tsx = NULL;
+  delete op; op = NULL;
+}
+
+// Test that requests waiting for a failed read get an error.
+TEST_F(HandlersTest, CoalescedReadFailure)
+{
+  FakeCounter coalesced_count;
+  CallListReadCoalescer coalescer(&coalesced_count);
+  CallListTask::Options options;
+  options.read_coalescer = &coalescer;
+  CallListTask::Config cfg(_auth_store, _hc, _call_store, "localhost", _stats_aggregator, _health_checker, "APIKEY", options);
+
+  MockHttpStack::Request req1(_httpstack, "/", "", "");
+  MockHttpStack::Request req2(_httpstack, "/", "", "");
+  CallListTask* handler1 = new CallListTask(req1, &cfg, 0);
+  CallListTask* handler2 = new CallListTask(req2, &cfg, 0);
+
+  // Make the first request the leader, and the second a follower.
+  EXPECT_TRUE(coalescer.lead_or_follow(handler1->call_list_key(), handler1));
+  handler1->_read_leader = true;
+  EXPECT_FALSE(handler2->respond_when_authenticated());
+
+  // The follower is completed (and deleted) when the leader's read fails.
+  std::vector<CallListStore::CallFragment> records;
+  EXPECT_CALL(*_httpstack, send_reply(_, 500, _)).Times(2);
+  handler1->on_call_fragments_retrieved(CassandraStore::ResultCode::RESOURCE_ERROR, records);
+
+  delete handler1;
+}
+
+// Test that a client that asks for JSON gets a JSON call list.
+TEST_F(HandlersTest, JsonResponse)
+{
+  std::vector<CallListStore::CallFragment> records;
+  CallListStore::CallFragment record;
+  record.type = CallListStore::CallFragment::Type::REJECTED;
+  record.timestamp = "20020530093010";
+  record.id = "a";
+  record.contents = "<start-time>2002-05-30T09:30:10</start-time>";
+  records.push_back(record);
+
+  MockHttpStack::Request req(_httpstack,
+                             "/org.projectclearwater.call-list/users/sip:6505551234@home.domain/call-list.xml",
+                             "",
+                             "");
+  req.add_header_to_incoming_req("NGV-API-Key", "APIKEY");
+  req.add_header_to_incoming_req("Accept", "application/cbor;q=0.5, application/json");
+
+  CallListTask* handler = new CallListTask(req, _cfg, 0);
+
+  EXPECT_CALL(*_call_store, get_call_fragments_sync(_, _, _))
+    .WillOnce(DoAll(SetArgReferee<1>(records), Return(CassandraStore::ResultCode::OK)));
+  EXPECT_CALL(*_httpstack, send_reply(_, 200, _));
+  handler->run();
+
+  EXPECT_EQ("{\"calls\":[{\"start-time\":\"2002-05-30T09:30:10\"}]}", req.content());
+}
+
+TEST_F(HandlersTest, ChooseFormat)
+{
+  EXPECT_EQ(CallListTask::XML, CallListTask::choose_format(""));
+  EXPECT_EQ(CallListTask::XML, CallListTask::choose_format("*/*"));
+  EXPECT_EQ(CallListTask::XML, CallListTask::choose_format("text/html, application/*"));
+  EXPECT_EQ(CallListTask::JSON, CallListTask::choose_format("application/json"));
+  EXPECT_EQ(CallListTask::CBOR, CallListTask::choose_format("application/json;q=0.9, Application/CBOR"));
+  EXPECT_EQ(CallListTask::XML, CallListTask::choose_format("application/json;q=0.5, application/vnd.projectclearwater.call-list+xml"));
+  EXPECT_EQ(CallListTask::XML, CallListTask::choose_format("application/json;q=0"));
+
+  EXPECT_EQ("\"1-2-json-gzip\"",
+            CallListTask::encoded_etag("\"1-2\"", CallListTask::JSON, CallListCompressor::GZIP));
+}
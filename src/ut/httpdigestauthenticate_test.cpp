@@ -24,10 +24,16 @@
 #include "fakehomesteadconnection.hpp"
 #include "fakecounter.h"
 #include "mockauthstore.h"
+#include "nonce_signer.h"
+#include "ha1_cache.h"
+#include "counting_counter.h"
+#include <openssl/md5.h>
 
 using namespace std;
 using testing::MatchesRegex;
 using testing::Return;
+using testing::DoAll;
+using testing::SetArgReferee;
 using testing::_;
 
 const SAS::TrailId DUMMY_TRAIL_ID = 0x1122334455667788;
@@ -110,6 +116,156 @@ class HTTPDigestAuthenticateMockStoreTest : public HTTPDigestAuthenticateTestBas
   HTTPDigestAuthenticate* _auth_mod;
 };
 
+/// Test fixture that signs nonces rather than storing challenges.
+class HTTPDigestAuthenticateSignedNonceTest : public HTTPDigestAuthenticateTestBase
+{
+  HTTPDigestAuthenticateSignedNonceTest() :
+    _nonce_signer("0123456789abcdef0123456789abcdef", 300)
+  {
+    _local_data_store = new LocalStore();
+    _auth_store = new AuthStore(_local_data_store, 300);
+    _auth_mod = new HTTPDigestAuthenticate(_auth_store,
+                                           _hc,
+                                           "home.domain",
+                                           &_auth_challenge_count,
+                                           &_auth_attempt_count,
+                                           &_auth_success_count,
+                                           &_auth_failure_count,
+                                           &_auth_stale_count,
+                                           NULL,
+                                           NULL,
+                                           &_nonce_signer);
+
+    set_ha1("123123123");
+    _auth_mod->set_members("sip:1231231231@home.domain", "GET", "1231231231@home.domain", 0);
+  }
+
+  virtual ~HTTPDigestAuthenticateSignedNonceTest()
+  {
+    delete _auth_mod; _auth_mod = NULL;
+    delete _auth_store; _auth_store = NULL;
+    delete _local_data_store; _local_data_store = NULL;
+    cwtest_reset_time();
+  }
+
+  void set_ha1(std::string ha1)
+  {
+    std::vector<std::string> result;
+    result.push_back(ha1);
+    result.push_back("home.domain");
+    _hc->set_result("/impi/1231231231%40home.domain/av?impu=sip%3A1231231231%40home.domain", result);
+  }
+
+  /// Sends a request without credentials, and saves the nonce and opaque
+  /// from the challenge.
+  void challenge()
+  {
+    std::string www_auth_header;
+    long rc = _auth_mod->request_digest_and_store(www_auth_header, false, _response);
+    ASSERT_EQ(401, rc);
+
+    _nonce = get_param(www_auth_header, "nonce");
+    _opaque = get_param(www_auth_header, "opaque");
+  }
+
+  /// Fills in the response to the saved challenge.
+  void respond(std::string ha1, std::string nc)
+  {
+    std::string uri = "org.projectclearwater.call-list/users/1231231231@home.domain/call-list.xml";
+    std::string ha2 = md5_hex("GET:" + uri);
+    std::string response = md5_hex(ha1 + ":" + _nonce + ":" + nc + ":cnonce:auth:" + ha2);
+    _response->set_members("1231231231@home.domain", "home.domain", _nonce, uri, "auth", nc, "cnonce", response, _opaque);
+  }
+
+  static std::string get_param(const std::string& header, const std::string& name)
+  {
+    size_t start = header.find(name + "=\"") + name.length() + 2;
+    return header.substr(start, header.find('"', start) - start);
+  }
+
+  static std::string md5_hex(const std::string& data)
+  {
+    unsigned char hash[Utils::MD5_HASH_SIZE];
+    unsigned char hash_hex[Utils::HEX_HASH_SIZE + 1];
+    MD5((const unsigned char*)data.data(), data.length(), hash);
+    Utils::hashToHex(hash, hash_hex);
+    return std::string((const char*)hash_hex);
+  }
+
+  LocalStore* _local_data_store;
+  AuthStore* _auth_store;
+  NonceSigner _nonce_signer;
+  std::string _nonce;
+  std::string _opaque;
+};
+
+/// Test fixture that signs nonces and caches HA1s.
+class HTTPDigestAuthenticateHA1CacheTest : public HTTPDigestAuthenticateSignedNonceTest
+{
+  HTTPDigestAuthenticateHA1CacheTest() :
+    _ha1_cache(_hc, 100, 60000, &_ha1_hit_count, &_ha1_miss_count, &_ha1_refresh_count)
+  {
+    delete _auth_mod;
+    _auth_mod = new HTTPDigestAuthenticate(_auth_store,
+                                           _hc,
+                                           "home.domain",
+                                           &_auth_challenge_count,
+                                           &_auth_attempt_count,
+                                           &_auth_success_count,
+                                           &_auth_failure_count,
+                                           &_auth_stale_count,
+                                           NULL,
+                                           NULL,
+                                           &_nonce_signer,
+                                           &_ha1_cache);
+    _auth_mod->set_members("sip:1231231231@home.domain", "GET", "1231231231@home.domain", 0);
+  }
+
+  virtual ~HTTPDigestAuthenticateHA1CacheTest() {}
+
+  CountingCounter _ha1_hit_count;
+  CountingCounter _ha1_miss_count;
+  CountingCounter _ha1_refresh_count;
+  HA1Cache _ha1_cache;
+};
+
+/// Test fixture that signs nonces and records nonce counts as separate
+/// entries in the store.
+class HTTPDigestAuthenticateSeparateNonceCountTest : public HTTPDigestAuthenticateSignedNonceTest
+{
+  HTTPDigestAuthenticateSeparateNonceCountTest()
+  {
+    delete _auth_mod;
+    delete _auth_store;
+
+    AuthStore::SerializerDeserializer* serializer =
+      new AuthStore::JsonSerializerDeserializer();
+    std::vector<AuthStore::SerializerDeserializer*> deserializers = {
+      new AuthStore::JsonSerializerDeserializer(),
+    };
+    _auth_store = new AuthStore(_local_data_store,
+                                serializer,
+                                deserializers,
+                                300,
+                                NULL,
+                                true);
+    _auth_mod = new HTTPDigestAuthenticate(_auth_store,
+                                           _hc,
+                                           "home.domain",
+                                           &_auth_challenge_count,
+                                           &_auth_attempt_count,
+                                           &_auth_success_count,
+                                           &_auth_failure_count,
+                                           &_auth_stale_count,
+                                           NULL,
+                                           NULL,
+                                           &_nonce_signer);
+    _auth_mod->set_members("sip:1231231231@home.domain", "GET", "1231231231@home.domain", 0);
+  }
+
+  virtual ~HTTPDigestAuthenticateSeparateNonceCountTest() {}
+};
+
 TEST_F(HTTPDigestAuthenticateTest, CheckAuthInfo_NoAuthHeader)
 {
   _auth_mod->set_members("sip:1231231231@home.domain", "GET", "", 0);
@@ -533,10 +689,10 @@ TEST_F(HTTPDigestAuthenticateTest, CheckIfMatches_WrongIMPU)
 }
 
 // This test checks the behaviour when the authenticator tries to update the
-// nonce count in the auth store, and the set fails with DATA_CONTENTION. This
-// simulates the case where the nonce has already been used to authenticate a
-// request, and is now stale. The authenticator therefore rechallenges the
-// request with the stale flag set.
+// nonce count in the auth store, and the set fails with DATA_CONTENTION because
+// another request has used the nonce in the meantime.  The authenticator
+// rereads the digest.  The other request used the same nonce count, so the
+// authenticator rechallenges the request with the stale flag set.
 TEST_F(HTTPDigestAuthenticateMockStoreTest, CheckIfMatches_NonceUpdateFails_RaceCondition)
 {
   // Set up an existing digest to pass into `check_if_matches`.
@@ -548,6 +704,10 @@ TEST_F(HTTPDigestAuthenticateMockStoreTest, CheckIfMatches_NonceUpdateFails_Race
   digest->_realm = "home.domain";
   digest->_impu = "sip:1231231231@home.domain";
 
+  // The digest as updated by the other request.
+  AuthStore::Digest current_digest = *digest;
+  current_digest.use_nonce_count(1);
+
   // The authenticator will request a new digest from homestead. Prepare for
   // this.
   std::vector<std::string> test;
@@ -559,13 +719,15 @@ TEST_F(HTTPDigestAuthenticateMockStoreTest, CheckIfMatches_NonceUpdateFails_Race
   _auth_mod->set_members("sip:1231231231@home.domain", "GET", "1231231231@home.domain", 0);
   _response->set_members("1231231231","home.domain","nonce","org.projectclearwater.call-list/users/1231231231@home.domain/call-list.xml","qop","00001","cnonce","242c99c1e20618147c6a325c09720664","opaque");
 
-  // The auth store is called twice:
+  // The auth store is written twice:
   // - Once to update the nonce count on the existing digest (which fails with
   //   DATA_CONTENTION).
   // - Once to store the new digest from homestead (which succeeds).
   EXPECT_CALL(_mock_auth_store, set_digest(_, _, _, _))
     .WillOnce(Return(Store::DATA_CONTENTION))
     .WillOnce(Return(Store::OK));
+  EXPECT_CALL(_mock_auth_store, get_digest(_, _, _, _))
+    .WillOnce(DoAll(SetArgReferee<2>(current_digest), Return(Store::OK)));
 
   // Run through check if matches. This should rechallenge the request.
   std::string www_auth_header;
@@ -577,3 +739,302 @@ TEST_F(HTTPDigestAuthenticateMockStoreTest, CheckIfMatches_NonceUpdateFails_Race
 
   delete digest; digest = NULL;
 }
+
+// This test checks that a request isn't rechallenged if another request
+// updates the digest with a different nonce count before this request's nonce
+// count is written.  This happens when a client sends requests in parallel
+// with the same nonce.
+TEST_F(HTTPDigestAuthenticateMockStoreTest, CheckIfMatches_NonceUpdateContention_Retries)
+{
+  AuthStore::Digest *digest = new AuthStore::Digest();
+  digest->_impi = "1231231231@home.domain";
+  digest->_nonce = "nonce";
+  digest->_ha1 = "123123123";
+  digest->_opaque = "opaque";
+  digest->_realm = "home.domain";
+  digest->_impu = "sip:1231231231@home.domain";
+
+  // The other request used nonce count 2.
+  AuthStore::Digest current_digest = *digest;
+  current_digest.use_nonce_count(2);
+
+  _auth_mod->set_members("sip:1231231231@home.domain", "GET", "1231231231@home.domain", 0);
+  _response->set_members("1231231231","home.domain","nonce","org.projectclearwater.call-list/users/1231231231@home.domain/call-list.xml","qop","00001","cnonce","242c99c1e20618147c6a325c09720664","opaque");
+
+  // The first write fails, so the digest is reread and written again.
+  EXPECT_CALL(_mock_auth_store, set_digest(_, _, _, _))
+    .WillOnce(Return(Store::DATA_CONTENTION))
+    .WillOnce(Return(Store::OK));
+  EXPECT_CALL(_mock_auth_store, get_digest(_, _, _, _))
+    .WillOnce(DoAll(SetArgReferee<2>(current_digest), Return(Store::OK)));
+
+  std::string www_auth_header;
+  long rc = _auth_mod->check_if_matches(digest, www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+
+  delete digest; digest = NULL;
+}
+
+TEST_F(HTTPDigestAuthenticateTest, CheckIfMatches_OutOfOrderNonceCounts)
+{
+  // Write a digest to the store. This simulates the digest stored when the
+  // unauthenticated request was received.
+  AuthStore::Digest orig_digest;
+  orig_digest._impi = "1231231231@home.domain";
+  orig_digest._nonce = "nonce";
+  orig_digest._ha1 = "123123123";
+  orig_digest._opaque = "opaque";
+  orig_digest._realm = "home.domain";
+  orig_digest._impu = "sip:1231231231@home.domain";
+
+  // Another request has already used nonce count 2.
+  orig_digest.use_nonce_count(2);
+  _auth_store->set_digest(orig_digest._impi, orig_digest._nonce, &orig_digest, DUMMY_TRAIL_ID);
+
+  _auth_mod->set_members("sip:1231231231@home.domain", "GET", "1231231231@home.domain", 0);
+  _response->set_members("1231231231","home.domain","nonce","org.projectclearwater.call-list/users/1231231231@home.domain/call-list.xml","qop","00001","cnonce","242c99c1e20618147c6a325c09720664","opaque");
+
+  // Nonce count 1 hasn't been used, so is accepted.
+  AuthStore::Digest* digest;
+  _auth_store->get_digest(orig_digest._impi, orig_digest._nonce, digest, DUMMY_TRAIL_ID);
+  std::string www_auth_header;
+  long rc = _auth_mod->check_if_matches(digest, www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+  delete digest; digest = NULL;
+
+  // It can't be used again.  The rechallenge fails as it can't get the digest
+  // from Homestead.
+  _auth_store->get_digest(orig_digest._impi, orig_digest._nonce, digest, DUMMY_TRAIL_ID);
+  rc = _auth_mod->check_if_matches(digest, www_auth_header, _response);
+  EXPECT_EQ(404, rc);
+  delete digest; digest = NULL;
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, ChallengeIsNotStored)
+{
+  challenge();
+
+  AuthStore::Digest* digest = NULL;
+  Store::Status status = _auth_store->get_digest("1231231231@home.domain", _nonce, digest, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::NOT_FOUND, status);
+  delete digest; digest = NULL;
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, FirstUseStoresDigest)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  ASSERT_EQ(200, rc);
+
+  // The digest is now stored, with the nonce count updated.
+  AuthStore::Digest* digest = NULL;
+  Store::Status status = _auth_store->get_digest("1231231231@home.domain", _nonce, digest, DUMMY_TRAIL_ID);
+  ASSERT_EQ(Store::OK, status);
+  EXPECT_EQ(2u, digest->_nonce_count);
+  EXPECT_EQ("sip:1231231231@home.domain", digest->_impu);
+  delete digest; digest = NULL;
+
+  // Later uses of the nonce are checked against the stored digest.
+  respond("123123123", "00000002");
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, ReplayedFirstUseIsStale)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  ASSERT_EQ(200, rc);
+
+  // Sending the same response again is rechallenged.
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, WrongPassword)
+{
+  challenge();
+  respond("321321321", "00000001");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(403, rc);
+
+  // Nothing is stored for a failed attempt.
+  AuthStore::Digest* digest = NULL;
+  Store::Status status = _auth_store->get_digest("1231231231@home.domain", _nonce, digest, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::NOT_FOUND, status);
+  delete digest; digest = NULL;
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, TamperedNonceIsStale)
+{
+  challenge();
+  _nonce[0] = (_nonce[0] == '1') ? '2' : '1';
+  respond("123123123", "00000001");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, WrongIMPUIsStale)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  // Use the nonce for a different IMPU.  The rechallenge needs the digest for
+  // that IMPU.
+  std::vector<std::string> result;
+  result.push_back("123123123");
+  result.push_back("home.domain");
+  _hc->set_result("/impi/1231231231%40home.domain/av?impu=sip%3A1231231232%40home.domain", result);
+  _auth_mod->set_members("sip:1231231232@home.domain", "GET", "1231231231@home.domain", 0);
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, ExpiredNonceIsStale)
+{
+  cwtest_completely_control_time();
+  challenge();
+  respond("123123123", "00000001");
+
+  cwtest_advance_time_ms(301000);
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+}
+
+TEST_F(HTTPDigestAuthenticateSignedNonceTest, ChangedPasswordIsStale)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  // The subscriber's password changes before the challenge is answered.
+  set_ha1("321321321");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+}
+
+TEST_F(HTTPDigestAuthenticateHA1CacheTest, CachedHA1IsUsed)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  // Homestead isn't queried again, so the response is checked against the
+  // HA1 that was cached when the challenge was sent.
+  set_ha1("321321321");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+  EXPECT_EQ(1, _ha1_hit_count.count);
+  EXPECT_EQ(1, _ha1_miss_count.count);
+}
+
+TEST_F(HTTPDigestAuthenticateHA1CacheTest, WrongPasswordInvalidates)
+{
+  challenge();
+
+  // The password changes after the HA1 is cached, and the client uses the
+  // new one.  The response doesn't match the cached HA1, so it is discarded.
+  set_ha1("321321321");
+  respond("321321321", "00000001");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(403, rc);
+  EXPECT_EQ(0u, _ha1_cache.size());
+
+  // The next challenge fetches the new HA1.
+  challenge();
+  respond("321321321", "00000001");
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+  EXPECT_EQ(2, _ha1_miss_count.count);
+}
+
+TEST_F(HTTPDigestAuthenticateSeparateNonceCountTest, DigestNotRewritten)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  // The first use of the nonce stores the digest.
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  ASSERT_EQ(200, rc);
+
+  // Later nonce counts are recorded without updating the digest.
+  respond("123123123", "00000002");
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+
+  AuthStore::Digest* digest = NULL;
+  Store::Status status = _auth_store->get_digest("1231231231@home.domain", _nonce, digest, DUMMY_TRAIL_ID);
+  ASSERT_EQ(Store::OK, status);
+  EXPECT_EQ(2u, digest->_nonce_count);
+  delete digest; digest = NULL;
+
+  // Nonce counts can still only be used once.
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+
+  respond("123123123", "00000003");
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(200, rc);
+}
+
+// A replayed nonce count is rejected by its separate entry, even though the
+// stored digest would still accept it.
+TEST_F(HTTPDigestAuthenticateSeparateNonceCountTest, ReplayRejectedBySeparateEntry)
+{
+  challenge();
+  respond("123123123", "00000001");
+
+  std::string www_auth_header;
+  long rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  ASSERT_EQ(200, rc);
+
+  respond("123123123", "00000002");
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  ASSERT_EQ(200, rc);
+
+  // Nonce count 2 has its own entry, and isn't in the stored digest.
+  std::string data;
+  uint64_t cas;
+  Store::Status status = _local_data_store->get_data("AuthStoreNonceCount",
+                                                     "1231231231@home.domain\\" + _nonce + "\\2",
+                                                     data,
+                                                     cas,
+                                                     DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::OK, status);
+
+  AuthStore::Digest* digest = NULL;
+  status = _auth_store->get_digest("1231231231@home.domain", _nonce, digest, DUMMY_TRAIL_ID);
+  ASSERT_EQ(Store::OK, status);
+  EXPECT_TRUE(digest->use_nonce_count(2));
+  delete digest; digest = NULL;
+
+  // Replaying it is rejected, and the client is challenged again.
+  rc = _auth_mod->retrieve_digest_from_store(www_auth_header, _response);
+  EXPECT_EQ(401, rc);
+  EXPECT_THAT(www_auth_header, MatchesRegex(".*,stale=TRUE"));
+}
@@ -0,0 +1,104 @@
+/**
+ * @file inline_string_test.cpp UT for strings with inline storage.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <sstream>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "inline_string.h"
+
+TEST(InlineStringTest, Empty)
+{
+  InlineString<8> value;
+  EXPECT_TRUE(value.empty());
+  EXPECT_EQ(0u, value.length());
+  EXPECT_STREQ("", value.c_str());
+  EXPECT_TRUE(value.is_inline());
+}
+
+TEST(InlineStringTest, ShortValuesAreInline)
+{
+  InlineString<8> value;
+  value = "12345678";
+  EXPECT_TRUE(value.is_inline());
+  EXPECT_EQ(8u, value.length());
+  EXPECT_STREQ("12345678", value.c_str());
+  EXPECT_EQ("12345678", value);
+  EXPECT_EQ('5', value[4]);
+}
+
+TEST(InlineStringTest, LongValuesOverflow)
+{
+  InlineString<8> value;
+  value = std::string("123456789");
+  EXPECT_FALSE(value.is_inline());
+  EXPECT_EQ(9u, value.length());
+  EXPECT_STREQ("123456789", value.c_str());
+
+  // Setting a short value moves it back inline.
+  value = "1234";
+  EXPECT_TRUE(value.is_inline());
+  EXPECT_EQ("1234", value);
+}
+
+TEST(InlineStringTest, EmbeddedNul)
+{
+  InlineString<8> value;
+  value.assign("ab\0cd", 5);
+  EXPECT_EQ(5u, value.length());
+  EXPECT_EQ(std::string("ab\0cd", 5), value.str());
+  EXPECT_NE("ab", value);
+}
+
+TEST(InlineStringTest, Copy)
+{
+  InlineString<4> short_value("abc");
+  InlineString<4> long_value("abcdefgh");
+
+  InlineString<4> short_copy(short_value);
+  InlineString<4> long_copy(long_value);
+  EXPECT_EQ(short_value, short_copy);
+  EXPECT_EQ(long_value, long_copy);
+
+  // The copy doesn't share the original's storage.
+  long_value = "zyxwvuts";
+  EXPECT_EQ("abcdefgh", long_copy);
+
+  short_copy = long_copy;
+  EXPECT_FALSE(short_copy.is_inline());
+  EXPECT_EQ("abcdefgh", short_copy);
+}
+
+TEST(InlineStringTest, Comparisons)
+{
+  InlineString<8> value("abc");
+  InlineString<16> other("abc");
+  EXPECT_TRUE(value == other);
+  EXPECT_TRUE(value == std::string("abc"));
+  EXPECT_TRUE(std::string("abc") == value);
+  EXPECT_TRUE("abc" == value);
+  EXPECT_TRUE(value != "abcd");
+  EXPECT_TRUE(value != std::string("ab"));
+
+  other = "abd";
+  EXPECT_TRUE(value != other);
+}
+
+TEST(InlineStringTest, Conversion)
+{
+  InlineString<8> value("abc");
+  std::string converted = value;
+  EXPECT_EQ("abc", converted);
+
+  std::ostringstream oss;
+  oss << value << '.';
+  EXPECT_EQ("abc.", oss.str());
+}
@@ -45,6 +45,10 @@ public:
                                           std::vector<CallListStore::CallFragment>& fragments,
                                           SAS::TrailId trail));
 
+  MOCK_METHOD2(do_async,
+               void(CassandraStore::Operation*& op,
+                    CassandraStore::Transaction*& trx));
+
   MOCK_METHOD4(delete_old_call_fragments_sync,
                CassandraStore::ResultCode(const std::string& impu,
                                           const std::vector<CallListStore::CallFragment> fragments,
@@ -27,8 +27,12 @@ class MockAuthStore : public AuthStore
                                          SAS::TrailId));
   MOCK_METHOD4(get_digest, Store::Status(const std::string&,
                                          const std::string&,
-                                         Digest*&,
+                                         Digest&,
                                          SAS::TrailId));
+  MOCK_METHOD4(record_nonce_count, Store::Status(const std::string&,
+                                                 const std::string&,
+                                                 uint32_t,
+                                                 SAS::TrailId));
 };
 
 #endif
@@ -0,0 +1,132 @@
+/**
+ * @file nonce_signer_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "nonce_signer.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+
+static const std::string KEY = "0123456789abcdef0123456789abcdef";
+static const std::string IMPI = "1231231231@home.domain";
+static const std::string IMPU = "sip:1231231231@home.domain";
+static const std::string REALM = "home.domain";
+static const std::string OPAQUE = "opaque";
+static const std::string HA1 = "123123123";
+
+class NonceSignerTest : public ::testing::Test
+{
+  NonceSignerTest() : _signer(KEY, 300) {}
+
+  virtual ~NonceSignerTest()
+  {
+    cwtest_reset_time();
+  }
+
+  NonceSigner _signer;
+};
+
+TEST_F(NonceSignerTest, SignedNonceIsValid)
+{
+  std::string nonce = _signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1);
+
+  std::string fingerprint;
+  EXPECT_EQ(NonceSigner::VALID,
+            _signer.verify(nonce, IMPI, IMPU, REALM, OPAQUE, fingerprint));
+  EXPECT_TRUE(_signer.matches_ha1(fingerprint, HA1));
+  EXPECT_FALSE(_signer.matches_ha1(fingerprint, "321321321"));
+
+  // The HA1 doesn't appear in the nonce.
+  EXPECT_EQ(std::string::npos, nonce.find(HA1));
+}
+
+TEST_F(NonceSignerTest, NoncesAreUnique)
+{
+  EXPECT_NE(_signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1),
+            _signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1));
+}
+
+TEST_F(NonceSignerTest, DifferentParameters)
+{
+  std::string nonce = _signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1);
+  std::string fingerprint;
+
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(nonce, "1231231232@home.domain", IMPU, REALM, OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(nonce, IMPI, "sip:1231231232@home.domain", REALM, OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(nonce, IMPI, IMPU, "home.domain2", OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(nonce, IMPI, IMPU, REALM, "opaque2", fingerprint));
+}
+
+TEST_F(NonceSignerTest, DifferentKey)
+{
+  NonceSigner other_signer("fedcba9876543210fedcba9876543210", 300);
+  std::string nonce = other_signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1);
+
+  std::string fingerprint;
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(nonce, IMPI, IMPU, REALM, OPAQUE, fingerprint));
+}
+
+TEST_F(NonceSignerTest, TamperedNonce)
+{
+  std::string nonce = _signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1);
+  std::string fingerprint;
+
+  // Change the issue time.
+  std::string tampered = nonce;
+  tampered[0] = (tampered[0] == '1') ? '2' : '1';
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(tampered, IMPI, IMPU, REALM, OPAQUE, fingerprint));
+
+  // Change the MAC.
+  tampered = nonce;
+  tampered[tampered.length() - 1] = (tampered[tampered.length() - 1] == '0') ? '1' : '0';
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(tampered, IMPI, IMPU, REALM, OPAQUE, fingerprint));
+}
+
+TEST_F(NonceSignerTest, MalformedNonce)
+{
+  std::string fingerprint;
+
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify("", IMPI, IMPU, REALM, OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify("nonce", IMPI, IMPU, REALM, OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify(".", IMPI, IMPU, REALM, OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify("1.2.3.4", IMPI, IMPU, REALM, OPAQUE, fingerprint));
+  EXPECT_EQ(NonceSigner::INVALID,
+            _signer.verify("0123456789abcdef.0123456789abcdef0123456789abcdef",
+                           IMPI, IMPU, REALM, OPAQUE, fingerprint));
+}
+
+TEST_F(NonceSignerTest, Expiry)
+{
+  cwtest_completely_control_time();
+
+  std::string nonce = _signer.sign(IMPI, IMPU, REALM, OPAQUE, HA1);
+  std::string fingerprint;
+
+  cwtest_advance_time_ms(299000);
+  EXPECT_EQ(NonceSigner::VALID,
+            _signer.verify(nonce, IMPI, IMPU, REALM, OPAQUE, fingerprint));
+
+  cwtest_advance_time_ms(2000);
+  EXPECT_EQ(NonceSigner::EXPIRED,
+            _signer.verify(nonce, IMPI, IMPU, REALM, OPAQUE, fingerprint));
+}
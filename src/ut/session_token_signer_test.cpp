@@ -0,0 +1,92 @@
+/**
+ * @file session_token_signer_test.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "session_token_signer.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+
+static const std::string KEY = "0123456789abcdef0123456789abcdef";
+static const std::string IMPU = "sip:1231231231@home.domain";
+
+class SessionTokenSignerTest : public ::testing::Test
+{
+  SessionTokenSignerTest() : _signer(KEY, 600, 1) {}
+
+  virtual ~SessionTokenSignerTest()
+  {
+    cwtest_reset_time();
+  }
+
+  SessionTokenSigner _signer;
+};
+
+TEST_F(SessionTokenSignerTest, IssuedTokenIsValid)
+{
+  std::string token = _signer.issue(IMPU);
+  EXPECT_TRUE(_signer.check(token, IMPU));
+}
+
+TEST_F(SessionTokenSignerTest, DifferentIMPU)
+{
+  std::string token = _signer.issue(IMPU);
+  EXPECT_FALSE(_signer.check(token, "sip:1231231232@home.domain"));
+}
+
+TEST_F(SessionTokenSignerTest, DifferentKey)
+{
+  SessionTokenSigner other_signer("fedcba9876543210fedcba9876543210", 600, 1);
+  EXPECT_FALSE(_signer.check(other_signer.issue(IMPU), IMPU));
+}
+
+TEST_F(SessionTokenSignerTest, DifferentEpoch)
+{
+  // Tokens from earlier epochs are revoked.
+  SessionTokenSigner new_signer(KEY, 600, 2);
+  EXPECT_FALSE(new_signer.check(_signer.issue(IMPU), IMPU));
+}
+
+TEST_F(SessionTokenSignerTest, TamperedToken)
+{
+  std::string token = _signer.issue(IMPU);
+
+  // Extend the expiry time.
+  std::string tampered = "9" + token;
+  EXPECT_FALSE(_signer.check(tampered, IMPU));
+
+  // Change the MAC.
+  tampered = token;
+  tampered[tampered.length() - 1] = (tampered[tampered.length() - 1] == '0') ? '1' : '0';
+  EXPECT_FALSE(_signer.check(tampered, IMPU));
+}
+
+TEST_F(SessionTokenSignerTest, MalformedToken)
+{
+  EXPECT_FALSE(_signer.check("", IMPU));
+  EXPECT_FALSE(_signer.check("token", IMPU));
+  EXPECT_FALSE(_signer.check("1.1", IMPU));
+  EXPECT_FALSE(_signer.check("1.1.", IMPU));
+  EXPECT_FALSE(_signer.check("..", IMPU));
+}
+
+TEST_F(SessionTokenSignerTest, Expiry)
+{
+  cwtest_completely_control_time();
+  std::string token = _signer.issue(IMPU);
+
+  cwtest_advance_time_ms(599000);
+  EXPECT_TRUE(_signer.check(token, IMPU));
+
+  cwtest_advance_time_ms(2000);
+  EXPECT_FALSE(_signer.check(token, IMPU));
+}
@@ -0,0 +1,125 @@
+/**
+ * @file sharded_lru_cache_test.cpp UT for the sharded LRU cache.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include "gtest/gtest.h"
+
+#include "sharded_lru_cache.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+#include "counting_counter.h"
+
+class ShardedLRUCacheTest : public ::testing::Test
+{
+public:
+  ShardedLRUCacheTest() :
+    _cache("value", 3, 10000, &_eviction_count, 1)
+  {
+    cwtest_completely_control_time();
+  }
+
+  virtual ~ShardedLRUCacheTest()
+  {
+    cwtest_reset_time();
+  }
+
+  CountingCounter _eviction_count;
+  ShardedLRUCache<std::string> _cache;
+};
+
+TEST_F(ShardedLRUCacheTest, PutAndGet)
+{
+  std::string value;
+  EXPECT_FALSE(_cache.get("a", value));
+
+  EXPECT_TRUE(_cache.put("a", "1", 1));
+  EXPECT_TRUE(_cache.get("a", value));
+  EXPECT_EQ("1", value);
+
+  // Putting an entry again replaces it.
+  EXPECT_TRUE(_cache.put("a", "2", 2));
+  EXPECT_TRUE(_cache.get("a", value));
+  EXPECT_EQ("2", value);
+  EXPECT_EQ(2u, _cache.size());
+
+  _cache.invalidate("a");
+  EXPECT_FALSE(_cache.get("a", value));
+  EXPECT_EQ(0u, _cache.size());
+}
+
+TEST_F(ShardedLRUCacheTest, Expiry)
+{
+  std::string value;
+  _cache.put("a", "1", 1);
+
+  cwtest_advance_time_ms(9999);
+  EXPECT_TRUE(_cache.get("a", value));
+
+  cwtest_advance_time_ms(1);
+  EXPECT_FALSE(_cache.get("a", value));
+  EXPECT_EQ(0u, _cache.size());
+}
+
+TEST_F(ShardedLRUCacheTest, Eviction)
+{
+  std::string value;
+  _cache.put("a", "1", 1);
+  _cache.put("b", "2", 1);
+  _cache.put("c", "3", 1);
+
+  // Looking up an entry without touching it leaves it to be evicted first.
+  EXPECT_TRUE(_cache.get("a", value, false));
+  EXPECT_TRUE(_cache.get("b", value));
+
+  _cache.put("d", "4", 2);
+  EXPECT_EQ(2, _eviction_count.count);
+  EXPECT_FALSE(_cache.get("a", value));
+  EXPECT_TRUE(_cache.get("b", value));
+  EXPECT_FALSE(_cache.get("c", value));
+  EXPECT_TRUE(_cache.get("d", value));
+}
+
+TEST_F(ShardedLRUCacheTest, TooLarge)
+{
+  std::string value;
+  _cache.put("a", "1", 1);
+
+  // An entry too large for a shard isn't cached, and removes the old entry.
+  EXPECT_FALSE(_cache.put("a", "2", 4));
+  EXPECT_FALSE(_cache.get("a", value));
+  EXPECT_EQ(0, _eviction_count.count);
+}
+
+TEST_F(ShardedLRUCacheTest, Replace)
+{
+  std::string value;
+  _cache.put("a", "1", 1);
+  _cache.put("b", "2", 1);
+  _cache.put("c", "3", 1);
+
+  // The value is only replaced if it hasn't changed.
+  EXPECT_FALSE(_cache.replace("a", "0", "4", 1));
+  EXPECT_TRUE(_cache.replace("a", "1", "4", 1));
+  EXPECT_TRUE(_cache.get("a", value));
+  EXPECT_EQ("4", value);
+
+  // Growing the entry evicts others, but never the entry itself.
+  EXPECT_TRUE(_cache.replace("a", "4", "5", 3));
+  EXPECT_EQ(2, _eviction_count.count);
+  EXPECT_TRUE(_cache.get("a", value));
+  EXPECT_EQ("5", value);
+  EXPECT_EQ(3u, _cache.size());
+
+  // The entry keeps its original expiry time.
+  cwtest_advance_time_ms(10000);
+  EXPECT_FALSE(_cache.replace("a", "5", "6", 1));
+  EXPECT_FALSE(_cache.get("a", value));
+}
@@ -0,0 +1,71 @@
+/**
+ * @file stage_timer_test.cpp UT for request stage timing.
+ *
+ * Copyright (C) Metaswitch Networks 2017
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "stage_timer.h"
+#include "test_utils.hpp"
+#include "test_interposer.hpp"
+
+using ::testing::_;
+using ::testing::Ge;
+
+class MockStageStatistics : public StageStatistics
+{
+public:
+  MockStageStatistics() : StageStatistics() {}
+  virtual ~MockStageStatistics() {}
+
+  MOCK_METHOD2(record, void(unsigned long latency_us, unsigned long cpu_time_us));
+};
+
+class StageTimerTest : public ::testing::Test
+{
+public:
+  StageTimerTest() {}
+
+  virtual ~StageTimerTest()
+  {
+    cwtest_reset_time();
+  }
+};
+
+// Check the stage is recorded once, when the timer is stopped.
+TEST_F(StageTimerTest, Stop)
+{
+  cwtest_completely_control_time();
+  MockStageStatistics stats;
+
+  StageTimer timer(&stats);
+  cwtest_advance_time_ms(5);
+
+  EXPECT_CALL(stats, record(Ge(5000u), _)).Times(1);
+  timer.stop();
+  timer.stop();
+}
+
+// Check the stage is recorded when the timer goes out of scope.
+TEST_F(StageTimerTest, Destroy)
+{
+  MockStageStatistics stats;
+  EXPECT_CALL(stats, record(_, _)).Times(1);
+
+  {
+    StageTimer timer(&stats);
+  }
+}
+
+TEST_F(StageTimerTest, NoStatistics)
+{
+  StageTimer timer(NULL);
+  timer.stop();
+}